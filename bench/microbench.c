@@ -0,0 +1,482 @@
+/*
+ * microbench.c - Microbenchmarks for the per-line and per-fence primitives
+ *
+ * Each case runs one primitive over a fixed set of inputs: a batch of
+ * calls is timed per repetition, after warmup, and the per-call median
+ * and p99 are reported in nanoseconds (clock_gettime) and, on x86, TSC
+ * cycles (rdtsc). Results go to stderr as a table and to the output file
+ * as JSON, so a change to one primitive can be compared in isolation.
+ *
+ * usage: microbench [-o FILE] [-r REPS] [-f FILTER]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "src/config.h"
+#include "src/markdown.h"
+#include "src/output.h"
+#include "src/util.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_REPS 301
+#define MIN_BATCH_NS 20000     /* a timed batch lasts at least this long */
+#define LONG_LINE 10240        /* adversarial line length (bytes) */
+#define DISTINCT_PATHS 4096
+#define UNKNOWN_LANGS 1024
+#define LOOKUP_PATHS 64        /* outputs in the lookup cases */
+
+/* Inputs of one case, cycled through by its run function */
+typedef struct {
+    const char **items;
+    size_t count;
+    void *state;               /* primitive-specific state */
+    size_t *tail;              /* str_trim: offset of the trimmed tail per item */
+} Inputs;
+
+typedef struct {
+    const char *name;
+    void (*run)(Inputs *in, size_t calls);
+    Inputs in;
+} Case;
+
+typedef struct {
+    double median_ns;
+    double p99_ns;
+    double median_cycles;
+    double p99_cycles;
+    size_t batch;
+} Result;
+
+/* Keeps results alive so calls are not optimized away */
+static volatile uintptr_t g_sink;
+
+/* Monotonic time in nanoseconds */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* TSC reference cycles, 0 where there is no TSC */
+static uint64_t now_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return 0;
+#endif
+}
+
+/* ---- Primitives under test ---- */
+
+static void run_count_backticks(Inputs *in, size_t calls)
+{
+    for (size_t i = 0; i < calls; i++) {
+        g_sink += (uintptr_t)count_backticks(in->items[i % in->count]);
+    }
+}
+
+static void run_parse_fence(Inputs *in, size_t calls)
+{
+    for (size_t i = 0; i < calls; i++) {
+        FenceInfo info = parse_fence(in->items[i % in->count]);
+        g_sink += (uintptr_t)info.backtick_count + (uintptr_t)info.filename[0];
+    }
+}
+
+static void run_closing_fence(Inputs *in, size_t calls)
+{
+    for (size_t i = 0; i < calls; i++) {
+        g_sink += (uintptr_t)get_closing_fence_backticks(in->items[i % in->count], 3);
+    }
+}
+
+static void run_lang_to_ext(Inputs *in, size_t calls)
+{
+    for (size_t i = 0; i < calls; i++) {
+        g_sink += (uintptr_t)lang_to_ext(in->items[i % in->count]);
+    }
+}
+
+/* Look up paths in a state that already holds them */
+static void run_output_lookup(Inputs *in, size_t calls)
+{
+    OutputState *state = in->state;
+    for (size_t i = 0; i < calls; i++) {
+        g_sink += (uintptr_t)get_output_file(state, in->items[i % in->count]);
+    }
+}
+
+/* Add distinct paths, starting over once the state holds all of them */
+static void run_output_insert(Inputs *in, size_t calls)
+{
+    OutputState *state = in->state;
+    for (size_t i = 0; i < calls; i++) {
+        if ((size_t)state->count == in->count) {
+            free_outputs(state);
+        }
+        g_sink += (uintptr_t)get_output_file(state, in->items[i % in->count]);
+    }
+}
+
+static void run_parse_config_line(Inputs *in, size_t calls)
+{
+    RyftConfig *config = in->state;
+    for (size_t i = 0; i < calls; i++) {
+        g_sink += (uintptr_t)parse_config_line(in->items[i % in->count], config, NULL);
+    }
+}
+
+/* str_trim() writes NULs over trailing whitespace; put the tail back
+ * after each call so every call sees the same input
+ */
+static void run_str_trim(Inputs *in, size_t calls)
+{
+    char **bufs = in->state;
+    for (size_t i = 0; i < calls; i++) {
+        size_t k = i % in->count;
+        g_sink += (uintptr_t)str_trim(bufs[k]);
+        size_t t = in->tail[k];
+        strcpy(bufs[k] + t, in->items[k] + t);
+    }
+}
+
+static void run_expand_path(Inputs *in, size_t calls)
+{
+    char out[MAX_PATH];
+    for (size_t i = 0; i < calls; i++) {
+        g_sink += (uintptr_t)expand_path(in->items[i % in->count], out, sizeof(out));
+        g_sink += (uintptr_t)out[0];
+    }
+}
+
+/* ---- Inputs ---- */
+
+/* A string of n copies of c followed by suffix (never freed) */
+static const char *repeat(char c, size_t n, const char *suffix)
+{
+    size_t len = strlen(suffix);
+    char *s = malloc(n + len + 1);
+    if (!s) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(1);
+    }
+    memset(s, c, n);
+    memcpy(s + n, suffix, len + 1);
+    return s;
+}
+
+/* n strings from a printf format with one %d (never freed) */
+static const char **numbered(const char *fmt, size_t n)
+{
+    const char **items = malloc(n * sizeof(char *));
+    if (!items) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+        char buf[MAX_PATH];
+        snprintf(buf, sizeof(buf), fmt, (int)i);
+        items[i] = strdup(buf);
+        if (!items[i]) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(1);
+        }
+    }
+    return items;
+}
+
+#define ONE(s) ((const char *[]){ s })
+#define INPUTS(arr) { (arr), sizeof(arr) / sizeof((arr)[0]), NULL, NULL }
+
+static const char *fence_lines[] = {
+    "```c main.c\n", "```python tools/gen.py\n", "```sh\n", "```\n"
+};
+static const char *attr_lines[] = {
+    "```c out/linux/main.c if=linux,!debug exec=sh inputs=a.txt,b.txt dedent=on trim=on\n"
+};
+static const char *body_lines[] = {
+    "    for (int i = 0; i < n; i++) {\n", "Some prose with `inline code` in it.\n",
+    "\n", "        return 0;\n"
+};
+static const char *close_lines[] = { "```\n", "````\n", "```   \n" };
+static const char *known_langs[] = { "c", "python", "sh", "rust", "yaml" };
+static const char *late_langs[] = { "make", "dockerfile", "txt" };
+static const char *config_lines[] = {
+    "backup = on\n", "output = build/\n", "lang = c\n", "# just a comment\n",
+    "strict_mode = false\n"
+};
+static const char *var_lines[] = { "var.PREFIX = \"/usr/local\"\n" };
+static const char *unknown_key_lines[] = { "no_such_key = whatever\n" };
+static const char *trim_items[] = {
+    "  value  ", "value", "\t\tkey = value \t\r\n", "   "
+};
+static const char *plain_paths[] = { "src/main.c", "out/linux/ryft.h", "README.md" };
+static const char *tilde_paths[] = { "~/projects/ryft/src/main.c", "~" };
+
+/* Set up str_trim inputs: writable copies plus where each tail starts */
+static Inputs trim_inputs(const char **items, size_t count)
+{
+    Inputs in = { items, count, NULL, NULL };
+    char **bufs = malloc(count * sizeof(char *));
+    in.tail = malloc(count * sizeof(size_t));
+    if (!bufs || !in.tail) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        bufs[i] = strdup(items[i]);
+        if (!bufs[i]) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(1);
+        }
+        char *r = str_trim(bufs[i]);
+        in.tail[i] = (size_t)(r - bufs[i]) + strlen(r);
+        strcpy(bufs[i], items[i]);
+    }
+    in.state = bufs;
+    return in;
+}
+
+/* An output state holding every path in items */
+static OutputState *filled_state(const char **items, size_t count)
+{
+    OutputState *state = calloc(1, sizeof(OutputState));
+    if (!state) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(1);
+    }
+    state->current = -1;
+    for (size_t i = 0; i < count; i++) {
+        get_output_file(state, items[i]);
+    }
+    return state;
+}
+
+/* ---- Harness ---- */
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Value at quantile q of sorted samples */
+static uint64_t quantile(const uint64_t *sorted, size_t n, double q)
+{
+    size_t i = (size_t)(q * (double)(n - 1) + 0.5);
+    return sorted[i < n ? i : n - 1];
+}
+
+/* Time a case: pick a batch long enough to time, warm up, then measure */
+static bool measure(Case *c, size_t reps, Result *r)
+{
+    size_t batch = 1;
+    while (batch < ((size_t)1 << 30)) {
+        uint64_t t = now_ns();
+        c->run(&c->in, batch);
+        if (now_ns() - t >= MIN_BATCH_NS) break;
+        batch *= 2;
+    }
+
+    for (size_t i = 0; i < reps / 10 + 1; i++) {
+        c->run(&c->in, batch);
+    }
+
+    uint64_t *ns = malloc(reps * sizeof(uint64_t));
+    uint64_t *cycles = malloc(reps * sizeof(uint64_t));
+    if (!ns || !cycles) {
+        free(ns);
+        free(cycles);
+        return false;
+    }
+
+    for (size_t i = 0; i < reps; i++) {
+        uint64_t t = now_ns();
+        uint64_t cy = now_cycles();
+        c->run(&c->in, batch);
+        cycles[i] = now_cycles() - cy;
+        ns[i] = now_ns() - t;
+    }
+
+    qsort(ns, reps, sizeof(uint64_t), compare_u64);
+    qsort(cycles, reps, sizeof(uint64_t), compare_u64);
+    r->batch = batch;
+    r->median_ns = (double)quantile(ns, reps, 0.5) / (double)batch;
+    r->p99_ns = (double)quantile(ns, reps, 0.99) / (double)batch;
+    r->median_cycles = (double)quantile(cycles, reps, 0.5) / (double)batch;
+    r->p99_cycles = (double)quantile(cycles, reps, 0.99) / (double)batch;
+
+    free(ns);
+    free(cycles);
+    return true;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: microbench [-o FILE] [-r REPS] [-f FILTER]\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_path = NULL;
+    const char *filter = NULL;
+    size_t reps = DEFAULT_REPS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            reps = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (reps == 0) {
+        usage();
+        return 1;
+    }
+
+    /* Adversarial inputs */
+    const char *backticks = repeat('`', LONG_LINE, "\n");
+    const char *backtick_fence = repeat('`', LONG_LINE, "c main.c\n");
+    const char *long_filename = repeat('a', MAX_LINE - 16, "\n");
+    const char *spaces_close = repeat(' ', LONG_LINE, "");
+    const char *long_config = repeat(' ', MAX_LINE - 32, "output = build/\n");
+    const char *long_trim = repeat(' ', LONG_LINE, "value");
+    const char *long_path = repeat('d', MAX_PATH - 16, "");
+    char *close_ws = malloc(LONG_LINE + 8);
+    char *fence_long = malloc(LONG_LINE + 8);
+    char *trim_both = malloc(2 * LONG_LINE + 8);
+    if (!close_ws || !fence_long || !trim_both) {
+        fprintf(stderr, "error: out of memory\n");
+        return 1;
+    }
+    snprintf(close_ws, LONG_LINE + 8, "```%s\n", spaces_close);
+    snprintf(fence_long, LONG_LINE + 8, "```c %s", long_filename);
+    snprintf(trim_both, 2 * LONG_LINE + 8, "%s%s", long_trim, spaces_close);
+
+    const char **paths = numbered("out/generated/module_%04d.c", DISTINCT_PATHS);
+    const char **langs = numbered("lang-unknown-%d", UNKNOWN_LANGS);
+    const char **lookup = numbered("src/file_%02d.c", LOOKUP_PATHS);
+    const char *lookup_last[] = { lookup[LOOKUP_PATHS - 1] };
+
+    OutputState *lookup_state = filled_state(lookup, LOOKUP_PATHS);
+    OutputState *insert_state = filled_state(NULL, 0);
+    static VarTable vars;
+    static RyftConfig config;
+    config.vars = &vars;
+
+    Case cases[] = {
+        { "count_backticks/fence", run_count_backticks, INPUTS(fence_lines) },
+        { "count_backticks/body", run_count_backticks, INPUTS(body_lines) },
+        { "count_backticks/10k_backticks", run_count_backticks, { ONE(backticks), 1, NULL, NULL } },
+
+        { "parse_fence/typical", run_parse_fence, INPUTS(fence_lines) },
+        { "parse_fence/attributes", run_parse_fence, INPUTS(attr_lines) },
+        { "parse_fence/10k_backticks", run_parse_fence, { ONE(backtick_fence), 1, NULL, NULL } },
+        { "parse_fence/long_filename", run_parse_fence, { ONE(fence_long), 1, NULL, NULL } },
+
+        { "get_closing_fence_backticks/close", run_closing_fence, INPUTS(close_lines) },
+        { "get_closing_fence_backticks/body", run_closing_fence, INPUTS(body_lines) },
+        { "get_closing_fence_backticks/10k_backticks", run_closing_fence,
+          { ONE(backticks), 1, NULL, NULL } },
+        { "get_closing_fence_backticks/10k_trailing_space", run_closing_fence,
+          { ONE(close_ws), 1, NULL, NULL } },
+
+        { "lang_to_ext/known", run_lang_to_ext, INPUTS(known_langs) },
+        { "lang_to_ext/late_or_default", run_lang_to_ext, INPUTS(late_langs) },
+        { "lang_to_ext/unknown_1k", run_lang_to_ext, { langs, UNKNOWN_LANGS, NULL, NULL } },
+
+        { "get_output_file/lookup_64", run_output_lookup,
+          { lookup, LOOKUP_PATHS, lookup_state, NULL } },
+        { "get_output_file/lookup_last", run_output_lookup, { lookup_last, 1, lookup_state, NULL } },
+        { "get_output_file/distinct_4k", run_output_insert,
+          { paths, DISTINCT_PATHS, insert_state, NULL } },
+
+        { "parse_config_line/known_keys", run_parse_config_line,
+          { config_lines, sizeof(config_lines) / sizeof(config_lines[0]), &config, NULL } },
+        { "parse_config_line/var", run_parse_config_line, { var_lines, 1, &config, NULL } },
+        { "parse_config_line/unknown_key", run_parse_config_line,
+          { unknown_key_lines, 1, &config, NULL } },
+        { "parse_config_line/long_line", run_parse_config_line,
+          { ONE(long_config), 1, &config, NULL } },
+
+        { "str_trim/typical", run_str_trim,
+          trim_inputs(trim_items, sizeof(trim_items) / sizeof(trim_items[0])) },
+        { "str_trim/10k_leading", run_str_trim, trim_inputs(ONE(long_trim), 1) },
+        { "str_trim/10k_both", run_str_trim, trim_inputs(ONE((const char *)trim_both), 1) },
+
+        { "expand_path/plain", run_expand_path, INPUTS(plain_paths) },
+        { "expand_path/tilde", run_expand_path, INPUTS(tilde_paths) },
+        { "expand_path/long", run_expand_path, { ONE(long_path), 1, NULL, NULL } },
+    };
+    size_t ncases = sizeof(cases) / sizeof(cases[0]);
+
+    FILE *out = stdout;
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (!out) {
+            fprintf(stderr, "error: cannot create '%s'\n", out_path);
+            return 1;
+        }
+    }
+
+    bool tsc = now_cycles() != 0;
+    fprintf(out, "{\n  \"version\": \"%s\",\n  \"reps\": %zu,\n", RYFT_VERSION, reps);
+    fprintf(out, "  \"clock\": \"clock_gettime(CLOCK_MONOTONIC)\",\n");
+    fprintf(out, "  \"cycles\": %s,\n", tsc ? "\"rdtsc\"" : "null");
+    fprintf(out, "  \"results\": [");
+
+    fprintf(stderr, "%-48s %10s %10s %10s %10s\n", "case", "median ns", "p99 ns",
+            "median cyc", "p99 cyc");
+
+    bool first = true;
+    for (size_t i = 0; i < ncases; i++) {
+        Case *c = &cases[i];
+        if (filter && !strstr(c->name, filter)) {
+            continue;
+        }
+
+        Result r;
+        if (!measure(c, reps, &r)) {
+            fprintf(stderr, "error: out of memory\n");
+            return 1;
+        }
+
+        fprintf(stderr, "%-48s %10.1f %10.1f %10.1f %10.1f\n", c->name, r.median_ns,
+                r.p99_ns, r.median_cycles, r.p99_cycles);
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"inputs\": %zu, \"batch\": %zu, "
+                "\"median_ns\": %.2f, \"p99_ns\": %.2f", first ? "" : ",", c->name,
+                c->in.count, r.batch, r.median_ns, r.p99_ns);
+        if (tsc) {
+            fprintf(out, ", \"median_cycles\": %.2f, \"p99_cycles\": %.2f}",
+                    r.median_cycles, r.p99_cycles);
+        } else {
+            fprintf(out, ", \"median_cycles\": null, \"p99_cycles\": null}");
+        }
+        first = false;
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "error: failed writing '%s'\n", out_path);
+        return 1;
+    }
+    if (out_path) {
+        fprintf(stderr, "results: %s\n", out_path);
+    }
+    return 0;
+}
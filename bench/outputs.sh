@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# outputs.sh - Time many small outputs on the POSIX and io_uring backends
+#
+# Generates a document with N outputs of 1-4 KB each, 100 per directory,
+# like a tangled API reference, then runs ryft on it R times per backend:
+# once into an empty tree (create) and once over the previous run's
+# outputs (overwrite). Prints the median wall time of each.
+#
+#   bench/outputs.sh [N] [R]        (defaults: 10000 outputs, 5 runs)
+#
+# RYFT selects the binary (default bin/ryft), TMPDIR the scratch space.
+
+set -e
+
+N=${1:-10000}
+R=${2:-5}
+RYFT=$(cd "$(dirname "${RYFT:-bin/ryft}")" && pwd)/$(basename "${RYFT:-bin/ryft}")
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/ryft-outputs.XXXXXX")
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v n="$N" 'BEGIN {
+    srand(1)
+    print "# API\n"
+    for (i = 0; i < n; i++) {
+        printf "```c api/m%03d/f%05d.c\n", int(i / 100), i
+        size = 1024 + int(rand() * 3072)
+        for (b = 0; b < size; b += 17) printf "int api_%05d_x;\n", i
+        print "```\n"
+    }
+}' > "$WORK/doc.md"
+
+# Median wall time in ms of R runs of: ryft $1 doc.md, after $2
+median() {
+    for r in $(seq "$R"); do
+        eval "$2"
+        start=$(date +%s%N)
+        (cd "$WORK" && "$RYFT" $1 doc.md > /dev/null)
+        end=$(date +%s%N)
+        echo $(( (end - start) / 1000000 ))
+    done | sort -n | awk '{ t[NR] = $1 } END { print t[int((NR + 1) / 2)] }'
+}
+
+printf "%d outputs, median of %d runs (ms)\n" "$N" "$R"
+printf "%-10s %8s %10s\n" backend create overwrite
+for backend in posix io_uring; do
+    flag=
+    [ "$backend" = io_uring ] && flag=--io-uring
+    create=$(median "$flag" 'rm -rf "$WORK/api"')
+    overwrite=$(median "$flag" ':')
+    printf "%-10s %8s %10s\n" "$backend" "$create" "$overwrite"
+done
@@ -9,6 +9,84 @@
 #define RYFT_API_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#define RYFT_MAX_LANG 64
+#define RYFT_MAX_PATH 1024
+
+/* Returned by ryft_process_file() in check mode when outputs are stale */
+#define RYFT_STALE 2
+
+/* Pluggable file I/O
+ *
+ * Everything ryft reads or writes while tangling (documents, outputs,
+ * backups, directories) goes through a backend. Functions return -1 or
+ * NULL and set errno on failure, like their POSIX counterparts.
+ */
+typedef struct RyftFile RyftFile;      /* open file, defined by the backend */
+typedef struct RyftIO RyftIO;
+
+struct RyftIO {
+    /* Open a file for reading, or create/truncate it for writing */
+    RyftFile *(*open)(RyftIO *io, const char *path, bool write);
+    /* Read or write up to len bytes; a short count means end of file or error */
+    size_t (*read)(RyftIO *io, RyftFile *f, void *buf, size_t len);
+    size_t (*write)(RyftIO *io, RyftFile *f, const void *buf, size_t len);
+    int (*close)(RyftIO *io, RyftFile *f);
+    /* 0 if path exists, filling *size */
+    int (*stat)(RyftIO *io, const char *path, size_t *size);
+    /* Create one directory (fails with EEXIST if it exists) */
+    int (*mkdir)(RyftIO *io, const char *path);
+    int (*rename)(RyftIO *io, const char *from, const char *to);
+    /* Copy a file, sharing storage where the backend can */
+    int (*clone)(RyftIO *io, const char *from, const char *to);
+    /* Optional: map a whole file read-only (0 on success); NULL to read it instead */
+    int (*map)(RyftIO *io, const char *path, const char **data, size_t *len);
+    void (*unmap)(RyftIO *io, const char *data, size_t len);
+    /* Optional: open an existing file for writing without truncating it;
+     * NULL if files can only be rewritten whole */
+    RyftFile *(*update)(RyftIO *io, const char *path);
+    /* Write len bytes at offset off of a file opened with update */
+    size_t (*pwrite)(RyftIO *io, RyftFile *f, const void *buf, size_t len, size_t off);
+    /* Cut or extend a file opened with update to size bytes */
+    int (*truncate)(RyftIO *io, RyftFile *f, size_t size);
+    /* Optional: wait for writes that close() left in flight; returns -1
+     * with errno set and *path naming a file that failed, once for each,
+     * then 0. NULL if close() always finishes the file */
+    int (*flush)(RyftIO *io, const char **path);
+    /* Free the backend (NULL for static backends) */
+    void (*release)(RyftIO *io);
+    void *ctx;                 /* backend state */
+};
+
+/* The local filesystem (the default); static, never freed */
+RyftIO *ryft_io_posix(void);
+
+/* The local filesystem, with output files written in batches through
+ * io_uring (Linux 5.15+); release with ryft_io_free(). NULL where
+ * io_uring cannot be used, in which case use ryft_io_posix() */
+RyftIO *ryft_io_uring(void);
+
+/* An empty in-memory filesystem; release with ryft_io_free() */
+RyftIO *ryft_io_memory(void);
+
+/* Store a file in an in-memory backend (e.g. a document to tangle)
+ * Returns 0 on success
+ */
+int ryft_io_memory_put(RyftIO *io, const char *path, const void *data, size_t len);
+
+/* Contents of a file in an in-memory backend, NULL if absent
+ * Valid until the file is written again or the backend is freed
+ */
+const char *ryft_io_memory_get(RyftIO *io, const char *path, size_t *len);
+
+/* Reads from base, discards every change (what --dry-run uses); release
+ * with ryft_io_free(), which leaves base alone; NULL base means POSIX
+ */
+RyftIO *ryft_io_dry_run(RyftIO *base);
+
+/* Release a backend created by one of the functions above */
+void ryft_io_free(RyftIO *io);
 
 /* Runtime options for processing */
 typedef struct {
@@ -19,15 +97,135 @@ typedef struct {
     bool verbose;              /* extra output during processing */
     bool summary;              /* print summary at end */
     bool strict_mode;          /* fail on warnings instead of continuing */
+    bool index;                /* keep a sidecar block index next to the document */
+    bool check;                /* compare outputs with existing files, write nothing */
+    bool diff;                 /* with check: print a unified diff of each stale output */
+    bool diff_stat;            /* with diff: only count the changed lines of each */
+    bool in_place;             /* rewrite only the changed chunks of existing outputs */
+    const char **only;         /* extract only outputs matching these globs */
+    int  only_count;
+    const char **defines;      /* NAME=value variables for ${NAME} in block bodies */
+    int  define_count;
+    const char *tags;          /* comma-separated tags for if= blocks */
+    const char *matrix;        /* ';'-separated tag sets, each under its own root */
+    int  jobs;                 /* scanner threads for plain documents (0/1=serial) */
+    bool no_wait;              /* fail on outputs another process is writing */
+    size_t max_memory;         /* bytes output buffers may hold before they
+                                * spill to temp files (0 = no limit) */
+    bool resume;               /* --project: journal written outputs, skip the
+                                * ones an interrupted run already wrote */
+    const char *fingerprint;   /* comma-separated languages (or "all") whose
+                                * outputs start with a fingerprint header line */
+    RyftIO *io;                /* file I/O backend, NULL for the local filesystem */
 } RyftOptions;
 
+/* Fill opts with the defaults the command line starts from (timestamped
+ * backups, at most 10 kept, one job). Callers should start from these
+ * rather than a zeroed struct, where 0 means "unlimited" and so on.
+ */
+void ryft_options_init(RyftOptions *opts);
+
 /* Process a markdown file, extracting code blocks to output files.
  *
  * filepath: Path to the markdown file to process
- * opts: Runtime options (may be NULL for defaults)
+ * opts: Runtime options, set up with ryft_options_init() (NULL for defaults)
  *
  * Returns 0 on success, non-zero on error.
  */
 int ryft_process_file(const char *filepath, RyftOptions *opts);
 
+/* Kind of a fenced block */
+typedef enum {
+    RYFT_BLOCK_CODE,           /* extracted to an output */
+    RYFT_BLOCK_DISPLAY,        /* 4+ backticks, not extracted */
+    RYFT_BLOCK_CONFIG,         /* ryft.config block */
+    RYFT_BLOCK_EXEC            /* exec= block: routed to an output like code,
+                                * but its generated text is not in the map */
+} RyftBlockKind;
+
+/* A byte range, usually pointing into the caller's buffer */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} RyftSpan;
+
+/* One fenced block of a mapped document */
+typedef struct {
+    RyftBlockKind kind;
+    bool continuation;         /* no filename, appended to the current output */
+    char lang[RYFT_MAX_LANG];
+    int output;                /* index into RyftSourceMap.outputs, -1 if none */
+    size_t fence_line;         /* line of the opening fence (1-based) */
+    size_t close_line;         /* line of the closing fence, 0 if unclosed */
+    size_t body_offset;        /* byte offset of the body in the input */
+    size_t body_len;           /* body length in bytes */
+    size_t out_offset;         /* byte offset of the body in the output */
+    size_t out_line;           /* first body line in the output (1-based) */
+    size_t out_lines;          /* number of body lines */
+    bool transformed;          /* body is rewritten by dedent=, eol=, trim= or
+                                * tabs=, so its output text is not in the map */
+    bool conditional;          /* has an if= condition */
+    bool excluded;             /* if= does not hold for the tags: not written,
+                                * output is -1 */
+    bool expands;              /* ${NAME} is expanded in its body (vars=on) */
+} RyftBlock;
+
+/* One output file of a mapped document */
+typedef struct {
+    char path[RYFT_MAX_PATH];  /* resolved path (~ expanded) */
+    char lang[RYFT_MAX_LANG];  /* language of the first block written */
+    int block_count;           /* blocks written to this output */
+    size_t size;               /* output size in bytes */
+    size_t lines;              /* output size in lines */
+    RyftSpan *spans;           /* contents in order (RYFT_MAP_SPANS only) */
+    size_t span_count;
+    bool fallback;             /* named after the document, not by a fence */
+} RyftOutput;
+
+/* Block/source map of a document */
+typedef struct {
+    RyftBlock *blocks;
+    size_t block_count;
+    RyftOutput *outputs;
+    size_t output_count;
+} RyftSourceMap;
+
+/* Flags for ryft_map_buffer */
+#define RYFT_MAP_SPANS 0x1     /* fill RyftOutput.spans */
+#define RYFT_MAP_UNCONDITIONAL 0x2 /* map if= blocks as if their condition held */
+
+/* Map a markdown document held in memory, without writing anything.
+ *
+ * buf, len: Document contents (need not be NUL-terminated)
+ * name: Path the document would be read from, used to name fallback
+ *       outputs the same way the CLI does (may be NULL)
+ * flags: RYFT_MAP_* flags
+ * map: Filled on success, release with ryft_map_free()
+ *
+ * Targets are resolved exactly as ryft_process_file() would, including
+ * ryft.config blocks inside the buffer. if= blocks are evaluated with no
+ * tags set, so only negated conditions hold (see RYFT_MAP_UNCONDITIONAL).
+ * Warnings and strict mode do not apply. Spans point into buf, except for the blank line added by a 4+
+ * backtick closing fence, which points to static storage; buf must
+ * outlive the map.
+ *
+ * Returns 0 on success, non-zero on allocation failure.
+ */
+int ryft_map_buffer(const char *buf, size_t len, const char *name,
+                    unsigned flags, RyftSourceMap *map);
+
+/* Like ryft_map_buffer(), resolved with opts as ryft_process_file() would
+ * with the same options: if= blocks are evaluated against opts->tags
+ * (opts->matrix is not applied) and a config 'output' is checked for a
+ * directory on opts->io (NULL opts: the defaults)
+ *
+ * Returns 0 on success, non-zero on allocation failure or an invalid
+ * opts->tags list.
+ */
+int ryft_map_buffer_opts(const char *buf, size_t len, const char *name, unsigned flags,
+                         const RyftOptions *opts, RyftSourceMap *map);
+
+/* Release memory owned by a source map */
+void ryft_map_free(RyftSourceMap *map);
+
 #endif /* RYFT_API_H */
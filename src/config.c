@@ -3,13 +3,19 @@
  */
 
 #include "config.h"
+#include "log.h"
+#include "trace.h"
+#include "transform.h"
 #include "util.h"
+#include "vars.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-/* Parse a single config line: key = value */
+/* Parse a single config line: key = value
+ * options may be NULL to parse silently (no verbose output or warnings)
+ */
 bool parse_config_line(const char *line, RyftConfig *config, RyftOptions *options)
 {
     char buf[MAX_LINE];
@@ -35,83 +41,117 @@ bool parse_config_line(const char *line, RyftConfig *config, RyftOptions *option
     if (strcmp(key, "output") == 0) {
         strncpy(config->output, value, MAX_PATH - 1);
         config->output[MAX_PATH - 1] = '\0';
-        if (options->verbose) {
-            printf("  config: output = %s\n", config->output);
+        config->output_resolved = false;
+        if (options && options->verbose) {
+            log_debug("  config: output = %s\n", config->output);
         }
     } else if (strcmp(key, "lang") == 0 || strcmp(key, "language") == 0) {
         strncpy(config->lang, value, MAX_LANG - 1);
         config->lang[MAX_LANG - 1] = '\0';
-        if (options->verbose) {
-            printf("  config: lang = %s\n", config->lang);
+        if (options && options->verbose) {
+            log_debug("  config: lang = %s\n", config->lang);
         }
     } else if (strcmp(key, "backup") == 0) {
         if (parse_bool(value, &config->backup)) {
             config->backup_set = true;
-            if (options->verbose) {
-                printf("  config: backup = %s\n", config->backup ? "on" : "off");
+            if (options && options->verbose) {
+                log_debug("  config: backup = %s\n", config->backup ? "on" : "off");
             }
-        } else {
-            fprintf(stderr, "warning: invalid boolean value for 'backup': %s\n", value);
+        } else if (options) {
+            log_warn("warning: invalid boolean value for 'backup': %s\n", value);
         }
     } else if (strcmp(key, "verbose") == 0) {
         if (parse_bool(value, &config->verbose)) {
             config->verbose_set = true;
-            if (options->verbose) {
-                printf("  config: verbose = %s\n", config->verbose ? "on" : "off");
+            if (options && options->verbose) {
+                log_debug("  config: verbose = %s\n", config->verbose ? "on" : "off");
             }
-        } else {
-            fprintf(stderr, "warning: invalid boolean value for 'verbose': %s\n", value);
+        } else if (options) {
+            log_warn("warning: invalid boolean value for 'verbose': %s\n", value);
         }
     } else if (strcmp(key, "summary") == 0) {
         if (parse_bool(value, &config->summary)) {
             config->summary_set = true;
-            if (options->verbose) {
-                printf("  config: summary = %s\n", config->summary ? "on" : "off");
+            if (options && options->verbose) {
+                log_debug("  config: summary = %s\n", config->summary ? "on" : "off");
             }
-        } else {
-            fprintf(stderr, "warning: invalid boolean value for 'summary': %s\n", value);
+        } else if (options) {
+            log_warn("warning: invalid boolean value for 'summary': %s\n", value);
         }
     } else if (strcmp(key, "strict_mode") == 0) {
         if (parse_bool(value, &config->strict_mode)) {
             config->strict_mode_set = true;
-            if (options->verbose) {
-                printf("  config: strict_mode = %s\n", config->strict_mode ? "on" : "off");
+            if (options && options->verbose) {
+                log_debug("  config: strict_mode = %s\n", config->strict_mode ? "on" : "off");
             }
-        } else {
-            fprintf(stderr, "warning: invalid boolean value for 'strict_mode': %s\n", value);
+        } else if (options) {
+            log_warn("warning: invalid boolean value for 'strict_mode': %s\n", value);
         }
     } else if (strcmp(key, "backup_timestamp") == 0) {
         if (parse_bool(value, &config->backup_timestamp)) {
             config->backup_timestamp_set = true;
-            if (options->verbose) {
-                printf("  config: backup_timestamp = %s\n", config->backup_timestamp ? "on" : "off");
+            if (options && options->verbose) {
+                log_debug("  config: backup_timestamp = %s\n", config->backup_timestamp ? "on" : "off");
             }
-        } else {
-            fprintf(stderr, "warning: invalid boolean value for 'backup_timestamp': %s\n", value);
+        } else if (options) {
+            log_warn("warning: invalid boolean value for 'backup_timestamp': %s\n", value);
         }
     } else if (strcmp(key, "backup_limit") == 0) {
         int limit = atoi(value);
         if (limit < 0) limit = 10;  /* Default for negative values */
         config->backup_limit = limit;
         config->backup_limit_set = true;
-        if (options->verbose) {
-            printf("  config: backup_limit = %d\n", config->backup_limit);
+        if (options && options->verbose) {
+            log_debug("  config: backup_limit = %d\n", config->backup_limit);
         }
     } else if (strcmp(key, "filename") == 0) {
         strncpy(config->filename, value, MAX_PATH - 1);
         config->filename[MAX_PATH - 1] = '\0';
-        if (options->verbose) {
-            printf("  config: filename = %s\n", config->filename);
+        if (options && options->verbose) {
+            log_debug("  config: filename = %s\n", config->filename);
         }
     } else if (strcmp(key, "version") == 0) {
         strncpy(config->version, value, sizeof(config->version) - 1);
         config->version[sizeof(config->version) - 1] = '\0';
-        if (options->verbose) {
-            printf("  config: version = %s\n", config->version);
+        if (options && options->verbose) {
+            log_debug("  config: version = %s\n", config->version);
+        }
+    } else if (strcmp(key, "fingerprint") == 0) {
+        strncpy(config->fingerprint, value, MAX_PATH - 1);
+        config->fingerprint[MAX_PATH - 1] = '\0';
+        if (options && options->verbose) {
+            log_debug("  config: fingerprint = %s\n", config->fingerprint);
+        }
+    } else if (strcmp(key, "vars") == 0) {
+        if (parse_bool(value, &config->expand_vars)) {
+            if (options && options->verbose) {
+                log_debug("  config: vars = %s\n", config->expand_vars ? "on" : "off");
+            }
+        } else if (options) {
+            log_warn("warning: invalid boolean value for 'vars': %s\n", value);
+        }
+    } else if (transform_key(key)) {
+        if (transform_parse(&config->transform, key, value)) {
+            if (options && options->verbose) {
+                log_debug("  config: %s = %s\n", key, value);
+            }
+        } else if (options) {
+            log_warn("warning: invalid value for '%s': %s\n", key, value);
+        }
+    } else if (strncmp(key, "var.", 4) == 0) {
+        if (!config->vars) {
+            return true;
+        }
+        if (var_set(config->vars, key + 4, value, false)) {
+            if (options && options->verbose) {
+                log_debug("  config: %s = %s\n", key, value);
+            }
+        } else if (options) {
+            log_warn("warning: cannot set variable '%s'\n", key + 4);
         }
     } else {
-        if (options->verbose) {
-            printf("  config: unknown key '%s' (ignored)\n", key);
+        if (options && options->verbose) {
+            log_debug("  config: unknown key '%s' (ignored)\n", key);
         }
     }
 
@@ -140,6 +180,12 @@ void apply_config(RyftConfig *config, RyftOptions *cli_options, RyftOptions *g_o
     if (config->strict_mode_set && !cli_options->strict_mode) {
         g_options->strict_mode = config->strict_mode;
     }
+    if (config->fingerprint[0] && !cli_options->fingerprint) {
+        /* Outlives the config it came from */
+        static char fingerprint[MAX_PATH];
+        memcpy(fingerprint, config->fingerprint, sizeof(fingerprint));
+        g_options->fingerprint = fingerprint;
+    }
     /* If verbose is on, summary is also on */
     if (g_options->verbose) {
         g_options->summary = true;
@@ -160,8 +206,11 @@ bool load_config_file(const char *path, RyftConfig *config, RyftOptions *options
         return false;
     }
 
+    uint64_t t;
+    TRACE_BEGIN(t, config, expanded);
+
     if (verbose) {
-        printf("loading config: %s\n", expanded);
+        log_info("loading config: %s\n", expanded);
     }
 
     char line[MAX_LINE];
@@ -174,6 +223,7 @@ bool load_config_file(const char *path, RyftConfig *config, RyftOptions *options
     }
 
     fclose(f);
+    TRACE_END(t, config, expanded);
     return true;
 }
 
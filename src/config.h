@@ -9,7 +9,9 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-/* Parse a single config line: key = value */
+/* Parse a single config line: key = value
+ * options may be NULL to parse silently (no verbose output or warnings)
+ */
 bool parse_config_line(const char *line, RyftConfig *config, RyftOptions *options);
 
 /* Apply document config to global options */
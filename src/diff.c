@@ -0,0 +1,418 @@
+/*
+ * diff.c - Line diff between existing and would-be output contents
+ *
+ * Tuned for small edits in large files: common prefix and suffix are
+ * trimmed in linear time, then the remaining window is split on lines
+ * that occur exactly once on both sides (matched by hash), keeping the
+ * longest run of anchors that appear in the same order. Windows with no
+ * anchors are diffed with Myers' O(ND) algorithm when they are small and
+ * differ in few lines; otherwise they become a single replacement hunk.
+ */
+
+#include "diff.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MYERS_MAX_WINDOW 65536 /* lines (both sides) diffed with Myers */
+#define MYERS_MAX_EDITS 512    /* edits before Myers gives up */
+
+/* Anchor candidate: a line unique in both windows */
+typedef struct {
+    size_t a;
+    size_t b;
+} Anchor;
+
+/* Hash table slot used to count line occurrences */
+typedef struct {
+    const DiffLine *line;
+    size_t a_pos;
+    size_t b_pos;
+    int a_count;
+    int b_count;
+} Slot;
+
+static bool lines_equal(const DiffLine *x, const DiffLine *y)
+{
+    return x->hash == y->hash && x->len == y->len && memcmp(x->ptr, y->ptr, x->len) == 0;
+}
+
+/* Split buf into lines and append them (lines point into buf) */
+bool diff_add_lines(DiffLines *dl, const char *buf, size_t len)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t n = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+
+        if (dl->count == dl->cap) {
+            size_t cap = dl->cap ? dl->cap * 2 : 256;
+            DiffLine *lines = realloc(dl->lines, cap * sizeof(DiffLine));
+            if (!lines) return false;
+            dl->lines = lines;
+            dl->cap = cap;
+        }
+
+        DiffLine *l = &dl->lines[dl->count++];
+        l->ptr = p;
+        l->len = n;
+        l->hash = hash_bytes(p, n);
+        p += n;
+    }
+
+    return true;
+}
+
+static bool add_hunk(DiffResult *out, size_t a0, size_t a1, size_t b0, size_t b1)
+{
+    if (a0 == a1 && b0 == b1) {
+        return true;
+    }
+
+    if (out->count == out->cap) {
+        size_t cap = out->cap ? out->cap * 2 : 16;
+        DiffHunk *hunks = realloc(out->hunks, cap * sizeof(DiffHunk));
+        if (!hunks) return false;
+        out->hunks = hunks;
+        out->cap = cap;
+    }
+
+    DiffHunk *h = &out->hunks[out->count++];
+    h->a_start = a0;
+    h->a_count = a1 - a0;
+    h->b_start = b0;
+    h->b_count = b1 - b0;
+    return true;
+}
+
+/* Collect lines unique in both windows, ordered by position in a */
+static bool find_anchors(const DiffLine *a, size_t a0, size_t a1,
+                         const DiffLine *b, size_t b0, size_t b1,
+                         Anchor **anchors, size_t *count)
+{
+    size_t size = 1;
+    while (size < 2 * ((a1 - a0) + (b1 - b0))) size <<= 1;
+
+    Slot *table = calloc(size, sizeof(Slot));
+    if (!table) return false;
+
+    for (int side = 0; side < 2; side++) {
+        const DiffLine *lines = side ? b : a;
+        size_t lo = side ? b0 : a0;
+        size_t hi = side ? b1 : a1;
+
+        for (size_t i = lo; i < hi; i++) {
+            size_t s = (size_t)lines[i].hash & (size - 1);
+            while (table[s].line && !lines_equal(table[s].line, &lines[i])) {
+                s = (s + 1) & (size - 1);
+            }
+            table[s].line = &lines[i];
+            if (side) {
+                table[s].b_count++;
+                table[s].b_pos = i;
+            } else {
+                table[s].a_count++;
+                table[s].a_pos = i;
+            }
+        }
+    }
+
+    *count = 0;
+    *anchors = malloc((a1 - a0) * sizeof(Anchor));
+    if (!*anchors) {
+        free(table);
+        return false;
+    }
+
+    /* Walk a in order so anchors come out sorted by a position */
+    for (size_t i = a0; i < a1; i++) {
+        size_t s = (size_t)a[i].hash & (size - 1);
+        while (!lines_equal(table[s].line, &a[i])) {
+            s = (s + 1) & (size - 1);
+        }
+        if (table[s].a_count == 1 && table[s].b_count == 1) {
+            (*anchors)[*count].a = i;
+            (*anchors)[*count].b = table[s].b_pos;
+            (*count)++;
+        }
+    }
+
+    free(table);
+    return true;
+}
+
+/* Keep the longest run of anchors increasing in b (patience sorting)
+ * Returns the new anchor count
+ */
+static size_t longest_increasing(Anchor *anchors, size_t count)
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t *tails = malloc(count * sizeof(size_t));
+    size_t *prev = malloc(count * sizeof(size_t));
+    size_t len = 0;
+
+    if (!tails || !prev) {
+        free(tails);
+        free(prev);
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        size_t lo = 0, hi = len;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (anchors[tails[mid]].b < anchors[i].b) lo = mid + 1;
+            else hi = mid;
+        }
+        prev[i] = lo > 0 ? tails[lo - 1] : (size_t)-1;
+        tails[lo] = i;
+        if (lo == len) len++;
+    }
+
+    /* Rebuild the chain back to front */
+    size_t k = tails[len - 1];
+    Anchor *chain = malloc(len * sizeof(Anchor));
+    if (chain) {
+        for (size_t i = len; i > 0; i--) {
+            chain[i - 1] = anchors[k];
+            k = prev[k];
+        }
+        memcpy(anchors, chain, len * sizeof(Anchor));
+        free(chain);
+    } else {
+        len = 0;
+    }
+
+    free(tails);
+    free(prev);
+    return len;
+}
+
+/* Turn marked deletions and insertions of a window into hunks */
+static bool mark_hunks(DiffResult *out, const bool *del, size_t a0, size_t a1,
+                       const bool *ins, size_t b0, size_t b1)
+{
+    size_t i = a0, j = b0;
+    while (i < a1 || j < b1) {
+        if (i < a1 && j < b1 && !del[i - a0] && !ins[j - b0]) {
+            i++;
+            j++;
+            continue;
+        }
+        size_t hi = i, hj = j;
+        while ((i < a1 && del[i - a0]) || (j < b1 && ins[j - b0])) {
+            while (i < a1 && del[i - a0]) i++;
+            while (j < b1 && ins[j - b0]) j++;
+        }
+        if (!add_hunk(out, hi, i, hj, j)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Shortest edit script of a window (Myers), keeping the furthest x of
+ * every diagonal after each step to walk the path back
+ * Returns false on allocation failure; *found is false if the window
+ * needs more than MYERS_MAX_EDITS edits
+ */
+static bool myers(const DiffLine *a, size_t a0, size_t a1,
+                  const DiffLine *b, size_t b0, size_t b1, DiffResult *out, bool *found)
+{
+    long n = (long)(a1 - a0);
+    long m = (long)(b1 - b0);
+    long max = n + m < MYERS_MAX_EDITS ? n + m : MYERS_MAX_EDITS;
+
+    /* Step d keeps diagonals -d..d, stored from trace[d * d] */
+    long *v = calloc((size_t)(2 * max + 3), sizeof(long));
+    long *trace = malloc((size_t)((max + 1) * (max + 1)) * sizeof(long));
+    bool *del = calloc((size_t)n + (size_t)m, sizeof(bool));
+    if (!v || !trace || !del) {
+        free(v);
+        free(trace);
+        free(del);
+        return false;
+    }
+    long *vk = v + max + 1;
+
+    *found = false;
+    long d;
+    for (d = 0; d <= max && !*found; d++) {
+        for (long k = -d; k <= d; k += 2) {
+            long x = (k == -d || (k != d && vk[k - 1] < vk[k + 1])) ? vk[k + 1] : vk[k - 1] + 1;
+            long y = x - k;
+            while (x < n && y < m && lines_equal(&a[a0 + x], &b[b0 + y])) {
+                x++;
+                y++;
+            }
+            vk[k] = x;
+            if (x >= n && y >= m) {
+                *found = true;
+                break;
+            }
+        }
+        if (!*found) {
+            memcpy(trace + d * d, vk - d, (size_t)(2 * d + 1) * sizeof(long));
+        }
+    }
+
+    if (*found) {
+        /* Walk back from the end, marking one edit per step */
+        bool *ins = del + n;
+        long x = n, y = m;
+        for (d--; d > 0; d--) {
+            const long *prev = trace + (d - 1) * (d - 1) + (d - 1);
+            long k = x - y;
+            bool down = k == -d || (k != d && prev[k - 1] < prev[k + 1]);
+            long pk = down ? k + 1 : k - 1;
+            long px = prev[pk];
+            long py = px - pk;
+            if (down) {
+                ins[py] = true;
+            } else {
+                del[px] = true;
+            }
+            x = px;
+            y = py;
+        }
+    }
+
+    bool ok = !*found || mark_hunks(out, del, a0, a1, del + n, b0, b1);
+    free(v);
+    free(trace);
+    free(del);
+    return ok;
+}
+
+static bool diff_range(const DiffLine *a, size_t a0, size_t a1,
+                       const DiffLine *b, size_t b0, size_t b1, DiffResult *out)
+{
+    /* Trim common prefix and suffix */
+    while (a0 < a1 && b0 < b1 && lines_equal(&a[a0], &b[b0])) {
+        a0++;
+        b0++;
+    }
+    while (a0 < a1 && b0 < b1 && lines_equal(&a[a1 - 1], &b[b1 - 1])) {
+        a1--;
+        b1--;
+    }
+
+    if (a0 == a1 || b0 == b1) {
+        return add_hunk(out, a0, a1, b0, b1);
+    }
+
+    Anchor *anchors;
+    size_t count;
+    if (!find_anchors(a, a0, a1, b, b0, b1, &anchors, &count)) {
+        return false;
+    }
+    count = longest_increasing(anchors, count);
+
+    if (count == 0) {
+        free(anchors);
+        bool found = false;
+        if ((a1 - a0) + (b1 - b0) <= MYERS_MAX_WINDOW &&
+            !myers(a, a0, a1, b, b0, b1, out, &found)) {
+            return false;
+        }
+        return found || add_hunk(out, a0, a1, b0, b1);
+    }
+
+    /* Recurse into the gaps between anchors */
+    bool ok = true;
+    size_t pa = a0, pb = b0;
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = diff_range(a, pa, anchors[i].a, b, pb, anchors[i].b, out);
+        pa = anchors[i].a + 1;
+        pb = anchors[i].b + 1;
+    }
+    if (ok) {
+        ok = diff_range(a, pa, a1, b, pb, b1, out);
+    }
+
+    free(anchors);
+    return ok;
+}
+
+/* Diff line sequence a against b, producing hunks in order */
+bool diff_lines(const DiffLines *a, const DiffLines *b, DiffResult *out)
+{
+    return diff_range(a->lines, 0, a->count, b->lines, 0, b->count, out);
+}
+
+/* Print one line with its prefix, noting a missing final newline */
+static void put_line(FILE *f, char prefix, const DiffLine *l)
+{
+    fputc(prefix, f);
+    fwrite(l->ptr, 1, l->len, f);
+    if (l->len == 0 || l->ptr[l->len - 1] != '\n') {
+        fputs("\n\\ No newline at end of file\n", f);
+    }
+}
+
+/* Start of a unified range: the line before it when it is empty */
+static size_t range_start(size_t start, size_t count)
+{
+    return count ? start + 1 : start;
+}
+
+/* Print hunks as unified diff hunks with context lines */
+void diff_print_unified(FILE *f, const DiffLines *a, const DiffLines *b,
+                        const DiffResult *res, size_t context)
+{
+    size_t i = 0;
+    while (i < res->count) {
+        /* Hunks whose context would touch or overlap print as one */
+        size_t last = i;
+        while (last + 1 < res->count &&
+               res->hunks[last + 1].a_start - (res->hunks[last].a_start +
+                                               res->hunks[last].a_count) <= 2 * context) {
+            last++;
+        }
+
+        const DiffHunk *first = &res->hunks[i];
+        const DiffHunk *end = &res->hunks[last];
+        size_t before = first->a_start < context ? first->a_start : context;
+        size_t a_end = end->a_start + end->a_count;
+        size_t after = a->count - a_end < context ? a->count - a_end : context;
+        size_t a_from = first->a_start - before;
+        size_t b_from = first->b_start - before;
+        size_t a_len = a_end + after - a_from;
+        size_t b_len = end->b_start + end->b_count + after - b_from;
+
+        fprintf(f, "@@ -%zu,%zu +%zu,%zu @@\n", range_start(a_from, a_len), a_len,
+                range_start(b_from, b_len), b_len);
+
+        size_t pa = a_from;
+        for (size_t h = i; h <= last; h++) {
+            const DiffHunk *hk = &res->hunks[h];
+            for (; pa < hk->a_start; pa++) put_line(f, ' ', &a->lines[pa]);
+            for (size_t k = 0; k < hk->a_count; k++) put_line(f, '-', &a->lines[hk->a_start + k]);
+            for (size_t k = 0; k < hk->b_count; k++) put_line(f, '+', &b->lines[hk->b_start + k]);
+            pa = hk->a_start + hk->a_count;
+        }
+        for (; pa < a_end + after; pa++) put_line(f, ' ', &a->lines[pa]);
+
+        i = last + 1;
+    }
+}
+
+/* Release line and hunk arrays */
+void diff_free_lines(DiffLines *dl)
+{
+    free(dl->lines);
+    memset(dl, 0, sizeof(*dl));
+}
+
+void diff_free(DiffResult *res)
+{
+    free(res->hunks);
+    memset(res, 0, sizeof(*res));
+}
@@ -0,0 +1,60 @@
+/*
+ * diff.h - Line diff between existing and would-be output contents
+ */
+
+#ifndef RYFT_DIFF_H
+#define RYFT_DIFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* One line, including its trailing newline if present */
+typedef struct {
+    const char *ptr;
+    size_t len;
+    uint64_t hash;
+} DiffLine;
+
+typedef struct {
+    DiffLine *lines;
+    size_t count;
+    size_t cap;
+} DiffLines;
+
+/* Replace a_count lines at a_start with b_count lines at b_start (0-based) */
+typedef struct {
+    size_t a_start;
+    size_t a_count;
+    size_t b_start;
+    size_t b_count;
+} DiffHunk;
+
+typedef struct {
+    DiffHunk *hunks;
+    size_t count;
+    size_t cap;
+} DiffResult;
+
+/* Split buf into lines and append them (lines point into buf)
+ * Returns false on allocation failure
+ */
+bool diff_add_lines(DiffLines *dl, const char *buf, size_t len);
+
+/* Diff line sequence a against b, producing hunks in order
+ * Returns false on allocation failure
+ */
+bool diff_lines(const DiffLines *a, const DiffLines *b, DiffResult *out);
+
+/* Print hunks as unified diff hunks ("@@ -a,n +b,m @@"), with up to
+ * context unchanged lines around each change; headers are the caller's
+ */
+void diff_print_unified(FILE *f, const DiffLines *a, const DiffLines *b,
+                        const DiffResult *res, size_t context);
+
+/* Release line and hunk arrays */
+void diff_free_lines(DiffLines *dl);
+void diff_free(DiffResult *res);
+
+#endif /* RYFT_DIFF_H */
@@ -0,0 +1,447 @@
+/*
+ * exec.c - Executable blocks (exec=) and their result cache
+ *
+ * An exec= block's body is fed to its interpreter on stdin and the
+ * interpreter's stdout becomes the block's contribution to its output.
+ * Results are cached as <doc>.ryftcache/<key>, where the key hashes the
+ * interpreter, the body (after variable expansion) and the path and
+ * contents of every declared input, so a rebuild with nothing changed
+ * starts no processes at all. Misses run as child processes, up to -j
+ * at a time; outputs hold back later writes until results they are
+ * waiting for arrive, so block order is kept. An interpreter writes to
+ * an anonymous temp file; the cache itself is read and written through
+ * the document's I/O backend.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "exec.h"
+#include "io.h"
+#include "log.h"
+#include "sink.h"
+#include "types.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef enum {
+    EXEC_QUEUED,               /* waiting for a free slot */
+    EXEC_RUNNING,
+    EXEC_DONE,                 /* result is in the cache */
+    EXEC_FAILED,               /* reported, contributes nothing */
+    EXEC_SKIPPED               /* not run (dry-run), contributes nothing */
+} ExecState;
+
+struct ExecJob {
+    ExecRunner *runner;
+    uint64_t key;
+    ExecState state;
+    int block;                 /* first block that asked for this result */
+    char interp[MAX_LANG];
+    char *script;              /* interpreter's stdin, freed once started */
+    size_t script_len;
+    pid_t pid;
+    FILE *result;              /* interpreter's stdout while it runs */
+    char path[MAX_PATH];       /* cached result */
+};
+
+struct ExecRunner {
+    RyftIO *io;                /* backend the cache and inputs live on */
+    char cache_dir[MAX_PATH];
+    char doc_dir[MAX_PATH];    /* inputs= paths are relative to it */
+    ExecJob **jobs;            /* in submission order */
+    int count;
+    int cap;
+    int running;
+    int max_running;
+    bool dry_run;
+    bool verbose;
+    bool failed;
+};
+
+/* Runner for the exec= blocks of one document */
+ExecRunner *exec_new(RyftIO *io, const char *filepath, int jobs, bool dry_run, bool verbose)
+{
+    ExecRunner *r = calloc(1, sizeof(ExecRunner));
+    if (!r) {
+        return NULL;
+    }
+    r->io = io;
+    snprintf(r->cache_dir, sizeof(r->cache_dir), "%s%s", filepath, EXEC_CACHE_SUFFIX);
+    get_directory(filepath, r->doc_dir, sizeof(r->doc_dir));
+    r->max_running = jobs > 1 ? jobs : 1;
+    r->dry_run = dry_run;
+    r->verbose = verbose;
+    return r;
+}
+
+/* Fold one more hash into a key */
+static uint64_t mix(uint64_t key, uint64_t h)
+{
+    uint64_t pair[2] = { key, h };
+    return hash_bytes(pair, sizeof(pair));
+}
+
+/* Key of a block: interpreter, body, and each input's path (as written)
+ * and contents; inputs are read relative to the document's directory
+ * Returns false if an input cannot be read (already reported)
+ */
+static bool job_key(ExecRunner *r, const char *interp, const char *inputs,
+                    const char *script, size_t len, int block, uint64_t *key)
+{
+    uint64_t k = mix(hash_bytes(interp, strlen(interp)), hash_bytes(script, len));
+
+    for (const char *p = inputs; *p; ) {
+        size_t n = strcspn(p, ",");
+        char name[MAX_PATH];
+        if (n > 0 && n < sizeof(name)) {
+            memcpy(name, p, n);
+            name[n] = '\0';
+
+            char path[MAX_PATH * 2];
+            if (name[0] == '/' || !r->doc_dir[0]) {
+                snprintf(path, sizeof(path), "%s", name);
+            } else {
+                snprintf(path, sizeof(path), "%s/%s", r->doc_dir, name);
+            }
+
+            const char *data;
+            size_t size;
+            if (!io_load(r->io, path, &data, &size)) {
+                log_error("error: cannot read input '%s' of exec= block %d\n", path, block);
+                return false;
+            }
+            k = mix(mix(k, hash_bytes(name, n)), hash_bytes(data, size));
+            io_unload(r->io, data, size);
+        }
+        p += n + (p[n] == ',');
+    }
+
+    *key = k;
+    return true;
+}
+
+/* Start an interpreter with the script on stdin and stdout to a temp file
+ * Returns false if it could not be started (already reported)
+ */
+static bool start_job(ExecJob *job)
+{
+    ExecRunner *r = job->runner;
+
+    if (!ensure_directory(r->io, r->cache_dir)) {
+        return false;
+    }
+
+    FILE *in = tmpfile();
+    if (!in || fwrite(job->script, 1, job->script_len, in) != job->script_len ||
+        fseek(in, 0, SEEK_SET) != 0) {
+        log_error("error: cannot stage exec= block %d: %s\n", job->block, strerror(errno));
+        if (in) fclose(in);
+        return false;
+    }
+
+    FILE *out = tmpfile();
+    if (!out) {
+        log_error("error: cannot stage exec= block %d: %s\n", job->block, strerror(errno));
+        fclose(in);
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        char *argv[] = { job->interp, NULL };
+        if (dup2(fileno(in), STDIN_FILENO) >= 0 && dup2(fileno(out), STDOUT_FILENO) >= 0) {
+            execvp(job->interp, argv);
+        }
+        fprintf(stderr, "error: cannot run '%s': %s\n", job->interp, strerror(errno));
+        _exit(127);
+    }
+
+    int saved = errno;
+    fclose(in);
+    if (pid < 0) {
+        log_error("error: cannot run exec= block %d: %s\n", job->block, strerror(saved));
+        fclose(out);
+        return false;
+    }
+
+    free(job->script);
+    job->script = NULL;
+    job->pid = pid;
+    job->result = out;
+    job->state = EXEC_RUNNING;
+    r->running++;
+    return true;
+}
+
+/* Copy an interpreter's output into the cache, via a temp name so a
+ * partly written result is never taken for a cached one
+ * Returns false if it could not be stored
+ */
+static bool store_result(ExecJob *job)
+{
+    RyftIO *io = job->runner->io;
+    char tmp[MAX_PATH + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", job->path);
+
+    struct stat st;
+    int fd = fileno(job->result);
+    if (fstat(fd, &st) != 0) {
+        return false;
+    }
+    RyftFile *f = io->open(io, tmp, true);
+    if (!f) {
+        return false;
+    }
+    bool ok = io_append_fd(io, f, fd, (size_t)st.st_size);
+    if (io->close(io, f) != 0) {
+        ok = false;
+    }
+    return ok && io->rename(io, tmp, job->path) == 0;
+}
+
+/* Record how an interpreter exited */
+static void finish_job(ExecJob *job, int status)
+{
+    ExecRunner *r = job->runner;
+    r->running--;
+
+    bool stored = WIFEXITED(status) && WEXITSTATUS(status) == 0 && store_result(job);
+    int saved = errno;
+    fclose(job->result);
+    job->result = NULL;
+
+    if (stored) {
+        job->state = EXEC_DONE;
+        return;
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        log_error("error: cannot store result of exec= block %d: %s\n",
+                  job->block, strerror(saved));
+    } else if (WIFEXITED(status)) {
+        log_error("error: exec= block %d failed (%s exited with status %d)\n",
+                  job->block, job->interp, WEXITSTATUS(status));
+    } else {
+        log_error("error: exec= block %d failed (%s killed by signal %d)\n",
+                  job->block, job->interp, WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+    }
+    job->state = EXEC_FAILED;
+    r->failed = true;
+}
+
+/* Ask for the output of running script through interp */
+ExecJob *exec_submit(ExecRunner *r, const char *interp, const char *inputs,
+                     const char *script, size_t len, int block)
+{
+    uint64_t key;
+    if (!job_key(r, interp, inputs, script, len, block, &key)) {
+        r->failed = true;
+        return NULL;
+    }
+
+    for (int i = 0; i < r->count; i++) {
+        if (r->jobs[i]->key == key) {
+            return r->jobs[i];
+        }
+    }
+
+    if (r->count == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 16;
+        ExecJob **grown = realloc(r->jobs, (size_t)cap * sizeof(ExecJob *));
+        if (!grown) {
+            log_error("error: out of memory\n");
+            return NULL;
+        }
+        r->jobs = grown;
+        r->cap = cap;
+    }
+
+    ExecJob *job = calloc(1, sizeof(ExecJob));
+    if (!job) {
+        log_error("error: out of memory\n");
+        return NULL;
+    }
+    int n = snprintf(job->path, sizeof(job->path), "%s/%016llx", r->cache_dir,
+                     (unsigned long long)key);
+    if (n < 0 || (size_t)n >= sizeof(job->path)) {
+        log_error("error: cache path too long for '%s'\n", r->cache_dir);
+        free(job);
+        r->failed = true;
+        return NULL;
+    }
+    job->runner = r;
+    job->key = key;
+    job->block = block;
+    snprintf(job->interp, sizeof(job->interp), "%s", interp);
+    r->jobs[r->count++] = job;
+
+    const char *status;
+    if (io_exists(r->io, job->path)) {
+        job->state = EXEC_DONE;
+        status = "cached";
+    } else if (r->dry_run) {
+        job->state = EXEC_SKIPPED;
+        status = "would run";
+    } else {
+        job->script = malloc(len ? len : 1);
+        if (!job->script) {
+            log_error("error: out of memory\n");
+            job->state = EXEC_FAILED;
+            r->failed = true;
+            return NULL;
+        }
+        memcpy(job->script, script, len);
+        job->script_len = len;
+        job->state = EXEC_QUEUED;
+        status = "running";
+    }
+
+    if (r->verbose) {
+        log_debug("  [block %d] exec=%s (%s)\n", block, interp, status);
+    }
+    exec_poll(r);
+    return job;
+}
+
+/* Collect finished interpreters and start queued ones, without blocking */
+void exec_poll(ExecRunner *r)
+{
+    for (int i = 0; i < r->count && r->running > 0; i++) {
+        ExecJob *job = r->jobs[i];
+        int status;
+        if (job->state == EXEC_RUNNING && waitpid(job->pid, &status, WNOHANG) == job->pid) {
+            finish_job(job, status);
+        }
+    }
+
+    for (int i = 0; i < r->count && r->running < r->max_running; i++) {
+        ExecJob *job = r->jobs[i];
+        if (job->state == EXEC_QUEUED && !start_job(job)) {
+            free(job->script);
+            job->script = NULL;
+            job->state = EXEC_FAILED;
+            r->failed = true;
+        }
+    }
+}
+
+/* Result of a job is known */
+static bool settled(const ExecJob *job)
+{
+    return job->state != EXEC_QUEUED && job->state != EXEC_RUNNING;
+}
+
+/* True once a job's result is known */
+bool exec_ready(ExecJob *job)
+{
+    if (!settled(job)) {
+        exec_poll(job->runner);
+    }
+    return settled(job);
+}
+
+/* Hand a reaped child to its job, or to its pipe sink */
+static void reaped(ExecRunner *r, pid_t pid, int status)
+{
+    for (int i = 0; i < r->count; i++) {
+        ExecJob *job = r->jobs[i];
+        if (job->state == EXEC_RUNNING && job->pid == pid) {
+            finish_job(job, status);
+            return;
+        }
+    }
+    sink_reaped(pid, status);
+}
+
+/* Wait until a job's result is known, keeping every slot busy meanwhile:
+ * block until any child exits, then start queued jobs in freed slots
+ */
+void exec_wait(ExecJob *job)
+{
+    ExecRunner *r = job->runner;
+
+    exec_poll(r);
+    while (!settled(job)) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* No children left: whatever still runs can never finish */
+            log_error("error: lost exec= block %d: %s\n", job->block, strerror(errno));
+            for (int i = 0; i < r->count; i++) {
+                if (r->jobs[i]->state == EXEC_RUNNING) {
+                    r->running--;
+                    fclose(r->jobs[i]->result);
+                    r->jobs[i]->result = NULL;
+                    r->jobs[i]->state = EXEC_FAILED;
+                }
+            }
+            r->failed = true;
+        } else {
+            reaped(r, pid, status);
+        }
+        exec_poll(r);
+    }
+}
+
+/* True if a job was not run (dry-run, --check) */
+bool exec_skipped(const ExecJob *job)
+{
+    return job->state == EXEC_SKIPPED;
+}
+
+/* Load a finished job's output */
+bool exec_result(ExecJob *job, const char **data, size_t *len)
+{
+    if (job->state != EXEC_DONE) {
+        return false;
+    }
+    if (!io_load(job->runner->io, job->path, data, len)) {
+        log_error("error: cannot read result of exec= block %d\n", job->block);
+        job->state = EXEC_FAILED;
+        job->runner->failed = true;
+        return false;
+    }
+    return true;
+}
+
+/* Release a result loaded with exec_result() */
+void exec_release(ExecJob *job, const char *data, size_t len)
+{
+    io_unload(job->runner->io, data, len);
+}
+
+/* Wait for every job */
+bool exec_finish(ExecRunner *r)
+{
+    for (int i = 0; i < r->count; i++) {
+        exec_wait(r->jobs[i]);
+    }
+    return !r->failed;
+}
+
+/* Release a runner */
+void exec_free(ExecRunner *r)
+{
+    if (!r) {
+        return;
+    }
+    exec_finish(r);
+    for (int i = 0; i < r->count; i++) {
+        free(r->jobs[i]->script);
+        free(r->jobs[i]);
+    }
+    free(r->jobs);
+    free(r);
+}
@@ -0,0 +1,63 @@
+/*
+ * exec.h - Executable blocks (exec=) and their result cache
+ */
+
+#ifndef RYFT_EXEC_H
+#define RYFT_EXEC_H
+
+#include "include/ryft.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define EXEC_CACHE_SUFFIX ".ryftcache"
+
+typedef struct ExecRunner ExecRunner;
+typedef struct ExecJob ExecJob;
+
+/* Runner for the exec= blocks of one document, running up to jobs
+ * interpreters at once; results are cached in <filepath>.ryftcache/ on io
+ * Returns NULL on allocation failure
+ */
+ExecRunner *exec_new(RyftIO *io, const char *filepath, int jobs, bool dry_run, bool verbose);
+
+/* Ask for the output of running script through interp; inputs is a
+ * comma-separated list of files the result depends on (may be empty).
+ * A cached result is used as-is; otherwise the block is queued and
+ * started as soon as a slot is free. Identical requests share a job.
+ * Returns NULL on error (already reported)
+ */
+ExecJob *exec_submit(ExecRunner *r, const char *interp, const char *inputs,
+                     const char *script, size_t len, int block);
+
+/* Collect finished interpreters and start queued ones, without blocking */
+void exec_poll(ExecRunner *r);
+
+/* True once a job's result is known (written, failed or not run);
+ * collects finished interpreters first
+ */
+bool exec_ready(ExecJob *job);
+
+/* Wait until a job's result is known */
+void exec_wait(ExecJob *job);
+
+/* True if a job was not run because the runner writes nothing */
+bool exec_skipped(const ExecJob *job);
+
+/* Load a finished job's output; release with exec_release()
+ * Returns false if the job produced nothing to insert
+ */
+bool exec_result(ExecJob *job, const char **data, size_t *len);
+
+/* Release a result loaded with exec_result() */
+void exec_release(ExecJob *job, const char *data, size_t len);
+
+/* Wait for every job
+ * Returns false if any block failed
+ */
+bool exec_finish(ExecRunner *r);
+
+/* Release a runner (waits for jobs still running) */
+void exec_free(ExecRunner *r);
+
+#endif /* RYFT_EXEC_H */
@@ -0,0 +1,279 @@
+/*
+ * fingerprint.c - Generated-file header lines (--fingerprint)
+ *
+ * A fingerprinted output carries one comment line, in its language's
+ * comment syntax, naming the document and blocks it came from and a
+ * 64-bit hash of the rest of the file:
+ *
+ *   // generated by ryft from api.md blocks 3-5,9 fingerprint 9c1e03b27f5d4a60
+ *
+ * The line is the first of the file, or the second when the first is a
+ * #! or <? line that has to stay first. Whether an output is current is
+ * decided from that line alone, and a file whose contents no longer hash
+ * to the value in its header was edited after ryft wrote it.
+ *
+ * The hash works on little-endian 8-byte words, so headers mean the same
+ * on every machine, and it is streamed: bodies are hashed as they are
+ * written, whatever the pieces.
+ */
+
+#include "fingerprint.h"
+#include "types.h"
+#include "util.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MARK " generated by ryft from "
+#define HASH_KEY " fingerprint "
+#define BLOCK_LIST 512         /* longest block list; longer ones end in "..." */
+
+/* Language list entries (--fingerprint c,python) match by extension, so
+ * aliases like py and python are the same language
+ */
+bool fingerprint_wanted(const char *langs, const char *lang)
+{
+    const char *open, *close;
+    if (!langs || !lang || !lang[0] || !lang_comment(lang, &open, &close)) {
+        return false;
+    }
+    if (strcmp(langs, "all") == 0) {
+        return true;
+    }
+
+    char ext[MAX_LANG + 1];
+    snprintf(ext, sizeof(ext), "%s", lang_to_ext(lang));
+    for (const char *p = langs; *p; ) {
+        size_t n = strcspn(p, ",");
+        char want[MAX_LANG];
+        snprintf(want, sizeof(want), "%.*s", (int)n, p);
+        if (strcmp(lang_to_ext(str_trim(want)), ext) == 0) {
+            return true;
+        }
+        p += n + (p[n] == ',');
+    }
+    return false;
+}
+
+static uint64_t load_le(const unsigned char *p)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t w;
+    memcpy(&w, p, 8);
+    return w;
+#else
+    uint64_t w = 0;
+    for (int i = 7; i >= 0; i--) {
+        w = w << 8 | p[i];
+    }
+    return w;
+#endif
+}
+
+static uint64_t mix_word(uint64_t h, uint64_t w)
+{
+    h = (h ^ (w * 0xc4ceb9fe1a85ec53ULL)) * 0x100000001b3ULL;
+    return h ^ (h >> 29);
+}
+
+/* Start hashing an empty body */
+void fingerprint_begin(Fingerprint *fp)
+{
+    memset(fp, 0, sizeof(*fp));
+    fp->hash = 0x9e3779b97f4a7c15ULL;
+}
+
+/* Add body bytes */
+void fingerprint_update(Fingerprint *fp, const char *p, size_t len)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    size_t fill = fp->size % 8;
+
+    if (len == 0) {
+        return;
+    }
+    for (size_t i = 0; i < len && fp->size + i < 2; i++) {
+        fp->lead[fp->size + i] = p[i];
+    }
+    if (!fp->first_line) {
+        const char *nl = memchr(p, '\n', len);
+        if (nl) {
+            fp->first_line = fp->size + (size_t)(nl - p) + 1;
+        }
+    }
+    fp->size += len;
+
+    /* Complete the word left over from the previous piece */
+    if (fill > 0) {
+        size_t n = 8 - fill < len ? 8 - fill : len;
+        memcpy(fp->tail + fill, u, n);
+        u += n;
+        len -= n;
+        if (fill + n < 8) {
+            return;
+        }
+        fp->hash = mix_word(fp->hash, load_le(fp->tail));
+    }
+    while (len >= 8) {
+        fp->hash = mix_word(fp->hash, load_le(u));
+        u += 8;
+        len -= 8;
+    }
+    memcpy(fp->tail, u, len);
+}
+
+/* Final hash: the partial last word and the length, then a 64-bit avalanche */
+static uint64_t fingerprint_value(const Fingerprint *fp)
+{
+    unsigned char last[8] = {0};
+    memcpy(last, fp->tail, fp->size % 8);
+
+    uint64_t h = mix_word(fp->hash, load_le(last));
+    h ^= (uint64_t)fp->size * 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Offset in the body the header line goes at */
+size_t fingerprint_offset(const Fingerprint *fp)
+{
+    bool declared = fp->size >= 2 && ((fp->lead[0] == '#' && fp->lead[1] == '!') ||
+                                      (fp->lead[0] == '<' && fp->lead[1] == '?'));
+    return declared ? fp->first_line : 0;
+}
+
+/* Block numbers as ranges: 3-5,9 */
+static void format_blocks(const int *blocks, int count, char *out, size_t out_size)
+{
+    size_t len = 0;
+    out[0] = '\0';
+
+    for (int i = 0; i < count; ) {
+        int j = i;
+        while (j + 1 < count && blocks[j + 1] == blocks[j] + 1) j++;
+
+        if (out_size - len < 32) {
+            snprintf(out + len, out_size - len, "...");
+            return;
+        }
+        const char *sep = i > 0 ? "," : "";
+        if (j > i) {
+            len += (size_t)snprintf(out + len, out_size - len, "%s%d-%d", sep, blocks[i], blocks[j]);
+        } else {
+            len += (size_t)snprintf(out + len, out_size - len, "%s%d", sep, blocks[i]);
+        }
+        i = j + 1;
+    }
+}
+
+/* Header line (with its newline) for a finished body */
+bool fingerprint_header(const Fingerprint *fp, const char *lang, const char *source,
+                        const int *blocks, int count, char *out, size_t out_size)
+{
+    const char *open, *close;
+    if (!lang_comment(lang, &open, &close)) {
+        return false;
+    }
+
+    char list[BLOCK_LIST];
+    format_blocks(blocks, count, list, sizeof(list));
+    snprintf(out, out_size, "%s" MARK "%s%s%s" HASH_KEY "%016" PRIx64 "%s\n", open, source,
+             count > 0 ? " blocks " : "", list, fingerprint_value(fp), close);
+    return true;
+}
+
+/* First occurrence of s in p[0..len), NULL if none */
+static const char *find(const char *p, size_t len, const char *s)
+{
+    size_t n = strlen(s);
+    for (size_t i = 0; i + n <= len; i++) {
+        if (memcmp(p + i, s, n) == 0) {
+            return p + i;
+        }
+    }
+    return NULL;
+}
+
+/* Parse the hash recorded in a header line
+ * Returns false if the line is not a header
+ */
+static bool recorded_hash(const char *line, size_t len, uint64_t *hash)
+{
+    const char *mark = find(line, len, MARK);
+    if (!mark) {
+        return false;
+    }
+    const char *key = NULL;
+    const char *end = line + len;
+    for (const char *k = mark; (k = find(k, (size_t)(end - k), HASH_KEY)); k++) {
+        key = k;  /* the last one: the document name may contain the key */
+    }
+    if (!key || end - key < (ptrdiff_t)(sizeof(HASH_KEY) - 1 + 16)) {
+        return false;
+    }
+
+    uint64_t h = 0;
+    const char *hex = key + sizeof(HASH_KEY) - 1;
+    for (int i = 0; i < 16; i++) {
+        char c = hex[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (digit < 0) {
+            return false;
+        }
+        h = h << 4 | (uint64_t)digit;
+    }
+    *hash = h;
+    return true;
+}
+
+/* Find the header line in the first two lines of a file */
+bool fingerprint_find(const char *data, size_t len, size_t *start, size_t *end)
+{
+    size_t pos = 0;
+    uint64_t hash;
+
+    for (int line = 0; line < 2 && pos < len; line++) {
+        const char *nl = memchr(data + pos, '\n', len - pos);
+        size_t stop = nl ? (size_t)(nl - data) + 1 : len;
+        if (stop - pos <= FINGERPRINT_MAX && recorded_hash(data + pos, stop - pos, &hash)) {
+            *start = pos;
+            *end = stop;
+            return true;
+        }
+        pos = stop;
+    }
+    return false;
+}
+
+/* True if a file's contents hash to neither its header's value nor fp's */
+bool fingerprint_edited(const char *data, size_t len, const Fingerprint *fp)
+{
+    size_t start, end;
+    uint64_t recorded;
+    if (!fingerprint_find(data, len, &start, &end) ||
+        !recorded_hash(data + start, end - start, &recorded)) {
+        return false;
+    }
+
+    Fingerprint actual;
+    fingerprint_begin(&actual);
+    fingerprint_update(&actual, data, start);
+    fingerprint_update(&actual, data + end, len - end);
+    uint64_t hash = fingerprint_value(&actual);
+    return hash != recorded && hash != fingerprint_value(fp);
+}
+
+/* Remove the header line from a file's contents, if it has one */
+void fingerprint_strip(char *data, size_t *len)
+{
+    size_t start, end;
+    if (fingerprint_find(data, *len, &start, &end)) {
+        memmove(data + start, data + end, *len - end);
+        *len -= end - start;
+    }
+}
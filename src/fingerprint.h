@@ -0,0 +1,61 @@
+/*
+ * fingerprint.h - Generated-file header lines (--fingerprint)
+ */
+
+#ifndef RYFT_FINGERPRINT_H
+#define RYFT_FINGERPRINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FINGERPRINT_MAX 2048     /* longest header line */
+#define FINGERPRINT_PREFIX 4096  /* bytes read to find the header of a file */
+
+/* Running hash of an output body, and where its header goes */
+typedef struct {
+    uint64_t hash;             /* full 8-byte words so far */
+    unsigned char tail[8];     /* bytes not yet in a full word */
+    size_t size;               /* body bytes so far */
+    size_t first_line;         /* length of the first line with its '\n', 0 until seen */
+    char lead[2];              /* first two bytes of the body */
+} Fingerprint;
+
+/* True if langs (comma-separated, or "all") asks for headers on outputs
+ * in lang, and lang has a comment syntax to write them in
+ */
+bool fingerprint_wanted(const char *langs, const char *lang);
+
+/* Start hashing an empty body */
+void fingerprint_begin(Fingerprint *fp);
+
+/* Add body bytes */
+void fingerprint_update(Fingerprint *fp, const char *p, size_t len);
+
+/* Offset in the body the header line goes at: after a #! or <? first
+ * line, which must stay first, otherwise 0
+ */
+size_t fingerprint_offset(const Fingerprint *fp);
+
+/* Header line (with its newline) for a finished body, naming the source
+ * document and the blocks written to it
+ * Returns false if lang has no comment syntax
+ */
+bool fingerprint_header(const Fingerprint *fp, const char *lang, const char *source,
+                        const int *blocks, int count, char *out, size_t out_size);
+
+/* Find the header line in the first two lines of a file
+ * Sets [*start, *end) to it, newline included; returns false if none
+ */
+bool fingerprint_find(const char *data, size_t len, size_t *start, size_t *end);
+
+/* True if a file has a header whose hash matches neither the rest of the
+ * file nor fp, the contents about to replace it: it was edited after ryft
+ * wrote it, and the edits are not in the document (--untangle)
+ */
+bool fingerprint_edited(const char *data, size_t len, const Fingerprint *fp);
+
+/* Remove the header line from a file's contents, if it has one */
+void fingerprint_strip(char *data, size_t *len);
+
+#endif /* RYFT_FINGERPRINT_H */
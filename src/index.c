@@ -0,0 +1,253 @@
+/*
+ * index.c - Sidecar block index for selective extraction
+ *
+ * The index records where every block body lives in a
+ * document and which target it resolves to, so a run that only needs a
+ * few outputs can seek to those ranges instead of scanning everything.
+ *
+ * Format (text, one record per line):
+ *   ryft-index 5
+ *   source <size> <mtime_sec> <mtime_nsec> <inode>
+ *   blocks <total> <display> <unclosed>
+ *   T <target path or attribute value>
+ *   E <kind> <block> <offset> <length> <closing> <target> <cond> <exec> <inputs> <transform>
+ *     <lang|->
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "index.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define INDEX_VERSION 7
+
+/* Get sidecar index path for a document */
+void index_path(const char *filepath, char *out, size_t out_size)
+{
+    snprintf(out, out_size, "%s%s", filepath, INDEX_SUFFIX);
+}
+
+/* Record the document's current identity (call before scanning it) */
+bool index_stamp(const char *filepath, BlockIndex *idx)
+{
+    struct stat st;
+    if (stat(filepath, &st) != 0) {
+        return false;
+    }
+
+    idx->size = (long long)st.st_size;
+    idx->mtime_sec = (long long)st.st_mtim.tv_sec;
+    idx->mtime_nsec = (long long)st.st_mtim.tv_nsec;
+    idx->ino = (long long)st.st_ino;
+    return true;
+}
+
+/* Find or add a string (target path or attribute value) */
+static int add_string(BlockIndex *idx, const char *str)
+{
+    for (size_t i = 0; i < idx->string_count; i++) {
+        if (strcmp(idx->strings[i], str) == 0) {
+            return (int)i;
+        }
+    }
+
+    if (idx->string_count == idx->string_cap) {
+        size_t cap = idx->string_cap ? idx->string_cap * 2 : 8;
+        void *p = realloc(idx->strings, cap * sizeof(*idx->strings));
+        if (!p) return -1;
+        idx->strings = p;
+        idx->string_cap = cap;
+    }
+
+    snprintf(idx->strings[idx->string_count], MAX_PATH, "%s", str);
+    return (int)idx->string_count++;
+}
+
+/* Reference an optional attribute value, -1 if empty */
+static bool add_attr(BlockIndex *idx, const char *value, int *ref)
+{
+    *ref = -1;
+    if (value[0]) {
+        *ref = add_string(idx, value);
+    }
+    return !value[0] || *ref >= 0;
+}
+
+/* Append an entry (length and closing fence are filled in when the block ends) */
+bool index_add(BlockIndex *idx, IndexEntryKind kind, int block, long offset,
+               const char *lang, const char *target, const FenceInfo *fence)
+{
+    if (idx->count == idx->cap) {
+        size_t cap = idx->cap ? idx->cap * 2 : 64;
+        void *p = realloc(idx->entries, cap * sizeof(IndexEntry));
+        if (!p) return false;
+        idx->entries = p;
+        idx->cap = cap;
+    }
+
+    IndexEntry *e = &idx->entries[idx->count];
+    memset(e, 0, sizeof(*e));
+    e->kind = kind;
+    e->block = block;
+    e->offset = offset;
+    e->target = -1;
+    e->cond = -1;
+    e->exec = -1;
+    e->inputs = -1;
+    e->transform = -1;
+    e->place = -1;
+    e->vars = -1;
+    if (lang) {
+        snprintf(e->lang, sizeof(e->lang), "%s", lang);
+    }
+    if (target) {
+        e->target = add_string(idx, target);
+        if (e->target < 0) return false;
+    }
+    if (fence && (!add_attr(idx, fence->cond, &e->cond) ||
+                  !add_attr(idx, fence->exec, &e->exec) ||
+                  !add_attr(idx, fence->inputs, &e->inputs) ||
+                  !add_attr(idx, fence->transform, &e->transform) ||
+                  !add_attr(idx, fence->place, &e->place) ||
+                  !add_attr(idx, fence->vars, &e->vars))) {
+        return false;
+    }
+
+    idx->count++;
+    return true;
+}
+
+/* Load sidecar index for a document */
+bool index_load(const char *filepath, BlockIndex *idx)
+{
+    memset(idx, 0, sizeof(*idx));
+
+    BlockIndex current = {0};
+    if (!index_stamp(filepath, &current)) {
+        return false;
+    }
+
+    char path[MAX_PATH];
+    index_path(filepath, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+
+    char line[MAX_LINE];
+    int version = 0;
+    int unclosed = 0;
+    bool ok = fgets(line, sizeof(line), f) && sscanf(line, "ryft-index %d", &version) == 1 &&
+              version == INDEX_VERSION &&
+              fgets(line, sizeof(line), f) &&
+              sscanf(line, "source %lld %lld %lld %lld", &idx->size, &idx->mtime_sec,
+                     &idx->mtime_nsec, &idx->ino) == 4 &&
+              fgets(line, sizeof(line), f) &&
+              sscanf(line, "blocks %d %d %d", &idx->total_blocks, &idx->display_blocks,
+                     &unclosed) == 3;
+
+    /* Stale if the document changed since the index was written */
+    if (ok && (idx->size != current.size || idx->mtime_sec != current.mtime_sec ||
+               idx->mtime_nsec != current.mtime_nsec || idx->ino != current.ino)) {
+        ok = false;
+    }
+    idx->unclosed = unclosed != 0;
+
+    while (ok && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+
+        if (line[0] == 'T' && line[1] == ' ') {
+            ok = add_string(idx, line + 2) >= 0;
+        } else if (line[0] == 'E' && line[1] == ' ') {
+            int kind, block, closing, target, cond, exec, inputs, transform, place, vars;
+            long offset, length;
+            char lang[MAX_LANG];
+            int strings = (int)idx->string_count;
+            if (sscanf(line + 2, "%d %d %ld %ld %d %d %d %d %d %d %d %d %63s", &kind, &block,
+                       &offset, &length, &closing, &target, &cond, &exec, &inputs, &transform,
+                       &place, &vars, lang) != 13 ||
+                kind < ENTRY_CONFIG || kind > ENTRY_DISPLAY ||
+                target < -1 || target >= strings || cond < -1 || cond >= strings ||
+                exec < -1 || exec >= strings || inputs < -1 || inputs >= strings ||
+                transform < -1 || transform >= strings || place < -1 || place >= strings ||
+                vars < -1 || vars >= strings ||
+                !index_add(idx, (IndexEntryKind)kind, block, offset,
+                           strcmp(lang, "-") == 0 ? NULL : lang, NULL, NULL)) {
+                ok = false;
+                break;
+            }
+            IndexEntry *e = &idx->entries[idx->count - 1];
+            e->length = length;
+            e->closing_backticks = closing;
+            e->target = target;
+            e->cond = cond;
+            e->exec = exec;
+            e->inputs = inputs;
+            e->transform = transform;
+            e->place = place;
+            e->vars = vars;
+        } else {
+            ok = false;
+        }
+    }
+
+    fclose(f);
+    if (!ok) {
+        index_free(idx);
+    }
+    return ok;
+}
+
+/* Write sidecar index */
+bool index_save(const char *filepath, BlockIndex *idx)
+{
+    /* Write to a temp file and rename so readers never see a partial index */
+    char path[MAX_PATH];
+    char tmp[MAX_PATH + 8];
+    index_path(filepath, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        log_warn("warning: cannot write index '%s'\n", tmp);
+        return false;
+    }
+
+    fprintf(f, "ryft-index %d\n", INDEX_VERSION);
+    fprintf(f, "source %lld %lld %lld %lld\n", idx->size, idx->mtime_sec,
+            idx->mtime_nsec, idx->ino);
+    fprintf(f, "blocks %d %d %d\n", idx->total_blocks, idx->display_blocks,
+            idx->unclosed ? 1 : 0);
+
+    for (size_t i = 0; i < idx->string_count; i++) {
+        fprintf(f, "T %s\n", idx->strings[i]);
+    }
+    for (size_t i = 0; i < idx->count; i++) {
+        IndexEntry *e = &idx->entries[i];
+        fprintf(f, "E %d %d %ld %ld %d %d %d %d %d %d %d %d %s\n", (int)e->kind, e->block,
+                e->offset, e->length, e->closing_backticks, e->target, e->cond, e->exec,
+                e->inputs, e->transform, e->place, e->vars, e->lang[0] ? e->lang : "-");
+    }
+
+    bool ok = !ferror(f);
+    if (fclose(f) != 0) ok = false;
+    if (ok && rename(tmp, path) != 0) ok = false;
+    if (!ok) {
+        log_warn("warning: cannot write index '%s'\n", path);
+        remove(tmp);
+    }
+    return ok;
+}
+
+/* Release index memory */
+void index_free(BlockIndex *idx)
+{
+    free(idx->entries);
+    free(idx->strings);
+    memset(idx, 0, sizeof(*idx));
+}
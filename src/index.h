@@ -0,0 +1,86 @@
+/*
+ * index.h - Sidecar block index for selective extraction
+ */
+
+#ifndef RYFT_INDEX_H
+#define RYFT_INDEX_H
+
+#include "types.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define INDEX_SUFFIX ".ryftidx"
+
+typedef enum {
+    ENTRY_CONFIG,              /* ryft.config block */
+    ENTRY_NAMED,               /* block with explicit filename */
+    ENTRY_FALLBACK,            /* no filename, target derived from document name */
+    ENTRY_CONFIG_FILENAME,     /* no filename, target from config 'filename' */
+    ENTRY_DISPLAY              /* 4+ backticks, not extracted */
+} IndexEntryKind;
+
+typedef struct {
+    IndexEntryKind kind;
+    int block;                 /* 1-based block number */
+    long offset;               /* byte offset of the body in the document */
+    long length;               /* body length in bytes */
+    int closing_backticks;     /* closing fence backticks, 0 if unclosed */
+    int target;                /* index into strings, -1 if none */
+    int cond;                  /* if= expression, index into strings, -1 if none */
+    int exec;                  /* exec= interpreter, index into strings, -1 if none */
+    int inputs;                /* inputs= list, index into strings, -1 if none */
+    int transform;             /* transform attributes, index into strings, -1 if none */
+    int place;                 /* placement attributes, index into strings, -1 if none */
+    int vars;                  /* vars= value, index into strings, -1 if none */
+    char lang[MAX_LANG];
+} IndexEntry;
+
+/* Blocks without a filename record their fallback target; whether they
+ * use it or continue the current target is decided when replaying, as
+ * that depends on which earlier blocks were included. */
+
+typedef struct {
+    /* Identity of the indexed document */
+    long long size;
+    long long mtime_sec;
+    long long mtime_nsec;
+    long long ino;
+
+    int total_blocks;          /* all code blocks found */
+    int display_blocks;        /* blocks skipped (4+ backticks) */
+    bool unclosed;             /* last block runs to end of file */
+
+    IndexEntry *entries;       /* all blocks in document order */
+    size_t count;
+    size_t cap;
+
+    char (*strings)[MAX_PATH]; /* distinct target paths and attribute values */
+    size_t string_count;
+    size_t string_cap;
+} BlockIndex;
+
+/* Get sidecar index path for a document */
+void index_path(const char *filepath, char *out, size_t out_size);
+
+/* Append an entry (length and closing fence are filled in when the block ends)
+ * Returns false on allocation failure
+ */
+bool index_add(BlockIndex *idx, IndexEntryKind kind, int block, long offset,
+               const char *lang, const char *target, const FenceInfo *fence);
+
+/* Load sidecar index for a document
+ * Returns false if missing, unreadable, or stale (document changed since)
+ */
+bool index_load(const char *filepath, BlockIndex *idx);
+
+/* Record the document's current identity (call before scanning it) */
+bool index_stamp(const char *filepath, BlockIndex *idx);
+
+/* Write sidecar index */
+bool index_save(const char *filepath, BlockIndex *idx);
+
+/* Release index memory */
+void index_free(BlockIndex *idx);
+
+#endif /* RYFT_INDEX_H */
@@ -0,0 +1,347 @@
+/*
+ * input.c - Document reader with transparent decompression
+ *
+ * Compressed documents are decoded through two fixed windows (compressed
+ * input and decoded output), so memory use stays bounded no matter how
+ * large the document is. Plain documents are read straight into the
+ * output window. All reads go through the I/O backend.
+ */
+
+#include "input.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef RYFT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef RYFT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* Detect compression from the first bytes of a file */
+InputFormat input_detect(const unsigned char *magic, size_t len)
+{
+    if (len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return INPUT_GZIP;
+    }
+    if (len >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 &&
+        magic[2] == 0x2f && magic[3] == 0xfd) {
+        return INPUT_ZSTD;
+    }
+    return INPUT_PLAIN;
+}
+
+/* Open a document, detecting compression by magic bytes */
+bool input_open(InputReader *r, RyftIO *io, const char *path)
+{
+    memset(r, 0, sizeof(*r));
+
+    r->io = io;
+    r->file = io->open(io, path, false);
+    if (!r->file) {
+        log_error("error: cannot open '%s'\n", path);
+        return false;
+    }
+
+    r->out = malloc(INPUT_WINDOW);
+    if (!r->out) {
+        log_error("error: out of memory\n");
+        input_close(r);
+        return false;
+    }
+
+    unsigned char magic[4];
+    size_t n = io->read(io, r->file, magic, sizeof(magic));
+    r->format = input_detect(magic, n);
+
+    if (r->format == INPUT_PLAIN) {
+        /* The magic bytes already read start the first window */
+        memcpy(r->out, magic, n);
+        r->out_len = n;
+        r->eof = n < sizeof(magic);
+        return true;
+    }
+
+    /* The magic bytes already read become the start of the compressed window */
+    r->in = malloc(INPUT_WINDOW);
+    if (!r->in) {
+        log_error("error: out of memory\n");
+        input_close(r);
+        return false;
+    }
+    memcpy(r->in, magic, n);
+    r->in_len = n;
+
+    if (r->format == INPUT_GZIP) {
+#ifdef RYFT_HAVE_ZLIB
+        z_stream *zs = calloc(1, sizeof(z_stream));
+        if (zs && inflateInit2(zs, 15 + 16) == Z_OK) {
+            r->stream = zs;
+            return true;
+        }
+        free(zs);
+        log_error("error: cannot initialize gzip decoder\n");
+#else
+        log_error("error: '%s' is gzip-compressed (rebuild with WITH_ZLIB=1)\n", path);
+#endif
+    } else {
+#ifdef RYFT_HAVE_ZSTD
+        ZSTD_DStream *ds = ZSTD_createDStream();
+        if (ds && !ZSTD_isError(ZSTD_initDStream(ds))) {
+            r->stream = ds;
+            return true;
+        }
+        ZSTD_freeDStream(ds);
+        log_error("error: cannot initialize zstd decoder\n");
+#else
+        log_error("error: '%s' is zstd-compressed (rebuild with WITH_ZSTD=1)\n", path);
+#endif
+    }
+
+    input_close(r);
+    return false;
+}
+
+/* Run the decoder over the compressed window
+ * Returns false on a decoding error
+ */
+static bool decode_step(InputReader *r)
+{
+#ifdef RYFT_HAVE_ZLIB
+    if (r->format == INPUT_GZIP) {
+        z_stream *zs = r->stream;
+        zs->next_in = r->in + r->in_pos;
+        zs->avail_in = (uInt)(r->in_len - r->in_pos);
+        zs->next_out = (Bytef *)r->out;
+        zs->avail_out = INPUT_WINDOW;
+
+        int ret = inflate(zs, Z_NO_FLUSH);
+        r->in_pos = r->in_len - zs->avail_in;
+        r->out_len = INPUT_WINDOW - zs->avail_out;
+
+        if (ret == Z_STREAM_END) {
+            r->at_boundary = true;
+            inflateReset(zs);  /* Concatenated members may follow */
+            return true;
+        }
+        r->at_boundary = false;
+        return ret == Z_OK || ret == Z_BUF_ERROR;
+    }
+#endif
+#ifdef RYFT_HAVE_ZSTD
+    if (r->format == INPUT_ZSTD) {
+        ZSTD_inBuffer in = { r->in, r->in_len, r->in_pos };
+        ZSTD_outBuffer out = { r->out, INPUT_WINDOW, 0 };
+
+        size_t ret = ZSTD_decompressStream(r->stream, &out, &in);
+        if (ZSTD_isError(ret)) {
+            return false;
+        }
+        r->in_pos = in.pos;
+        r->out_len = out.pos;
+        r->at_boundary = ret == 0;
+        return true;
+    }
+#endif
+    (void)r;
+    return false;
+}
+
+/* Spaces ending the window that start a line, -1 if other text
+ * precedes them on it (more than enough for an indent counts as 4)
+ */
+static int window_lead(const InputReader *r)
+{
+    size_t n = r->out_len;
+    int spaces = 0;
+    while (n > 0 && r->out[n - 1] == ' ' && spaces < 4) {
+        n--;
+        spaces++;
+    }
+    if (n == 0) {
+        return r->lead < 0 ? -1 : r->lead + spaces;
+    }
+    return r->out[n - 1] == '\n' ? spaces : -1;
+}
+
+/* Decode the next chunk into the output window
+ * Returns false at end of input or on error
+ */
+static bool refill(InputReader *r)
+{
+    r->lead = window_lead(r);
+    r->out_pos = 0;
+    r->out_len = 0;
+
+    if (r->format == INPUT_PLAIN) {
+        if (!r->eof) {
+            r->out_len = r->io->read(r->io, r->file, r->out, INPUT_WINDOW);
+            r->eof = r->out_len < INPUT_WINDOW;
+        }
+        return r->out_len > 0;
+    }
+
+    while (r->out_len == 0 && !r->eof) {
+        if (r->in_pos == r->in_len) {
+            r->in_pos = 0;
+            r->in_len = r->io->read(r->io, r->file, r->in, INPUT_WINDOW);
+            if (r->in_len == 0) {
+                /* Input ended: fine between frames, truncated otherwise */
+                r->eof = true;
+                if (!r->at_boundary) {
+                    log_error("error: unexpected end of compressed input\n");
+                    r->error = true;
+                }
+                break;
+            }
+        }
+
+        if (!decode_step(r)) {
+            log_error("error: corrupt compressed input\n");
+            r->error = true;
+            r->eof = true;
+        }
+    }
+
+    return r->out_len > 0;
+}
+
+/* Read a line like fgets(), decoding on the fly */
+char *input_gets(char *line, int size, InputReader *r)
+{
+    size_t n = 0;
+    size_t max = (size_t)size - 1;
+
+    while (n < max) {
+        if (r->out_pos == r->out_len && !refill(r)) {
+            break;
+        }
+
+        size_t avail = r->out_len - r->out_pos;
+        size_t want = max - n < avail ? max - n : avail;
+        const char *src = r->out + r->out_pos;
+        const char *nl = memchr(src, '\n', want);
+        size_t take = nl ? (size_t)(nl - src) + 1 : want;
+
+        memcpy(line + n, src, take);
+        n += take;
+        r->out_pos += take;
+        if (nl) break;
+    }
+
+    if (n == 0) {
+        return NULL;
+    }
+    line[n] = '\0';
+    return line;
+}
+
+/* Read the next line that starts with c, skipping the others */
+char *input_find(char *line, int size, char c, InputReader *r)
+{
+    for (;;) {
+        if (r->out_pos == r->out_len && !refill(r)) {
+            return NULL;
+        }
+
+        /* Only a c after a newline and up to 3 spaces starts a line */
+        const char *src = r->out + r->out_pos;
+        const char *end = r->out + r->out_len;
+        for (const char *p = src; (p = memchr(p, c, (size_t)(end - p))); p++) {
+            const char *s = p;
+            int spaces = 0;
+            while (s > src && s[-1] == ' ' && spaces < 3) {
+                s--;
+                spaces++;
+            }
+            if (s > r->out ? s[-1] == '\n' : r->lead >= 0 && r->lead + spaces <= 3) {
+                r->out_pos = (size_t)(s - r->out);
+                return input_gets(line, size, r);
+            }
+        }
+        r->out_pos = r->out_len;
+    }
+}
+
+/* Length of the line starting at p as input_gets() would split it */
+size_t input_piece(const char *p, const char *end, int size)
+{
+    size_t max = (size_t)size - 1;
+    size_t avail = (size_t)(end - p);
+    if (avail > max) avail = max;
+
+    const char *nl = memchr(p, '\n', avail);
+    return nl ? (size_t)(nl - p) + 1 : avail;
+}
+
+/* Decode a whole document into memory */
+bool input_read_all(RyftIO *io, const char *path, char **data, size_t *len)
+{
+    InputReader r;
+    if (!input_open(&r, io, path)) {
+        return false;
+    }
+
+    char *buf = NULL;
+    size_t used = 0;
+    size_t cap = 0;
+    bool ok = true;
+    while (ok && refill(&r)) {
+        if (r.out_len > cap - used) {
+            size_t grown_cap = cap ? cap * 2 : 4 * INPUT_WINDOW;
+            while (grown_cap - used < r.out_len) grown_cap *= 2;
+            char *grown = realloc(buf, grown_cap);
+            if (!grown) {
+                log_error("error: out of memory\n");
+                ok = false;
+                break;
+            }
+            buf = grown;
+            cap = grown_cap;
+        }
+        memcpy(buf + used, r.out, r.out_len);
+        used += r.out_len;
+    }
+
+    if (ok && !buf && !(buf = malloc(1))) {
+        log_error("error: out of memory\n");
+        ok = false;
+    }
+    if (ok && r.error) {
+        log_error("error: cannot decompress '%s'\n", path);
+        ok = false;
+    }
+    input_close(&r);
+    if (!ok) {
+        free(buf);
+        return false;
+    }
+    *data = buf;
+    *len = used;
+    return true;
+}
+
+/* Close the document and release decoder state */
+void input_close(InputReader *r)
+{
+#ifdef RYFT_HAVE_ZLIB
+    if (r->stream && r->format == INPUT_GZIP) {
+        inflateEnd(r->stream);
+        free(r->stream);
+    }
+#endif
+#ifdef RYFT_HAVE_ZSTD
+    if (r->stream && r->format == INPUT_ZSTD) {
+        ZSTD_freeDStream(r->stream);
+    }
+#endif
+    if (r->file) {
+        r->io->close(r->io, r->file);
+    }
+    free(r->in);
+    free(r->out);
+    memset(r, 0, sizeof(*r));
+}
@@ -0,0 +1,69 @@
+/*
+ * input.h - Document reader with transparent decompression
+ */
+
+#ifndef RYFT_INPUT_H
+#define RYFT_INPUT_H
+
+#include "include/ryft.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define INPUT_WINDOW 65536     /* compressed and decoded buffer size */
+
+typedef enum {
+    INPUT_PLAIN,
+    INPUT_GZIP,
+    INPUT_ZSTD
+} InputFormat;
+
+typedef struct {
+    RyftIO *io;
+    RyftFile *file;
+    InputFormat format;
+    void *stream;              /* decoder state, NULL for plain input */
+    unsigned char *in;         /* compressed window */
+    size_t in_len;
+    size_t in_pos;
+    char *out;                 /* decoded window (plain input is read straight into it) */
+    size_t out_len;
+    size_t out_pos;
+    int lead;                  /* spaces just before out[0] that start a line,
+                                * -1 if other text precedes it on its line */
+    bool at_boundary;          /* decoder is between streams/frames */
+    bool eof;                  /* compressed input exhausted */
+    bool error;
+} InputReader;
+
+/* Detect compression from the first bytes of a file */
+InputFormat input_detect(const unsigned char *magic, size_t len);
+
+/* Open a document, detecting compression by magic bytes
+ * Returns false (after printing an error) if it cannot be read
+ */
+bool input_open(InputReader *r, RyftIO *io, const char *path);
+
+/* Read a line like fgets(), decoding on the fly */
+char *input_gets(char *line, int size, InputReader *r);
+
+/* Read the next line that starts with c, possibly indented by up to 3
+ * spaces (as a fence may be), like input_gets(), skipping the lines
+ * before it without copying them
+ */
+char *input_find(char *line, int size, char c, InputReader *r);
+
+/* Length of the line starting at p as input_gets() would split it
+ * (through the next newline, at most size - 1 bytes)
+ */
+size_t input_piece(const char *p, const char *end, int size);
+
+/* Decode a whole document into a malloc'd buffer
+ * Returns false (after printing an error) if it cannot be read
+ */
+bool input_read_all(RyftIO *io, const char *path, char **data, size_t *len);
+
+/* Close the document and release decoder state */
+void input_close(InputReader *r);
+
+#endif /* RYFT_INPUT_H */
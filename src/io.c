@@ -0,0 +1,855 @@
+/*
+ * io.c - File I/O backends (POSIX, in-memory, dry-run)
+ *
+ * The POSIX backend wraps stdio, so output writes stay buffered, and
+ * clones backups with a reflink where the filesystem supports one;
+ * in-place updates use pwrite on the stream's descriptor. The
+ * in-memory backend keeps whole files in growable buffers. The dry-run
+ * backend forwards reads to another backend and accepts every change
+ * without making it, which is all --dry-run needs from the filesystem.
+ * The io_uring backend is in uring.c.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE            /* copy_file_range */
+#endif
+#define _POSIX_C_SOURCE 200809L
+
+#include "io.h"
+#include "log.h"
+#include "trace.h"
+#include "types.h"
+#include "uring.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+/* POSIX backend: RyftFile is a FILE */
+
+static RyftFile *posix_open(RyftIO *io, const char *path, bool write)
+{
+    (void)io;
+    return (RyftFile *)fopen(path, write ? "w" : "r");
+}
+
+static size_t posix_read(RyftIO *io, RyftFile *f, void *buf, size_t len)
+{
+    (void)io;
+    return fread(buf, 1, len, (FILE *)f);
+}
+
+static size_t posix_write(RyftIO *io, RyftFile *f, const void *buf, size_t len)
+{
+    (void)io;
+    return fwrite(buf, 1, len, (FILE *)f);
+}
+
+static int posix_close(RyftIO *io, RyftFile *f)
+{
+    (void)io;
+    return fclose((FILE *)f) == 0 ? 0 : -1;
+}
+
+static int posix_stat(RyftIO *io, const char *path, size_t *size)
+{
+    (void)io;
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+    *size = (size_t)st.st_size;
+    return 0;
+}
+
+static int posix_mkdir(RyftIO *io, const char *path)
+{
+    (void)io;
+    return mkdir(path, 0755);
+}
+
+static int posix_rename(RyftIO *io, const char *from, const char *to)
+{
+    (void)io;
+    return rename(from, to);
+}
+
+static int posix_clone(RyftIO *io, const char *from, const char *to)
+{
+    (void)io;
+    int src = open(from, O_RDONLY);
+    if (src < 0) {
+        return -1;
+    }
+    int dst = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (dst < 0) {
+        int saved = errno;
+        close(src);
+        errno = saved;
+        return -1;
+    }
+
+    int rc = 0;
+#ifdef FICLONE
+    /* Share extents on copy-on-write filesystems (btrfs, XFS) */
+    if (ioctl(dst, FICLONE, src) == 0) {
+        close(src);
+        return close(dst);
+    }
+#endif
+
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(src, buf, sizeof(buf))) > 0) {
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = write(dst, buf + done, (size_t)(n - done));
+            if (w < 0) {
+                rc = -1;
+                break;
+            }
+            done += w;
+        }
+        if (rc != 0) break;
+    }
+    if (n < 0) rc = -1;
+
+    int saved = errno;
+    close(src);
+    if (close(dst) != 0) rc = -1;
+    if (rc != 0) errno = saved;
+    return rc;
+}
+
+static int posix_map(RyftIO *io, const char *path, const char **data, size_t *len)
+{
+    (void)io;
+    return map_file(path, data, len) ? 0 : -1;
+}
+
+static void posix_unmap(RyftIO *io, const char *data, size_t len)
+{
+    (void)io;
+    unmap_file(data, len);
+}
+
+static RyftFile *posix_update(RyftIO *io, const char *path)
+{
+    (void)io;
+    return (RyftFile *)fopen(path, "r+");
+}
+
+static size_t posix_pwrite(RyftIO *io, RyftFile *f, const void *buf, size_t len, size_t off)
+{
+    (void)io;
+    int fd = fileno((FILE *)f);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(fd, (const char *)buf + done, len - done, (off_t)(off + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += (size_t)n;
+    }
+    return done;
+}
+
+static int posix_truncate(RyftIO *io, RyftFile *f, size_t size)
+{
+    (void)io;
+    return ftruncate(fileno((FILE *)f), (off_t)size);
+}
+
+static RyftIO posix_io = {
+    posix_open, posix_read, posix_write, posix_close, posix_stat,
+    posix_mkdir, posix_rename, posix_clone, posix_map, posix_unmap,
+    posix_update, posix_pwrite, posix_truncate, NULL, NULL, NULL
+};
+
+/* The local filesystem (the default) */
+RyftIO *ryft_io_posix(void)
+{
+    return &posix_io;
+}
+
+/* In-memory backend */
+
+typedef struct {
+    char *path;
+    uint64_t hash;
+    char *data;
+    size_t len;
+    size_t cap;
+} MemFile;
+
+typedef struct {
+    MemFile *files;
+    int count;
+    int cap;
+} MemStore;
+
+/* Open file: an index, since files may move when the store grows */
+typedef struct {
+    int file;
+    size_t pos;
+} MemHandle;
+
+static int mem_find(MemStore *store, const char *path)
+{
+    uint64_t hash = hash_bytes(path, strlen(path));
+    for (int i = 0; i < store->count; i++) {
+        if (store->files[i].hash == hash && strcmp(store->files[i].path, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Find or create an empty file */
+static int mem_create(MemStore *store, const char *path)
+{
+    int i = mem_find(store, path);
+    if (i >= 0) {
+        store->files[i].len = 0;
+        return i;
+    }
+
+    if (store->count >= store->cap) {
+        int cap = store->cap ? store->cap * 2 : 16;
+        MemFile *grown = realloc(store->files, (size_t)cap * sizeof(MemFile));
+        if (!grown) {
+            errno = ENOMEM;
+            return -1;
+        }
+        store->files = grown;
+        store->cap = cap;
+    }
+
+    MemFile *f = &store->files[store->count];
+    memset(f, 0, sizeof(*f));
+    size_t len = strlen(path);
+    f->path = malloc(len + 1);
+    if (!f->path) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(f->path, path, len + 1);
+    f->hash = hash_bytes(path, len);
+    return store->count++;
+}
+
+/* Make room for size bytes */
+static bool mem_reserve(MemFile *f, size_t size)
+{
+    if (size <= f->cap) {
+        return true;
+    }
+    size_t cap = f->cap ? f->cap : 4096;
+    while (cap < size) cap *= 2;
+    char *grown = realloc(f->data, cap);
+    if (!grown) {
+        errno = ENOMEM;
+        return false;
+    }
+    f->data = grown;
+    f->cap = cap;
+    return true;
+}
+
+static bool mem_append(MemFile *f, const void *buf, size_t len)
+{
+    if (len == 0) {
+        return true;
+    }
+    if (!mem_reserve(f, f->len + len)) {
+        return false;
+    }
+    memcpy(f->data + f->len, buf, len);
+    f->len += len;
+    return true;
+}
+
+static RyftFile *mem_handle(int file)
+{
+    MemHandle *h = malloc(sizeof(MemHandle));
+    if (!h) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    h->file = file;
+    h->pos = 0;
+    return (RyftFile *)h;
+}
+
+static RyftFile *mem_open(RyftIO *io, const char *path, bool write)
+{
+    MemStore *store = io->ctx;
+    int i = write ? mem_create(store, path) : mem_find(store, path);
+    if (i < 0) {
+        if (!write) errno = ENOENT;
+        return NULL;
+    }
+
+    return mem_handle(i);
+}
+
+static size_t mem_read(RyftIO *io, RyftFile *f, void *buf, size_t len)
+{
+    MemStore *store = io->ctx;
+    MemHandle *h = (MemHandle *)f;
+    MemFile *file = &store->files[h->file];
+
+    size_t avail = file->len - h->pos;
+    if (len > avail) len = avail;
+    if (len == 0) {
+        return 0;
+    }
+    memcpy(buf, file->data + h->pos, len);
+    h->pos += len;
+    return len;
+}
+
+static size_t mem_write(RyftIO *io, RyftFile *f, const void *buf, size_t len)
+{
+    MemStore *store = io->ctx;
+    MemHandle *h = (MemHandle *)f;
+    return mem_append(&store->files[h->file], buf, len) ? len : 0;
+}
+
+static int mem_close(RyftIO *io, RyftFile *f)
+{
+    (void)io;
+    free(f);
+    return 0;
+}
+
+static RyftFile *mem_update(RyftIO *io, const char *path)
+{
+    int i = mem_find(io->ctx, path);
+    if (i < 0) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    return mem_handle(i);
+}
+
+/* Set the length of a file, zero-filling any gap */
+static bool mem_resize(MemFile *file, size_t size)
+{
+    if (size > file->len) {
+        if (!mem_reserve(file, size)) {
+            return false;
+        }
+        memset(file->data + file->len, 0, size - file->len);
+    }
+    file->len = size;
+    return true;
+}
+
+static size_t mem_pwrite(RyftIO *io, RyftFile *f, const void *buf, size_t len, size_t off)
+{
+    MemStore *store = io->ctx;
+    MemFile *file = &store->files[((MemHandle *)f)->file];
+    if (len == 0) {
+        return 0;
+    }
+    if (off + len > file->len && !mem_resize(file, off + len)) {
+        return 0;
+    }
+    memcpy(file->data + off, buf, len);
+    return len;
+}
+
+static int mem_truncate(RyftIO *io, RyftFile *f, size_t size)
+{
+    MemStore *store = io->ctx;
+    return mem_resize(&store->files[((MemHandle *)f)->file], size) ? 0 : -1;
+}
+
+static int mem_stat(RyftIO *io, const char *path, size_t *size)
+{
+    int i = mem_find(io->ctx, path);
+    if (i < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    *size = ((MemStore *)io->ctx)->files[i].len;
+    return 0;
+}
+
+static int mem_mkdir(RyftIO *io, const char *path)
+{
+    /* Directories are implied by file paths */
+    (void)io;
+    (void)path;
+    return 0;
+}
+
+static int mem_rename(RyftIO *io, const char *from, const char *to)
+{
+    MemStore *store = io->ctx;
+    int i = mem_find(store, from);
+    if (i < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    int j = mem_find(store, to);
+    if (j == i) {
+        return 0;
+    }
+    if (j >= 0) {
+        /* Replace the target, keeping the slot of the source */
+        MemFile *dst = &store->files[j];
+        free(dst->data);
+        dst->data = store->files[i].data;
+        dst->len = store->files[i].len;
+        dst->cap = store->files[i].cap;
+        free(store->files[i].path);
+        store->files[i] = store->files[--store->count];
+        return 0;
+    }
+
+    size_t len = strlen(to);
+    char *path = malloc(len + 1);
+    if (!path) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(path, to, len + 1);
+    free(store->files[i].path);
+    store->files[i].path = path;
+    store->files[i].hash = hash_bytes(to, len);
+    return 0;
+}
+
+static int mem_clone(RyftIO *io, const char *from, const char *to)
+{
+    MemStore *store = io->ctx;
+    int i = mem_find(store, from);
+    if (i < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (strcmp(from, to) == 0) {
+        return 0;
+    }
+    int j = mem_create(store, to);
+    if (j < 0) {
+        return -1;
+    }
+    /* Index again: creating the target may have moved the store */
+    MemFile *src = &store->files[i];
+    return mem_append(&store->files[j], src->data, src->len) ? 0 : -1;
+}
+
+static int mem_map(RyftIO *io, const char *path, const char **data, size_t *len)
+{
+    MemStore *store = io->ctx;
+    int i = mem_find(store, path);
+    if (i < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    *data = store->files[i].data;
+    *len = store->files[i].len;
+    return 0;
+}
+
+static void mem_unmap(RyftIO *io, const char *data, size_t len)
+{
+    (void)io;
+    (void)data;
+    (void)len;
+}
+
+static void mem_release(RyftIO *io)
+{
+    MemStore *store = io->ctx;
+    for (int i = 0; i < store->count; i++) {
+        free(store->files[i].path);
+        free(store->files[i].data);
+    }
+    free(store->files);
+    free(store);
+    free(io);
+}
+
+/* An empty in-memory filesystem */
+RyftIO *ryft_io_memory(void)
+{
+    RyftIO *io = calloc(1, sizeof(RyftIO));
+    MemStore *store = calloc(1, sizeof(MemStore));
+    if (!io || !store) {
+        free(io);
+        free(store);
+        return NULL;
+    }
+
+    io->open = mem_open;
+    io->read = mem_read;
+    io->write = mem_write;
+    io->close = mem_close;
+    io->stat = mem_stat;
+    io->mkdir = mem_mkdir;
+    io->rename = mem_rename;
+    io->clone = mem_clone;
+    io->map = mem_map;
+    io->unmap = mem_unmap;
+    io->update = mem_update;
+    io->pwrite = mem_pwrite;
+    io->truncate = mem_truncate;
+    io->release = mem_release;
+    io->ctx = store;
+    return io;
+}
+
+/* Store a file in an in-memory backend */
+int ryft_io_memory_put(RyftIO *io, const char *path, const void *data, size_t len)
+{
+    if (io->open != mem_open) {
+        errno = EINVAL;
+        return -1;
+    }
+    MemStore *store = io->ctx;
+    int i = mem_create(store, path);
+    if (i < 0 || !mem_append(&store->files[i], data, len)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Contents of a file in an in-memory backend */
+const char *ryft_io_memory_get(RyftIO *io, const char *path, size_t *len)
+{
+    if (io->open != mem_open) {
+        return NULL;
+    }
+    MemStore *store = io->ctx;
+    int i = mem_find(store, path);
+    if (i < 0) {
+        return NULL;
+    }
+    *len = store->files[i].len;
+    return store->files[i].data ? store->files[i].data : "";
+}
+
+/* Dry-run backend: reads go to the base, changes are accepted and dropped */
+
+static char dry_sink;          /* handle for every file opened for writing */
+
+static RyftFile *dry_open(RyftIO *io, const char *path, bool write)
+{
+    RyftIO *base = io->ctx;
+    return write ? (RyftFile *)&dry_sink : base->open(base, path, false);
+}
+
+static size_t dry_read(RyftIO *io, RyftFile *f, void *buf, size_t len)
+{
+    RyftIO *base = io->ctx;
+    return f == (RyftFile *)&dry_sink ? 0 : base->read(base, f, buf, len);
+}
+
+static size_t dry_write(RyftIO *io, RyftFile *f, const void *buf, size_t len)
+{
+    (void)io;
+    (void)f;
+    (void)buf;
+    return len;
+}
+
+static int dry_close(RyftIO *io, RyftFile *f)
+{
+    RyftIO *base = io->ctx;
+    return f == (RyftFile *)&dry_sink ? 0 : base->close(base, f);
+}
+
+static int dry_stat(RyftIO *io, const char *path, size_t *size)
+{
+    RyftIO *base = io->ctx;
+    return base->stat(base, path, size);
+}
+
+static int dry_change(RyftIO *io, const char *path)
+{
+    (void)io;
+    (void)path;
+    return 0;
+}
+
+static int dry_change2(RyftIO *io, const char *from, const char *to)
+{
+    (void)io;
+    (void)from;
+    (void)to;
+    return 0;
+}
+
+static int dry_map(RyftIO *io, const char *path, const char **data, size_t *len)
+{
+    RyftIO *base = io->ctx;
+    return base->map(base, path, data, len);
+}
+
+static void dry_unmap(RyftIO *io, const char *data, size_t len)
+{
+    RyftIO *base = io->ctx;
+    base->unmap(base, data, len);
+}
+
+static RyftFile *dry_update(RyftIO *io, const char *path)
+{
+    (void)io;
+    (void)path;
+    return (RyftFile *)&dry_sink;
+}
+
+static size_t dry_pwrite(RyftIO *io, RyftFile *f, const void *buf, size_t len, size_t off)
+{
+    (void)io;
+    (void)f;
+    (void)buf;
+    (void)off;
+    return len;
+}
+
+static int dry_truncate(RyftIO *io, RyftFile *f, size_t size)
+{
+    (void)io;
+    (void)f;
+    (void)size;
+    return 0;
+}
+
+static void dry_release(RyftIO *io)
+{
+    free(io);
+}
+
+/* Reads from base, discards every change */
+RyftIO *ryft_io_dry_run(RyftIO *base)
+{
+    RyftIO *io = calloc(1, sizeof(RyftIO));
+    if (!io) {
+        return NULL;
+    }
+    if (!base) {
+        base = ryft_io_posix();
+    }
+
+    io->open = dry_open;
+    io->read = dry_read;
+    io->write = dry_write;
+    io->close = dry_close;
+    io->stat = dry_stat;
+    io->mkdir = dry_change;
+    io->rename = dry_change2;
+    io->clone = dry_change2;
+    io->map = base->map ? dry_map : NULL;
+    io->unmap = base->map ? dry_unmap : NULL;
+    io->update = base->update ? dry_update : NULL;
+    io->pwrite = dry_pwrite;
+    io->truncate = dry_truncate;
+    io->release = dry_release;
+    io->ctx = base;
+    return io;
+}
+
+/* Release a backend */
+void ryft_io_free(RyftIO *io)
+{
+    if (io && io->release) {
+        io->release(io);
+    }
+}
+
+/* Helpers used by the tangle pipeline */
+
+/* Backend selected by options (POSIX when unset) */
+RyftIO *io_for(const RyftOptions *options)
+{
+    return options->io ? options->io : &posix_io;
+}
+
+/* True if files live on the local filesystem */
+bool io_native(RyftIO *io)
+{
+    while (io->open == dry_open) {
+        io = io->ctx;
+    }
+    return io == &posix_io || uring_backend(io);
+}
+
+/* Open an output for writing on the descriptor its lock is held on */
+RyftFile *io_open_locked(RyftIO *io, const char *path, int *fd)
+{
+    if (io != &posix_io || *fd < 0) {
+        return io->open(io, path, true);
+    }
+
+    /* The lock was taken without truncating: that happens only now */
+    FILE *f = ftruncate(*fd, 0) == 0 ? fdopen(*fd, "w") : NULL;
+    if (f) {
+        *fd = -1;
+    }
+    return (RyftFile *)f;
+}
+
+/* Check if a file exists */
+bool io_exists(RyftIO *io, const char *path)
+{
+    size_t size;
+    return io->stat(io, path, &size) == 0;
+}
+
+/* Load a whole file, mapped when the backend can */
+bool io_load(RyftIO *io, const char *path, const char **data, size_t *len)
+{
+    if (io->map) {
+        return io->map(io, path, data, len) == 0;
+    }
+
+    RyftFile *f = io->open(io, path, false);
+    if (!f) {
+        return false;
+    }
+
+    char *buf = NULL;
+    size_t used = 0;
+    size_t cap = 0;
+    for (;;) {
+        if (used == cap) {
+            cap = cap ? cap * 2 : 65536;
+            char *grown = realloc(buf, cap);
+            if (!grown) {
+                free(buf);
+                io->close(io, f);
+                return false;
+            }
+            buf = grown;
+        }
+        size_t n = io->read(io, f, buf + used, cap - used);
+        if (n == 0) break;
+        used += n;
+    }
+    io->close(io, f);
+
+    if (used == 0) {
+        free(buf);
+        buf = NULL;
+    }
+    *data = buf;
+    *len = used;
+    return true;
+}
+
+/* Append the first len bytes of fd to a file opened for writing */
+bool io_append_fd(RyftIO *io, RyftFile *f, int fd, size_t len)
+{
+    size_t done = 0;
+
+#ifdef __linux__
+    if (io == &posix_io) {
+        FILE *out = (FILE *)f;
+        if (fflush(out) != 0) {
+            return false;
+        }
+        loff_t off = 0;
+        while (done < len) {
+            ssize_t n = copy_file_range(fd, &off, fileno(out), NULL, len - done, 0);
+            if (n <= 0) {
+                break;  /* unsupported here: copy the rest below */
+            }
+            done += (size_t)n;
+        }
+        /* The stream continues after the bytes written under it */
+        if (done > 0 && fseek(out, 0, SEEK_END) != 0) {
+            return false;
+        }
+    }
+#endif
+
+    char buf[65536];
+    while (done < len) {
+        size_t want = len - done < sizeof(buf) ? len - done : sizeof(buf);
+        ssize_t n = pread(fd, buf, want, (off_t)done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0 || io->write(io, f, buf, (size_t)n) != (size_t)n) {
+            return false;
+        }
+        done += (size_t)n;
+    }
+    return true;
+}
+
+/* Release a file loaded with io_load() */
+void io_unload(RyftIO *io, const char *data, size_t len)
+{
+    if (io->map) {
+        io->unmap(io, data, len);
+    } else {
+        free((char *)data);
+    }
+}
+
+/* Create directory and all parent directories (like mkdir -p)
+ *
+ * The full path is tried first, so an existing parent costs one mkdir,
+ * and parents are only walked on ENOENT. EEXIST is success wherever it
+ * comes from: another process creating the same directory at the same
+ * moment has done the work for us, and nothing needs retrying.
+ */
+static bool make_directories(RyftIO *io, char *path)
+{
+    if (io->mkdir(io, path) == 0 || errno == EEXIST) {
+        return true;
+    }
+
+    char *slash = strrchr(path, '/');
+    if (errno == ENOENT && slash && slash != path) {
+        *slash = '\0';
+        bool ok = make_directories(io, path);
+        *slash = '/';
+        if (!ok) {
+            return false;
+        }
+        if (io->mkdir(io, path) == 0 || errno == EEXIST) {
+            return true;
+        }
+    }
+
+    log_error("error: cannot create directory '%s': %s\n", path, strerror(errno));
+    return false;
+}
+
+/* Create directory and all parent directories (like mkdir -p) */
+bool ensure_directory(RyftIO *io, const char *path)
+{
+    uint64_t t;
+    char tmp[MAX_PATH];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+
+    /* Remove trailing slash */
+    size_t len = strlen(tmp);
+    if (len > 1 && tmp[len - 1] == '/') {
+        tmp[len - 1] = '\0';
+    }
+
+    TRACE_BEGIN(t, mkdir, path);
+    bool ok = make_directories(io, tmp);
+    TRACE_END(t, mkdir, path);
+    return ok;
+}
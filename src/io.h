@@ -0,0 +1,47 @@
+/*
+ * io.h - File I/O backends (POSIX, in-memory, dry-run)
+ */
+
+#ifndef RYFT_IO_H
+#define RYFT_IO_H
+
+#include "include/ryft.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Backend selected by options (POSIX when unset) */
+RyftIO *io_for(const RyftOptions *options);
+
+/* True if files live on the local filesystem (POSIX, or dry-run over it) */
+bool io_native(RyftIO *io);
+
+/* Open an output for writing on the descriptor its lock is held on
+ * (see lock_output()), so file and lock share one descriptor; on the
+ * POSIX backend *fd then belongs to the file and is set to -1, and
+ * closing the file drops the lock. Other backends open path as usual
+ */
+RyftFile *io_open_locked(RyftIO *io, const char *path, int *fd);
+
+/* Check if a file exists */
+bool io_exists(RyftIO *io, const char *path);
+
+/* Load a whole file, mapped when the backend can (empty files load as
+ * NULL, 0); release with io_unload()
+ * Returns false if the file cannot be read
+ */
+bool io_load(RyftIO *io, const char *path, const char **data, size_t *len);
+
+/* Append the first len bytes of fd to a file opened for writing; local
+ * files copy them in the kernel (copy_file_range) where it can
+ * Returns false if they could not all be written
+ */
+bool io_append_fd(RyftIO *io, RyftFile *f, int fd, size_t len);
+
+/* Release a file loaded with io_load() */
+void io_unload(RyftIO *io, const char *data, size_t len);
+
+/* Create directory and all parent directories (like mkdir -p) */
+bool ensure_directory(RyftIO *io, const char *path);
+
+#endif /* RYFT_IO_H */
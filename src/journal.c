@@ -0,0 +1,271 @@
+/*
+ * journal.c - Write-ahead journal for resumable --project runs
+ *
+ * With --resume, a project run appends to <manifest>.ryftjournal:
+ *
+ *   ryft-journal 1
+ *   B <path>                      output about to be truncated
+ *   C <hash> <size> <path>        output written completely
+ *
+ * Commits are held back and made durable in batches: the outputs of a
+ * batch are fsynced first, then their C records are appended and the
+ * journal is fsynced, so a C record on disk always describes data on
+ * disk. A rerun skips outputs whose C record matches the contents it
+ * would write and whose size on disk agrees; a B record without a later
+ * C marks an output that was cut off halfway, which is written again.
+ * A torn last line is ignored.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "journal.h"
+#include "log.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Journal path for a manifest */
+void journal_path(const char *manifest, char *out, size_t out_size)
+{
+    snprintf(out, out_size, "%s%s", manifest, JOURNAL_SUFFIX);
+}
+
+/* Order entries by key, then by record order */
+static int compare_entries(const void *a, const void *b)
+{
+    const JournalEntry *x = a;
+    const JournalEntry *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    if (x->seq != y->seq) return x->seq < y->seq ? -1 : 1;
+    return 0;
+}
+
+/* Parse one complete record into e
+ * Returns false for a malformed line
+ */
+static bool parse_record(char *line, JournalEntry *e)
+{
+    size_t len = strlen(line);
+    if (len < 3 || line[len - 1] != '\n') {
+        return false;
+    }
+    line[len - 1] = '\0';
+
+    char *path;
+    if (line[0] == 'B' && line[1] == ' ') {
+        e->state = JOURNAL_BEGUN;
+        e->hash = 0;
+        e->size = 0;
+        path = line + 2;
+    } else if (line[0] == 'C' && line[1] == ' ') {
+        char *end;
+        e->state = JOURNAL_COMMITTED;
+        e->hash = strtoull(line + 2, &end, 16);
+        if (*end != ' ') return false;
+        e->size = (size_t)strtoull(end + 1, &end, 10);
+        if (*end != ' ') return false;
+        path = end + 1;
+    } else {
+        return false;
+    }
+
+    if (!*path || !(e->path = malloc(strlen(path) + 1))) {
+        return false;
+    }
+    strcpy(e->path, path);
+    e->key = hash_bytes(path, strlen(path));
+    return true;
+}
+
+/* Read an interrupted run's records
+ * Returns false if the file is missing or not a journal
+ */
+static bool load_entries(Journal *j)
+{
+    FILE *f = fopen(j->path, "r");
+    if (!f) {
+        return false;
+    }
+
+    char line[MAX_LINE];
+    int version = 0;
+    if (!fgets(line, sizeof(line), f) || sscanf(line, "ryft-journal %d", &version) != 1 ||
+        version != JOURNAL_VERSION) {
+        fclose(f);
+        return false;
+    }
+
+    size_t cap = 0;
+    while (fgets(line, sizeof(line), f)) {
+        JournalEntry e;
+        if (!parse_record(line, &e)) {
+            continue;
+        }
+        if (j->entry_count == cap) {
+            size_t grown_cap = cap ? cap * 2 : 256;
+            JournalEntry *grown = realloc(j->entries, grown_cap * sizeof(JournalEntry));
+            if (!grown) {
+                free(e.path);
+                break;
+            }
+            j->entries = grown;
+            cap = grown_cap;
+        }
+        e.seq = j->entry_count;
+        j->entries[j->entry_count++] = e;
+    }
+    fclose(f);
+
+    qsort(j->entries, j->entry_count, sizeof(JournalEntry), compare_entries);
+    return true;
+}
+
+/* Load what an interrupted run recorded, then start recording this run */
+bool journal_open(Journal *j, const char *manifest, bool record)
+{
+    memset(j, 0, sizeof(*j));
+    journal_path(manifest, j->path, sizeof(j->path));
+
+    bool resumed = load_entries(j);
+    if (!record) {
+        return true;
+    }
+
+    j->f = fopen(j->path, resumed ? "a" : "w");
+    if (!j->f) {
+        log_error("error: cannot write journal '%s': %s\n", j->path, strerror(errno));
+        return false;
+    }
+    if (!resumed) {
+        fprintf(j->f, "ryft-journal %d\n", JOURNAL_VERSION);
+    }
+    return true;
+}
+
+/* What the interrupted run recorded about an output with these contents */
+JournalState journal_state(const Journal *j, const char *path, uint64_t hash, size_t size)
+{
+    uint64_t key = hash_bytes(path, strlen(path));
+
+    /* Last record for the path: entries with one key are in record order */
+    size_t lo = 0;
+    size_t hi = j->entry_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (j->entries[mid].key <= key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    while (lo > 0 && j->entries[lo - 1].key == key) {
+        const JournalEntry *e = &j->entries[--lo];
+        if (strcmp(e->path, path) != 0) {
+            continue;
+        }
+        if (e->state == JOURNAL_COMMITTED) {
+            return e->hash == hash && e->size == size ? JOURNAL_COMMITTED : JOURNAL_NONE;
+        }
+        return e->state;
+    }
+    return JOURNAL_NONE;
+}
+
+/* Report the first failed journal write */
+static void write_failed(Journal *j)
+{
+    if (!j->failed) {
+        log_error("error: cannot write journal '%s': %s\n", j->path, strerror(errno));
+        j->failed = true;
+    }
+}
+
+/* Make the pending commits durable: outputs first, then their records */
+static void sync_pending(Journal *j)
+{
+    for (int i = 0; i < j->pending_count; i++) {
+        JournalEntry *e = &j->pending[i];
+        int fd = open(e->path, O_RDONLY);
+        bool synced = fd >= 0 && fsync(fd) == 0;
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        /* An output that cannot be synced is simply not committed */
+        if (synced && fprintf(j->f, "C %016" PRIx64 " %zu %s\n", e->hash, e->size, e->path) < 0) {
+            write_failed(j);
+        }
+        free(e->path);
+    }
+    j->pending_count = 0;
+
+    if (fflush(j->f) != 0 || fsync(fileno(j->f)) != 0) {
+        write_failed(j);
+    }
+}
+
+/* Record that an output is about to be truncated and written */
+void journal_begin(Journal *j, const char *path)
+{
+    if (!j->f) {
+        return;
+    }
+    if (fprintf(j->f, "B %s\n", path) < 0 || fflush(j->f) != 0) {
+        write_failed(j);
+    }
+}
+
+/* Record that an output was written completely */
+void journal_commit(Journal *j, const char *path, uint64_t hash, size_t size)
+{
+    if (!j->f) {
+        return;
+    }
+    if (!j->pending) {
+        j->pending = malloc(JOURNAL_BATCH * sizeof(JournalEntry));
+    }
+
+    JournalEntry *e = j->pending ? &j->pending[j->pending_count] : NULL;
+    if (!e || !(e->path = malloc(strlen(path) + 1))) {
+        /* Without memory the output stays uncommitted and is redone */
+        return;
+    }
+    strcpy(e->path, path);
+    e->hash = hash;
+    e->size = size;
+
+    if (++j->pending_count == JOURNAL_BATCH) {
+        sync_pending(j);
+    }
+}
+
+/* Sync outstanding commits and close */
+bool journal_close(Journal *j, bool complete)
+{
+    bool ok = true;
+    if (j->f) {
+        sync_pending(j);
+        if (fclose(j->f) != 0) {
+            write_failed(j);
+        }
+        ok = !j->failed;
+        if (complete && ok && remove(j->path) != 0) {
+            log_error("error: cannot remove journal '%s': %s\n", j->path, strerror(errno));
+            ok = false;
+        }
+    }
+
+    for (size_t i = 0; i < j->entry_count; i++) {
+        free(j->entries[i].path);
+    }
+    free(j->entries);
+    free(j->pending);
+    memset(j, 0, sizeof(*j));
+    return ok;
+}
@@ -0,0 +1,69 @@
+/*
+ * journal.h - Write-ahead journal for resumable --project runs
+ */
+
+#ifndef RYFT_JOURNAL_H
+#define RYFT_JOURNAL_H
+
+#include "types.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define JOURNAL_SUFFIX ".ryftjournal"
+#define JOURNAL_VERSION 1
+#define JOURNAL_BATCH 64       /* commits made durable per fsync */
+
+/* What an earlier run recorded about an output */
+typedef enum {
+    JOURNAL_NONE,              /* nothing, or committed with other contents */
+    JOURNAL_BEGUN,             /* started but never committed: half-written */
+    JOURNAL_COMMITTED          /* written completely with these contents */
+} JournalState;
+
+typedef struct {
+    uint64_t key;              /* hash of the path */
+    char *path;
+    JournalState state;
+    uint64_t hash;             /* contents (committed only) */
+    size_t size;
+    size_t seq;                /* record order, later records win */
+} JournalEntry;
+
+typedef struct {
+    char path[MAX_PATH];
+    FILE *f;                   /* NULL when not recording (dry-run) */
+    JournalEntry *entries;     /* records of the interrupted run, by key */
+    size_t entry_count;
+    JournalEntry *pending;     /* commits waiting for the next sync */
+    int pending_count;
+    bool failed;               /* a journal write failed (already reported) */
+} Journal;
+
+/* Journal path for a manifest */
+void journal_path(const char *manifest, char *out, size_t out_size);
+
+/* Load what an interrupted run recorded, then start recording this run
+ * after it (record false reads only)
+ * Returns false if the journal cannot be written (already reported)
+ */
+bool journal_open(Journal *j, const char *manifest, bool record);
+
+/* What the interrupted run recorded about an output with these contents */
+JournalState journal_state(const Journal *j, const char *path, uint64_t hash, size_t size);
+
+/* Record that an output is about to be truncated and written */
+void journal_begin(Journal *j, const char *path);
+
+/* Record that an output was written completely; every JOURNAL_BATCH
+ * commits, the outputs and then their records are synced to disk
+ */
+void journal_commit(Journal *j, const char *path, uint64_t hash, size_t size);
+
+/* Sync outstanding commits and close; a complete run removes the
+ * journal, as there is nothing left to resume
+ * Returns false if the journal could not be written
+ */
+bool journal_close(Journal *j, bool complete);
+
+#endif /* RYFT_JOURNAL_H */
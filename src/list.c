@@ -0,0 +1,197 @@
+/*
+ * list.c - Machine-readable block and output listing (--list)
+ *
+ * Maps the document in one pass with ryft_map_buffer_opts() and prints what
+ * it found, for editors and scripts. Nothing is written and no output
+ * is looked at on disk: sizes come from the block bodies themselves.
+ */
+
+#include "list.h"
+#include "input.h"
+#include "io.h"
+#include "log.h"
+#include "sink.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Check if format names a --list format */
+bool list_format(const char *format)
+{
+    return strcmp(format, "json") == 0 || strcmp(format, "tsv") == 0;
+}
+
+static const char *kind_name(RyftBlockKind kind)
+{
+    switch (kind) {
+    case RYFT_BLOCK_DISPLAY: return "display";
+    case RYFT_BLOCK_CONFIG:  return "config";
+    case RYFT_BLOCK_EXEC:    return "exec";
+    default:                 return "code";
+    }
+}
+
+/* Output sizes are known only when every block is copied as written */
+static void sizes_known(const RyftSourceMap *map, bool *known)
+{
+    for (size_t o = 0; o < map->output_count; o++) {
+        known[o] = true;
+    }
+    for (size_t i = 0; i < map->block_count; i++) {
+        const RyftBlock *b = &map->blocks[i];
+        if (b->output >= 0 && (b->kind == RYFT_BLOCK_EXEC || b->transformed)) {
+            known[b->output] = false;
+        }
+    }
+}
+
+/* Write s as a TSV field (tab, newline and backslash escaped) */
+static void put_tsv(const char *s)
+{
+    for (; *s; s++) {
+        switch (*s) {
+        case '\t': fputs("\\t", stdout); break;
+        case '\n': fputs("\\n", stdout); break;
+        case '\r': fputs("\\r", stdout); break;
+        case '\\': fputs("\\\\", stdout); break;
+        default:   putchar(*s); break;
+        }
+    }
+}
+
+static void list_json(const char *filepath, const RyftSourceMap *map, const bool *known)
+{
+    printf("{\"document\":\"");
+    put_json(stdout, filepath);
+    printf("\",\n \"blocks\":[");
+
+    for (size_t i = 0; i < map->block_count; i++) {
+        const RyftBlock *b = &map->blocks[i];
+        printf("%s\n  {\"index\":%zu,\"fence_line\":%zu,", i ? "," : "", i + 1, b->fence_line);
+        if (b->close_line) {
+            printf("\"close_line\":%zu,", b->close_line);
+        } else {
+            printf("\"close_line\":null,");
+        }
+        printf("\"kind\":\"%s\",\"continuation\":%s,\"excluded\":%s,\"lang\":\"",
+               kind_name(b->kind), b->continuation ? "true" : "false",
+               b->excluded ? "true" : "false");
+        put_json(stdout, b->lang);
+        if (b->output >= 0) {
+            printf("\",\"output\":%d,\"target\":\"", b->output + 1);
+            put_json(stdout, map->outputs[b->output].path);
+            printf("\"");
+        } else {
+            printf("\",\"output\":null,\"target\":null");
+        }
+        printf(",\"transformed\":%s,\"body_offset\":%zu,\"body_len\":%zu}",
+               b->transformed ? "true" : "false", b->body_offset, b->body_len);
+    }
+
+    printf("],\n \"outputs\":[");
+    for (size_t o = 0; o < map->output_count; o++) {
+        const RyftOutput *out = &map->outputs[o];
+        printf("%s\n  {\"index\":%zu,\"path\":\"", o ? "," : "", o + 1);
+        put_json(stdout, out->path);
+        printf("\",\"lang\":\"");
+        put_json(stdout, out->lang);
+        printf("\",\"blocks\":%d,", out->block_count);
+        if (known[o]) {
+            printf("\"size\":%zu,\"lines\":%zu,", out->size, out->lines);
+        } else {
+            printf("\"size\":null,\"lines\":null,");
+        }
+        printf("\"fallback\":%s,\"pipe\":%s}",
+               out->fallback ? "true" : "false", sink_target(out->path) ? "true" : "false");
+    }
+    printf("]}\n");
+}
+
+static void list_tsv(const RyftSourceMap *map, const bool *known)
+{
+    for (size_t i = 0; i < map->block_count; i++) {
+        const RyftBlock *b = &map->blocks[i];
+        printf("block\t%zu\t%zu\t", i + 1, b->fence_line);
+        if (b->close_line) {
+            printf("%zu", b->close_line);
+        } else {
+            putchar('-');
+        }
+        printf("\t%s\t%s\t", kind_name(b->kind),
+               b->continuation ? "cont" : b->excluded ? "skip" : "-");
+        put_tsv(b->lang[0] ? b->lang : "-");
+        putchar('\t');
+        put_tsv(b->output >= 0 ? map->outputs[b->output].path : "-");
+        printf("\t%zu\t%zu\n", b->body_offset, b->body_len);
+    }
+
+    for (size_t o = 0; o < map->output_count; o++) {
+        const RyftOutput *out = &map->outputs[o];
+        printf("output\t%zu\t", o + 1);
+        put_tsv(out->path);
+        putchar('\t');
+        put_tsv(out->lang[0] ? out->lang : "-");
+        printf("\t%d\t", out->block_count);
+        if (known[o]) {
+            printf("%zu\t%zu", out->size, out->lines);
+        } else {
+            printf("-\t-");
+        }
+        printf("\t%s\n", out->fallback ? "fallback" : sink_target(out->path) ? "pipe" : "-");
+    }
+}
+
+/* Print every block and output of a document as JSON or TSV */
+int list_file(const char *filepath, const char *format, RyftOptions *options)
+{
+    RyftIO *io = io_for(options);
+    const char *data;
+    size_t len;
+    if (!io_load(io, filepath, &data, &len)) {
+        log_error("error: cannot open '%s'\n", filepath);
+        return 1;
+    }
+
+    /* Compressed documents are decoded into memory first */
+    char *decoded = NULL;
+    bool compressed = input_detect((const unsigned char *)data, len) != INPUT_PLAIN;
+    if (compressed) {
+        io_unload(io, data, len);
+        if (!input_read_all(io, filepath, &decoded, &len)) {
+            return 1;
+        }
+        data = decoded;
+    }
+
+    RyftSourceMap map;
+    bool *known = NULL;
+    int rc = ryft_map_buffer_opts(data, len, filepath, 0, options, &map);
+    if (rc == 0) {
+        known = malloc((map.output_count + 1) * sizeof(bool));
+        if (!known) {
+            ryft_map_free(&map);
+            rc = 1;
+        }
+    }
+    if (rc != 0) {
+        log_error("error: out of memory\n");
+    } else {
+        sizes_known(&map, known);
+        if (strcmp(format, "tsv") == 0) {
+            list_tsv(&map, known);
+        } else {
+            list_json(filepath, &map, known);
+        }
+        free(known);
+        ryft_map_free(&map);
+    }
+
+    if (compressed) {
+        free(decoded);
+    } else {
+        io_unload(io, data, len);
+    }
+    return rc;
+}
@@ -0,0 +1,19 @@
+/*
+ * list.h - Machine-readable block and output listing (--list)
+ */
+
+#ifndef RYFT_LIST_H
+#define RYFT_LIST_H
+
+#include "types.h"
+
+/* Print every block and output of a document as JSON or TSV
+ * format: "json" or "tsv"
+ * Returns 0 on success, non-zero on error
+ */
+int list_file(const char *filepath, const char *format, RyftOptions *options);
+
+/* Check if format names a --list format */
+bool list_format(const char *format);
+
+#endif /* RYFT_LIST_H */
@@ -0,0 +1,114 @@
+/*
+ * lock.c - Advisory locks on outputs shared between ryft processes
+ *
+ * Locks belong to an open file description (Linux OFD locks, or flock()
+ * elsewhere) rather than to the process, so closing some other
+ * descriptor of the same file does not drop them, and two threads of
+ * one process exclude each other just as two processes do. The locked
+ * descriptor is opened without O_TRUNC: the output is only truncated
+ * once the lock is held. The POSIX backend then writes through that
+ * same descriptor (io_open_locked()), so each output costs one.
+ */
+
+#define _GNU_SOURCE
+
+#include "lock.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef F_OFD_SETLK
+#include <sys/file.h>
+#endif
+
+/* One attempt at the lock, blocking if wait is set */
+static int try_lock(int fd, bool wait)
+{
+#ifdef F_OFD_SETLK
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    int rc = fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &fl);
+    if (rc != 0 && errno == EACCES) {
+        errno = EWOULDBLOCK;
+    }
+    return rc;
+#else
+    return flock(fd, LOCK_EX | (wait ? 0 : LOCK_NB));
+#endif
+}
+
+/* Wait for a lock another process holds
+ * Returns false with errno EWOULDBLOCK on timeout
+ */
+static bool wait_lock(int fd, int timeout_ms)
+{
+    if (timeout_ms < 0) {
+        while (try_lock(fd, true) != 0) {
+            if (errno != EINTR) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct timespec pause = { 0, LOCK_POLL_MS * 1000000L };
+    for (int waited = 0; waited < timeout_ms; waited += LOCK_POLL_MS) {
+        nanosleep(&pause, NULL);
+        if (try_lock(fd, false) == 0) {
+            return true;
+        }
+        if (errno != EWOULDBLOCK && errno != EINTR) {
+            return false;
+        }
+    }
+    errno = EWOULDBLOCK;
+    return false;
+}
+
+/* Lock an output for writing, creating it if needed */
+int lock_output(const char *path, bool no_wait, int timeout_ms, bool verbose)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        log_error("error: cannot create '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (try_lock(fd, false) == 0) {
+        return fd;
+    }
+
+    if (errno == EWOULDBLOCK && no_wait) {
+        log_error("error: '%s' is being written by another process\n", path);
+    } else if (errno == EWOULDBLOCK) {
+        if (verbose) {
+            log_info("  waiting for: %s\n", path);
+            log_flush();
+        }
+        if (wait_lock(fd, timeout_ms)) {
+            return fd;
+        }
+        if (errno == EWOULDBLOCK) {
+            log_error("error: timed out waiting for '%s' (its writer may be "
+                      "waiting for an output locked here)\n", path);
+        } else {
+            log_error("error: cannot lock '%s': %s\n", path, strerror(errno));
+        }
+    } else {
+        log_error("error: cannot lock '%s': %s\n", path, strerror(errno));
+    }
+    close(fd);
+    return -1;
+}
+
+/* Release an output's lock */
+void lock_release(int fd)
+{
+    close(fd);
+}
@@ -0,0 +1,22 @@
+/*
+ * lock.h - Advisory locks on outputs shared between ryft processes
+ */
+
+#ifndef RYFT_LOCK_H
+#define RYFT_LOCK_H
+
+#include <stdbool.h>
+
+#define LOCK_POLL_MS 10        /* retry interval of a bounded wait */
+
+/* Lock an output for writing, creating it (never truncating it) if
+ * needed. An output another process is writing is waited for, up to
+ * timeout_ms (-1 for as long as it takes), unless no_wait is set
+ * Returns the lock descriptor, or -1 after reporting why not
+ */
+int lock_output(const char *path, bool no_wait, int timeout_ms, bool verbose);
+
+/* Release an output's lock */
+void lock_release(int fd);
+
+#endif /* RYFT_LOCK_H */
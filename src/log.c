@@ -0,0 +1,223 @@
+/*
+ * log.c - Leveled, buffered logging
+ *
+ * Verbose runs print a line or more per block and per output, so stdout
+ * is fully buffered (main() sets it up) and flushed at document
+ * boundaries instead of at every newline, which on a terminal used to
+ * cost more than the extraction itself. Errors and warnings stay
+ * unbuffered on stderr, but flush stdout first, so the two streams still
+ * interleave in the order messages were logged.
+ *
+ * Most messages use only %s, %d and %zu; those are put together by hand
+ * rather than through vprintf(), whose general machinery is most of what
+ * a verbose line costs.
+ *
+ * Worker threads log into a LogSink of their own, which the thread that
+ * started them drains after joining, in job order: output never depends
+ * on how the threads were scheduled.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_RECORD 1024        /* longest message kept in a sink */
+
+static pthread_key_t log_key;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+
+static void log_key_init(void)
+{
+    pthread_key_create(&log_key, NULL);
+}
+
+/* Buffer stdout fully */
+void log_init(void)
+{
+    setvbuf(stdout, NULL, _IOFBF, LOG_BUFFER);
+}
+
+/* Write one finished message to its stream */
+static void log_emit(LogLevel level, const char *text)
+{
+    if (level <= LOG_WARN) {
+        fflush(stdout);
+        fputs(text, stderr);
+    } else {
+        fputs(text, stdout);
+    }
+}
+
+/* Check if fmt uses only the conversions plain_write() handles:
+ * %s, %d, %ld, %zu and %%
+ */
+static bool plain_format(const char *fmt)
+{
+    for (const char *p = fmt; (p = strchr(p, '%')) != NULL; p++) {
+        p++;
+        if (p[0] == 'z' && p[1] == 'u') {
+            p++;
+        } else if (p[0] == 'l' && p[1] == 'd') {
+            p++;
+        } else if (p[0] != 's' && p[0] != 'd' && p[0] != '%') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Digits of v (negative if neg), written backwards from end
+ * Returns where they start
+ */
+static char *put_number(char *end, unsigned long long v, bool neg)
+{
+    char *p = end;
+    do {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (neg) {
+        *--p = '-';
+    }
+    return p;
+}
+
+/* Write a message whose format plain_format() accepts, in one fwrite() */
+static void plain_write(FILE *out, const char *fmt, va_list ap)
+{
+    char buf[LOG_RECORD];
+    size_t len = 0;
+
+    for (const char *p = fmt; *p; p++) {
+        char num[24];
+        const char *piece;
+        size_t n;
+
+        if (*p != '%') {
+            piece = p;
+            n = strcspn(p, "%");
+            p += n - 1;
+        } else if (*++p == '%') {
+            piece = "%";
+            n = 1;
+        } else if (*p == 's') {
+            piece = va_arg(ap, const char *);
+            if (!piece) piece = "(null)";
+            n = strlen(piece);
+        } else {
+            char *end = num + sizeof(num);
+            if (*p == 'z') {
+                piece = put_number(end, va_arg(ap, size_t), false);
+                p++;
+            } else {
+                long v = *p == 'l' ? va_arg(ap, long) : va_arg(ap, int);
+                unsigned long long mag = v < 0 ? 0ULL - (unsigned long long)v
+                                               : (unsigned long long)v;
+                piece = put_number(end, mag, v < 0);
+                p += *p == 'l';
+            }
+            n = (size_t)(end - piece);
+        }
+
+        if (len + n > sizeof(buf)) {
+            fwrite(buf, 1, len, out);
+            len = 0;
+            if (n > sizeof(buf)) {
+                fwrite(piece, 1, n, out);
+                continue;
+            }
+        }
+        memcpy(buf + len, piece, n);
+        len += n;
+    }
+    fwrite(buf, 1, len, out);
+}
+
+/* Append a record to sink */
+static void sink_append(LogSink *sink, LogLevel level, const char *fmt, va_list ap)
+{
+    char text[LOG_RECORD];
+    int n = vsnprintf(text, sizeof(text), fmt, ap);
+    if (n < 0) {
+        return;
+    }
+    size_t len = (size_t)n < sizeof(text) ? (size_t)n : sizeof(text) - 1;
+
+    if (sink->len + len + 2 > sink->cap) {
+        size_t cap = sink->cap ? sink->cap * 2 : 4096;
+        while (cap < sink->len + len + 2) cap *= 2;
+        char *data = realloc(sink->data, cap);
+        if (!data) {
+            sink->failed = 1;
+            return;
+        }
+        sink->data = data;
+        sink->cap = cap;
+    }
+    sink->data[sink->len++] = (char)('0' + level);
+    memcpy(sink->data + sink->len, text, len);
+    sink->len += len;
+    sink->data[sink->len++] = '\0';
+}
+
+/* Write one message */
+void log_write(LogLevel level, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+
+    pthread_once(&log_once, log_key_init);
+    LogSink *sink = pthread_getspecific(log_key);
+    if (sink) {
+        sink_append(sink, level, fmt, ap);
+    } else if (level <= LOG_WARN) {
+        fflush(stdout);
+        vfprintf(stderr, fmt, ap);
+    } else if (plain_format(fmt)) {
+        plain_write(stdout, fmt, ap);
+    } else {
+        vprintf(fmt, ap);
+    }
+    va_end(ap);
+}
+
+/* Make buffered messages visible */
+void log_flush(void)
+{
+    fflush(stdout);
+}
+
+/* Send the calling thread's messages to sink */
+void log_begin(LogSink *sink)
+{
+    pthread_once(&log_once, log_key_init);
+    pthread_setspecific(log_key, sink);
+}
+
+/* Stop sending the calling thread's messages to its sink */
+void log_end(void)
+{
+    pthread_once(&log_once, log_key_init);
+    pthread_setspecific(log_key, NULL);
+}
+
+/* Write out and free the messages held in sink */
+void log_drain(LogSink *sink)
+{
+    for (size_t pos = 0; pos < sink->len; ) {
+        const char *text = sink->data + pos + 1;
+        log_emit((LogLevel)(sink->data[pos] - '0'), text);
+        pos += strlen(text) + 2;
+    }
+    if (sink->failed) {
+        log_emit(LOG_WARN, "warning: some messages were lost (out of memory)\n");
+    }
+    free(sink->data);
+    memset(sink, 0, sizeof(*sink));
+}
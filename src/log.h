@@ -0,0 +1,68 @@
+/*
+ * log.h - Leveled, buffered logging
+ */
+
+#ifndef RYFT_LOG_H
+#define RYFT_LOG_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef enum {
+    LOG_ERROR,                 /* stderr, "error: ..." */
+    LOG_WARN,                  /* stderr, "warning: ..." */
+    LOG_INFO,                  /* stdout: files written, documents processed */
+    LOG_DEBUG                  /* stdout: per-block and per-config-key detail */
+} LogLevel;
+
+/* Messages logged by one thread while it is the only one holding the sink */
+typedef struct {
+    char *data;                /* records: level byte, text, '\0' */
+    size_t len;
+    size_t cap;
+    int failed;                /* a record was dropped for lack of memory */
+} LogSink;
+
+#if defined(__GNUC__)
+#define LOG_FORMAT(a, b) __attribute__((format(printf, a, b)))
+#else
+#define LOG_FORMAT(a, b)
+#endif
+
+#define LOG_BUFFER 65536       /* stdout buffer */
+
+/* Buffer stdout fully; call before anything is written to it */
+void log_init(void);
+
+/* Write one message. Errors and warnings go to stderr at once, after
+ * everything logged before them; info and debug messages are buffered on
+ * stdout until log_flush().
+ */
+void log_write(LogLevel level, const char *fmt, ...) LOG_FORMAT(2, 3);
+
+#define log_error(...) log_write(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) log_write(LOG_WARN, __VA_ARGS__)
+#define log_info(...) log_write(LOG_INFO, __VA_ARGS__)
+
+/* Debug messages compile away entirely with make NO_DEBUG_LOG=1; the
+ * arguments are still type-checked, but never evaluated
+ */
+#ifdef RYFT_NO_DEBUG_LOG
+#define log_debug(...) ((void)(0 && printf(__VA_ARGS__)))
+#else
+#define log_debug(...) log_write(LOG_DEBUG, __VA_ARGS__)
+#endif
+
+/* Make buffered messages visible: at document boundaries, before waiting,
+ * and before starting a process that shares stdout
+ */
+void log_flush(void);
+
+/* Send the calling thread's messages to sink until log_end() */
+void log_begin(LogSink *sink);
+void log_end(void);
+
+/* Write out and free the messages held in sink, in the order logged */
+void log_drain(LogSink *sink);
+
+#endif /* RYFT_LOG_H */
@@ -5,12 +5,23 @@
  * into source/config files.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "types.h"
 #include "config.h"
+#include "list.h"
+#include "log.h"
 #include "process.h"
+#include "project.h"
+#include "tags.h"
+#include "trace.h"
+#include "untangle.h"
+#include "util.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 
 #ifndef RYFT_VERSION
 #define RYFT_VERSION "dev"
@@ -19,6 +30,7 @@
 static void usage(const char *prog)
 {
     fprintf(stderr, "usage: %s [options] <markdown-file>\n", prog);
+    fprintf(stderr, "       %s [options] --project <manifest>\n", prog);
     fprintf(stderr, "\nExtracts code blocks from markdown files.\n");
     fprintf(stderr, "\nOptions:\n");
     fprintf(stderr, "  -b, --backup     Create timestamped backup before overwriting\n");
@@ -26,15 +38,62 @@ static void usage(const char *prog)
     fprintf(stderr, "  -s, --summary    Print detailed summary after processing\n");
     fprintf(stderr, "  -S, --strict     Strict mode: fail on warnings\n");
     fprintf(stderr, "  -v, --verbose    Verbose output (includes summary)\n");
+    fprintf(stderr, "  --only PATTERN   Only write outputs matching path or glob (repeatable)\n");
+    fprintf(stderr, "  --index          Keep a sidecar block index for fast --only runs\n");
+    fprintf(stderr, "  -D, --define N=V Set variable N, for ${N} in vars=on blocks\n");
+    fprintf(stderr, "  -t, --tags LIST  Tags for if= blocks (e.g. linux,x86)\n");
+    fprintf(stderr, "  --matrix SETS    Write each tag set (a,b;c;...) under its own directory\n");
+    fprintf(stderr, "  -j, --jobs N     Scan large documents with N threads, run N exec= blocks at once\n");
+    fprintf(stderr, "  --check          Report outputs that differ from the document (exit 2)\n");
+    fprintf(stderr, "  --diff           Show a unified diff of what would change, write nothing\n");
+    fprintf(stderr, "  --diff-stat      Like --diff, but only count changed lines per output\n");
+    fprintf(stderr, "  --in-place       Rewrite only the changed parts of existing outputs\n");
+    fprintf(stderr, "  --fingerprint L  Start outputs in languages L (c,py or all) with a hash header\n");
+    fprintf(stderr, "  --no-wait        Fail instead of waiting for outputs another ryft is writing\n");
+    fprintf(stderr, "  --max-memory N   Spill output buffers past N bytes (K, M, G) to temp files\n");
+    fprintf(stderr, "  --io-uring       Write outputs in batches through io_uring (Linux)\n");
+    fprintf(stderr, "  --untangle       Copy edits made in outputs back into the markdown\n");
+    fprintf(stderr, "  --list           Print blocks and outputs without writing anything\n");
+    fprintf(stderr, "  --format FMT     Format for --list: json (default) or tsv\n");
+    fprintf(stderr, "  --project FILE   Tangle every document listed in FILE, merging shared outputs\n");
+    fprintf(stderr, "  --resume         With --project, skip outputs an interrupted run wrote\n");
+    fprintf(stderr, "  --trace FILE     Write Chrome trace events for the run to FILE\n");
     fprintf(stderr, "  -V, --version    Show version information\n");
     fprintf(stderr, "  -h, --help       Show this help message\n");
 }
 
+/* Every output holds a descriptor until the end of the run, and a
+ * reference doc can have thousands: allow as many as the hard limit does
+ */
+static void raise_file_limit(void)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     const char *input_file = NULL;
+    const char *manifest = NULL;
+    const char *trace = NULL;
+    bool untangle = false;
+    bool list = false;
+    bool io_uring = false;
+    const char *format = NULL;
     RyftOptions cli_options = {0};  /* Track what CLI explicitly set */
 
+    log_init();
+
+    const char **only = malloc((size_t)argc * sizeof(*only));
+    if (!only) {
+        log_error("error: out of memory\n");
+        return 1;
+    }
+    g_options.only = only;
+
     /* Parse arguments first so we know if verbose is set */
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--backup") == 0) {
@@ -52,6 +111,115 @@ int main(int argc, char *argv[])
         } else if (strcmp(argv[i], "-S") == 0 || strcmp(argv[i], "--strict") == 0) {
             g_options.strict_mode = true;
             cli_options.strict_mode = true;
+        } else if (strcmp(argv[i], "--only") == 0) {
+            if (i + 1 >= argc) {
+                log_error("error: '%s' requires an argument\n", argv[i]);
+                return 1;
+            }
+            only[g_options.only_count++] = argv[++i];
+        } else if (strcmp(argv[i], "-D") == 0 || strcmp(argv[i], "--define") == 0) {
+            if (i + 1 >= argc) {
+                log_error("error: '%s' requires an argument\n", argv[i]);
+                return 1;
+            }
+            if (!var_define(&g_vars, argv[++i])) {
+                log_error("error: invalid variable definition '%s' (expected NAME=value)\n",
+                          argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--tags") == 0) {
+            if (i + 1 >= argc) {
+                log_error("error: '%s' requires an argument\n", argv[i]);
+                return 1;
+            }
+            g_options.tags = argv[++i];
+        } else if (strcmp(argv[i], "--matrix") == 0) {
+            if (i + 1 >= argc) {
+                log_error("error: '%s' requires an argument\n", argv[i]);
+                return 1;
+            }
+            g_options.matrix = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) {
+            if (i + 1 >= argc) {
+                log_error("error: '%s' requires an argument\n", argv[i]);
+                return 1;
+            }
+            char *end;
+            long jobs = strtol(argv[++i], &end, 10);
+            if (*end || jobs < 1 || jobs > 256) {
+                log_error("error: invalid job count '%s' (expected 1-256)\n", argv[i]);
+                return 1;
+            }
+            g_options.jobs = (int)jobs;
+        } else if (strcmp(argv[i], "--no-wait") == 0) {
+            g_options.no_wait = true;
+            cli_options.no_wait = true;
+        } else if (strcmp(argv[i], "--max-memory") == 0) {
+            if (i + 1 >= argc) {
+                log_error("error: '%s' requires an argument\n", argv[i]);
+                return 1;
+            }
+            if (!parse_size(argv[++i], &g_options.max_memory) || g_options.max_memory == 0) {
+                log_error("error: invalid size '%s' (expected e.g. 512K, 64M, 1G)\n",
+                          argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            io_uring = true;
+        } else if (strcmp(argv[i], "--untangle") == 0) {
+            untangle = true;
+        } else if (strcmp(argv[i], "--list") == 0) {
+            list = true;
+        } else if (strcmp(argv[i], "--format") == 0 || strncmp(argv[i], "--format=", 9) == 0) {
+            if (argv[i][8] == '=') {
+                format = argv[i] + 9;
+            } else if (i + 1 >= argc) {
+                log_error("error: '%s' requires an argument\n", argv[i]);
+                return 1;
+            } else {
+                format = argv[++i];
+            }
+            if (!list_format(format)) {
+                log_error("error: invalid format '%s' (expected json or tsv)\n", format);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--check") == 0) {
+            g_options.check = true;
+            cli_options.check = true;
+        } else if (strcmp(argv[i], "--diff") == 0 || strcmp(argv[i], "--diff-stat") == 0) {
+            g_options.check = true;
+            g_options.diff = true;
+            cli_options.check = true;
+            if (argv[i][6] == '-') {
+                g_options.diff_stat = true;
+            }
+        } else if (strcmp(argv[i], "--fingerprint") == 0) {
+            if (i + 1 >= argc) {
+                log_error("error: '%s' requires an argument\n", argv[i]);
+                return 1;
+            }
+            g_options.fingerprint = argv[++i];
+            cli_options.fingerprint = argv[i];
+        } else if (strcmp(argv[i], "--in-place") == 0) {
+            g_options.in_place = true;
+            cli_options.in_place = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            if (i + 1 >= argc) {
+                log_error("error: '%s' requires an argument\n", argv[i]);
+                return 1;
+            }
+            trace = argv[++i];
+        } else if (strcmp(argv[i], "--project") == 0) {
+            if (i + 1 >= argc) {
+                log_error("error: '%s' requires an argument\n", argv[i]);
+                return 1;
+            }
+            manifest = argv[++i];
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            g_options.resume = true;
+        } else if (strcmp(argv[i], "--index") == 0) {
+            g_options.index = true;
+            cli_options.index = true;
         } else if (strcmp(argv[i], "-V") == 0 || strcmp(argv[i], "--version") == 0) {
             printf("ryft %s\n", RYFT_VERSION);
             return 0;
@@ -59,33 +227,105 @@ int main(int argc, char *argv[])
             usage(argv[0]);
             return 0;
         } else if (argv[i][0] == '-') {
-            fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
+            log_error("error: unknown option '%s'\n", argv[i]);
             usage(argv[0]);
             return 1;
         } else {
             if (input_file) {
-                fprintf(stderr, "error: multiple input files not supported\n");
+                log_error("error: multiple input files not supported\n");
                 return 1;
             }
             input_file = argv[i];
         }
     }
 
-    if (!input_file) {
+    if (g_options.check && untangle) {
+        log_error("error: --check cannot be combined with --untangle\n");
+        return 1;
+    }
+    if (list && (g_options.check || untangle || manifest || g_options.matrix)) {
+        log_error("error: --list cannot be combined with --check, --untangle, --project "
+                  "or --matrix\n");
+        return 1;
+    }
+    if (format && !list) {
+        log_error("error: --format requires --list\n");
+        return 1;
+    }
+    if (g_options.diff && (untangle || manifest)) {
+        log_error("error: --diff cannot be combined with --untangle or --project\n");
+        return 1;
+    }
+    if (g_options.resume && (!manifest || g_options.check)) {
+        log_error("error: --resume requires --project and cannot be combined with --check\n");
+        return 1;
+    }
+    if (g_options.fingerprint && manifest) {
+        log_error("error: --fingerprint cannot be combined with --project\n");
+        return 1;
+    }
+    if (manifest && (input_file || untangle)) {
+        log_error("error: --project does not take a markdown file\n");
+        return 1;
+    }
+    if (!input_file && !manifest) {
         usage(argv[0]);
         return 1;
     }
 
+    /* Mapped modes evaluate if= blocks too, so reject a bad list up front */
+    TagRegistry tags = {0};
+    uint64_t tag_set;
+    if (g_options.tags &&
+        !tag_parse_set(&tags, g_options.tags, strlen(g_options.tags), &tag_set)) {
+        log_error("error: invalid tag list '%s'\n", g_options.tags);
+        return 1;
+    }
+
+    if (trace && !trace_open(trace)) {
+        return 1;
+    }
+
     /* Load global config from ~/.config/ryft/config */
     char global_config_path[MAX_PATH];
     get_global_config_path(global_config_path, sizeof(global_config_path));
 
     if (global_config_path[0]) {
         RyftConfig global_config = {0};
+        global_config.vars = &g_vars;
         if (load_config_file(global_config_path, &global_config, &g_options, g_options.verbose)) {
             apply_config(&global_config, &cli_options, &g_options);
         }
     }
 
-    return process_file(input_file, &cli_options);
+    raise_file_limit();
+
+    /* Where io_uring cannot be used, outputs are written as usual */
+    RyftIO *uring = NULL;
+    if (io_uring) {
+        uring = ryft_io_uring();
+        if (uring) {
+            g_options.io = uring;
+        } else if (g_options.verbose) {
+            log_info("io_uring unavailable, writing outputs synchronously\n");
+        }
+    }
+
+    int rc;
+    if (manifest) {
+        rc = project_run(manifest, &g_options);
+    } else if (list) {
+        rc = list_file(input_file, format ? format : "json", &g_options);
+    } else if (untangle) {
+        rc = untangle_file(input_file, &g_options);
+    } else {
+        rc = process_file(input_file, &cli_options);
+    }
+
+    ryft_io_free(uring);
+
+    if (!trace_close() && rc == 0) {
+        rc = 1;
+    }
+    return rc;
 }
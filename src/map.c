@@ -0,0 +1,451 @@
+/*
+ * map.c - In-memory block/source map
+ *
+ * Walks a document held in memory with the same fence and target rules
+ * as process_file(), recording where every block lands in its output
+ * instead of writing anything.
+ */
+
+#include "types.h"
+#include "config.h"
+#include "io.h"
+#include "markdown.h"
+#include "output.h"
+#include "place.h"
+#include "tags.h"
+#include "transform.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Blank line added after a block closed with 4+ backticks */
+static const char blank_line[] = "\n";
+
+/* Copy one line into a NUL-terminated buffer for the line parsers */
+static void copy_line(const char *p, size_t len, char *out, size_t out_size)
+{
+    if (len >= out_size) {
+        len = out_size - 1;
+    }
+    memcpy(out, p, len);
+    out[len] = '\0';
+}
+
+/* Make room for one more item in a growable array */
+static bool reserve(void **items, size_t count, size_t *cap, size_t item_size)
+{
+    if (count < *cap) {
+        return true;
+    }
+
+    size_t new_cap = *cap ? *cap * 2 : 16;
+    void *p = realloc(*items, new_cap * item_size);
+    if (!p) {
+        return false;
+    }
+    *items = p;
+    *cap = new_cap;
+    return true;
+}
+
+/* Count lines in a block body (a trailing partial line counts) */
+static size_t count_lines(const char *p, size_t len)
+{
+    size_t lines = 0;
+    const char *end = p + len;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        lines++;
+        if (!nl) break;
+        p = nl + 1;
+    }
+    return lines;
+}
+
+/* Find or create output entry, mirroring get_output_file() */
+static int map_output(RyftSourceMap *map, size_t *cap, const char *path)
+{
+    char expanded[MAX_PATH];
+    if (!expand_path(path, expanded, sizeof(expanded))) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < map->output_count; i++) {
+        if (strcmp(map->outputs[i].path, expanded) == 0) {
+            return (int)i;
+        }
+    }
+
+    if (!reserve((void **)&map->outputs, map->output_count, cap, sizeof(RyftOutput))) {
+        return -1;
+    }
+
+    RyftOutput *out = &map->outputs[map->output_count];
+    memset(out, 0, sizeof(*out));
+    snprintf(out->path, sizeof(out->path), "%s", expanded);
+
+    return (int)map->output_count++;
+}
+
+/* Append a span to an output (capacity doubles at powers of two) */
+static bool add_span(RyftOutput *out, const char *ptr, size_t len)
+{
+    size_t n = out->span_count;
+
+    if (n == 0 || (n & (n - 1)) == 0) {
+        RyftSpan *p = realloc(out->spans, (n ? n * 2 : 1) * sizeof(RyftSpan));
+        if (!p) {
+            return false;
+        }
+        out->spans = p;
+    }
+
+    out->spans[n].ptr = ptr;
+    out->spans[n].len = len;
+    out->span_count++;
+    return true;
+}
+
+/* Whether an if= condition holds for a tag set (malformed: excluded) */
+static bool cond_holds(TagRegistry *tags, const char *cond, uint64_t set)
+{
+    TagPredicate pred = {0};
+    return tag_compile(tags, cond, &pred) && tag_match(&pred, set);
+}
+
+/* Place a finished block into its output
+ * closing is the closing fence backtick count, 0 if unclosed
+ */
+static bool place_block(RyftSourceMap *map, RyftBlock *b, const char *buf,
+                        int closing, unsigned flags)
+{
+    if (b->output < 0) {
+        return true;
+    }
+
+    RyftOutput *out = &map->outputs[b->output];
+
+    /* exec= and transformed blocks are counted, but the text they write
+     * is not known until the run */
+    if (b->kind == RYFT_BLOCK_EXEC || b->transformed) {
+        if (b->body_len > 0 && b->lang[0] && !out->lang[0]) {
+            snprintf(out->lang, sizeof(out->lang), "%s", b->lang);
+        }
+        if (closing > 0) {
+            out->block_count++;
+        }
+        return true;
+    }
+
+    b->out_offset = out->size;
+    b->out_line = out->lines + 1;
+    b->out_lines = count_lines(buf + b->body_offset, b->body_len);
+
+    if (b->body_len > 0) {
+        /* Output language comes from the first block actually written */
+        if (b->lang[0] && !out->lang[0]) {
+            snprintf(out->lang, sizeof(out->lang), "%s", b->lang);
+        }
+        if ((flags & RYFT_MAP_SPANS) && !add_span(out, buf + b->body_offset, b->body_len)) {
+            return false;
+        }
+        out->size += b->body_len;
+        out->lines += b->out_lines;
+    }
+
+    if (closing == 0) {
+        return true;  /* Unclosed block is written but not counted */
+    }
+    out->block_count++;
+
+    /* Blank line only once the output has been opened */
+    if (closing >= 4 && out->size > 0) {
+        if ((flags & RYFT_MAP_SPANS) && !add_span(out, blank_line, 1)) {
+            return false;
+        }
+        out->size++;
+        out->lines++;
+    }
+
+    return true;
+}
+
+/* A mapped block's share of its output: its body and any blank line after it */
+typedef struct {
+    size_t size;
+    size_t lines;
+    size_t span;               /* first span */
+    size_t span_count;
+} MapPiece;
+
+/* Put the blocks of one output in placement order (order=, before=,
+ * after=); each mapped block's piece moves with it, the same pieces
+ * process_file() moves
+ */
+static bool place_output(RyftSourceMap *map, size_t o, const Placement *places,
+                         unsigned flags)
+{
+    RyftOutput *out = &map->outputs[o];
+    size_t count = 0;
+    bool moves = false;
+
+    for (size_t i = 0; i < map->block_count; i++) {
+        if (map->blocks[i].output == (int)o) {
+            count++;
+            moves = moves || place_moves(&places[i]);
+        }
+    }
+    if (!moves) {
+        return true;
+    }
+
+    size_t *members = malloc(count * sizeof(size_t));
+    const Placement **blocks = malloc(count * sizeof(*blocks));
+    size_t *order = malloc(count * sizeof(size_t));
+    PlaceStatus *status = malloc(count * sizeof(PlaceStatus));
+    MapPiece *pieces = calloc(count, sizeof(MapPiece));
+    RyftSpan *spans = (flags & RYFT_MAP_SPANS) ? malloc(out->span_count * sizeof(RyftSpan) + 1) : NULL;
+    bool ok = members && blocks && order && status && pieces &&
+              (spans || !(flags & RYFT_MAP_SPANS));
+
+    size_t k = 0;
+    for (size_t i = 0; ok && i < map->block_count; i++) {
+        if (map->blocks[i].output == (int)o) {
+            members[k] = i;
+            blocks[k++] = &places[i];
+        }
+    }
+    ok = ok && place_order(blocks, count, order, status);
+
+    /* Measure the pieces in document order; a piece runs to the next
+     * mapped block of the output */
+    size_t span = 0;
+    for (size_t j = 0; ok && j < count; j++) {
+        const RyftBlock *b = &map->blocks[members[j]];
+        if (b->kind != RYFT_BLOCK_CODE || b->transformed) continue;
+
+        size_t next_offset = out->size;
+        size_t next_line = out->lines + 1;
+        for (size_t m = j + 1; m < count; m++) {
+            const RyftBlock *nb = &map->blocks[members[m]];
+            if (nb->kind == RYFT_BLOCK_CODE && !nb->transformed) {
+                next_offset = nb->out_offset;
+                next_line = nb->out_line;
+                break;
+            }
+        }
+        pieces[j].size = next_offset - b->out_offset;
+        pieces[j].lines = next_line - b->out_line;
+        pieces[j].span = span;
+
+        size_t taken = 0;
+        while ((flags & RYFT_MAP_SPANS) && taken < pieces[j].size && span < out->span_count) {
+            taken += out->spans[span++].len;
+        }
+        pieces[j].span_count = span - pieces[j].span;
+    }
+
+    /* Lay the pieces out again in placement order */
+    size_t offset = 0;
+    size_t line = 1;
+    size_t n = 0;
+    for (size_t j = 0; ok && j < count; j++) {
+        size_t m = order[j];
+        RyftBlock *b = &map->blocks[members[m]];
+        if (b->kind != RYFT_BLOCK_CODE || b->transformed) continue;
+
+        b->out_offset = offset;
+        b->out_line = line;
+        offset += pieces[m].size;
+        line += pieces[m].lines;
+        if (spans) {
+            memcpy(spans + n, out->spans + pieces[m].span, pieces[m].span_count * sizeof(RyftSpan));
+            n += pieces[m].span_count;
+        }
+    }
+    if (ok && spans) {
+        free(out->spans);
+        out->spans = spans;
+        spans = NULL;
+    }
+
+    free(members);
+    free(blocks);
+    free(order);
+    free(status);
+    free(pieces);
+    free(spans);
+    return ok;
+}
+
+/* Map a markdown document held in memory with default options */
+int ryft_map_buffer(const char *buf, size_t len, const char *name,
+                    unsigned flags, RyftSourceMap *map)
+{
+    return ryft_map_buffer_opts(buf, len, name, flags, NULL, map);
+}
+
+/* Map a markdown document held in memory, without writing anything */
+int ryft_map_buffer_opts(const char *buf, size_t len, const char *name, unsigned flags,
+                         const RyftOptions *opts, RyftSourceMap *map)
+{
+    RyftIO *io = opts ? io_for(opts) : ryft_io_posix();
+    memset(map, 0, sizeof(*map));
+
+    /* Tags if= conditions are evaluated against */
+    TagRegistry tags = {0};
+    uint64_t tag_set = 0;
+    const char *tag_list = opts ? opts->tags : NULL;
+    if (tag_list && !tag_parse_set(&tags, tag_list, strlen(tag_list), &tag_set)) {
+        return 1;
+    }
+    size_t block_cap = 0;
+    size_t output_cap = 0;
+
+    RyftConfig doc_config = {0};
+
+    char default_basename[MAX_FILENAME];
+    get_basename_no_ext(name ? name : "untitled", default_basename, sizeof(default_basename));
+
+    char line[MAX_LINE];
+    FenceInfo current = {0};
+    int current_output = -1;
+    RyftBlock *block = NULL;
+    size_t lineno = 0;
+
+    /* Placement of each block, beside map->blocks */
+    Placement *places = NULL;
+    size_t place_cap = 0;
+
+    const char *p = buf;
+    const char *end = buf + len;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t n = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+        lineno++;
+
+        if (!block) {
+            /* Check for opening fence */
+            if (fence_line(p, n)) {
+                copy_line(p, n, line, sizeof(line));
+                current = parse_fence(line);
+
+                if (!reserve((void **)&map->blocks, map->block_count, &block_cap, sizeof(RyftBlock)) ||
+                    !reserve((void **)&places, map->block_count, &place_cap, sizeof(Placement))) {
+                    goto fail;
+                }
+                char bad[MAX_PLACE];
+                memset(&places[map->block_count], 0, sizeof(Placement));
+                if (current.place[0]) {
+                    place_parse(&places[map->block_count], current.place, bad, sizeof(bad));
+                }
+                block = &map->blocks[map->block_count++];
+                memset(block, 0, sizeof(*block));
+                block->output = -1;
+                block->fence_line = lineno;
+                block->body_offset = (size_t)(p + n - buf);
+                snprintf(block->lang, sizeof(block->lang), "%s", current.lang);
+
+                if (current.is_display) {
+                    block->kind = RYFT_BLOCK_DISPLAY;
+                } else if (current.is_config) {
+                    block->kind = RYFT_BLOCK_CONFIG;
+                } else if (current.cond[0] && !(flags & RYFT_MAP_UNCONDITIONAL) &&
+                           !cond_holds(&tags, current.cond, tag_set)) {
+                    /* Not written: the current target is left as it was */
+                    block->excluded = true;
+                } else if (current.filename[0]) {
+                    /* Explicit filename - switch to this target */
+                    current_output = map_output(map, &output_cap, current.filename);
+                    if (current_output < 0) goto fail;
+                } else if (current_output < 0) {
+                    /* No current target, use fallback */
+                    char fallback[MAX_PATH];
+                    get_fallback_path(&doc_config, io, default_basename, current.lang,
+                                      fallback, sizeof(fallback));
+                    current_output = map_output(map, &output_cap, fallback);
+                    if (current_output < 0) goto fail;
+                    map->outputs[current_output].fallback = true;
+                } else {
+                    block->continuation = true;
+                }
+
+                if (block->kind == RYFT_BLOCK_CODE) {
+                    TransformSpec transform = doc_config.transform;
+                    char bad[MAX_TRANSFORM];
+                    transform_overlay(&transform, current.transform, bad, sizeof(bad));
+
+                    block->output = block->excluded ? -1 : current_output;
+                    block->transformed = transform_enabled(&transform);
+                    block->conditional = current.cond[0] != '\0';
+                    block->expands = doc_config.expand_vars;
+                    if (current.vars[0]) {
+                        parse_bool(current.vars, &block->expands);
+                    }
+                    if (current.exec[0]) {
+                        block->kind = RYFT_BLOCK_EXEC;
+                    }
+                }
+            }
+        } else {
+            /* Check for closing fence */
+            int closing_backticks = 0;
+            if (fence_line(p, n)) {
+                copy_line(p, n, line, sizeof(line));
+                closing_backticks = get_closing_fence_backticks(line, current.backtick_count);
+            }
+
+            if (closing_backticks > 0) {
+                block->close_line = lineno;
+                block->body_len = (size_t)(p - buf) - block->body_offset;
+                if (!place_block(map, block, buf, closing_backticks, flags)) {
+                    goto fail;
+                }
+                block = NULL;
+            } else if (current.is_config) {
+                copy_line(p, n, line, sizeof(line));
+                parse_config_line(line, &doc_config, NULL);
+            }
+        }
+
+        p += n;
+    }
+
+    /* Unclosed block runs to end of buffer */
+    if (block) {
+        block->body_len = len - block->body_offset;
+        if (!place_block(map, block, buf, 0, flags)) {
+            goto fail;
+        }
+    }
+
+    for (size_t o = 0; o < map->output_count; o++) {
+        if (!place_output(map, o, places, flags)) {
+            goto fail;
+        }
+    }
+    free(places);
+    return 0;
+
+fail:
+    free(places);
+    ryft_map_free(map);
+    return 1;
+}
+
+/* Release memory owned by a source map */
+void ryft_map_free(RyftSourceMap *map)
+{
+    if (!map) return;
+
+    for (size_t i = 0; i < map->output_count; i++) {
+        free(map->outputs[i].spans);
+    }
+    free(map->outputs);
+    free(map->blocks);
+    memset(map, 0, sizeof(*map));
+}
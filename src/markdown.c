@@ -3,9 +3,20 @@
  */
 
 #include "markdown.h"
+#include "trace.h"
 
+#include <stdio.h>
 #include <string.h>
 
+/* Skip the indentation (up to FENCE_MAX_INDENT spaces) before a fence */
+const char *fence_start(const char *line)
+{
+    for (int i = 0; i < FENCE_MAX_INDENT && *line == ' '; i++) {
+        line++;
+    }
+    return line;
+}
+
 /* Count leading backticks in a line */
 int count_backticks(const char *line)
 {
@@ -17,11 +28,76 @@ int count_backticks(const char *line)
     return count;
 }
 
+/* Remove a name=value attribute from a fence's filename text, copying
+ * its value to out (left alone if the attribute is absent)
+ */
+static void take_attr(char *text, const char *name, char *out, size_t out_size)
+{
+    size_t name_len = strlen(name);
+    char *attr = text;
+    while ((attr = strstr(attr, name)) != NULL) {
+        if (attr == text || attr[-1] == ' ' || attr[-1] == '\t') {
+            break;
+        }
+        attr += name_len;
+    }
+    if (!attr) {
+        return;
+    }
+
+    const char *value = attr + name_len;
+    size_t len = strcspn(value, " \t");
+    size_t copy = len < out_size ? len : out_size - 1;
+    memcpy(out, value, copy);
+    out[copy] = '\0';
+
+    const char *rest = value + len;
+    memmove(attr, rest, strlen(rest) + 1);
+
+    /* Re-trim around the removed attribute */
+    size_t i = strlen(text);
+    while (i > 0 && (text[i-1] == ' ' || text[i-1] == '\t')) {
+        text[--i] = '\0';
+    }
+    char *start = text;
+    while (*start == ' ' || *start == '\t') start++;
+    memmove(text, start, strlen(start) + 1);
+}
+
+/* Remove the named attributes ("name=") from a fence's filename text,
+ * collecting them into out as "name=value ..."
+ */
+static void take_attrs(char *text, const char *const *names, size_t count,
+                       char *out, size_t out_size)
+{
+    for (size_t i = 0; i < count; i++) {
+        char value[MAX_PLACE];
+        value[0] = '\0';
+        take_attr(text, names[i], value, sizeof(value));
+        if (value[0]) {
+            size_t used = strlen(out);
+            snprintf(out + used, out_size - used, "%s%s%s", used ? " " : "", names[i], value);
+        }
+    }
+}
+
+/* Check if a fence's filename text has any of the named attributes */
+static bool has_attr(const char *text, const char *const *names, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (strstr(text, names[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Parse opening fence line: ```lang filename or ````lang etc */
-FenceInfo parse_fence(const char *line)
+static FenceInfo parse_fence_line(const char *line)
 {
     FenceInfo info = {0};
 
+    line = fence_start(line);
     info.backtick_count = count_backticks(line);
     if (info.backtick_count < 3) {
         return info;
@@ -66,6 +142,50 @@ FenceInfo parse_fence(const char *line)
         info.filename[--i] = '\0';
     }
 
+    /* A lone ```if=... has no language */
+    if (strncmp(info.lang, "if=", 3) == 0) {
+        size_t len = strlen(info.lang + 3);
+        if (len >= sizeof(info.cond)) {
+            len = sizeof(info.cond) - 1;
+        }
+        memcpy(info.cond, info.lang + 3, len);
+        info.cond[len] = '\0';
+        info.lang[0] = '\0';
+    }
+
+    /* Pull attributes out of the filename; most fences have none */
+    if (!strchr(info.filename, '=')) {
+        return info;
+    }
+    take_attr(info.filename, "if=", info.cond, sizeof(info.cond));
+    take_attr(info.filename, "exec=", info.exec, sizeof(info.exec));
+    take_attr(info.filename, "inputs=", info.inputs, sizeof(info.inputs));
+    take_attr(info.filename, "vars=", info.vars, sizeof(info.vars));
+
+    /* Transform and placement attributes are kept as "name=value ..." for
+     * the caller */
+    static const char *const transforms[] = { "dedent=", "eol=", "trim=", "tabs=" };
+    static const char *const places[] = { "id=", "order=", "before=", "after=" };
+    size_t transform_count = sizeof(transforms) / sizeof(transforms[0]);
+    size_t place_count = sizeof(places) / sizeof(places[0]);
+    if (has_attr(info.filename, transforms, transform_count)) {
+        take_attrs(info.filename, transforms, transform_count,
+                   info.transform, sizeof(info.transform));
+    }
+    if (has_attr(info.filename, places, place_count)) {
+        take_attrs(info.filename, places, place_count, info.place, sizeof(info.place));
+    }
+
+    return info;
+}
+
+/* Parse opening fence line: ```lang filename or ````lang etc */
+FenceInfo parse_fence(const char *line)
+{
+    uint64_t t;
+    TRACE_BEGIN(t, fence, line);
+    FenceInfo info = parse_fence_line(line);
+    TRACE_END(t, fence, line);
     return info;
 }
 
@@ -74,6 +194,7 @@ FenceInfo parse_fence(const char *line)
  */
 int get_closing_fence_backticks(const char *line, int open_backticks)
 {
+    line = fence_start(line);
     int count = count_backticks(line);
     if (count < open_backticks) {
         return 0;
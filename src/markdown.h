@@ -7,6 +7,21 @@
 
 #include "types.h"
 
+#define FENCE_MAX_INDENT 3     /* spaces a fence may be indented by (CommonMark) */
+
+/* Check if a line of n bytes (not necessarily terminated) may be a fence:
+ * up to FENCE_MAX_INDENT spaces, then three backticks
+ */
+static inline bool fence_line(const char *p, size_t n)
+{
+    size_t i = 0;
+    while (i < n && i < FENCE_MAX_INDENT && p[i] == ' ') i++;
+    return n - i >= 3 && p[i] == '`' && p[i + 1] == '`' && p[i + 2] == '`';
+}
+
+/* Skip the indentation (up to FENCE_MAX_INDENT spaces) before a fence */
+const char *fence_start(const char *line);
+
 /* Count leading backticks in a line */
 int count_backticks(const char *line);
 
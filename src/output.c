@@ -3,22 +3,39 @@
  */
 
 #include "output.h"
+#include "diff.h"
+#include "exec.h"
+#include "io.h"
+#include "lock.h"
+#include "log.h"
+#include "sink.h"
+#include "trace.h"
 #include "util.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/wait.h>
 #include <time.h>
 
-/* Create backup of existing file with timestamp
+#define UPDATE_CHUNK 65536     /* in-place compare and write granularity */
+#define UPDATE_SHIFT 16        /* changed chunks in a row taken as a shift */
+#define DIFF_CONTEXT 3         /* unchanged lines around each --diff hunk */
+#define LOCK_HELD_WAIT 60000   /* ms to wait for a locked output while holding others */
+
+/* Outputs this process has locked */
+static int g_locks_held;
+
+/* Copy an existing file to a timestamped backup
  * Format: filename.ext.YYYYMMDD_HHMMSS.bak
  * Stores backup path in output_backup if provided
  */
-bool create_backup(const char *path, char *output_backup, size_t backup_size,
-                   RyftOptions *options, RyftStats *stats)
+static bool copy_backup(const char *path, char *output_backup, size_t backup_size,
+                        RyftOptions *options, RyftStats *stats)
 {
-    if (!file_exists(path)) {
+    RyftIO *io = io_for(options);
+    if (!io_exists(io, path)) {
         return true;  /* Nothing to backup */
     }
 
@@ -33,37 +50,12 @@ bool create_backup(const char *path, char *output_backup, size_t backup_size,
     snprintf(backup_path, sizeof(backup_path), "%s.%s.bak", path, timestamp);
 
     /* Copy file contents */
-    FILE *src = fopen(path, "rb");
-    if (!src) {
-        fprintf(stderr, "error: cannot read '%s' for backup: %s\n",
-                path, strerror(errno));
-        return false;
-    }
-
-    FILE *dst = fopen(backup_path, "wb");
-    if (!dst) {
-        fclose(src);
-        fprintf(stderr, "error: cannot create backup '%s': %s\n",
-                backup_path, strerror(errno));
+    if (io->clone(io, path, backup_path) != 0) {
+        log_error("error: cannot create backup '%s': %s\n",
+                  backup_path, strerror(errno));
         return false;
     }
 
-    /* Copy in chunks */
-    char buf[8192];
-    size_t n;
-    while ((n = fread(buf, 1, sizeof(buf), src)) > 0) {
-        if (fwrite(buf, 1, n, dst) != n) {
-            fprintf(stderr, "error: failed writing backup '%s': %s\n",
-                    backup_path, strerror(errno));
-            fclose(src);
-            fclose(dst);
-            return false;
-        }
-    }
-
-    fclose(src);
-    fclose(dst);
-
     /* Store backup path if requested */
     if (output_backup && backup_size > 0) {
         strncpy(output_backup, backup_path, backup_size - 1);
@@ -71,13 +63,71 @@ bool create_backup(const char *path, char *output_backup, size_t backup_size,
     }
 
     if (options->verbose) {
-        printf("  backup: %s -> %s\n", path, backup_path);
+        if (options->dry_run) {
+            log_info("  [dry-run] would backup: %s -> %s\n", path, backup_path);
+        } else {
+            log_info("  backup: %s -> %s\n", path, backup_path);
+        }
     }
 
     stats->backups_created++;
     return true;
 }
 
+/* Create backup of existing file with timestamp */
+bool create_backup(const char *path, char *output_backup, size_t backup_size,
+                   RyftOptions *options, RyftStats *stats)
+{
+    uint64_t t;
+    TRACE_BEGIN(t, backup, path);
+    bool ok = copy_backup(path, output_backup, backup_size, options, stats);
+    TRACE_END(t, backup, path);
+    return ok;
+}
+
+/* Add an output to the path hash table */
+static void insert_slot(OutputState *state, int idx, uint64_t hash)
+{
+    size_t mask = (size_t)state->slot_count - 1;
+    size_t slot = (size_t)hash & mask;
+    while (state->slots[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    state->slots[slot] = idx + 1;
+}
+
+/* Make room for one more output; the hash table is kept at most half full
+ * Returns false on allocation failure
+ */
+static bool grow_outputs(OutputState *state)
+{
+    if (state->count == state->cap) {
+        int cap = state->cap ? state->cap * 2 : 16;
+        OutputFile **files = realloc(state->files, (size_t)cap * sizeof(OutputFile *));
+        if (!files) {
+            return false;
+        }
+        state->files = files;
+        state->cap = cap;
+    }
+
+    if ((state->count + 1) * 2 > state->slot_count) {
+        int slot_count = state->slot_count ? state->slot_count * 2 : 32;
+        int *slots = calloc((size_t)slot_count, sizeof(int));
+        if (!slots) {
+            return false;
+        }
+        free(state->slots);
+        state->slots = slots;
+        state->slot_count = slot_count;
+        for (int i = 0; i < state->count; i++) {
+            const char *path = state->files[i]->path;
+            insert_slot(state, i, hash_bytes(path, strlen(path)));
+        }
+    }
+    return true;
+}
+
 /* Find or create output file entry */
 int get_output_file(OutputState *state, const char *path)
 {
@@ -87,25 +137,48 @@ int get_output_file(OutputState *state, const char *path)
         return -1;
     }
 
+    /* Relative paths go under the output root (commands stay as written) */
+    bool is_pipe = sink_target(expanded);
+    if (state->root[0] && expanded[0] != '/' && !is_pipe) {
+        char rooted[MAX_PATH];
+        if ((size_t)snprintf(rooted, sizeof(rooted), "%s/%s", state->root, expanded) >=
+            sizeof(rooted)) {
+            return -1;
+        }
+        strcpy(expanded, rooted);
+    }
+
     /* Check if already exists */
-    for (int i = 0; i < state->count; i++) {
-        if (strcmp(state->files[i].path, expanded) == 0) {
+    uint64_t hash = hash_bytes(expanded, strlen(expanded));
+    size_t mask = (size_t)state->slot_count - 1;
+    size_t slot = state->slot_count ? (size_t)hash & mask : 0;
+    while (state->slot_count && state->slots[slot]) {
+        int i = state->slots[slot] - 1;
+        if (strcmp(state->files[i]->path, expanded) == 0) {
             return i;
         }
+        slot = (slot + 1) & mask;
     }
 
     /* Create new entry */
-    if (state->count >= MAX_OUTPUT_FILES) {
-        fprintf(stderr, "error: too many output files (max %d)\n", MAX_OUTPUT_FILES);
+    if (!grow_outputs(state)) {
+        log_error("error: out of memory\n");
+        return -1;
+    }
+    OutputFile *of = calloc(1, sizeof(OutputFile));
+    if (!of) {
+        log_error("error: out of memory\n");
         return -1;
     }
 
     int idx = state->count++;
-    strncpy(state->files[idx].path, expanded, MAX_PATH - 1);
-    state->files[idx].path[MAX_PATH - 1] = '\0';
-    state->files[idx].fp = NULL;
-    state->files[idx].block_count = 0;
-    state->files[idx].unnamed_block_count = 0;
+    state->files[idx] = of;
+    insert_slot(state, idx, hash);
+    strncpy(of->path, expanded, MAX_PATH - 1);
+    of->path[MAX_PATH - 1] = '\0';
+    of->is_pipe = is_pipe;
+    of->lock_fd = -1;
+    of->placing = state->placing && !is_pipe;
 
     if (state->count > 1) {
         state->multiple_files = true;
@@ -114,77 +187,113 @@ int get_output_file(OutputState *state, const char *path)
     return idx;
 }
 
-/* Open output file for writing (or simulate in dry-run mode) */
-FILE *open_output(OutputState *state, int idx, const char *lang,
-                  RyftOptions *options, RyftStats *stats)
+/* Build output path for a block without a filename
+ * Uses the config 'filename' if set, otherwise basename + language extension
+ * placed according to the config 'output' setting. Whether that names a
+ * directory is asked of io once per value (NULL: only a trailing '/' counts).
+ * Returns true if the path came from the config 'filename' key
+ */
+bool get_fallback_path(RyftConfig *doc_config, RyftIO *io, const char *basename,
+                       const char *lang, char *out, size_t out_size)
 {
-    if (idx < 0 || idx >= state->count) {
-        return NULL;
+    if (doc_config->filename[0]) {
+        strncpy(out, doc_config->filename, out_size - 1);
+        out[out_size - 1] = '\0';
+        return true;
     }
 
-    OutputFile *of = &state->files[idx];
+    /* Build filename from basename + extension */
+    char filename[MAX_FILENAME];
+    if (lang && lang[0]) {
+        snprintf(filename, sizeof(filename), "%s%s", basename, lang_to_ext(lang));
+    } else {
+        snprintf(filename, sizeof(filename), "%s", basename);
+    }
 
-    /* Track language if not already set */
-    if (lang && lang[0] && !of->lang[0]) {
-        strncpy(of->lang, lang, MAX_LANG - 1);
-        of->lang[MAX_LANG - 1] = '\0';
+    if (!doc_config->output_resolved) {
+        doc_config->output_dir = is_directory_path(io, doc_config->output);
+        doc_config->output_resolved = true;
     }
+    build_output_path(doc_config->output, doc_config->output_dir, filename, out, out_size);
+    return false;
+}
 
-    /* Already opened (or simulated open in dry-run) */
-    if (of->opened) {
-        return of->fp;  /* May be NULL in dry-run mode */
+/* Set up an in-place update of an existing output
+ * Returns false if the backend cannot do it (the file is rewritten instead)
+ */
+static bool open_update(OutputFile *of, RyftIO *io)
+{
+    if (!io->update || !io->pwrite || !io->truncate) {
+        return false;
     }
-    of->opened = true;
+    if (!io_load(io, of->path, &of->check_data, &of->check_len)) {
+        return false;
+    }
+    of->chunk = malloc(UPDATE_CHUNK);
+    of->file = of->chunk ? io->update(io, of->path) : NULL;
+    if (!of->file) {
+        io_unload(io, of->check_data, of->check_len);
+        of->check_data = NULL;
+        free(of->chunk);
+        of->chunk = NULL;
+        return false;
+    }
+    of->updating = true;
+    return true;
+}
 
-    /* Check if file exists before we would write */
-    of->existed = file_exists(of->path);
+/* Start the command of a |cmd target (not in dry-run or check mode);
+ * there is no file, so this always returns NULL
+ */
+static RyftFile *open_pipe(OutputFile *of, RyftOptions *options, RyftStats *stats)
+{
+    const char *command = sink_command(of->path);
 
-    /* Dry-run mode: simulate what would happen */
-    if (options->dry_run) {
-        /* Track stats */
-        if (of->existed) {
-            stats->files_overwritten++;
-        } else {
-            stats->files_created++;
-        }
-
-        /* Would backup be created? */
-        if (options->backup && of->existed) {
-            /* Generate backup path for display */
-            time_t now = time(NULL);
-            struct tm *tm_info = localtime(&now);
-            char timestamp[20];
-            strftime(timestamp, sizeof(timestamp), "%Y%m%d_%H%M%S", tm_info);
-            snprintf(of->backup_path, sizeof(of->backup_path), "%s.%s.bak", of->path, timestamp);
-            of->backed_up = true;
-            stats->backups_created++;
-
-            if (options->verbose) {
-                printf("  [dry-run] would backup: %s -> %s\n", of->path, of->backup_path);
-            }
+    if (options->dry_run || options->check) {
+        if (options->verbose && options->dry_run) {
+            log_info("  [dry-run] would pipe to: %s\n", command);
         }
+        return NULL;
+    }
 
-        if (options->verbose) {
-            if (of->existed) {
-                printf("  [dry-run] would overwrite: %s\n", of->path);
-            } else {
-                printf("  [dry-run] would create: %s\n", of->path);
-            }
-        }
+    of->sink = sink_open(command);
+    if (!of->sink) {
+        of->failed = true;
+        return NULL;
+    }
+    stats->pipes_started++;
 
-        /* Mark as "opened" by incrementing block_count later */
-        return NULL;  /* No actual file in dry-run */
+    if (options->verbose) {
+        log_info("  piping to: %s\n", command);
     }
+    return NULL;
+}
 
-    /* Normal mode: actually create files */
+/* Read the header line of an existing output, if it has one */
+static void load_header(OutputFile *of)
+{
+    RyftFile *f = of->io->open(of->io, of->path, false);
+    if (!f) {
+        return;
+    }
+    char *prefix = malloc(FINGERPRINT_PREFIX);
+    size_t len = prefix ? of->io->read(of->io, f, prefix, FINGERPRINT_PREFIX) : 0;
+    of->io->close(of->io, f);
 
-    /* Ensure parent directory exists */
-    char dir[MAX_PATH];
-    if (get_directory(of->path, dir, sizeof(dir)) && dir[0]) {
-        if (!ensure_directory(dir)) {
-            return NULL;
-        }
+    size_t start, end;
+    if (len > 0 && fingerprint_find(prefix, len, &start, &end) &&
+        (of->old_header = malloc(end - start + 1))) {
+        memcpy(of->old_header, prefix + start, end - start);
+        of->old_header[end - start] = '\0';
     }
+    free(prefix);
+}
+
+/* Back up, then create or update an output, and count it */
+static RyftFile *open_file(OutputFile *of, RyftOptions *options, RyftStats *stats)
+{
+    RyftIO *io = of->io;
+    const char *would = options->dry_run ? "[dry-run] would " : "";
 
     /* Create backup if enabled and file exists */
     if (options->backup && of->existed) {
@@ -194,10 +303,13 @@ FILE *open_output(OutputState *state, int idx, const char *lang,
         of->backed_up = true;
     }
 
-    of->fp = fopen(of->path, "w");
-    if (!of->fp) {
-        fprintf(stderr, "error: cannot create '%s': %s\n", of->path, strerror(errno));
-        return NULL;
+    /* In-place: keep the file and write only the chunks that change */
+    if (!(options->in_place && of->existed && open_update(of, io))) {
+        of->file = io_open_locked(io, of->path, &of->lock_fd);
+        if (!of->file) {
+            log_error("error: cannot create '%s': %s\n", of->path, strerror(errno));
+            return NULL;
+        }
     }
 
     /* Track stats */
@@ -208,25 +320,808 @@ FILE *open_output(OutputState *state, int idx, const char *lang,
     }
 
     if (options->verbose) {
+        if (of->updating) {
+            log_info("  %s%s: %s\n", would, options->dry_run ? "update" : "updating", of->path);
+        } else if (of->existed) {
+            log_info("  %s%s: %s\n", would, options->dry_run ? "overwrite" : "overwriting", of->path);
+        } else {
+            log_info("  %s%s: %s\n", would, options->dry_run ? "create" : "creating", of->path);
+        }
+    }
+
+    return of->file;
+}
+
+/* First open of an output; in dry-run mode the backend makes no changes */
+static RyftFile *open_new_output(OutputState *state, OutputFile *of, RyftOptions *options,
+                                 RyftStats *stats)
+{
+    RyftIO *io = io_for(options);
+
+    if (of->is_pipe) {
+        return open_pipe(of, options, stats);
+    }
+
+    /* Check if file exists before we would write */
+    of->io = io;
+    of->existed = io_exists(io, of->path);
+
+    of->fingerprinting = fingerprint_wanted(options->fingerprint, of->lang);
+    if (of->fingerprinting) {
+        fingerprint_begin(&of->fp);
+    }
+
+    /* Check mode: compare with the existing file as bytes arrive; a
+     * fingerprinted file is compared by its header, unless --diff needs
+     * the whole file */
+    if (options->check) {
+        of->checking = true;
+        of->diffing = options->diff;
+        bool whole = !of->fingerprinting || of->diffing;
+        if (of->fingerprinting && of->existed) {
+            load_header(of);
+        }
+        if (!of->existed ||
+            (whole && !io_load(io, of->path, &of->check_data, &of->check_len))) {
+            of->stale = true;
+        }
+        return NULL;
+    }
+
+    /* Ensure parent directory exists; outputs tend to come directory by
+     * directory, so the last one is not created again */
+    char dir[MAX_PATH];
+    if (get_directory(of->path, dir, sizeof(dir)) && dir[0] &&
+        strcmp(dir, state->made_dir) != 0) {
+        if (!ensure_directory(io, dir)) {
+            return NULL;
+        }
+        snprintf(state->made_dir, sizeof(state->made_dir), "%s", dir);
+    }
+
+    /* Lock the output before it is truncated, so concurrent runs writing
+     * the same file take turns. Waiting while holding other outputs could
+     * deadlock with a run that waits for one of ours, so that is bounded */
+    if (io_native(io) && !options->dry_run) {
+        of->lock_fd = lock_output(of->path, options->no_wait,
+                                  g_locks_held > 0 ? LOCK_HELD_WAIT : -1, options->verbose);
+        if (of->lock_fd < 0) {
+            of->failed = true;
+            return NULL;
+        }
+        of->locked = true;
+        g_locks_held++;
+    }
+
+    /* A fingerprinted file is written at close, once its header is known */
+    if (of->fingerprinting) {
         if (of->existed) {
-            printf("  overwriting: %s\n", of->path);
+            load_header(of);
+        }
+        return NULL;
+    }
+    return open_file(of, options, stats);
+}
+
+/* Open output file for writing (through the dry-run backend in dry-run mode) */
+RyftFile *open_output(OutputState *state, int idx, const char *lang,
+                      RyftOptions *options, RyftStats *stats)
+{
+    if (idx < 0 || idx >= state->count) {
+        return NULL;
+    }
+
+    OutputFile *of = state->files[idx];
+
+    /* Track language if not already set */
+    if (lang && lang[0] && !of->lang[0]) {
+        strncpy(of->lang, lang, MAX_LANG - 1);
+        of->lang[MAX_LANG - 1] = '\0';
+    }
+
+    /* Already opened */
+    if (of->opened) {
+        return of->file;  /* NULL in check mode or if opening failed */
+    }
+    of->opened = true;
+
+    uint64_t t;
+    TRACE_BEGIN(t, open_output, of->path);
+    RyftFile *file = open_new_output(state, of, options, stats);
+    TRACE_END(t, open_output, of->path);
+    return file;
+}
+
+/* Write the pending chunk of an in-place update if it changed */
+static void flush_chunk(OutputFile *of)
+{
+    size_t off = of->size - of->chunk_len;
+
+    if (of->chunk_dirty || of->streaming) {
+        if (of->io->pwrite(of->io, of->file, of->chunk, of->chunk_len, off) != of->chunk_len &&
+            !of->failed) {
+            log_error("error: failed writing '%s': %s\n", of->path, strerror(errno));
+            of->failed = true;
+        }
+        of->written += of->chunk_len;
+
+        /* An insertion or deletion shifts everything after it, so a long
+         * run of changed chunks means comparing the rest is wasted work */
+        if (++of->dirty_run >= UPDATE_SHIFT) {
+            of->streaming = true;
+        }
+    } else {
+        of->dirty_run = 0;
+    }
+    of->chunk_len = 0;
+    of->chunk_dirty = false;
+}
+
+/* Collect bytes of an in-place update into aligned chunks, noting
+ * whether each differs from the existing file at the same offset
+ */
+static void update_write(OutputFile *of, const char *p, size_t len)
+{
+    while (len > 0) {
+        size_t n = UPDATE_CHUNK - of->chunk_len;
+        if (n > len) n = len;
+
+        /* Bytes past the old end always differ */
+        if (!of->chunk_dirty && !of->streaming &&
+            (of->size > of->check_len || n > of->check_len - of->size ||
+             memcmp(of->check_data + of->size, p, n) != 0)) {
+            of->chunk_dirty = true;
+        }
+        memcpy(of->chunk + of->chunk_len, p, n);
+        of->chunk_len += n;
+        of->size += n;
+        p += n;
+        len -= n;
+
+        if (of->chunk_len == UPDATE_CHUNK) {
+            flush_chunk(of);
+        }
+    }
+}
+
+/* Finish an in-place update: last chunk, then the new length */
+static void finish_update(OutputFile *of)
+{
+    if (of->chunk_len > 0) {
+        flush_chunk(of);
+    }
+    if (of->check_data) {
+        io_unload(of->io, of->check_data, of->check_len);
+        of->check_data = NULL;
+    }
+    if (of->size != of->check_len && !of->failed &&
+        of->io->truncate(of->io, of->file, of->size) != 0) {
+        log_error("error: failed writing '%s': %s\n", of->path, strerror(errno));
+        of->failed = true;
+    }
+    free(of->chunk);
+    of->chunk = NULL;
+}
+
+/* Write bytes to an opened output, or compare them in check mode */
+static void emit(OutputFile *of, const char *p, size_t len)
+{
+    /* Placed blocks go out at close, in their final order */
+    if (of->placing) {
+        if (!of->placed && (of->placed = malloc(sizeof(SpillBuffer)))) {
+            spill_init(of->placed);
+        }
+        if ((!of->placed || !spill_append(of->placed, p, len)) && !of->failed) {
+            log_error("error: out of memory\n");
+            of->failed = true;
+        }
+        return;
+    }
+
+    if (of->fingerprinting) {
+        fingerprint_update(&of->fp, p, len);
+    }
+
+    if (of->checking) {
+        /* --diff keeps every byte: what differs is only known at the end */
+        if (of->diffing && !of->diff && (of->diff = malloc(sizeof(SpillBuffer)))) {
+            spill_init(of->diff);
+        }
+        if (of->diffing && (!of->diff || !spill_append(of->diff, p, len))) {
+            log_error("error: out of memory diffing '%s'\n", of->path);
+            of->failed = true;
+            of->diffing = false;
+        }
+
+        /* Stop comparing at the first difference; fingerprinted outputs
+         * are compared by their header at close */
+        if (of->stale || of->fingerprinting) {
+            return;
+        }
+        if (len > of->check_len - of->check_pos ||
+            memcmp(of->check_data + of->check_pos, p, len) != 0) {
+            of->stale = true;
+            return;
+        }
+        of->check_pos += len;
+    } else if (of->fingerprinting) {
+        if (!of->held && (of->held = malloc(sizeof(SpillBuffer)))) {
+            spill_init(of->held);
+        }
+        if ((!of->held || !spill_append(of->held, p, len)) && !of->failed) {
+            log_error("error: out of memory\n");
+            of->failed = true;
+        }
+    } else if (of->updating) {
+        update_write(of, p, len);
+    } else if (of->sink) {
+        sink_write(of->sink, p, len);
+        of->size += len;
+        of->written += len;
+    } else if (of->file) {
+        of->io->write(of->io, of->file, p, len);
+        of->size += len;
+        of->written += len;
+    }
+}
+
+/* Queue a write behind a pending exec= result (or queue the result
+ * itself when job is given); bytes follow the result before them
+ * Returns false on allocation failure (reported, the output fails)
+ */
+static bool hold_back(OutputFile *of, ExecJob *job, const char *p, size_t len)
+{
+    PendingWrite *w = of->pending_tail;
+
+    if (job || !w) {
+        w = calloc(1, sizeof(PendingWrite));
+        if (!w) {
+            log_error("error: out of memory\n");
+            of->failed = true;
+            return false;
+        }
+        w->job = job;
+        w->piece = -1;
+        spill_init(&w->buf);
+        if (of->pending_tail) {
+            of->pending_tail->next = w;
         } else {
-            printf("  creating: %s\n", of->path);
+            of->pending = w;
         }
+        of->pending_tail = w;
     }
+    if (!spill_append(&w->buf, p, len)) {
+        log_error("error: out of memory\n");
+        of->failed = true;
+        return false;
+    }
+    return true;
+}
 
-    return of->fp;
+static void emit_piece(void *ctx, const char *p, size_t len)
+{
+    emit(ctx, p, len);
 }
 
-/* Close all output files */
-void close_all_outputs(OutputState *state)
+/* Write held-back bytes; a plain output takes the spilled part straight
+ * from the temp file (copy_file_range), the rest goes through emit()
+ */
+static void emit_held(OutputFile *of, SpillBuffer *b)
 {
+    if (b->spilled > 0 && of->file && !of->checking && !of->updating && !of->sink) {
+        if (io_append_fd(of->io, of->file, b->fd, b->spilled)) {
+            of->size += b->spilled;
+            of->written += b->spilled;
+        } else {
+            log_error("error: failed writing '%s': %s\n", of->path, strerror(errno));
+            of->failed = true;
+        }
+        if (b->len > 0) {
+            emit(of, b->data, b->len);
+        }
+    } else if (!spill_read(b, emit_piece, of)) {
+        log_error("error: cannot read back spilled output for '%s': %s\n", of->path,
+                  strerror(errno));
+        of->failed = true;
+    }
+}
+
+/* Write bytes to an opened output, or compare them in check mode; held
+ * back while an earlier exec= result is pending
+ */
+void output_write(OutputFile *of, const char *p, size_t len)
+{
+    if (of->pending) {
+        hold_back(of, NULL, p, len);
+    } else {
+        emit(of, p, len);
+    }
+}
+
+/* Write a settled exec= result; one that was not run because nothing
+ * is written (--check) leaves the output stale, since its contents
+ * are not known
+ */
+static void emit_result(OutputFile *of, ExecJob *job)
+{
+    const char *data;
+    size_t len;
+    if (exec_result(job, &data, &len)) {
+        emit(of, data, len);
+        exec_release(job, data, len);
+    } else if (of->checking && exec_skipped(job)) {
+        of->stale = true;
+    }
+}
+
+/* Insert an exec= result at the current end of an output */
+void output_exec(OutputFile *of, ExecJob *job)
+{
+    if (of->pending || !exec_ready(job)) {
+        hold_back(of, job, NULL, 0);
+        return;
+    }
+
+    emit_result(of, job);
+}
+
+/* Start piece at the current end of a placing output's contents */
+static void start_piece(OutputFile *of, int piece)
+{
+    of->pieces[piece].offset = of->placed ? spill_length(of->placed) : 0;
+}
+
+/* Write held-back data whose exec= results have arrived; with wait,
+ * wait for every result and write everything
+ */
+void output_drain(OutputFile *of, bool wait)
+{
+    while (of->pending) {
+        PendingWrite *w = of->pending;
+        if (w->job) {
+            if (!exec_ready(w->job)) {
+                if (!wait) {
+                    break;
+                }
+                exec_wait(w->job);
+            }
+
+            emit_result(of, w->job);
+        }
+        if (w->piece >= 0) {
+            start_piece(of, w->piece);
+        }
+        emit_held(of, &w->buf);
+
+        of->pending = w->next;
+        if (!of->pending) {
+            of->pending_tail = NULL;
+        }
+        spill_free(&w->buf);
+        free(w);
+    }
+}
+
+/* Record a block written to an output, for its fingerprint header */
+void output_block(OutputFile *of, int block)
+{
+    if (of->block_id_count > 0 && of->block_ids[of->block_id_count - 1] == block) {
+        return;
+    }
+    if (of->block_id_count == of->block_id_cap) {
+        int cap = of->block_id_cap ? of->block_id_cap * 2 : 8;
+        int *ids = realloc(of->block_ids, (size_t)cap * sizeof(int));
+        if (!ids) {
+            log_error("error: out of memory\n");
+            of->failed = true;
+            return;
+        }
+        of->block_ids = ids;
+        of->block_id_cap = cap;
+    }
+    of->block_ids[of->block_id_count++] = block;
+}
+
+/* Start a block in an output whose blocks are placed; its bytes run up
+ * to the next block's, in the order they reach the output (exec= results
+ * included). Until a block carries a placement attribute, the blocks so
+ * far stay one piece in document order, as nothing can move among them.
+ * A |cmd target streams what it has until such a block, and is held from
+ * there on
+ */
+void output_place(OutputFile *of, int block, const Placement *place)
+{
+    bool marked = place_moves(place) || place->id[0];
+    if (of->is_pipe && marked) {
+        of->placing = true;
+    }
+    if (!of->placing || of->failed) {
+        return;
+    }
+    if (!marked && !of->arranging && of->piece_count > 0) {
+        return;
+    }
+    of->arranging = of->arranging || marked;
+    if (of->piece_count == of->piece_cap) {
+        int cap = of->piece_cap ? of->piece_cap * 2 : 8;
+        OutputPiece *pieces = realloc(of->pieces, (size_t)cap * sizeof(OutputPiece));
+        if (!pieces) {
+            log_error("error: out of memory\n");
+            of->failed = true;
+            return;
+        }
+        of->pieces = pieces;
+        of->piece_cap = cap;
+    }
+
+    int piece = of->piece_count++;
+    of->pieces[piece].block = block;
+    of->pieces[piece].place = *place;
+
+    /* Behind a pending exec= result, the piece starts where it is drained */
+    if (of->pending) {
+        PendingWrite *w = calloc(1, sizeof(PendingWrite));
+        if (!w) {
+            log_error("error: out of memory\n");
+            of->failed = true;
+            return;
+        }
+        w->piece = piece;
+        spill_init(&w->buf);
+        of->pending_tail->next = w;
+        of->pending_tail = w;
+    } else {
+        start_piece(of, piece);
+    }
+}
+
+/* Count outputs that are written (not skipped by --only) */
+int count_outputs(OutputState *state)
+{
+    int count = 0;
+    for (int i = 0; i < state->count; i++) {
+        if (!state->files[i]->skipped) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Wait for the writes a batching backend still has in flight, marking
+ * the outputs that failed
+ */
+static void flush_outputs(OutputState *state, RyftIO *io)
+{
+    const char *path;
+    while (io->flush(io, &path) != 0) {
+        log_error("error: failed writing '%s': %s\n", path, strerror(errno));
+        for (int i = 0; i < state->count; i++) {
+            if (strcmp(state->files[i]->path, path) == 0) {
+                state->files[i]->failed = true;
+            }
+        }
+    }
+}
+
+/* Report a block that could not be placed as asked
+ * Returns false if that fails the output (strict mode)
+ */
+static bool check_placement(const OutputFile *of, const OutputPiece *piece, PlaceStatus status,
+                            RyftOptions *options)
+{
+    const Placement *p = &piece->place;
+    const char *attr = p->after ? "after" : "before";
+    const char *outcome = "";
+    char what[MAX_PATH + 2 * MAX_ANCHOR + 64];
+
+    switch (status) {
+    case PLACE_OK:
+        return true;
+    case PLACE_NO_ANCHOR:
+        snprintf(what, sizeof(what), "%s=%s in block %d matches no id= in '%s'",
+                 attr, p->anchor, piece->block, of->path);
+        outcome = "block left in place";
+        break;
+    case PLACE_DUPLICATE:
+        snprintf(what, sizeof(what), "id=%s in block %d is already used in '%s'",
+                 p->id, piece->block, of->path);
+        outcome = "ignored";
+        break;
+    case PLACE_CYCLE:
+        snprintf(what, sizeof(what), "%s=%s in block %d leads back to it in '%s'",
+                 attr, p->anchor, piece->block, of->path);
+        outcome = "block placed last";
+        break;
+    }
+
+    if (options->strict_mode) {
+        log_error("error: %s (strict mode)\n", what);
+        return false;
+    }
+    log_warn("warning: %s, %s\n", what, outcome);
+    return true;
+}
+
+/* Write the blocks of a placing output in their final order: the held
+ * contents are cut into one span per block, and only the spans are
+ * reordered
+ */
+static void place_output(OutputFile *of, RyftOptions *options)
+{
+    of->placing = false;
+
+    const char *data = "";
+    size_t len = 0;
+    if (of->placed && !spill_contents(of->placed, &data, &len)) {
+        log_error("error: cannot read back spilled output for '%s': %s\n", of->path,
+                  strerror(errno));
+        of->failed = true;
+    }
+
+    size_t count = (size_t)of->piece_count;
+    const Placement **places = malloc(count * sizeof(*places) + 1);
+    size_t *order = malloc(count * sizeof(size_t) + 1);
+    PlaceStatus *status = malloc(count * sizeof(PlaceStatus) + 1);
+    if (!places || !order || !status) {
+        log_error("error: out of memory\n");
+        of->failed = true;
+    }
+
+    bool moves = false;
+    for (size_t i = 0; !of->failed && i < count; i++) {
+        places[i] = &of->pieces[i].place;
+        order[i] = i;
+        if (place_moves(places[i]) || places[i]->id[0]) {
+            moves = true;
+        }
+    }
+    if (!of->failed && moves && !place_order(places, count, order, status)) {
+        log_error("error: out of memory\n");
+        of->failed = true;
+    }
+    for (size_t i = 0; !of->failed && moves && i < count; i++) {
+        if (!check_placement(of, &of->pieces[i], status[i], options)) {
+            of->failed = true;
+        }
+    }
+
+    /* Anything written before the first block started stays first */
+    size_t lead = count > 0 ? of->pieces[0].offset : len;
+    if (!of->failed) {
+        emit(of, data, lead);
+    }
+    for (size_t i = 0; !of->failed && i < count; i++) {
+        size_t k = order[i];
+        size_t start = of->pieces[k].offset;
+        size_t end = k + 1 < count ? of->pieces[k + 1].offset : len;
+        emit(of, data + start, end - start);
+    }
+
+    free(places);
+    free(order);
+    free(status);
+    if (of->placed) {
+        spill_free(of->placed);
+        free(of->placed);
+        of->placed = NULL;
+    }
+}
+
+/* Release contents held for a fingerprint header */
+static void drop_held(OutputFile *of)
+{
+    if (of->held) {
+        spill_free(of->held);
+        free(of->held);
+        of->held = NULL;
+    }
+}
+
+/* True if an existing output was edited since it was written, and the
+ * edits are not in the new contents */
+static bool hand_edited(OutputFile *of)
+{
+    const char *data;
+    size_t len;
+    if (!io_load(of->io, of->path, &data, &len)) {
+        return false;
+    }
+    bool edited = fingerprint_edited(data, len, &of->fp);
+    io_unload(of->io, data, len);
+    return edited;
+}
+
+/* Finish a fingerprinted output once all of it is known. --check only
+ * compares the header with the existing one; otherwise the file is left
+ * alone if its header already matches, refused if it was edited since
+ * it was written, and written with the header otherwise
+ */
+static void finish_fingerprint(OutputState *state, OutputFile *of, RyftOptions *options,
+                               RyftStats *stats)
+{
+    char header[FINGERPRINT_MAX];
+    fingerprint_header(&of->fp, of->lang, state->source, of->block_ids, of->block_id_count,
+                       header, sizeof(header));
+    size_t header_len = strlen(header);
+
+    if (of->checking) {
+        if (!of->old_header || strcmp(of->old_header, header) != 0) {
+            of->stale = true;
+        }
+        /* --diff shows the header among the changes */
+        if (of->diffing && (of->header = malloc(header_len + 1))) {
+            memcpy(of->header, header, header_len + 1);
+        }
+        return;
+    }
+
+    of->fingerprinting = false;
+    if (of->failed) {
+        drop_held(of);
+        return;
+    }
+
+    if (of->old_header && strcmp(of->old_header, header) == 0) {
+        of->current = true;
+        stats->files_current++;
+        if (options->verbose) {
+            log_info("  up to date: %s\n", of->path);
+        }
+        drop_held(of);
+        return;
+    }
+    if (of->old_header && hand_edited(of)) {
+        log_error("error: '%s' was edited since it was generated, not overwriting it\n",
+                  of->path);
+        log_error("  Use --untangle to copy the edits back, or remove its ryft header line.\n");
+        of->failed = true;
+        drop_held(of);
+        return;
+    }
+
+    const char *data = "";
+    size_t len = 0;
+    if (of->held && !spill_contents(of->held, &data, &len)) {
+        log_error("error: cannot read back spilled output for '%s': %s\n", of->path,
+                  strerror(errno));
+        of->failed = true;
+    } else if (open_file(of, options, stats)) {
+        size_t at = fingerprint_offset(&of->fp);
+        emit(of, data, at);
+        emit(of, header, header_len);
+        emit(of, data + at, len - at);
+    }
+    drop_held(of);
+}
+
+/* Close all output files; |cmd sinks get all their input first and
+ * are then waited for together. Locks are dropped only once every
+ * output is on disk, including writes a backend batched up
+ * Returns false if any could not be written completely
+ */
+bool close_all_outputs(OutputState *state, RyftOptions *options, RyftStats *stats)
+{
+    bool ok = true;
+    RyftIO *batched = NULL;
+
+    /* Placed and fingerprinted outputs are written now, in document order */
     for (int i = 0; i < state->count; i++) {
-        if (state->files[i].fp) {
-            fclose(state->files[i].fp);
-            state->files[i].fp = NULL;
+        OutputFile *of = state->files[i];
+        if (of->placing) {
+            output_drain(of, true);
+            place_output(of, options);
+        }
+        if (of->fingerprinting) {
+            output_drain(of, true);
+            finish_fingerprint(state, of, options, stats);
         }
     }
+
+    /* Newest first: glibc finds a closing stream by walking the list of
+     * open ones from the newest, so oldest first would be quadratic */
+    for (int i = state->count - 1; i >= 0; i--) {
+        OutputFile *of = state->files[i];
+        output_drain(of, true);
+        if (of->sink) {
+            sink_close_input(of->sink);
+        }
+        if (of->file) {
+            uint64_t t;
+            TRACE_BEGIN(t, close, of->path);
+            if (of->updating) {
+                finish_update(of);
+            }
+            if (of->io->close(of->io, of->file) != 0 && !of->failed) {
+                log_error("error: failed writing '%s': %s\n", of->path, strerror(errno));
+                of->failed = true;
+            }
+            if (of->io->flush) {
+                batched = of->io;
+            }
+            of->file = NULL;
+            TRACE_END(t, close, of->path);
+        }
+        if (of->checking) {
+            /* Existing file is longer than the new contents */
+            if (!of->fingerprinting && of->check_pos != of->check_len) {
+                of->stale = true;
+            }
+            /* --diff still needs the existing contents */
+            if (of->check_data && !of->diffing) {
+                io_unload(of->io, of->check_data, of->check_len);
+                of->check_data = NULL;
+            }
+            of->checking = false;
+        }
+    }
+
+    if (batched) {
+        flush_outputs(state, batched);
+    }
+
+    for (int i = 0; i < state->count; i++) {
+        OutputFile *of = state->files[i];
+        if (of->lock_fd >= 0) {
+            lock_release(of->lock_fd);
+            of->lock_fd = -1;
+        }
+        if (of->locked) {
+            of->locked = false;
+            g_locks_held--;
+        }
+        if (of->failed) {
+            ok = false;
+        }
+        if (of->sink) {
+            of->exit_status = sink_wait(of->sink);
+            of->sink = NULL;
+            of->exited = true;
+        }
+    }
+
+    return ok;
+}
+
+/* Release every output entry (after close_all_outputs) */
+void free_outputs(OutputState *state)
+{
+    for (int i = 0; i < state->count; i++) {
+        OutputFile *of = state->files[i];
+        drop_held(of);
+        if (of->placed) {
+            spill_free(of->placed);
+            free(of->placed);
+        }
+        free(of->pieces);
+        free(of->block_ids);
+        free(of->old_header);
+        free(of->header);
+        free(of);
+    }
+    free(state->files);
+    free(state->slots);
+    state->files = NULL;
+    state->slots = NULL;
+    state->count = state->cap = state->slot_count = 0;
+    state->current = -1;
+}
+
+/* Describe how a |cmd sink's command ended: "exit 0", "signal 9" */
+static void describe_exit(const OutputFile *of, char *out, size_t out_size)
+{
+    if (WIFEXITED(of->exit_status)) {
+        snprintf(out, out_size, "exit %d", WEXITSTATUS(of->exit_status));
+    } else if (WIFSIGNALED(of->exit_status)) {
+        snprintf(out, out_size, "signal %d", WTERMSIG(of->exit_status));
+    } else {
+        snprintf(out, out_size, "status %d", of->exit_status);
+    }
+}
+
+/* True if a |cmd sink's command did not exit cleanly */
+static bool pipe_failed(const OutputFile *of)
+{
+    return of->exited && !(WIFEXITED(of->exit_status) && WEXITSTATUS(of->exit_status) == 0);
 }
 
 /* Print warnings about output state
@@ -240,25 +1135,126 @@ bool print_warnings(OutputState *state, RyftOptions *options)
     if (state->multiple_files && state->has_unnamed_blocks) {
         had_warnings = true;
         if (options->strict_mode) {
-            fprintf(stderr, "\nerror: multiple output files with some unnamed blocks (strict mode)\n");
+            log_error("\nerror: multiple output files with some unnamed blocks (strict mode)\n");
         } else {
-            fprintf(stderr, "\nwarning: multiple output files with some unnamed blocks\n");
+            log_warn("\nwarning: multiple output files with some unnamed blocks\n");
         }
-        fprintf(stderr, "  For clarity, specify filename in each code fence.\n");
-        fprintf(stderr, "  Example: ```c filename.c instead of just ```c\n");
+        log_warn("  For clarity, specify filename in each code fence.\n");
+        log_warn("  Example: ```c filename.c instead of just ```c\n");
 
         for (int i = 0; i < state->count; i++) {
-            if (state->files[i].unnamed_block_count > 0) {
-                fprintf(stderr, "  %s: %d unnamed block(s)\n",
-                        state->files[i].path,
-                        state->files[i].unnamed_block_count);
+            if (state->files[i]->unnamed_block_count > 0) {
+                log_warn("  %s: %d unnamed block(s)\n",
+                         state->files[i]->path,
+                         state->files[i]->unnamed_block_count);
             }
         }
     }
 
+    /* Commands that |cmd targets were piped into and that failed */
+    for (int i = 0; i < state->count; i++) {
+        OutputFile *of = state->files[i];
+        if (!pipe_failed(of)) {
+            continue;
+        }
+        char how[32];
+        describe_exit(of, how, sizeof(how));
+        had_warnings = true;
+        if (options->strict_mode) {
+            log_error("\nerror: '%s' failed (%s) (strict mode)\n", sink_command(of->path), how);
+        } else {
+            log_warn("\nwarning: '%s' failed (%s)\n", sink_command(of->path), how);
+        }
+    }
+
     return had_warnings;
 }
 
+/* Show how a stale output would change: a unified diff, or with
+ * --diff-stat the number of lines added and removed
+ * Returns false if it could not be diffed (out of memory)
+ */
+static bool print_diff(OutputFile *of, RyftOptions *options)
+{
+    DiffLines old_lines = {0};
+    DiffLines new_lines = {0};
+    DiffResult res = {0};
+    const char *data = "";
+    size_t len = 0;
+    bool ok = !of->diff || spill_contents(of->diff, &data, &len);
+
+    /* A fingerprint header goes in at its place in the new contents */
+    size_t at = of->header ? fingerprint_offset(&of->fp) : len;
+    ok = ok && diff_add_lines(&old_lines, of->check_data, of->check_data ? of->check_len : 0) &&
+         diff_add_lines(&new_lines, data, at) &&
+         (!of->header || diff_add_lines(&new_lines, of->header, strlen(of->header))) &&
+         diff_add_lines(&new_lines, data + at, len - at) &&
+         diff_lines(&old_lines, &new_lines, &res);
+
+    if (ok && options->diff_stat) {
+        size_t added = 0, removed = 0;
+        for (size_t i = 0; i < res.count; i++) {
+            added += res.hunks[i].b_count;
+            removed += res.hunks[i].a_count;
+        }
+        printf("%s: %s (+%zu -%zu)\n", of->existed ? "stale" : "missing", of->path,
+               added, removed);
+    } else if (ok) {
+        /* a/ and b/ prefixes as git uses them, for patch -p1 */
+        const char *prefix = of->path[0] == '/' ? "" : "/";
+        if (of->existed) {
+            printf("--- a%s%s\n", prefix, of->path);
+        } else {
+            printf("--- /dev/null\n");
+        }
+        printf("+++ b%s%s\n", prefix, of->path);
+        diff_print_unified(stdout, &old_lines, &new_lines, &res, DIFF_CONTEXT);
+    } else {
+        log_error("error: out of memory diffing '%s'\n", of->path);
+    }
+
+    diff_free(&res);
+    diff_free_lines(&old_lines);
+    diff_free_lines(&new_lines);
+    return ok;
+}
+
+/* List outputs that differ from the existing files (--check)
+ * Returns the number of stale or missing outputs; checked outputs are
+ * added to *total
+ */
+int print_check(OutputState *state, RyftOptions *options, int *total)
+{
+    int stale = 0;
+
+    for (int i = 0; i < state->count; i++) {
+        OutputFile *of = state->files[i];
+        if (!of->opened || of->skipped || of->is_pipe) {
+            continue;
+        }
+        (*total)++;
+        if (of->stale) {
+            stale++;
+            if (!of->diffing || !print_diff(of, options)) {
+                printf("%s: %s\n", of->existed ? "stale" : "missing", of->path);
+            }
+        } else if (options->verbose) {
+            printf("  up to date: %s\n", of->path);
+        }
+
+        if (of->check_data) {
+            io_unload(of->io, of->check_data, of->check_len);
+            of->check_data = NULL;
+        }
+        if (of->diff) {
+            spill_free(of->diff);
+            free(of->diff);
+            of->diff = NULL;
+        }
+    }
+    return stale;
+}
+
 /* Print detailed summary */
 void print_summary(OutputState *state, RyftOptions *options, RyftStats *stats)
 {
@@ -275,14 +1271,33 @@ void print_summary(OutputState *state, RyftOptions *options, RyftStats *stats)
     printf("\n");
     printf("Files%s:\n", options->dry_run ? " (would be written)" : "");
 
+    size_t written = 0;
+    size_t size = 0;
     for (int i = 0; i < state->count; i++) {
-        OutputFile *of = &state->files[i];
+        OutputFile *of = state->files[i];
+        if (of->skipped) {
+            continue;
+        }
+        written += of->written;
+        size += of->size;
         printf("  %s\n", of->path);
         printf("    Blocks:   %d\n", of->block_count);
         if (of->lang[0]) {
             printf("    Language: %s\n", of->lang);
         }
-        if (options->dry_run) {
+        if (of->is_pipe) {
+            if (of->exited) {
+                char how[32];
+                describe_exit(of, how, sizeof(how));
+                printf("    Status:   piped, %zu bytes (%s)\n", of->written, how);
+            } else {
+                printf("    Status:   %s\n", options->dry_run ? "would pipe" : "not started");
+            }
+            continue;
+        }
+        if (of->current) {
+            printf("    Status:   up to date (fingerprint)\n");
+        } else if (options->dry_run) {
             if (of->existed) {
                 printf("    Status:   would overwrite\n");
             } else {
@@ -301,13 +1316,33 @@ void print_summary(OutputState *state, RyftOptions *options, RyftStats *stats)
                 printf("    Backup:   %s\n", of->backup_path);
             }
         }
+        if (options->in_place) {
+            printf("    Written:  %zu of %zu bytes%s\n", of->written, of->size,
+                   of->updating ? " (in place)" : "");
+        }
     }
 
     printf("\n");
     printf("Totals%s:\n", options->dry_run ? " (would be)" : "");
     printf("  New files:      %d\n", stats->files_created);
     printf("  Overwritten:    %d\n", stats->files_overwritten);
+    if (stats->files_current > 0) {
+        printf("  Up to date:     %d (fingerprint)\n", stats->files_current);
+    }
     if (stats->backups_created > 0) {
         printf("  Backups:        %d\n", stats->backups_created);
     }
+    if (stats->pipes_started > 0) {
+        printf("  Piped:          %d command(s)\n", stats->pipes_started);
+    }
+    if (options->in_place) {
+        printf("  Written:        %zu of %zu bytes\n", written, size);
+    }
+
+    int spills;
+    size_t spilled;
+    spill_totals(&spills, &spilled);
+    if (spills > 0) {
+        printf("  Spilled:        %zu bytes in %d spill(s) (--max-memory)\n", spilled, spills);
+    }
 }
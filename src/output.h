@@ -5,6 +5,7 @@
 #ifndef RYFT_OUTPUT_H
 #define RYFT_OUTPUT_H
 
+#include "exec.h"
 #include "types.h"
 
 #include <stdbool.h>
@@ -18,18 +19,63 @@ bool create_backup(const char *path, char *output_backup, size_t backup_size,
 /* Find or create output file entry */
 int get_output_file(OutputState *state, const char *path);
 
-/* Open output file for writing (or simulate in dry-run mode) */
-FILE *open_output(OutputState *state, int idx, const char *lang,
-                  RyftOptions *options, RyftStats *stats);
+/* Build output path for a block without a filename
+ * io is asked once per config 'output' value whether it is a directory;
+ * with NULL only a trailing '/' makes it one.
+ * Returns true if the path came from the config 'filename' key
+ */
+bool get_fallback_path(RyftConfig *doc_config, RyftIO *io, const char *basename,
+                       const char *lang, char *out, size_t out_size);
+
+/* Open output file for writing (through the dry-run backend in dry-run mode) */
+RyftFile *open_output(OutputState *state, int idx, const char *lang,
+                      RyftOptions *options, RyftStats *stats);
+
+/* Write bytes to an opened output, or compare them in check mode; held
+ * back while an earlier exec= result is pending
+ */
+void output_write(OutputFile *of, const char *p, size_t len);
 
-/* Close all output files */
-void close_all_outputs(OutputState *state);
+/* Insert an exec= result at the current end of an output */
+void output_exec(OutputFile *of, ExecJob *job);
+
+/* Write held-back data whose exec= results have arrived; with wait,
+ * wait for every result and write everything
+ */
+void output_drain(OutputFile *of, bool wait);
+
+/* Record a block written to an output, for its fingerprint header */
+void output_block(OutputFile *of, int block);
+
+/* Start a block in an output whose blocks are placed at close (order=,
+ * before=, after=); does nothing for other outputs
+ */
+void output_place(OutputFile *of, int block, const Placement *place);
+
+/* Count outputs that are written (not skipped by --only) */
+int count_outputs(OutputState *state);
+
+/* Close all output files; fingerprinted outputs are written now, with
+ * their header
+ * Returns false if any could not be written completely
+ */
+bool close_all_outputs(OutputState *state, RyftOptions *options, RyftStats *stats);
+
+/* Release every output entry (after close_all_outputs) */
+void free_outputs(OutputState *state);
 
 /* Print warnings about output state
  * Returns true if there were warnings, false otherwise
  */
 bool print_warnings(OutputState *state, RyftOptions *options);
 
+/* List outputs that differ from the existing files (--check), or show
+ * how they differ (--diff, --diff-stat)
+ * Returns the number of stale or missing outputs; checked outputs are
+ * added to *total
+ */
+int print_check(OutputState *state, RyftOptions *options, int *total);
+
 /* Print detailed summary */
 void print_summary(OutputState *state, RyftOptions *options, RyftStats *stats);
 
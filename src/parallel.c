@@ -0,0 +1,232 @@
+/*
+ * parallel.c - Parallel block scanning for large documents
+ *
+ * The document is cut into chunks at line boundaries. Each worker walks
+ * its chunk line by line (split exactly as input_gets() would split them)
+ * and records every line that starts with ``` - the only lines that can
+ * open or close a fence. Whether such a line opens, closes or is just
+ * block content depends on everything before it, so a short serial
+ * fix-up pass then walks the merged candidate list in order, resolving
+ * fences, ryft.config blocks and fallback targets exactly like the
+ * serial scanner. Block bodies themselves are never touched here; they
+ * become byte ranges into the mapped document.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallel.h"
+#include "config.h"
+#include "input.h"
+#include "markdown.h"
+#include "output.h"
+#include "trace.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Slice of the document and the fence candidates found in it */
+typedef struct {
+    const char *start;         /* at a line boundary */
+    const char *end;
+    const char **fences;       /* candidate fence lines, in order */
+    size_t count;
+    size_t cap;
+    bool failed;
+} Chunk;
+
+/* Worker: collect lines starting with ``` (after up to 3 spaces) */
+static void *scan_chunk(void *arg)
+{
+    Chunk *c = arg;
+    const char *p = c->start;
+
+    while (p < c->end) {
+        size_t n = input_piece(p, c->end, MAX_LINE);
+
+        if (fence_line(p, n)) {
+            if (c->count == c->cap) {
+                size_t cap = c->cap ? c->cap * 2 : 256;
+                const char **fences = realloc(c->fences, cap * sizeof(*fences));
+                if (!fences) {
+                    c->failed = true;
+                    return NULL;
+                }
+                c->fences = fences;
+                c->cap = cap;
+            }
+            c->fences[c->count++] = p;
+        }
+        p += n;
+    }
+
+    return NULL;
+}
+
+/* Thread entry: scan_chunk() traced as one span */
+static void *scan_worker(void *arg)
+{
+    uint64_t t;
+    TRACE_BEGIN(t, scan_chunk, NULL);
+    scan_chunk(arg);
+    TRACE_END(t, scan_chunk, NULL);
+    return NULL;
+}
+
+/* Fix-up pass: resolve candidates into blocks, in document order */
+static bool resolve_blocks(RyftIO *io, const char *data, size_t len, const char *filepath,
+                           Chunk *chunks, int count, BlockIndex *index)
+{
+    RyftConfig doc_config = {0};
+    char default_basename[MAX_FILENAME];
+    get_basename_no_ext(filepath, default_basename, sizeof(default_basename));
+
+    const char *end = data + len;
+    char line[MAX_LINE];
+    FenceInfo current = {0};
+    bool in_block = false;
+    int block = 0;
+
+    for (int c = 0; c < count; c++) {
+        for (size_t i = 0; i < chunks[c].count; i++) {
+            const char *p = chunks[c].fences[i];
+            size_t n = input_piece(p, end, sizeof(line));
+            memcpy(line, p, n);
+            line[n] = '\0';
+
+            if (!in_block) {
+                current = parse_fence(line);
+                in_block = true;
+                block++;
+
+                IndexEntryKind kind;
+                const char *lang = current.lang;
+                const char *target = NULL;
+                char fallback[MAX_PATH];
+
+                if (current.is_display) {
+                    kind = ENTRY_DISPLAY;
+                    index->display_blocks++;
+                } else if (current.is_config) {
+                    kind = ENTRY_CONFIG;
+                    lang = NULL;
+                } else if (current.filename[0]) {
+                    kind = ENTRY_NAMED;
+                    target = current.filename;
+                } else {
+                    bool using_config_filename = get_fallback_path(&doc_config, io,
+                                                                   default_basename,
+                                                                   current.lang, fallback,
+                                                                   sizeof(fallback));
+                    kind = using_config_filename ? ENTRY_CONFIG_FILENAME : ENTRY_FALLBACK;
+                    target = fallback;
+                }
+
+                if (!index_add(index, kind, block, (long)(p + n - data), lang, target,
+                               current.is_display || current.is_config ? NULL : &current)) {
+                    return false;
+                }
+                continue;
+            }
+
+            int closing_backticks = get_closing_fence_backticks(line, current.backtick_count);
+            if (closing_backticks == 0) {
+                continue;  /* Looks like a fence, but is block content */
+            }
+
+            IndexEntry *e = &index->entries[index->count - 1];
+            e->length = (long)(p - data) - e->offset;
+            e->closing_backticks = closing_backticks;
+            in_block = false;
+
+            /* Config blocks decide later fallback targets */
+            if (current.is_config) {
+                const char *q = data + e->offset;
+                while (q < p) {
+                    size_t m = input_piece(q, p, sizeof(line));
+                    memcpy(line, q, m);
+                    line[m] = '\0';
+                    parse_config_line(line, &doc_config, NULL);
+                    q += m;
+                }
+            }
+        }
+    }
+
+    if (in_block) {
+        IndexEntry *e = &index->entries[index->count - 1];
+        e->length = (long)len - e->offset;
+    }
+    index->unclosed = in_block;
+    index->total_blocks = block;
+    return true;
+}
+
+/* Build the block index of a mapped document using up to jobs threads */
+bool parallel_index(RyftIO *io, const char *data, size_t len, const char *filepath,
+                    int jobs, BlockIndex *index)
+{
+    int count = jobs;
+    if ((size_t)count > len / PARALLEL_MIN_CHUNK + 1) {
+        count = (int)(len / PARALLEL_MIN_CHUNK + 1);
+    }
+
+    Chunk *chunks = calloc((size_t)count, sizeof(Chunk));
+    pthread_t *threads = calloc((size_t)count, sizeof(pthread_t));
+    if (!chunks || !threads) {
+        free(chunks);
+        free(threads);
+        return false;
+    }
+
+    /* Cut at line boundaries so every worker sees whole lines */
+    const char *end = data + len;
+    const char *p = data;
+    for (int i = 0; i < count; i++) {
+        chunks[i].start = p;
+        const char *cut = data + len / (size_t)count * (size_t)(i + 1);
+        if (i == count - 1 || cut >= end) {
+            cut = end;
+        } else if (cut > p) {
+            const char *nl = memchr(cut - 1, '\n', (size_t)(end - cut + 1));
+            cut = nl ? nl + 1 : end;
+        } else {
+            cut = p;
+        }
+        chunks[i].end = cut;
+        p = cut;
+    }
+
+    /* Chunk 0 runs on this thread */
+    bool ok = true;
+    int started = 1;
+    for (int i = 1; i < count; i++, started++) {
+        if (pthread_create(&threads[i], NULL, scan_worker, &chunks[i]) != 0) {
+            ok = false;
+            break;
+        }
+    }
+    scan_worker(&chunks[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; ok && i < count; i++) {
+        if (chunks[i].failed) ok = false;
+    }
+
+    if (ok) {
+        uint64_t t;
+        TRACE_BEGIN(t, resolve, filepath);
+        ok = resolve_blocks(io, data, len, filepath, chunks, count, index);
+        TRACE_END(t, resolve, filepath);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(chunks[i].fences);
+    }
+    free(chunks);
+    free(threads);
+    return ok;
+}
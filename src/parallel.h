@@ -0,0 +1,23 @@
+/*
+ * parallel.h - Parallel block scanning for large documents
+ */
+
+#ifndef RYFT_PARALLEL_H
+#define RYFT_PARALLEL_H
+
+#include "index.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PARALLEL_MIN_CHUNK (1 << 20)   /* smallest slice worth a worker thread */
+
+/* Build the block index of a mapped document using up to jobs threads
+ * The result matches what a serial scan records, entry for entry; io
+ * answers whether a config 'output' names a directory.
+ * Returns false on allocation or thread failure
+ */
+bool parallel_index(RyftIO *io, const char *data, size_t len, const char *filepath,
+                    int jobs, BlockIndex *index);
+
+#endif /* RYFT_PARALLEL_H */
@@ -0,0 +1,246 @@
+/*
+ * place.c - Block placement within an output (order=, before=, after=)
+ *
+ * Blocks normally land in their output in document order. A fence can
+ * name its block with id= and move it with order=, before= or after=:
+ *
+ *   ```c api.c order=-1        with the includes, whatever comes first
+ *   ```c api.c after=parse     right after the block with id=parse
+ *
+ * Anchored blocks form trees under their anchors. The blocks that are
+ * not anchored are sorted by order= (document order breaks ties), and
+ * each is written preceded by its before= subtrees and followed by its
+ * after= subtrees, so the whole layout is one sort and one walk.
+ */
+
+#include "place.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NONE SIZE_MAX
+
+/* Set one attribute; false if the name or value is invalid */
+static bool set_attr(Placement *place, const char *key, const char *value)
+{
+    size_t len = strlen(value);
+    if (len == 0 || len >= MAX_ANCHOR) {
+        return false;
+    }
+
+    if (strcmp(key, "id") == 0) {
+        memcpy(place->id, value, len + 1);
+    } else if (strcmp(key, "order") == 0) {
+        char *end;
+        errno = 0;
+        long n = strtol(value, &end, 10);
+        if (*end || errno == ERANGE || place->anchor[0]) {
+            return false;
+        }
+        place->order = n;
+    } else if (strcmp(key, "before") == 0 || strcmp(key, "after") == 0) {
+        /* One anchor per block, and anchored blocks take no order= */
+        if (place->anchor[0] || place->order != 0) {
+            return false;
+        }
+        memcpy(place->anchor, value, len + 1);
+        place->after = key[0] == 'a';
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* Parse fence attributes ("id=a after=b") */
+bool place_parse(Placement *place, const char *attrs, char *bad, size_t bad_size)
+{
+    bool ok = true;
+    memset(place, 0, sizeof(*place));
+
+    while (*attrs) {
+        size_t len = strcspn(attrs, " ");
+        char attr[MAX_PLACE];
+        size_t copy = len < sizeof(attr) ? len : sizeof(attr) - 1;
+        memcpy(attr, attrs, copy);
+        attr[copy] = '\0';
+
+        char *eq = strchr(attr, '=');
+        if (eq) {
+            *eq = '\0';
+        }
+        if ((!eq || !set_attr(place, attr, eq + 1)) && ok) {
+            if (eq) {
+                *eq = '=';
+            }
+            snprintf(bad, bad_size, "%s", attr);
+            ok = false;
+        }
+
+        attrs += len;
+        while (*attrs == ' ') attrs++;
+    }
+    return ok;
+}
+
+/* Check if a placement moves its block out of document order */
+bool place_moves(const Placement *place)
+{
+    return place->anchor[0] || place->order != 0;
+}
+
+/* An unanchored block and its sort key */
+typedef struct {
+    long order;
+    size_t index;
+} Root;
+
+static int compare_roots(const void *a, const void *b)
+{
+    const Root *x = a;
+    const Root *y = b;
+    if (x->order != y->order) {
+        return x->order < y->order ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* A block being written: its before= children, itself, its after= children */
+typedef struct {
+    size_t index;
+    size_t child;              /* next child to write, NONE when done */
+    bool self_done;            /* the block itself has been written */
+} Frame;
+
+/* Find the block named id, NONE if none */
+static size_t find_id(const Placement *const *blocks, const size_t *slots, size_t mask,
+                      const char *id)
+{
+    size_t i = (size_t)hash_bytes(id, strlen(id)) & mask;
+    for (; slots[i] != NONE; i = (i + 1) & mask) {
+        if (strcmp(blocks[slots[i]]->id, id) == 0) {
+            return slots[i];
+        }
+    }
+    return NONE;
+}
+
+/* Order the blocks of one output */
+bool place_order(const Placement *const *blocks, size_t count, size_t *order,
+                 PlaceStatus *status)
+{
+    size_t slot_count = 16;
+    while (slot_count < count * 2) slot_count *= 2;
+
+    size_t *slots = malloc(slot_count * sizeof(size_t));
+    size_t *links = malloc(count * 4 * sizeof(size_t) + 1);
+    Root *roots = malloc(count * sizeof(Root) + 1);
+    Frame *stack = malloc(count * sizeof(Frame) + 1);
+    bool *written = calloc(count + 1, sizeof(bool));
+    if (!slots || !links || !roots || !stack || !written) {
+        free(slots);
+        free(links);
+        free(roots);
+        free(stack);
+        free(written);
+        return false;
+    }
+    size_t *before = links;            /* first before= child, NONE if none */
+    size_t *after = links + count;     /* first after= child */
+    size_t *next = links + count * 2;  /* next sibling under the same anchor */
+    size_t *anchor = links + count * 3;
+
+    /* Index the ids; a repeated id keeps pointing at its first block */
+    size_t mask = slot_count - 1;
+    for (size_t i = 0; i < slot_count; i++) slots[i] = NONE;
+    for (size_t i = 0; i < count; i++) {
+        status[i] = PLACE_OK;
+        before[i] = after[i] = next[i] = anchor[i] = NONE;
+        const char *id = blocks[i]->id;
+        if (!id[0]) continue;
+
+        size_t s = (size_t)hash_bytes(id, strlen(id)) & mask;
+        while (slots[s] != NONE && strcmp(blocks[slots[s]]->id, id) != 0) {
+            s = (s + 1) & mask;
+        }
+        if (slots[s] == NONE) {
+            slots[s] = i;
+        } else {
+            status[i] = PLACE_DUPLICATE;
+        }
+    }
+
+    /* Hang anchored blocks under their anchors; walking backwards and
+     * prepending keeps siblings in document order */
+    for (size_t i = count; i-- > 0; ) {
+        const Placement *p = blocks[i];
+        if (!p->anchor[0]) continue;
+
+        size_t a = find_id(blocks, slots, mask, p->anchor);
+        if (a == NONE) {
+            status[i] = PLACE_NO_ANCHOR;
+            continue;
+        }
+        size_t *head = p->after ? &after[a] : &before[a];
+        next[i] = *head;
+        *head = i;
+        anchor[i] = a;
+    }
+
+    size_t root_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (anchor[i] == NONE) {
+            roots[root_count].order = blocks[i]->order;
+            roots[root_count].index = i;
+            root_count++;
+        }
+    }
+    qsort(roots, root_count, sizeof(Root), compare_roots);
+
+    /* Write each root's tree; blocks left over hang off an anchor loop,
+     * which is broken at its first block in document order */
+    size_t n = 0;
+    for (size_t r = 0; r < root_count + count; r++) {
+        size_t start;
+        if (r < root_count) {
+            start = roots[r].index;
+        } else {
+            start = r - root_count;
+            if (written[start]) continue;
+            status[start] = PLACE_CYCLE;
+        }
+
+        size_t depth = 0;
+        stack[depth++] = (Frame){ start, before[start], false };
+        written[start] = true;
+        while (depth > 0) {
+            Frame *f = &stack[depth - 1];
+            if (f->child == NONE && !f->self_done) {
+                order[n++] = f->index;
+                f->self_done = true;
+                f->child = after[f->index];
+                continue;
+            }
+            if (f->child == NONE) {
+                depth--;
+                continue;
+            }
+            size_t c = f->child;
+            f->child = next[c];
+            if (!written[c]) {
+                written[c] = true;
+                stack[depth++] = (Frame){ c, before[c], false };
+            }
+        }
+    }
+
+    free(slots);
+    free(links);
+    free(roots);
+    free(stack);
+    free(written);
+    return true;
+}
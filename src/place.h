@@ -0,0 +1,48 @@
+/*
+ * place.h - Block placement within an output (order=, before=, after=)
+ */
+
+#ifndef RYFT_PLACE_H
+#define RYFT_PLACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_ANCHOR 64          /* longest id= name */
+#define MAX_PLACE 160          /* fence attribute text: "id=a after=b order=2" */
+
+/* Where a block goes in its output */
+typedef struct {
+    char id[MAX_ANCHOR];       /* id=: name other blocks are placed by, "" if none */
+    char anchor[MAX_ANCHOR];   /* before= or after= block, "" if none */
+    bool after;                /* anchor is after=, not before= */
+    long order;                /* order=: blocks without an anchor sort by it, 0 if unset */
+} Placement;
+
+/* How a block's placement was resolved */
+typedef enum {
+    PLACE_OK,
+    PLACE_NO_ANCHOR,           /* no block in the output has that id=; left in place */
+    PLACE_DUPLICATE,           /* its id= was used by an earlier block; not an anchor */
+    PLACE_CYCLE                /* anchors lead back to it; the loop is broken here */
+} PlaceStatus;
+
+/* Parse fence attributes ("id=a after=b"); invalid attributes are skipped
+ * Returns false with the first invalid attribute in bad
+ */
+bool place_parse(Placement *place, const char *attrs, char *bad, size_t bad_size);
+
+/* Check if a placement moves its block out of document order */
+bool place_moves(const Placement *place);
+
+/* Order the count blocks of one output, given in document order: order[i]
+ * is the block that goes i-th. Blocks without an anchor sort by order=
+ * (stable); anchored blocks go right before or after their anchor, in
+ * document order among themselves. status[i] tells how block i fared.
+ * O(count log count).
+ * Returns false on allocation failure
+ */
+bool place_order(const Placement *const *blocks, size_t count, size_t *order,
+                 PlaceStatus *status);
+
+#endif /* RYFT_PLACE_H */
@@ -4,44 +4,465 @@
 
 #include "process.h"
 #include "config.h"
+#include "exec.h"
+#include "index.h"
+#include "input.h"
+#include "io.h"
+#include "log.h"
 #include "markdown.h"
 #include "output.h"
+#include "parallel.h"
+#include "sink.h"
+#include "spill.h"
+#include "tags.h"
+#include "trace.h"
+#include "transform.h"
 #include "util.h"
+#include "vars.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* Default options */
-RyftOptions g_options = {
-    .backup = false,
-    .backup_timestamp = true,
-    .backup_limit = 10,
-    .dry_run = false,
-    .verbose = false,
-    .summary = false,
-    .strict_mode = false,
-};
+#define DEFAULT_OPTIONS {       \
+    .backup = false,            \
+    .backup_timestamp = true,   \
+    .backup_limit = 10,         \
+    .dry_run = false,           \
+    .verbose = false,           \
+    .summary = false,           \
+    .strict_mode = false,       \
+    .index = false,             \
+    .jobs = 1,                  \
+}
+
+RyftOptions g_options = DEFAULT_OPTIONS;
 
 /* Global stats */
 RyftStats g_stats = {0};
 
-/* Process a markdown file, extract code blocks to files */
-int process_file(const char *filepath, RyftOptions *cli_options)
+/* User variables from --define, global config and ryft.config blocks */
+VarTable g_vars = {0};
+
+/* Tag names seen in --tags, --matrix and if= expressions */
+static TagRegistry g_tags;
+
+/* exec= blocks of the document being processed, created on first use */
+static ExecRunner *g_exec;
+static const char *g_filepath;
+
+#define MAX_VARIANTS 16        /* tag sets in one --matrix run */
+
+/* One tag set and the outputs it produces */
+typedef struct {
+    uint64_t tags;
+    OutputState state;         /* outputs, under state.root for --matrix */
+    RyftStats stats;           /* blocks and files written for this tag set */
+    Expander ex;
+    bool included;             /* current block's if= holds for this tag set */
+    bool active;               /* current block is being written */
+    bool expanding;            /* current block body expands variables */
+    uint64_t trace_start;      /* start of the current block's write span */
+    const char *exec;          /* current block's exec= interpreter, NULL if none */
+    const char *inputs;        /* and its inputs= list */
+    char *script;              /* exec= body collected so far */
+    size_t script_len;
+    size_t script_cap;
+    bool script_failed;        /* out of memory collecting the body */
+    Transform tf;              /* dedent/eol/trim/tabs stage of the current block */
+    bool transforming;         /* current block body goes through tf */
+} Variant;
+
+/* Check whether an output is selected by --only */
+static bool is_selected(const char *path)
 {
-    FILE *f = fopen(filepath, "r");
-    if (!f) {
-        fprintf(stderr, "error: cannot open '%s'\n", filepath);
-        return 1;
+    if (g_options.only_count == 0) {
+        return true;
+    }
+
+    for (int i = 0; i < g_options.only_count; i++) {
+        if (path_matches(path, g_options.only[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Make idx the current output target (--only matches paths below the root) */
+static void select_output(OutputState *state, int idx)
+{
+    const char *path = state->files[idx]->path;
+    size_t root_len = strlen(state->root);
+    if (root_len > 0 && strncmp(path, state->root, root_len) == 0 && path[root_len] == '/') {
+        path += root_len + 1;
+    }
+
+    state->current = idx;
+    state->files[idx]->skipped = !is_selected(path);
+}
+
+/* Warn about a fallback output name, or fail in strict mode
+ * Returns false if processing should stop
+ */
+static bool check_fallback(const char *lang, const char *fallback)
+{
+    if (lang[0]) {
+        if (g_options.strict_mode) {
+            log_error("error: no output filename specified (strict mode)\n");
+            return false;
+        }
+        log_warn("warning: no output filename specified, assuming '%s' from ```%s\n",
+                 fallback, lang);
+    } else {
+        if (g_options.strict_mode) {
+            log_error("error: no language specified (strict mode)\n");
+            return false;
+        }
+        log_warn("warning: no language specified, outputting as plaintext '%s'\n",
+                 fallback);
+    }
+    return true;
+}
+
+/* Warn about a block left open at end of file, or fail in strict mode
+ * Returns false if processing should stop
+ */
+static bool check_unclosed(void)
+{
+    if (g_options.strict_mode) {
+        log_error("error: unclosed code block at end of file (strict mode)\n");
+        return false;
+    }
+    log_warn("warning: unclosed code block at end of file\n");
+    return true;
+}
+
+/* Warn about undefined variables in a block, or fail in strict mode
+ * Returns false if processing should stop
+ */
+static bool check_undefined(Expander *ex, int block)
+{
+    if (ex->undefined == 0) {
+        return true;
+    }
+    if (g_options.strict_mode) {
+        log_error("error: undefined variable '${%s}' in block %d (strict mode)\n",
+                  ex->first_undefined, block);
+        return false;
+    }
+    log_warn("warning: undefined variable '${%s}' in block %d, left as-is\n",
+             ex->first_undefined, block);
+    return true;
+}
+
+/* Work out a block's transforms: the document's, overlaid with the fence's
+ * Returns false if processing should stop
+ */
+static bool block_transform(const TransformSpec *doc, const char *attrs, int block,
+                            TransformSpec *out)
+{
+    char bad[MAX_TRANSFORM];
+    *out = *doc;
+    if (transform_overlay(out, attrs, bad, sizeof(bad))) {
+        return true;
+    }
+    if (g_options.strict_mode) {
+        log_error("error: invalid transform '%s' in block %d (strict mode)\n", bad, block);
+        return false;
+    }
+    log_warn("warning: invalid transform '%s' in block %d, ignored\n", bad, block);
+    return true;
+}
+
+/* Work out whether a block expands ${NAME}: its vars= attribute, else the
+ * document's vars setting
+ * Returns false if processing should stop
+ */
+static bool block_vars(const RyftConfig *doc, const char *attr, int block, bool *out)
+{
+    *out = doc->expand_vars;
+    if (!attr[0] || parse_bool(attr, out)) {
+        return true;
+    }
+    if (g_options.strict_mode) {
+        log_error("error: invalid value 'vars=%s' in block %d (strict mode)\n", attr, block);
+        return false;
+    }
+    log_warn("warning: invalid value 'vars=%s' in block %d, ignored\n", attr, block);
+    return true;
+}
+
+/* Work out where a block goes in its output from its fence attributes
+ * Returns false if processing should stop
+ */
+static bool block_placement(const char *attrs, int block, Placement *out)
+{
+    char bad[MAX_PLACE];
+    if (!attrs[0]) {
+        memset(out, 0, sizeof(*out));
+        return true;
+    }
+    if (place_parse(out, attrs, bad, sizeof(bad))) {
+        return true;
+    }
+    if (g_options.strict_mode) {
+        log_error("error: invalid placement '%s' in block %d (strict mode)\n", bad, block);
+        return false;
+    }
+    log_warn("warning: invalid placement '%s' in block %d, ignored\n", bad, block);
+    return true;
+}
+
+/* Work out whether a block is included in each variant
+ * Returns false if processing should stop
+ */
+static bool match_block(Variant *variants, int nvariants, const char *cond, int block)
+{
+    TagPredicate pred = {0};
+    bool valid = !cond[0] || tag_compile(&g_tags, cond, &pred);
+
+    if (!valid) {
+        if (g_options.strict_mode) {
+            log_error("error: invalid if= expression '%s' in block %d (strict mode)\n",
+                      cond, block);
+            return false;
+        }
+        log_warn("warning: invalid if= expression '%s' in block %d, block excluded\n",
+                 cond, block);
+    }
+
+    for (int i = 0; i < nvariants; i++) {
+        Variant *v = &variants[i];
+        v->included = valid && tag_match(&pred, v->tags);
+        if (!v->included && g_options.verbose) {
+            log_debug("  [block %d] if=%s (excluded%s%s)\n", block, cond,
+                      v->state.root[0] ? " from " : "", v->state.root);
+        }
+    }
+    return true;
+}
+
+/* Body sink: text goes straight to the output */
+static void output_sink(void *ctx, const char *p, size_t len)
+{
+    output_write(ctx, p, len);
+}
+
+/* Expander sink and collector for the body of an exec= block */
+static void script_sink(void *ctx, const char *p, size_t len)
+{
+    Variant *v = ctx;
+    if (len > v->script_cap - v->script_len) {
+        size_t cap = v->script_cap ? v->script_cap : 4096;
+        while (cap - v->script_len < len) cap *= 2;
+        char *grown = realloc(v->script, cap);
+        if (!grown) {
+            v->script_failed = true;
+            return;
+        }
+        v->script = grown;
+        v->script_cap = cap;
     }
+    memcpy(v->script + v->script_len, p, len);
+    v->script_len += len;
+}
 
-    OutputState state = {0};
-    state.current = -1;
+/* Expander sink feeding the transform stage */
+static void transform_sink(void *ctx, const char *p, size_t len)
+{
+    transform_write(ctx, p, len);
+}
 
+/* Route a code block to its output in one variant
+ * Blocks without a filename use fallback unless a target is already current.
+ * Returns false if processing should stop
+ */
+static bool begin_block(Variant *v, IndexEntryKind kind, const char *target,
+                        const char *lang, const char *exec, const char *inputs,
+                        const TransformSpec *transform, const Placement *place, bool vars,
+                        int block)
+{
+    OutputState *state = &v->state;
+    const char *root = sink_target(target) ? "" : state->root;
+    const char *sep = root[0] ? "/" : "";
+
+    /* Track default language from first code block */
+    if (!state->default_lang[0] && lang[0]) {
+        strncpy(state->default_lang, lang, MAX_LANG - 1);
+    }
+
+    if (kind == ENTRY_NAMED) {
+        /* Explicit filename - switch to this target */
+        int idx = get_output_file(state, target);
+        if (idx >= 0) {
+            select_output(state, idx);
+            state->has_named_blocks = true;
+            if (g_options.verbose) {
+                log_debug("  [block %d] lang=%s -> %s%s%s\n", block, lang[0] ? lang : "(none)",
+                          root, sep, target);
+            }
+        }
+    } else if (state->current < 0) {
+        /* No current target, use fallback (no warning if it came from config) */
+        if (kind == ENTRY_FALLBACK && !check_fallback(lang, target)) {
+            return false;
+        }
+        int idx = get_output_file(state, target);
+        if (idx >= 0) {
+            select_output(state, idx);
+            if (g_options.verbose) {
+                log_debug("  [block %d] lang=%s -> %s%s%s (fallback)\n", block,
+                          lang[0] ? lang : "(none)", root, sep, target);
+            }
+        }
+    } else {
+        /* Continuation block - append to current */
+        state->has_unnamed_blocks = true;
+        state->files[state->current]->unnamed_block_count++;
+        if (g_options.verbose) {
+            log_debug("  [block %d] lang=%s -> %s (continuation)\n", block,
+                      lang[0] ? lang : "(none)", state->files[state->current]->path);
+        }
+    }
+
+    v->active = state->current >= 0 && !state->files[state->current]->skipped;
+    if (v->active && g_options.fingerprint) {
+        output_block(state->files[state->current], block);
+    }
+    if (v->active) {
+        output_place(state->files[state->current], block, place);
+    }
+    v->exec = exec && exec[0] ? exec : NULL;
+    v->inputs = inputs ? inputs : "";
+    v->script_len = 0;
+    v->transforming = v->active && transform_enabled(transform);
+    if (v->transforming) {
+        OutputFile *of = state->files[state->current];
+        transform_begin(&v->tf, transform, v->exec ? script_sink : output_sink,
+                        v->exec ? (void *)v : (void *)of);
+    }
+    if (v->active) {
+        TRACE_BEGIN(v->trace_start, write, state->files[state->current]->path);
+    }
+    v->expanding = v->active && vars;
+    if (v->expanding) {
+        expand_begin(&v->ex, &g_vars);
+    }
+    return true;
+}
+
+/* Write part of a block body in one variant (collected for exec= blocks) */
+static void write_body(Variant *v, const char *p, size_t len, const char *lang)
+{
+    if (!v->active) {
+        return;
+    }
+
+    open_output(&v->state, v->state.current, lang, &g_options, &v->stats);
+    OutputFile *of = v->state.files[v->state.current];
+    void (*sink)(void *ctx, const char *p, size_t len) = v->exec ? script_sink : output_sink;
+    void *ctx = v->exec ? (void *)v : (void *)of;
+    if (v->transforming) {
+        sink = transform_sink;
+        ctx = &v->tf;
+    }
+
+    if (v->expanding) {
+        v->ex.sink = sink;
+        v->ex.sink_ctx = ctx;
+        expand_write(&v->ex, p, len, NULL);
+    } else {
+        sink(ctx, p, len);
+    }
+}
+
+/* Run (or fetch the cached result of) an exec= block and insert its
+ * output where the body would have gone
+ * Returns false if processing should stop
+ */
+static bool run_block(Variant *v, OutputFile *of, const char *lang, int block)
+{
+    if (v->script_failed) {
+        log_error("error: out of memory\n");
+        return false;
+    }
+
+    if (!g_exec) {
+        /* --check and --diff write nothing, the cache included */
+        g_exec = exec_new(io_for(&g_options), g_filepath, g_options.jobs,
+                          g_options.dry_run || g_options.check, g_options.verbose);
+        if (!g_exec) {
+            log_error("error: out of memory\n");
+            return false;
+        }
+    }
+
+    ExecJob *job = exec_submit(g_exec, v->exec, v->inputs, v->script, v->script_len, block);
+    if (!job) {
+        return false;
+    }
+    open_output(&v->state, v->state.current, lang, &g_options, &v->stats);
+    output_exec(of, job);
+    return true;
+}
+
+/* Finish a block in one variant; closing is 0 for a block left unclosed
+ * Returns false if processing should stop
+ */
+static bool end_block(Variant *v, int closing, const char *lang, int block)
+{
+    if (!v->active) {
+        return true;
+    }
+    v->active = false;
+
+    OutputFile *of = v->state.files[v->state.current];
+    if (v->expanding) {
+        v->expanding = false;
+        expand_end(&v->ex, NULL);
+        if (!check_undefined(&v->ex, block)) {
+            return false;
+        }
+    }
+    if (v->transforming) {
+        v->transforming = false;
+        if (!transform_end(&v->tf)) {
+            log_error("error: out of memory\n");
+            return false;
+        }
+    }
+
+    if (v->exec) {
+        if (!run_block(v, of, lang, block)) {
+            return false;
+        }
+        v->exec = NULL;
+    }
+
+    if (closing > 0) {
+        of->block_count++;
+        v->stats.extracted_blocks++;
+
+        /* Add blank line after block if closing fence has 4+ backticks */
+        if (closing >= 4 && of->opened) {
+            output_write(of, "\n", 1);
+        }
+    }
+    if (of->pending) {
+        output_drain(of, false);
+    }
+    TRACE_END(v->trace_start, write, of->path);
+    return true;
+}
+
+/* Scan the whole document, recording blocks into index if given */
+static int scan_document(InputReader *in, const char *filepath, Variant *variants,
+                         int nvariants, RyftOptions *cli_options, BlockIndex *index)
+{
     /* Document-level config */
     RyftConfig doc_config = {0};
-
-    /* Reset stats */
-    memset(&g_stats, 0, sizeof(g_stats));
+    doc_config.vars = &g_vars;
 
     /* Get default output basename from input file */
     char default_basename[MAX_FILENAME];
@@ -49,25 +470,30 @@ int process_file(const char *filepath, RyftOptions *cli_options)
 
     char line[MAX_LINE];
     bool in_block = false;
+    bool indexed = false;      /* current block has an index entry */
+    long offset = 0;           /* byte offset of the current line */
+    long body_start = 0;
     FenceInfo current = {0};
 
-    if (g_options.verbose) {
-        printf("processing: %s\n", filepath);
-    }
-
-    while (fgets(line, sizeof(line), f)) {
+    for (; input_gets(line, sizeof(line), in); offset += (long)strlen(line)) {
         if (!in_block) {
             /* Check for opening fence */
-            if (count_backticks(line) >= 3) {
+            if (count_backticks(fence_start(line)) >= 3) {
                 current = parse_fence(line);
                 in_block = true;
+                indexed = false;
+                body_start = offset + (long)strlen(line);
                 g_stats.total_blocks++;
 
                 /* Handle display blocks */
                 if (current.is_display) {
                     g_stats.display_blocks++;
                     if (g_options.verbose) {
-                        printf("  [block %d] display-only (skipped)\n", g_stats.total_blocks);
+                        log_debug("  [block %d] display-only (skipped)\n", g_stats.total_blocks);
+                    }
+                    if (index && !(indexed = index_add(index, ENTRY_DISPLAY, g_stats.total_blocks,
+                                                       body_start, current.lang, NULL, NULL))) {
+                        return 1;
                     }
                     continue;
                 }
@@ -76,98 +502,52 @@ int process_file(const char *filepath, RyftOptions *cli_options)
                 if (current.is_config) {
                     g_stats.config_blocks++;
                     if (g_options.verbose) {
-                        printf("  [block %d] ryft.config\n", g_stats.total_blocks);
+                        log_debug("  [block %d] ryft.config\n", g_stats.total_blocks);
+                    }
+                    if (index && !(indexed = index_add(index, ENTRY_CONFIG, g_stats.total_blocks,
+                                                       body_start, NULL, NULL, NULL))) {
+                        return 1;
                     }
                     continue;
                 }
 
-                /* Track default language from first code block */
-                if (!state.default_lang[0] && current.lang[0]) {
-                    strncpy(state.default_lang, current.lang, MAX_LANG - 1);
-                }
-
                 /* Determine output target */
-                if (current.filename[0]) {
-                    /* Explicit filename - switch to this target */
-                    int idx = get_output_file(&state, current.filename);
-                    if (idx >= 0) {
-                        state.current = idx;
-                        state.has_named_blocks = true;
-                        if (g_options.verbose) {
-                            printf("  [block %d] lang=%s -> %s\n",
-                                   g_stats.total_blocks,
-                                   current.lang[0] ? current.lang : "(none)",
-                                   current.filename);
-                        }
-                    }
-                } else if (state.current < 0) {
-                    /* No current target, create fallback */
-                    char filename[MAX_FILENAME];
-                    char fallback[MAX_PATH];
-                    const char *ext = lang_to_ext(current.lang);
-
-                    /* Build filename from basename + extension */
-                    if (current.lang[0]) {
-                        snprintf(filename, sizeof(filename), "%s%s", default_basename, ext);
-                    } else {
-                        snprintf(filename, sizeof(filename), "%s", default_basename);
-                    }
+                IndexEntryKind kind = ENTRY_NAMED;
+                const char *target = current.filename;
+                char fallback[MAX_PATH];
 
-                    /* Apply config output path if set, or use config filename */
-                    bool using_config_filename = false;
-                    if (doc_config.filename[0]) {
-                        strncpy(fallback, doc_config.filename, sizeof(fallback) - 1);
-                        fallback[sizeof(fallback) - 1] = '\0';
-                        using_config_filename = true;
-                    } else {
-                        build_output_path(doc_config.output, filename, fallback, sizeof(fallback));
-                    }
+                if (!current.filename[0]) {
+                    bool using_config_filename = get_fallback_path(&doc_config,
+                                                                   io_for(&g_options),
+                                                                   default_basename,
+                                                                   current.lang, fallback,
+                                                                   sizeof(fallback));
+                    kind = using_config_filename ? ENTRY_CONFIG_FILENAME : ENTRY_FALLBACK;
+                    target = fallback;
+                }
 
-                    /* Warn or error about fallback (but not if filename came from config) */
-                    if (!using_config_filename) {
-                        if (current.lang[0]) {
-                            if (g_options.strict_mode) {
-                                fprintf(stderr, "error: no output filename specified (strict mode)\n");
-                                fclose(f);
-                                close_all_outputs(&state);
-                                return 1;
-                            }
-                            fprintf(stderr, "warning: no output filename specified, assuming '%s' from ```%s\n",
-                                    fallback, current.lang);
-                        } else {
-                            if (g_options.strict_mode) {
-                                fprintf(stderr, "error: no language specified (strict mode)\n");
-                                fclose(f);
-                                close_all_outputs(&state);
-                                return 1;
-                            }
-                            fprintf(stderr, "warning: no language specified, outputting as plaintext '%s'\n",
-                                    fallback);
-                        }
+                TransformSpec transform;
+                Placement place;
+                bool vars;
+                if (!match_block(variants, nvariants, current.cond, g_stats.total_blocks) ||
+                    !block_transform(&doc_config.transform, current.transform,
+                                     g_stats.total_blocks, &transform) ||
+                    !block_placement(current.place, g_stats.total_blocks, &place) ||
+                    !block_vars(&doc_config, current.vars, g_stats.total_blocks, &vars)) {
+                    return 1;
+                }
+                for (int i = 0; i < nvariants; i++) {
+                    if (variants[i].included &&
+                        !begin_block(&variants[i], kind, target, current.lang, current.exec,
+                                     current.inputs, &transform, &place, vars,
+                                     g_stats.total_blocks)) {
+                        return 1;
                     }
+                }
 
-                    int idx = get_output_file(&state, fallback);
-                    if (idx >= 0) {
-                        state.current = idx;
-                        if (g_options.verbose) {
-                            printf("  [block %d] lang=%s -> %s (fallback)\n",
-                                   g_stats.total_blocks,
-                                   current.lang[0] ? current.lang : "(none)",
-                                   fallback);
-                        }
-                    }
-                } else {
-                    /* Continuation block - append to current */
-                    state.has_unnamed_blocks = true;
-                    if (state.current >= 0) {
-                        state.files[state.current].unnamed_block_count++;
-                        if (g_options.verbose) {
-                            printf("  [block %d] lang=%s -> %s (continuation)\n",
-                                   g_stats.total_blocks,
-                                   current.lang[0] ? current.lang : "(none)",
-                                   state.files[state.current].path);
-                        }
-                    }
+                if (index && !(indexed = index_add(index, kind, g_stats.total_blocks, body_start,
+                                                   current.lang, target, &current))) {
+                    return 1;
                 }
             }
         } else {
@@ -176,75 +556,481 @@ int process_file(const char *filepath, RyftOptions *cli_options)
             if (closing_backticks > 0) {
                 in_block = false;
 
+                if (indexed) {
+                    IndexEntry *e = &index->entries[index->count - 1];
+                    e->length = offset - body_start;
+                    e->closing_backticks = closing_backticks;
+                    indexed = false;
+                }
+
                 /* Apply config after parsing config block */
                 if (current.is_config) {
                     apply_config(&doc_config, cli_options, &g_options);
                 }
 
-                /* Handle extracted blocks */
-                if (!current.is_display && !current.is_config && state.current >= 0) {
-                    OutputFile *of = &state.files[state.current];
-                    of->block_count++;
-                    g_stats.extracted_blocks++;
-
-                    /* Add blank line after block if closing fence has 4+ backticks */
-                    if (closing_backticks >= 4 && of->fp) {
-                        fputs("\n", of->fp);
+                for (int i = 0; i < nvariants; i++) {
+                    if (!end_block(&variants[i], closing_backticks, current.lang,
+                                   g_stats.total_blocks)) {
+                        return 1;
                     }
                 }
 
                 current = (FenceInfo){0};
-            } else {
+            } else if (current.is_config) {
                 /* Parse config block content */
-                if (current.is_config) {
-                    parse_config_line(line, &doc_config, &g_options);
-                }
+                parse_config_line(line, &doc_config, &g_options);
+            } else {
                 /* Output regular block content */
-                else if (!current.is_display && state.current >= 0) {
-                    FILE *out = open_output(&state, state.current, current.lang,
-                                            &g_options, &g_stats);
-                    if (out) {
-                        fputs(line, out);
-                    }
+                size_t len = strlen(line);
+                for (int i = 0; i < nvariants; i++) {
+                    write_body(&variants[i], line, len, current.lang);
                 }
             }
         }
     }
 
-    if (in_block) {
-        if (g_options.strict_mode) {
-            fprintf(stderr, "error: unclosed code block at end of file (strict mode)\n");
-            fclose(f);
-            close_all_outputs(&state);
+    if (index) {
+        index->total_blocks = g_stats.total_blocks;
+        index->display_blocks = g_stats.display_blocks;
+        index->unclosed = in_block;
+        if (indexed) {
+            index->entries[index->count - 1].length = offset - body_start;
+        }
+    }
+
+    if (in->error) {
+        return 1;
+    }
+
+    /* Unclosed block still ran to end of file */
+    for (int i = 0; i < nvariants; i++) {
+        if (!end_block(&variants[i], 0, current.lang, g_stats.total_blocks)) {
+            return 1;
+        }
+    }
+
+    if (in_block && !check_unclosed()) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Replay an index over the mapped document, reading only config blocks
+ * and the bodies of selected outputs
+ */
+static int replay_index(const char *data, size_t len, BlockIndex *index,
+                        Variant *variants, int nvariants, RyftOptions *cli_options)
+{
+    RyftConfig doc_config = {0};
+    doc_config.vars = &g_vars;
+    char line[MAX_LINE];
+
+    g_stats.total_blocks = index->total_blocks;
+    g_stats.display_blocks = index->display_blocks;
+
+    for (size_t i = 0; i < index->count; i++) {
+        IndexEntry *e = &index->entries[i];
+
+        if (e->offset < 0 || e->length < 0 || (size_t)e->offset + (size_t)e->length > len) {
+            log_error("error: block index does not match document\n");
+            return 1;
+        }
+
+        if (e->kind == ENTRY_DISPLAY) {
+            if (g_options.verbose) {
+                log_debug("  [block %d] display-only (skipped)\n", e->block);
+            }
+            continue;
+        }
+
+        if (e->kind == ENTRY_CONFIG) {
+            g_stats.config_blocks++;
+            if (g_options.verbose) {
+                log_debug("  [block %d] ryft.config\n", e->block);
+            }
+            const char *p = data + e->offset;
+            const char *end = p + e->length;
+            while (p < end) {
+                size_t n = input_piece(p, end, sizeof(line));
+                memcpy(line, p, n);
+                line[n] = '\0';
+                parse_config_line(line, &doc_config, &g_options);
+                p += n;
+            }
+            if (e->closing_backticks > 0) {
+                apply_config(&doc_config, cli_options, &g_options);
+            }
+            continue;
+        }
+
+        const char *target = e->target >= 0 ? index->strings[e->target] : "";
+        const char *cond = e->cond >= 0 ? index->strings[e->cond] : "";
+        const char *exec = e->exec >= 0 ? index->strings[e->exec] : "";
+        const char *inputs = e->inputs >= 0 ? index->strings[e->inputs] : "";
+        const char *attrs = e->transform >= 0 ? index->strings[e->transform] : "";
+        const char *places = e->place >= 0 ? index->strings[e->place] : "";
+        const char *expand = e->vars >= 0 ? index->strings[e->vars] : "";
+
+        TransformSpec transform;
+        Placement place;
+        bool vars;
+        if (!match_block(variants, nvariants, cond, e->block) ||
+            !block_transform(&doc_config.transform, attrs, e->block, &transform) ||
+            !block_placement(places, e->block, &place) ||
+            !block_vars(&doc_config, expand, e->block, &vars)) {
             return 1;
         }
-        fprintf(stderr, "warning: unclosed code block at end of file\n");
+
+        /* Copy the block body straight from its byte range */
+        for (int v = 0; v < nvariants; v++) {
+            if (variants[v].included &&
+                !begin_block(&variants[v], e->kind, target, e->lang, exec, inputs,
+                             &transform, &place, vars, e->block)) {
+                return 1;
+            }
+        }
+        for (int v = 0; e->length > 0 && v < nvariants; v++) {
+            write_body(&variants[v], data + e->offset, (size_t)e->length, e->lang);
+        }
+        for (int v = 0; v < nvariants; v++) {
+            if (!end_block(&variants[v], e->closing_backticks, e->lang, e->block)) {
+                return 1;
+            }
+        }
+    }
+
+    if (index->unclosed && !check_unclosed()) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Set up one variant per tag set: --tags alone, or each --matrix entry
+ * (plus --tags) written under its own output root
+ * Returns the number of variants, or 0 on error
+ */
+static int build_variants(Variant **out)
+{
+    uint64_t base = 0;
+    if (g_options.tags &&
+        !tag_parse_set(&g_tags, g_options.tags, strlen(g_options.tags), &base)) {
+        log_error("error: invalid tag list '%s'\n", g_options.tags);
+        return 0;
+    }
+
+    int count = 1;
+    for (const char *p = g_options.matrix; p && *p; p++) {
+        if (*p == ';') count++;
+    }
+    if (count > MAX_VARIANTS) {
+        log_error("error: too many tag sets in --matrix (max %d)\n", MAX_VARIANTS);
+        return 0;
+    }
+
+    Variant *variants = calloc((size_t)count, sizeof(Variant));
+    if (!variants) {
+        log_error("error: out of memory\n");
+        return 0;
+    }
+
+    const char *p = g_options.matrix;
+    for (int i = 0; i < count; i++) {
+        Variant *v = &variants[i];
+        v->state.current = -1;
+        v->state.source = g_filepath;
+        v->tags = base;
+        if (!p) {
+            continue;
+        }
+
+        size_t len = strcspn(p, ";");
+        uint64_t set;
+        if (!tag_parse_set(&g_tags, p, len, &set)) {
+            log_error("error: invalid tag set '%.*s' in --matrix\n", (int)len, p);
+            free(variants);
+            return 0;
+        }
+        v->tags |= set;
+
+        /* Output root named after the tag set: "linux,x86" -> "linux+x86" */
+        char *root = v->state.root;
+        if (len == 0) {
+            strcpy(root, "default");
+        } else {
+            snprintf(root, sizeof(v->state.root), "%.*s", (int)len, p);
+            for (char *c = root; *c; c++) {
+                if (*c == ',') *c = '+';
+            }
+        }
+        p += len + (p[len] == ';');
     }
 
-    fclose(f);
-    close_all_outputs(&state);
+    *out = variants;
+    return count;
+}
+
+/* Release variants and the exec= bodies and transform buffers they hold */
+static void free_variants(Variant *variants, int nvariants)
+{
+    for (int i = 0; i < nvariants; i++) {
+        free(variants[i].script);
+        transform_free(&variants[i].tf);
+        free_outputs(&variants[i].state);
+    }
+    free(variants);
+}
 
-    /* Use config output path if set and no explicit filenames were given */
-    (void)doc_config;  /* Mark as used - output path handling comes later */
+/* Check if any indexed block moves out of document order */
+static bool index_places(const BlockIndex *index)
+{
+    for (size_t i = 0; i < index->count; i++) {
+        const IndexEntry *e = &index->entries[i];
+        if (e->place < 0 || e->kind == ENTRY_CONFIG || e->kind == ENTRY_DISPLAY) continue;
 
-    /* Print summary or brief output */
-    if (g_options.summary || g_options.verbose) {
-        print_summary(&state, &g_options, &g_stats);
+        Placement place;
+        char bad[MAX_PLACE];
+        place_parse(&place, index->strings[e->place], bad, sizeof(bad));
+        if (place_moves(&place)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Outputs are held until they are closed and written in placement
+ * order, unless the block index shows that no block moves
+ */
+static void hold_placed(Variant *variants, int nvariants, bool places)
+{
+    for (int i = 0; i < nvariants; i++) {
+        variants[i].state.placing = places;
+    }
+}
+
+/* Process a markdown file, extract code blocks to files */
+static int process_document(const char *filepath, RyftOptions *cli_options)
+{
+    RyftIO *io = io_for(&g_options);
+    InputReader in;
+    if (!input_open(&in, io, filepath)) {
+        return 1;
+    }
+
+    /* Reset stats and tags */
+    memset(&g_stats, 0, sizeof(g_stats));
+    memset(&g_tags, 0, sizeof(g_tags));
+
+    Variant *variants;
+    int nvariants = build_variants(&variants);
+    if (nvariants == 0) {
+        input_close(&in);
+        return 1;
+    }
+
+    if (g_options.verbose) {
+        log_info("processing: %s\n", filepath);
+    }
+
+    /* Selective runs seek straight to the blocks they need when the
+     * sidecar index is still valid; otherwise scan and (re)build it.
+     * Compressed documents cannot seek, so they are always scanned.
+     * With -j, plain documents are indexed by worker threads first. */
+    BlockIndex index = {0};
+    char sidecar[MAX_PATH];
+    index_path(filepath, sidecar, sizeof(sidecar));
+    bool seekable = in.format == INPUT_PLAIN;
+    bool native = io_native(io);  /* the sidecar index lives next to a real file */
+
+    bool use_index = seekable && native && g_options.only_count > 0 &&
+                     index_load(filepath, &index);
+    bool parallel = !use_index && seekable && g_options.jobs > 1;
+    bool build_index = !use_index && seekable && native && !g_options.dry_run &&
+                       !g_options.check && (g_options.index || file_exists(sidecar)) &&
+                       index_stamp(filepath, &index);
+
+    int rc;
+    if (use_index || parallel) {
+        /* Both paths write block bodies straight from the mapped document */
+        const char *data;
+        size_t len;
+        if (!io_load(io, filepath, &data, &len)) {
+            log_error("error: cannot map '%s'\n", filepath);
+            index_free(&index);
+            input_close(&in);
+            free_variants(variants, nvariants);
+            return 1;
+        }
+
+        rc = 0;
+        if (use_index) {
+            if (g_options.verbose) {
+                log_info("  using index: %s\n", sidecar);
+            }
+        } else if (!parallel_index(io, data, len, filepath, g_options.jobs, &index)) {
+            log_error("error: parallel scan of '%s' failed\n", filepath);
+            rc = 1;
+        }
+
+        if (rc == 0) {
+            hold_placed(variants, nvariants, index_places(&index));
+            rc = replay_index(data, len, &index, variants, nvariants, cli_options);
+        }
+        io_unload(io, data, len);
     } else {
-        /* Brief output */
-        if (g_options.dry_run) {
-            printf("[dry-run] would extract %d block(s) to %d file(s)\n",
-                   g_stats.extracted_blocks, state.count);
+        hold_placed(variants, nvariants, true);
+        rc = scan_document(&in, filepath, variants, nvariants, cli_options,
+                           build_index ? &index : NULL);
+    }
+
+    if (rc == 0 && build_index) {
+        index_save(filepath, &index);
+    }
+
+    index_free(&index);
+    input_close(&in);
+
+    /* Totals across variants */
+    for (int i = 0; i < nvariants; i++) {
+        RyftStats *s = &variants[i].stats;
+        if (!close_all_outputs(&variants[i].state, &g_options, s)) {
+            rc = 1;
+        }
+        g_stats.extracted_blocks += s->extracted_blocks;
+        g_stats.files_created += s->files_created;
+        g_stats.files_overwritten += s->files_overwritten;
+        g_stats.backups_created += s->backups_created;
+        g_stats.files_current += s->files_current;
+        g_stats.pipes_started += s->pipes_started;
+        s->total_blocks = g_stats.total_blocks;
+        s->display_blocks = g_stats.display_blocks;
+        s->config_blocks = g_stats.config_blocks;
+    }
+
+    /* Every output is closed, so every exec= result has arrived */
+    if (g_exec && !exec_finish(g_exec)) {
+        rc = 1;
+    }
+
+    if (rc != 0) {
+        free_variants(variants, nvariants);
+        return rc;
+    }
+
+    bool had_warnings = false;
+    int stale = 0;
+    int checked = 0;
+    for (int i = 0; i < nvariants; i++) {
+        Variant *v = &variants[i];
+        const char *root = v->state.root;
+
+        /* Print check results, summary or brief output */
+        if (g_options.check) {
+            stale += print_check(&v->state, &g_options, &checked);
+        } else if (g_options.summary || g_options.verbose) {
+            if (root[0]) {
+                printf("\nvariant: %s\n", root);
+            }
+            print_summary(&v->state, &g_options, &v->stats);
+        } else {
+            /* Brief output */
+            int files = count_outputs(&v->state);
+            if (root[0]) {
+                printf("%s: ", root);
+            }
+            if (g_options.dry_run) {
+                printf("[dry-run] would extract %d block(s) to %d file(s)\n",
+                       v->stats.extracted_blocks, files);
+            } else {
+                printf("extracted %d block(s) to %d file(s)\n",
+                       v->stats.extracted_blocks, files);
+            }
+        }
+
+        if (print_warnings(&v->state, &g_options)) {
+            had_warnings = true;
+        }
+    }
+
+    free_variants(variants, nvariants);
+
+    if (g_options.check) {
+        if (stale > 0) {
+            printf("%d of %d output(s) out of date\n", stale, checked);
         } else {
-            printf("extracted %d block(s) to %d file(s)\n",
-                   g_stats.extracted_blocks, state.count);
+            printf("%d output(s) up to date\n", checked);
         }
     }
 
-    bool had_warnings = print_warnings(&state, &g_options);
     if (had_warnings && g_options.strict_mode) {
         return 1;
     }
 
-    return 0;
+    return stale > 0 ? RYFT_STALE : 0;
+}
+
+/* Process a markdown file, extract code blocks to files */
+int process_file(const char *filepath, RyftOptions *cli_options)
+{
+    /* Dry-run is the dry-run backend over whatever backend is in use */
+    RyftIO *base = g_options.io;
+    RyftIO *dry = NULL;
+    if (g_options.dry_run) {
+        dry = ryft_io_dry_run(base);
+        if (!dry) {
+            log_error("error: out of memory\n");
+            return 1;
+        }
+        g_options.io = dry;
+    }
+
+    spill_set_budget(g_options.max_memory);
+
+    uint64_t t;
+    TRACE_BEGIN(t, process, filepath);
+    g_filepath = filepath;
+    int rc = process_document(filepath, cli_options);
+    exec_free(g_exec);
+    g_exec = NULL;
+    TRACE_END(t, process, filepath);
+
+    if (dry) {
+        g_options.io = base;
+        ryft_io_free(dry);
+    }
+    log_flush();
+    return rc;
+}
+
+/* Public API: fill opts with the defaults */
+void ryft_options_init(RyftOptions *opts)
+{
+    *opts = (RyftOptions)DEFAULT_OPTIONS;
+}
+
+/* Public API: process a markdown file with explicit options */
+int ryft_process_file(const char *filepath, RyftOptions *opts)
+{
+    RyftOptions cli_options = {0};
+
+    /* Options passed by the caller take precedence over ryft.config;
+     * without any, every call starts from the defaults */
+    if (opts) {
+        g_options = *opts;
+        cli_options = *opts;
+    } else {
+        ryft_options_init(&g_options);
+    }
+
+    /* Variables never carry over from a previous document */
+    memset(&g_vars, 0, sizeof(g_vars));
+    for (int i = 0; i < g_options.define_count; i++) {
+        if (!var_define(&g_vars, g_options.defines[i])) {
+            log_error("error: invalid variable definition '%s'\n", g_options.defines[i]);
+            return 1;
+        }
+    }
+
+    return process_file(filepath, &cli_options);
 }
@@ -13,6 +13,9 @@ extern RyftOptions g_options;
 /* Global stats - defined in process.c */
 extern RyftStats g_stats;
 
+/* User variables - defined in process.c */
+extern VarTable g_vars;
+
 /* Process a markdown file, extract code blocks to files */
 int process_file(const char *filepath, RyftOptions *cli_options);
 
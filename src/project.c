@@ -0,0 +1,746 @@
+/*
+ * project.c - Multi-document projects with shared outputs
+ *
+ * A manifest lists markdown documents, one per line. Every document is
+ * mapped with ryft_map_buffer() (in parallel with -j), then outputs are
+ * merged in a registry keyed by path. An output named by several
+ * documents gets their blocks in manifest order, then block order, and
+ * is written exactly once, so the result never depends on which document
+ * happened to be mapped first. With --resume, written outputs are
+ * journaled so a rerun after an interruption skips them.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "project.h"
+#include "input.h"
+#include "io.h"
+#include "journal.h"
+#include "lock.h"
+#include "log.h"
+#include "output.h"
+#include "sink.h"
+#include "trace.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* One document of the manifest */
+typedef struct {
+    char path[MAX_PATH];
+    const char *data;
+    size_t len;
+    bool decoded;              /* data is a decompressed copy, not io_load()ed */
+    RyftSourceMap map;
+    bool mapped;
+} Document;
+
+/* Blocks one document contributes to a shared output */
+typedef struct {
+    int doc;
+    int output;                /* index into the document's map outputs */
+} Contribution;
+
+/* A shared output and its contributions in manifest order */
+typedef struct {
+    const char *path;          /* points into the first contributor's map */
+    const char *lang;
+    uint64_t hash;
+    Contribution *parts;
+    int part_count;
+    int part_cap;
+    bool fallback;             /* some contributor named it by fallback */
+    bool conflict;
+    bool selected;             /* matches --only */
+    bool existed;
+    bool stale;                /* differs from the existing file (--check) */
+} SharedOutput;
+
+typedef struct {
+    SharedOutput *outputs;
+    int count;
+    int cap;
+    int *buckets;              /* open addressing, -1 = empty */
+    int bucket_count;
+} Registry;
+
+/* Work for one thread: items first, first + stride, ... */
+typedef struct {
+    Document *docs;
+    Registry *reg;
+    const RyftOptions *options;
+    RyftIO *io;                /* io_for(options) */
+    int count;
+    int first;
+    int stride;
+    void *(*fn)(void *);
+    LogSink log;               /* messages, written after the join */
+} Job;
+
+/* Thread entry: run a job with its messages held back */
+static void *run_job(void *arg)
+{
+    Job *job = arg;
+    log_begin(&job->log);
+    job->fn(job);
+    log_end();
+    return NULL;
+}
+
+/* Run fn over count items on up to threads threads
+ * Messages come out in job order, as if the jobs had run one by one
+ */
+static bool run_jobs(void *(*fn)(void *), Document *docs, Registry *reg,
+                     const RyftOptions *options, int count, int threads)
+{
+    if (threads > count) threads = count;
+    if (threads < 1) threads = 1;
+
+    Job *jobs = calloc((size_t)threads, sizeof(Job));
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (!jobs || !tids) {
+        free(jobs);
+        free(tids);
+        return false;
+    }
+
+    for (int t = 0; t < threads; t++) {
+        jobs[t].docs = docs;
+        jobs[t].reg = reg;
+        jobs[t].options = options;
+        jobs[t].io = io_for(options);
+        jobs[t].count = count;
+        jobs[t].first = t;
+        jobs[t].stride = threads;
+        jobs[t].fn = fn;
+    }
+
+    /* Job 0 runs here, as do jobs whose thread could not be started */
+    int started = 1;
+    for (int t = 1; t < threads; t++, started++) {
+        if (pthread_create(&tids[t], NULL, run_job, &jobs[t]) != 0) {
+            break;
+        }
+    }
+    for (int t = started; t < threads; t++) {
+        run_job(&jobs[t]);
+    }
+    run_job(&jobs[0]);
+    for (int t = 1; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    for (int t = 0; t < threads; t++) {
+        log_drain(&jobs[t].log);
+    }
+
+    free(jobs);
+    free(tids);
+    return true;
+}
+
+/* Worker: map documents */
+static void *map_documents(void *arg)
+{
+    Job *job = arg;
+    for (int i = job->first; i < job->count; i += job->stride) {
+        Document *d = &job->docs[i];
+        uint64_t t;
+        TRACE_BEGIN(t, map, d->path);
+        if (io_load(job->io, d->path, &d->data, &d->len) &&
+            input_detect((const unsigned char *)d->data, d->len) != INPUT_PLAIN) {
+            /* Compressed documents are decoded into memory first */
+            char *decoded;
+            io_unload(job->io, d->data, d->len);
+            d->data = NULL;
+            if (input_read_all(job->io, d->path, &decoded, &d->len)) {
+                d->data = decoded;
+                d->decoded = true;
+            }
+        }
+        if (d->data) {
+            d->mapped = ryft_map_buffer_opts(d->data, d->len, d->path, RYFT_MAP_SPANS,
+                                             job->options, &d->map) == 0;
+        }
+        TRACE_END(t, map, d->path);
+    }
+    return NULL;
+}
+
+/* Read the manifest; relative paths are relative to its directory */
+static bool read_manifest(const char *manifest, Document **docs, int *count)
+{
+    FILE *f = fopen(manifest, "r");
+    if (!f) {
+        log_error("error: cannot open manifest '%s': %s\n",
+                  manifest, strerror(errno));
+        return false;
+    }
+
+    char base[MAX_PATH];
+    if (!get_directory(manifest, base, sizeof(base))) {
+        base[0] = '\0';
+    }
+
+    int cap = 0;
+    char line[MAX_LINE];
+    *docs = NULL;
+    *count = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "#\r\n")] = '\0';
+        char *path = str_trim(line);
+        if (!*path) continue;
+
+        if (*count >= cap) {
+            cap = cap ? cap * 2 : 16;
+            Document *grown = realloc(*docs, (size_t)cap * sizeof(Document));
+            if (!grown) {
+                log_error("error: out of memory\n");
+                fclose(f);
+                return false;
+            }
+            *docs = grown;
+        }
+
+        Document *d = &(*docs)[(*count)++];
+        memset(d, 0, sizeof(*d));
+        char expanded[MAX_PATH];
+        if (!expand_path(path, expanded, sizeof(expanded))) {
+            snprintf(expanded, sizeof(expanded), "%s", path);
+        }
+        int n;
+        if (expanded[0] != '/' && base[0]) {
+            n = snprintf(d->path, sizeof(d->path), "%s/%s", base, expanded);
+        } else {
+            n = snprintf(d->path, sizeof(d->path), "%s", expanded);
+        }
+        if (n < 0 || (size_t)n >= sizeof(d->path)) {
+            log_error("error: path too long in manifest: %s\n", path);
+            fclose(f);
+            return false;
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+/* Find or add the shared output for path, -1 on allocation failure */
+static int registry_get(Registry *reg, const char *path)
+{
+    uint64_t hash = hash_bytes(path, strlen(path));
+
+    if (reg->count * 2 >= reg->bucket_count) {
+        int n = reg->bucket_count ? reg->bucket_count * 2 : 64;
+        int *buckets = malloc((size_t)n * sizeof(int));
+        if (!buckets) return -1;
+        for (int i = 0; i < n; i++) buckets[i] = -1;
+        for (int i = 0; i < reg->count; i++) {
+            int b = (int)(reg->outputs[i].hash & (uint64_t)(n - 1));
+            while (buckets[b] >= 0) b = (b + 1) & (n - 1);
+            buckets[b] = i;
+        }
+        free(reg->buckets);
+        reg->buckets = buckets;
+        reg->bucket_count = n;
+    }
+
+    int b = (int)(hash & (uint64_t)(reg->bucket_count - 1));
+    while (reg->buckets[b] >= 0) {
+        SharedOutput *o = &reg->outputs[reg->buckets[b]];
+        if (o->hash == hash && strcmp(o->path, path) == 0) {
+            return reg->buckets[b];
+        }
+        b = (b + 1) & (reg->bucket_count - 1);
+    }
+
+    if (reg->count >= reg->cap) {
+        int cap = reg->cap ? reg->cap * 2 : 64;
+        SharedOutput *grown = realloc(reg->outputs, (size_t)cap * sizeof(SharedOutput));
+        if (!grown) return -1;
+        reg->outputs = grown;
+        reg->cap = cap;
+    }
+
+    SharedOutput *o = &reg->outputs[reg->count];
+    memset(o, 0, sizeof(*o));
+    o->path = path;
+    o->hash = hash;
+    reg->buckets[b] = reg->count;
+    return reg->count++;
+}
+
+static bool add_part(SharedOutput *o, int doc, int output)
+{
+    if (o->part_count >= o->part_cap) {
+        int cap = o->part_cap ? o->part_cap * 2 : 4;
+        Contribution *grown = realloc(o->parts, (size_t)cap * sizeof(Contribution));
+        if (!grown) return false;
+        o->parts = grown;
+        o->part_cap = cap;
+    }
+    o->parts[o->part_count].doc = doc;
+    o->parts[o->part_count].output = output;
+    o->part_count++;
+    return true;
+}
+
+/* Report outputs that documents disagree on
+ * Returns the number of conflicting outputs
+ */
+static int check_conflicts(Registry *reg, Document *docs, RyftOptions *options)
+{
+    LogLevel level = options->strict_mode ? LOG_ERROR : LOG_WARN;
+    const char *prefix = options->strict_mode ? "error" : "warning";
+    int conflicts = 0;
+
+    for (int i = 0; i < reg->count; i++) {
+        SharedOutput *o = &reg->outputs[i];
+        if (o->part_count < 2) continue;
+
+        const Document *first = &docs[o->parts[0].doc];
+        for (int j = 1; j < o->part_count; j++) {
+            const Document *d = &docs[o->parts[j].doc];
+            const RyftOutput *out = &d->map.outputs[o->parts[j].output];
+            if (out->lang[0] && o->lang[0] && strcmp(out->lang, o->lang) != 0) {
+                log_write(level, "%s: '%s' is %s in %s but %s in %s\n",
+                          prefix, o->path, o->lang, first->path, out->lang, d->path);
+                o->conflict = true;
+            }
+        }
+
+        if (o->fallback) {
+            log_write(level, "%s: '%s' is a fallback output shared by %d documents"
+                      " (first: %s)\n", prefix, o->path, o->part_count, first->path);
+            o->conflict = true;
+        }
+
+        if (o->conflict) conflicts++;
+    }
+
+    return conflicts;
+}
+
+/* Hash of the contents an output gets from its contributions */
+static uint64_t content_hash(const SharedOutput *o, Document *docs, size_t *size)
+{
+    uint64_t hash = 0;
+    *size = 0;
+    for (int i = 0; i < o->part_count; i++) {
+        const RyftOutput *out = &docs[o->parts[i].doc].map.outputs[o->parts[i].output];
+        for (size_t s = 0; s < out->span_count; s++) {
+            uint64_t pair[2] = { hash, hash_bytes(out->spans[s].ptr, out->spans[s].len) };
+            hash = hash_bytes(pair, sizeof(pair));
+            *size += out->spans[s].len;
+        }
+    }
+    return hash;
+}
+
+/* Write one shared output from its contributions; in dry-run mode the
+ * backend makes no changes. The journal (if any) records the output as
+ * begun before it is truncated */
+static bool write_output(SharedOutput *o, Document *docs, RyftOptions *options,
+                         RyftStats *stats, Journal *journal)
+{
+    RyftIO *io = io_for(options);
+    const char *would = options->dry_run ? "[dry-run] would " : "";
+    bool existed = io_exists(io, o->path);
+
+    char dir[MAX_PATH];
+    if (get_directory(o->path, dir, sizeof(dir)) && dir[0]) {
+        if (!ensure_directory(io, dir)) {
+            return false;
+        }
+    }
+
+    /* Outputs are written one at a time, so waiting for one another
+     * process is writing cannot deadlock */
+    int lock_fd = -1;
+    if (io_native(io) && !options->dry_run) {
+        lock_fd = lock_output(o->path, options->no_wait, -1, options->verbose);
+        if (lock_fd < 0) {
+            return false;
+        }
+    }
+
+    if (options->backup && existed) {
+        char backup[MAX_PATH];
+        if (!create_backup(o->path, backup, sizeof(backup), options, stats)) {
+            if (lock_fd >= 0) lock_release(lock_fd);
+            return false;
+        }
+    }
+
+    if (journal) {
+        journal_begin(journal, o->path);
+    }
+
+    RyftFile *f = io->open(io, o->path, true);
+    if (!f) {
+        log_error("error: cannot create '%s': %s\n", o->path, strerror(errno));
+        if (lock_fd >= 0) lock_release(lock_fd);
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < o->part_count && ok; i++) {
+        const RyftOutput *out = &docs[o->parts[i].doc].map.outputs[o->parts[i].output];
+        for (size_t s = 0; s < out->span_count; s++) {
+            if (io->write(io, f, out->spans[s].ptr, out->spans[s].len) != out->spans[s].len) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    if (io->close(io, f) != 0) ok = false;
+
+    /* The lock covers the write, so a batching backend finishes it now */
+    const char *failed;
+    while (io->flush && io->flush(io, &failed) != 0) ok = false;
+    if (lock_fd >= 0) lock_release(lock_fd);
+    if (!ok) {
+        log_error("error: failed writing '%s': %s\n", o->path, strerror(errno));
+        return false;
+    }
+
+    if (options->verbose) {
+        if (existed) {
+            log_info("  %s%s: %s\n", would, options->dry_run ? "overwrite" : "overwriting", o->path);
+        } else {
+            log_info("  %s%s: %s\n", would, options->dry_run ? "create" : "creating", o->path);
+        }
+    }
+
+    if (existed) {
+        stats->files_overwritten++;
+    } else {
+        stats->files_created++;
+    }
+
+    if (options->verbose) {
+        for (int i = 0; i < o->part_count; i++) {
+            const Document *d = &docs[o->parts[i].doc];
+            log_debug("    %d block(s) from %s\n",
+                      d->map.outputs[o->parts[i].output].block_count, d->path);
+        }
+    }
+    return true;
+}
+
+/* Worker: compare shared outputs with the existing files */
+static void *check_outputs(void *arg)
+{
+    Job *job = arg;
+    for (int i = job->first; i < job->count; i += job->stride) {
+        SharedOutput *o = &job->reg->outputs[i];
+        if (!o->selected) continue;
+
+        const char *data;
+        size_t len;
+        o->existed = io_exists(job->io, o->path);
+        if (!o->existed || !io_load(job->io, o->path, &data, &len)) {
+            o->stale = true;
+            continue;
+        }
+
+        /* Sizes are known up front, so most edits never reach memcmp */
+        size_t size = 0;
+        for (int j = 0; j < o->part_count; j++) {
+            size += job->docs[o->parts[j].doc].map.outputs[o->parts[j].output].size;
+        }
+
+        size_t pos = 0;
+        o->stale = size != len;
+        for (int j = 0; j < o->part_count && !o->stale; j++) {
+            const RyftOutput *out = &job->docs[o->parts[j].doc].map.outputs[o->parts[j].output];
+            for (size_t k = 0; k < out->span_count; k++) {
+                if (memcmp(data + pos, out->spans[k].ptr, out->spans[k].len) != 0) {
+                    o->stale = true;
+                    break;
+                }
+                pos += out->spans[k].len;
+            }
+        }
+        io_unload(job->io, data, len);
+    }
+    return NULL;
+}
+
+/* Compare every selected output with the existing file (--check)
+ * Returns 0 if all are up to date, RYFT_STALE or 1 on error
+ */
+static int check_project(Registry *reg, Document *docs, RyftOptions *options, int threads)
+{
+    if (!run_jobs(check_outputs, docs, reg, options, reg->count, threads)) {
+        log_error("error: out of memory\n");
+        return 1;
+    }
+
+    int stale = 0;
+    int checked = 0;
+    for (int i = 0; i < reg->count; i++) {
+        SharedOutput *o = &reg->outputs[i];
+        if (!o->selected) continue;
+        checked++;
+        if (o->stale) {
+            stale++;
+            printf("%s: %s\n", o->existed ? "stale" : "missing", o->path);
+        } else if (options->verbose) {
+            printf("  up to date: %s\n", o->path);
+        }
+    }
+
+    if (stale > 0) {
+        printf("%d of %d output(s) out of date\n", stale, checked);
+        return RYFT_STALE;
+    }
+    printf("%d output(s) up to date\n", checked);
+    return 0;
+}
+
+static bool is_selected(const char *path, RyftOptions *options)
+{
+    if (options->only_count == 0) return true;
+    for (int i = 0; i < options->only_count; i++) {
+        if (path_matches(path, options->only[i])) return true;
+    }
+    return false;
+}
+
+/* Tangle every document listed in a manifest */
+static int run_project(const char *manifest, RyftOptions *options)
+{
+    Document *docs = NULL;
+    int doc_count = 0;
+    if (!read_manifest(manifest, &docs, &doc_count)) {
+        free(docs);
+        return 1;
+    }
+    if (doc_count == 0) {
+        log_error("error: manifest '%s' lists no documents\n", manifest);
+        free(docs);
+        return 1;
+    }
+
+    /* Map documents, spreading them over the requested threads */
+    int threads = options->jobs > 1 ? options->jobs : 1;
+    if (!run_jobs(map_documents, docs, NULL, options, doc_count, threads)) {
+        log_error("error: out of memory\n");
+        free(docs);
+        return 1;
+    }
+
+    int rc = 0;
+    Registry reg = {0};
+    RyftStats stats = {0};
+
+    for (int i = 0; i < doc_count; i++) {
+        if (!docs[i].mapped) {
+            log_error("error: cannot read '%s'\n", docs[i].path);
+            rc = 1;
+        }
+    }
+
+    /* Merge outputs in manifest order, then order of first appearance */
+    for (int i = 0; rc == 0 && i < doc_count; i++) {
+        RyftSourceMap *map = &docs[i].map;
+
+        for (size_t b = 0; rc == 0 && b < map->block_count; b++) {
+            switch (map->blocks[b].kind) {
+            case RYFT_BLOCK_CODE: stats.total_blocks++; break;
+            case RYFT_BLOCK_DISPLAY: stats.display_blocks++; break;
+            case RYFT_BLOCK_CONFIG: stats.config_blocks++; break;
+            case RYFT_BLOCK_EXEC:
+                log_error("error: %s: exec= blocks are not supported with --project\n",
+                          docs[i].path);
+                rc = 1;
+                break;
+            }
+            if (rc == 0 && map->blocks[b].transformed) {
+                log_error("error: %s: transforms (dedent=, eol=, trim=, tabs=) are not "
+                          "supported with --project\n", docs[i].path);
+                rc = 1;
+            }
+            if (rc == 0 && map->blocks[b].conditional) {
+                log_error("error: %s: if= blocks are not supported with --project\n",
+                          docs[i].path);
+                rc = 1;
+            }
+            if (rc == 0 && map->blocks[b].expands) {
+                log_error("error: %s: variables (vars=on) are not supported with --project\n",
+                          docs[i].path);
+                rc = 1;
+            }
+        }
+        if (rc != 0) {
+            break;
+        }
+
+        for (size_t j = 0; j < map->output_count; j++) {
+            RyftOutput *out = &map->outputs[j];
+            if (sink_target(out->path)) {
+                log_error("error: %s: pipe targets (%s) are not supported with --project\n",
+                          docs[i].path, out->path);
+                rc = 1;
+                break;
+            }
+            int idx = registry_get(&reg, out->path);
+            if (idx < 0 || !add_part(&reg.outputs[idx], i, (int)j)) {
+                log_error("error: out of memory\n");
+                rc = 1;
+                break;
+            }
+            SharedOutput *o = &reg.outputs[idx];
+            o->selected = is_selected(o->path, options);
+            if (!o->lang) o->lang = out->lang;
+            if (out->fallback) o->fallback = true;
+        }
+    }
+
+    if (rc == 0 && options->verbose) {
+        log_info("project: %s (%d document(s), %d output(s))\n",
+                 manifest, doc_count, reg.count);
+    }
+
+    if (rc == 0 && check_conflicts(&reg, docs, options) > 0 && options->strict_mode) {
+        rc = 1;
+    }
+
+    if (rc == 0 && options->check) {
+        rc = check_project(&reg, docs, options, threads);
+    }
+
+    /* Resumed runs read the interrupted run's journal and add to it */
+    Journal journal;
+    bool resume = rc == 0 && options->resume && !options->check;
+    if (resume && !journal_open(&journal, manifest, !options->dry_run)) {
+        rc = 1;
+        resume = false;
+    }
+
+    /* Write each output once */
+    int files = 0;
+    int resumed = 0;
+    for (int i = 0; rc == 0 && !options->check && i < reg.count; i++) {
+        SharedOutput *o = &reg.outputs[i];
+        if (!o->selected) {
+            if (options->verbose) {
+                log_info("  skipping: %s (not selected)\n", o->path);
+            }
+            continue;
+        }
+
+        size_t size = 0;
+        uint64_t hash = 0;
+        if (resume) {
+            hash = content_hash(o, docs, &size);
+            JournalState state = journal_state(&journal, o->path, hash, size);
+            RyftIO *io = io_for(options);
+            size_t disk;
+            if (state == JOURNAL_COMMITTED && io->stat(io, o->path, &disk) == 0 && disk == size) {
+                if (options->verbose) {
+                    log_info("  resumed: %s (already written)\n", o->path);
+                }
+                resumed++;
+                continue;
+            }
+            if (state == JOURNAL_BEGUN && options->verbose) {
+                log_info("  redoing: %s (interrupted)\n", o->path);
+            }
+        }
+
+        if (!write_output(o, docs, options, &stats, resume ? &journal : NULL)) {
+            rc = 1;
+            break;
+        }
+        if (resume) {
+            journal_commit(&journal, o->path, hash, size);
+        }
+        for (int j = 0; j < o->part_count; j++) {
+            stats.extracted_blocks +=
+                docs[o->parts[j].doc].map.outputs[o->parts[j].output].block_count;
+        }
+        files++;
+    }
+
+    if (resume && !journal_close(&journal, rc == 0) && rc == 0) {
+        rc = 1;
+    }
+
+    if (rc == 0 && !options->check) {
+        if (options->summary || options->verbose) {
+            printf("\n");
+            printf("=== Summary%s ===\n", options->dry_run ? " (dry-run)" : "");
+            printf("Documents:        %d\n", doc_count);
+            printf("Blocks found:     %d\n", stats.total_blocks);
+            printf("  Extracted:      %d\n", stats.extracted_blocks);
+            printf("  Display only:   %d (4+ backticks)\n", stats.display_blocks);
+            printf("  Config:         %d (ryft.config)\n", stats.config_blocks);
+            printf("\n");
+            printf("Totals%s:\n", options->dry_run ? " (would be)" : "");
+            printf("  Files:          %d\n", files);
+            printf("  New files:      %d\n", stats.files_created);
+            printf("  Overwritten:    %d\n", stats.files_overwritten);
+            if (stats.backups_created > 0) {
+                printf("  Backups:        %d\n", stats.backups_created);
+            }
+            if (resumed > 0) {
+                printf("  Resumed:        %d (already written)\n", resumed);
+            }
+        } else if (options->dry_run) {
+            printf("[dry-run] would extract %d block(s) from %d document(s) to %d file(s)",
+                   stats.extracted_blocks, doc_count, files);
+            if (resumed > 0) printf(", %d already written", resumed);
+            printf("\n");
+        } else {
+            printf("extracted %d block(s) from %d document(s) to %d file(s)",
+                   stats.extracted_blocks, doc_count, files);
+            if (resumed > 0) printf(", %d already written", resumed);
+            printf("\n");
+        }
+    }
+
+    for (int i = 0; i < reg.count; i++) {
+        free(reg.outputs[i].parts);
+    }
+    free(reg.outputs);
+    free(reg.buckets);
+    for (int i = 0; i < doc_count; i++) {
+        if (docs[i].mapped) ryft_map_free(&docs[i].map);
+        if (docs[i].decoded) {
+            free((char *)docs[i].data);
+        } else if (docs[i].data) {
+            io_unload(io_for(options), docs[i].data, docs[i].len);
+        }
+    }
+    free(docs);
+    return rc;
+}
+
+int project_run(const char *manifest, RyftOptions *options)
+{
+    /* Dry-run is the dry-run backend over whatever backend is in use */
+    RyftIO *base = options->io;
+    RyftIO *dry = NULL;
+    if (options->dry_run) {
+        dry = ryft_io_dry_run(base);
+        if (!dry) {
+            log_error("error: out of memory\n");
+            return 1;
+        }
+        options->io = dry;
+    }
+
+    int rc = run_project(manifest, options);
+
+    if (dry) {
+        options->io = base;
+        ryft_io_free(dry);
+    }
+    log_flush();
+    return rc;
+}
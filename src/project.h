@@ -0,0 +1,16 @@
+/*
+ * project.h - Multi-document projects with shared outputs
+ */
+
+#ifndef RYFT_PROJECT_H
+#define RYFT_PROJECT_H
+
+#include "types.h"
+
+/* Tangle every document listed in a manifest, writing each output once
+ * with blocks ordered by manifest position, then block order
+ * Returns 0 on success, non-zero on error (including conflicts in strict mode)
+ */
+int project_run(const char *manifest, RyftOptions *options);
+
+#endif /* RYFT_PROJECT_H */
@@ -0,0 +1,310 @@
+/*
+ * sink.c - Pipe sinks (|cmd fence targets)
+ *
+ * A fence target starting with '|' names a command rather than a file:
+ * the command is started once, on the first block routed to it, and
+ * block bodies are streamed into its stdin. Writes never block while the
+ * command keeps up; bytes it is not ready for are buffered, and a sink
+ * that falls too far behind makes the writer wait in poll() across every
+ * open sink, so all commands keep running concurrently.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "sink.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SINK_HIGH_WATER (1 << 20)    /* buffered bytes before a writer waits */
+
+struct PipeSink {
+    pid_t pid;
+    int fd;                    /* write end of the command's stdin */
+    bool broken;               /* command stopped reading, the rest is dropped */
+    char *buf;                 /* bytes the command has not taken yet */
+    size_t start;
+    size_t len;
+    size_t cap;
+    PipeSink *next;            /* in the list of sinks with stdin open */
+    PipeSink *next_child;      /* in the list of sinks not waited for yet */
+    bool exited;               /* reaped elsewhere, status holds how it exited */
+    int status;
+};
+
+/* Sinks with stdin still open; SIGPIPE is ignored while there are any */
+static PipeSink *g_sinks;
+static struct sigaction g_sigpipe;
+
+/* Sinks whose command has not been waited for */
+static PipeSink *g_children;
+
+/* Check if a fence target is a |cmd sink rather than a file */
+bool sink_target(const char *target)
+{
+    return target[0] == SINK_PREFIX;
+}
+
+/* Command of a |cmd target (the text after '|') */
+const char *sink_command(const char *target)
+{
+    if (sink_target(target)) {
+        target++;
+    }
+    while (*target == ' ' || *target == '\t') target++;
+    return target;
+}
+
+/* Write as much as the command takes without blocking
+ * Returns the number of bytes taken
+ */
+static size_t put(PipeSink *s, const char *p, size_t len)
+{
+    size_t done = 0;
+    while (done < len && !s->broken) {
+        ssize_t n = write(s->fd, p + done, len - done);
+        if (n > 0) {
+            done += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            s->broken = true;
+        }
+    }
+    return done;
+}
+
+/* Hand buffered bytes to the command */
+static void push(PipeSink *s)
+{
+    size_t n = put(s, s->buf + s->start, s->len);
+    s->start += n;
+    s->len -= n;
+    if (s->len == 0 || s->broken) {
+        s->start = 0;
+        s->len = 0;
+    }
+}
+
+/* Feed every sink with buffered bytes until s has at most limit left */
+static void service(PipeSink *s, size_t limit)
+{
+    push(s);
+    while (s->len > limit) {
+        int count = 0;
+        for (PipeSink *o = g_sinks; o; o = o->next) {
+            count += o->len > 0;
+        }
+
+        struct pollfd *fds = malloc((size_t)count * sizeof(struct pollfd));
+        if (!fds) {
+            /* Fall back to waiting on this sink alone */
+            struct pollfd one = { s->fd, POLLOUT, 0 };
+            poll(&one, 1, -1);
+            push(s);
+            continue;
+        }
+
+        int n = 0;
+        for (PipeSink *o = g_sinks; o; o = o->next) {
+            if (o->len > 0) {
+                fds[n].fd = o->fd;
+                fds[n].events = POLLOUT;
+                fds[n].revents = 0;
+                n++;
+            }
+        }
+
+        if (poll(fds, (nfds_t)n, -1) > 0) {
+            int i = 0;
+            for (PipeSink *o = g_sinks; o; o = o->next) {
+                if (o->len > 0 && fds[i++].revents) {
+                    push(o);
+                }
+            }
+        }
+        free(fds);
+    }
+}
+
+/* Start command through /bin/sh with a pipe to its stdin */
+PipeSink *sink_open(const char *command)
+{
+    PipeSink *s = calloc(1, sizeof(PipeSink));
+    int fds[2];
+    if (!s || pipe(fds) != 0) {
+        log_error("error: cannot start '%s': %s\n", command, strerror(errno));
+        free(s);
+        return NULL;
+    }
+
+    /* Later commands must not hold this stdin open */
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    if (!g_sinks) {
+        struct sigaction ignore;
+        memset(&ignore, 0, sizeof(ignore));
+        ignore.sa_handler = SIG_IGN;
+        sigaction(SIGPIPE, &ignore, &g_sigpipe);
+    }
+
+    /* Keep our own output ahead of the command's */
+    log_flush();
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGPIPE, SIG_DFL);
+        if (dup2(fds[0], STDIN_FILENO) >= 0) {
+            close(fds[0]);
+            execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        }
+        _exit(127);
+    }
+
+    int saved = errno;
+    close(fds[0]);
+    if (pid < 0) {
+        log_error("error: cannot start '%s': %s\n", command, strerror(saved));
+        close(fds[1]);
+        free(s);
+        if (!g_sinks) {
+            sigaction(SIGPIPE, &g_sigpipe, NULL);
+        }
+        return NULL;
+    }
+
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+    s->pid = pid;
+    s->fd = fds[1];
+    s->next = g_sinks;
+    g_sinks = s;
+    s->next_child = g_children;
+    g_children = s;
+    return s;
+}
+
+/* Make room to buffer len more bytes
+ * Returns false on allocation failure
+ */
+static bool reserve(PipeSink *s, size_t len)
+{
+    if (len <= s->cap - s->start - s->len) {
+        return true;
+    }
+
+    /* Move pending bytes to the front before growing */
+    if (s->start > 0) {
+        memmove(s->buf, s->buf + s->start, s->len);
+        s->start = 0;
+    }
+    if (len <= s->cap - s->len) {
+        return true;
+    }
+
+    size_t cap = s->cap ? s->cap : 65536;
+    while (cap - s->len < len) cap *= 2;
+    char *grown = realloc(s->buf, cap);
+    if (!grown) {
+        return false;
+    }
+    s->buf = grown;
+    s->cap = cap;
+    return true;
+}
+
+/* Stream bytes into a sink's stdin */
+void sink_write(PipeSink *s, const char *p, size_t len)
+{
+    if (s->len == 0) {
+        size_t n = put(s, p, len);
+        p += n;
+        len -= n;
+    }
+    if (len == 0 || s->broken) {
+        return;
+    }
+
+    if (!reserve(s, len)) {
+        /* No room to buffer: wait until the command has taken it all */
+        service(s, 0);
+        while (len > 0 && !s->broken) {
+            struct pollfd one = { s->fd, POLLOUT, 0 };
+            poll(&one, 1, -1);
+            size_t n = put(s, p, len);
+            p += n;
+            len -= n;
+        }
+        return;
+    }
+    memcpy(s->buf + s->start + s->len, p, len);
+    s->len += len;
+
+    if (s->len > SINK_HIGH_WATER) {
+        service(s, SINK_HIGH_WATER / 2);
+    }
+}
+
+/* Deliver the rest of the buffered bytes and close the command's stdin */
+void sink_close_input(PipeSink *s)
+{
+    if (s->fd < 0) {
+        return;
+    }
+    service(s, 0);
+    close(s->fd);
+    s->fd = -1;
+
+    for (PipeSink **p = &g_sinks; *p; p = &(*p)->next) {
+        if (*p == s) {
+            *p = s->next;
+            break;
+        }
+    }
+    if (!g_sinks) {
+        sigaction(SIGPIPE, &g_sigpipe, NULL);
+    }
+}
+
+/* Record the wait status of a sink's command reaped by someone else */
+bool sink_reaped(pid_t pid, int status)
+{
+    for (PipeSink *s = g_children; s; s = s->next_child) {
+        if (s->pid == pid) {
+            s->exited = true;
+            s->status = status;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Wait for the command to exit and release the sink */
+int sink_wait(PipeSink *s)
+{
+    sink_close_input(s);
+
+    for (PipeSink **p = &g_children; *p; p = &(*p)->next_child) {
+        if (*p == s) {
+            *p = s->next_child;
+            break;
+        }
+    }
+
+    int status = s->status;
+    while (!s->exited && waitpid(s->pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    free(s->buf);
+    free(s);
+    return status;
+}
@@ -0,0 +1,48 @@
+/*
+ * sink.h - Pipe sinks (|cmd fence targets)
+ */
+
+#ifndef RYFT_SINK_H
+#define RYFT_SINK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SINK_PREFIX '|'
+
+typedef struct PipeSink PipeSink;
+
+/* Check if a fence target is a |cmd sink rather than a file */
+bool sink_target(const char *target);
+
+/* Command of a |cmd target (the text after '|') */
+const char *sink_command(const char *target);
+
+/* Start command through /bin/sh with a pipe to its stdin
+ * Returns NULL if it cannot be started (already reported)
+ */
+PipeSink *sink_open(const char *command);
+
+/* Stream bytes into a sink's stdin; bytes the command is not ready for
+ * are buffered, and past the high-water mark this waits (while feeding
+ * every other sink) until the command catches up. Bytes sent after the
+ * command has stopped reading are dropped
+ */
+void sink_write(PipeSink *s, const char *p, size_t len);
+
+/* Deliver the rest of the buffered bytes and close the command's stdin */
+void sink_close_input(PipeSink *s);
+
+/* Record the wait status of a command reaped by someone else (a
+ * waitpid(-1) for another child)
+ * Returns false if pid is not a sink's command
+ */
+bool sink_reaped(pid_t pid, int status);
+
+/* Wait for the command to exit and release the sink
+ * Returns its wait status
+ */
+int sink_wait(PipeSink *s);
+
+#endif /* RYFT_SINK_H */
@@ -0,0 +1,281 @@
+/*
+ * spill.c - Output buffers under a memory budget (--max-memory)
+ *
+ * Buffers that hold output before it can be written (bytes behind a
+ * pending exec= result, new contents kept for --diff) are accounted
+ * together. When they outgrow the budget, the largest buffer's bytes
+ * are appended to an anonymous temp file (O_TMPFILE where available,
+ * otherwise an unlinked mkstemp file) and its memory is freed, so peak
+ * memory stays at the budget however large the document. Spilled bytes
+ * are read back in chunks, copied in the kernel, or mapped.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE            /* O_TMPFILE */
+#else
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "spill.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static size_t g_budget;        /* 0 = no limit */
+static size_t g_held;          /* bytes allocated by all buffers */
+static SpillBuffer *g_buffers; /* buffers holding memory */
+static bool g_spill_failed;    /* temp files do not work, stop trying */
+static int g_spills;
+static size_t g_spilled;
+
+/* Limit the memory all buffers may hold together */
+void spill_set_budget(size_t bytes)
+{
+    g_budget = bytes;
+}
+
+/* Start an empty buffer */
+void spill_init(SpillBuffer *b)
+{
+    memset(b, 0, sizeof(*b));
+    b->fd = -1;
+}
+
+/* Create an anonymous temp file
+ * Returns its descriptor, or -1 with errno set
+ */
+static int temp_file(void)
+{
+    const char *dir = getenv("TMPDIR");
+    if (!dir || !*dir) {
+        dir = "/tmp";
+    }
+
+#ifdef O_TMPFILE
+    int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)) {
+        return fd;
+    }
+#endif
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/ryft-spill-XXXXXX", dir);
+    int tmp = mkstemp(path);
+    if (tmp >= 0) {
+        unlink(path);
+        fcntl(tmp, F_SETFD, FD_CLOEXEC);
+    }
+    return tmp;
+}
+
+/* Write all of p to fd
+ * Returns false with errno set on failure
+ */
+static bool write_all(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/* Stop accounting a buffer's memory */
+static void release_memory(SpillBuffer *b)
+{
+    if (b->cap == 0) {
+        return;
+    }
+    g_held -= b->cap;
+    if (b->prev) {
+        b->prev->next = b->next;
+    } else {
+        g_buffers = b->next;
+    }
+    if (b->next) {
+        b->next->prev = b->prev;
+    }
+    b->prev = b->next = NULL;
+
+    free(b->data);
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+}
+
+/* Move a buffer's bytes to its temp file
+ * Returns false if they stay in memory
+ */
+static bool spill(SpillBuffer *b)
+{
+    if (b->fd < 0) {
+        b->fd = temp_file();
+    }
+    if (b->fd < 0 || !write_all(b->fd, b->data, b->len)) {
+        log_warn("warning: cannot spill output buffers to disk: %s\n", strerror(errno));
+        g_spill_failed = true;
+        return false;
+    }
+
+    b->spilled += b->len;
+    g_spills++;
+    g_spilled += b->len;
+    release_memory(b);
+    return true;
+}
+
+/* Spill the largest buffers until the others fit the budget */
+static void enforce_budget(void)
+{
+    while (g_held > g_budget && !g_spill_failed) {
+        SpillBuffer *largest = g_buffers;
+        for (SpillBuffer *b = g_buffers; b; b = b->next) {
+            if (b->cap > largest->cap) {
+                largest = b;
+            }
+        }
+        if (!largest || largest->len == 0 || !spill(largest)) {
+            break;
+        }
+    }
+}
+
+/* Append bytes; past the budget, the largest buffers are moved to disk */
+bool spill_append(SpillBuffer *b, const char *p, size_t len)
+{
+    if (len == 0) {
+        return true;
+    }
+
+    if (len > b->cap - b->len) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap - b->len < len) cap *= 2;
+
+        /* Doubling must not overshoot the budget by itself */
+        if (g_budget && cap > g_budget && b->len + len <= g_budget) {
+            cap = g_budget;
+        }
+
+        char *grown = realloc(b->data, cap);
+        if (!grown) {
+            return false;
+        }
+        if (b->cap == 0) {
+            b->next = g_buffers;
+            if (g_buffers) {
+                g_buffers->prev = b;
+            }
+            g_buffers = b;
+        }
+        g_held += cap - b->cap;
+        b->data = grown;
+        b->cap = cap;
+    }
+
+    memcpy(b->data + b->len, p, len);
+    b->len += len;
+
+    if (g_budget && g_held > g_budget) {
+        enforce_budget();
+    }
+    return true;
+}
+
+/* Total bytes appended */
+size_t spill_length(const SpillBuffer *b)
+{
+    return b->spilled + b->len;
+}
+
+/* Pass the contents to fn in order, in pieces */
+bool spill_read(const SpillBuffer *b, void (*fn)(void *ctx, const char *p, size_t len),
+                void *ctx)
+{
+    if (b->spilled > 0) {
+        char *chunk = malloc(SPILL_CHUNK);
+        if (!chunk) {
+            return false;
+        }
+        size_t off = 0;
+        while (off < b->spilled) {
+            size_t want = b->spilled - off < SPILL_CHUNK ? b->spilled - off : SPILL_CHUNK;
+            ssize_t n = pread(b->fd, chunk, want, (off_t)off);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                free(chunk);
+                return false;
+            }
+            fn(ctx, chunk, (size_t)n);
+            off += (size_t)n;
+        }
+        free(chunk);
+    }
+    if (b->len > 0) {
+        fn(ctx, b->data, b->len);
+    }
+    return true;
+}
+
+/* The whole contents as one range */
+bool spill_contents(SpillBuffer *b, const char **data, size_t *len)
+{
+    if (b->spilled == 0) {
+        *data = b->data;
+        *len = b->len;
+        return true;
+    }
+
+    /* Everything goes to the temp file, which is then mapped */
+    if (b->len > 0) {
+        if (!write_all(b->fd, b->data, b->len)) {
+            return false;
+        }
+        b->spilled += b->len;
+        release_memory(b);
+    }
+    if (!b->map) {
+        void *p = mmap(NULL, b->spilled, PROT_READ, MAP_SHARED, b->fd, 0);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        b->map = p;
+    }
+    *data = b->map;
+    *len = b->spilled;
+    return true;
+}
+
+/* Release memory, temp file and mapping */
+void spill_free(SpillBuffer *b)
+{
+    release_memory(b);
+    if (b->map) {
+        munmap((void *)b->map, b->spilled);
+    }
+    if (b->fd >= 0) {
+        close(b->fd);
+    }
+    spill_init(b);
+}
+
+/* Spills so far and the bytes they moved to disk */
+void spill_totals(int *spills, size_t *bytes)
+{
+    *spills = g_spills;
+    *bytes = g_spilled;
+}
@@ -0,0 +1,59 @@
+/*
+ * spill.h - Output buffers under a memory budget (--max-memory)
+ */
+
+#ifndef RYFT_SPILL_H
+#define RYFT_SPILL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SPILL_CHUNK 65536      /* read-back granularity of spilled bytes */
+
+/* Growable buffer whose head may live in an anonymous temp file: the
+ * contents are the spilled bytes followed by data[0..len)
+ */
+typedef struct SpillBuffer {
+    char *data;                /* bytes not spilled (yet) */
+    size_t len;
+    size_t cap;
+    int fd;                    /* temp file, -1 until the first spill */
+    size_t spilled;            /* bytes in the temp file */
+    const char *map;           /* spill_contents() mapping of the temp file */
+    struct SpillBuffer *prev;  /* buffers holding memory, for the budget */
+    struct SpillBuffer *next;
+} SpillBuffer;
+
+/* Limit the memory all buffers may hold together; 0 for no limit */
+void spill_set_budget(size_t bytes);
+
+/* Start an empty buffer */
+void spill_init(SpillBuffer *b);
+
+/* Append bytes; past the budget, the largest buffers are moved to disk
+ * Returns false on allocation failure
+ */
+bool spill_append(SpillBuffer *b, const char *p, size_t len);
+
+/* Total bytes appended */
+size_t spill_length(const SpillBuffer *b);
+
+/* Pass the contents to fn in order, in pieces
+ * Returns false if spilled bytes could not be read back
+ */
+bool spill_read(const SpillBuffer *b, void (*fn)(void *ctx, const char *p, size_t len),
+                void *ctx);
+
+/* The whole contents as one range; spilled buffers are mapped from
+ * their temp file, so this does not bring them back into memory
+ * Returns false if the temp file cannot be mapped
+ */
+bool spill_contents(SpillBuffer *b, const char **data, size_t *len);
+
+/* Release memory, temp file and mapping */
+void spill_free(SpillBuffer *b);
+
+/* Spills so far and the bytes they moved to disk */
+void spill_totals(int *spills, size_t *bytes);
+
+#endif /* RYFT_SPILL_H */
@@ -0,0 +1,107 @@
+/*
+ * tags.c - Tag sets and if= block predicates
+ *
+ * Tag names are interned into a registry so a tag set is a 64-bit mask
+ * and an if= expression compiles once into AND-of-OR clauses over that
+ * mask. Evaluating a block against any number of tag sets is then a few
+ * bitwise operations per set.
+ */
+
+#include "tags.h"
+
+#include <string.h>
+
+static bool is_tag_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.';
+}
+
+/* Find or add a tag, returning its bit index or -1 */
+static int tag_id(TagRegistry *reg, const char *name, size_t len)
+{
+    if (len == 0 || len >= MAX_TAG_NAME) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!is_tag_char(name[i])) {
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < reg->count; i++) {
+        if (strncmp(reg->names[i], name, len) == 0 && reg->names[i][len] == '\0') {
+            return i;
+        }
+    }
+
+    if (reg->count >= MAX_TAGS) {
+        return -1;
+    }
+    memcpy(reg->names[reg->count], name, len);
+    reg->names[reg->count][len] = '\0';
+    return reg->count++;
+}
+
+/* Parse a tag list such as "linux,x86" into a bitmask */
+bool tag_parse_set(TagRegistry *reg, const char *list, size_t len, uint64_t *mask)
+{
+    const char *p = list;
+    const char *end = list + len;
+
+    *mask = 0;
+    while (p < end) {
+        const char *comma = memchr(p, ',', (size_t)(end - p));
+        const char *stop = comma ? comma : end;
+        if (stop > p) {
+            int id = tag_id(reg, p, (size_t)(stop - p));
+            if (id < 0) {
+                return false;
+            }
+            *mask |= (uint64_t)1 << id;
+        }
+        p = comma ? comma + 1 : end;
+    }
+    return true;
+}
+
+/* Compile an if= expression such as "linux|macos,!musl" */
+bool tag_compile(TagRegistry *reg, const char *expr, TagPredicate *pred)
+{
+    const char *p = expr;
+
+    memset(pred, 0, sizeof(*pred));
+    while (*p) {
+        if (pred->count >= MAX_CLAUSES) {
+            return false;
+        }
+        TagClause *clause = &pred->clauses[pred->count++];
+
+        /* Literals of one clause, separated by '|' */
+        for (;;) {
+            bool negate = *p == '!';
+            if (negate) p++;
+
+            size_t len = strcspn(p, ",|");
+            int id = tag_id(reg, p, len);
+            if (id < 0) {
+                return false;
+            }
+            if (negate) {
+                clause->neg |= (uint64_t)1 << id;
+            } else {
+                clause->pos |= (uint64_t)1 << id;
+            }
+
+            p += len;
+            if (*p != '|') break;
+            p++;
+        }
+
+        if (*p == ',') {
+            p++;
+            if (!*p) return false;  /* Trailing comma */
+        }
+    }
+    return true;
+}
@@ -0,0 +1,57 @@
+/*
+ * tags.h - Tag sets and if= block predicates
+ */
+
+#ifndef RYFT_TAGS_H
+#define RYFT_TAGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_TAGS 64            /* one bit per tag in a tag set */
+#define MAX_TAG_NAME 32
+#define MAX_CLAUSES 16
+#define MAX_COND 128           /* if= expression length */
+
+/* Known tag names; a tag's index is its bit */
+typedef struct {
+    char names[MAX_TAGS][MAX_TAG_NAME];
+    int count;
+} TagRegistry;
+
+/* One comma-separated term: true if any listed tag is set (pos) or
+ * any negated tag is clear (neg) */
+typedef struct {
+    uint64_t pos;
+    uint64_t neg;
+} TagClause;
+
+/* Compiled if= expression: all clauses must hold (none = always true) */
+typedef struct {
+    TagClause clauses[MAX_CLAUSES];
+    int count;
+} TagPredicate;
+
+/* Parse a tag list such as "linux,x86" into a bitmask
+ * Returns false if a name is invalid or the registry is full
+ */
+bool tag_parse_set(TagRegistry *reg, const char *list, size_t len, uint64_t *mask);
+
+/* Compile an if= expression such as "linux|macos,!musl"
+ * Returns false if the expression is malformed
+ */
+bool tag_compile(TagRegistry *reg, const char *expr, TagPredicate *pred);
+
+/* Evaluate a compiled predicate against a tag set */
+static inline bool tag_match(const TagPredicate *pred, uint64_t set)
+{
+    for (int i = 0; i < pred->count; i++) {
+        if (!(set & pred->clauses[i].pos) && !(~set & pred->clauses[i].neg)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif /* RYFT_TAGS_H */
@@ -0,0 +1,194 @@
+/*
+ * trace.c - Pipeline tracing (Chrome trace events, USDT probes)
+ *
+ * Every thread records finished spans into its own fixed-size ring
+ * buffer, so recording takes no locks and never allocates after the
+ * thread's first event; on overflow the oldest events are overwritten.
+ * Buffers are chained into a global list once and written out as Chrome
+ * trace-event JSON (chrome://tracing, Perfetto) when tracing stops.
+ * With tracing off, each traced site costs one predictable branch.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include "log.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    const char *name;          /* static string */
+    uint64_t start;
+    uint64_t end;
+    char arg[TRACE_ARG];
+} TraceEvent;
+
+typedef struct TraceBuffer {
+    TraceEvent *events;        /* TRACE_RING entries */
+    uint64_t recorded;         /* total events, may exceed TRACE_RING */
+    int tid;
+    bool main;                 /* the thread that called trace_open() */
+    struct TraceBuffer *next;
+} TraceBuffer;
+
+bool g_trace_enabled = false;
+
+static char trace_path[1024];
+static uint64_t trace_epoch;
+static pthread_key_t trace_key;
+static pthread_t trace_main;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceBuffer *trace_buffers;
+static int trace_threads;
+
+/* Monotonic time in nanoseconds */
+uint64_t trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Start recording */
+bool trace_open(const char *path)
+{
+    if (strlen(path) >= sizeof(trace_path)) {
+        log_error("error: trace path too long\n");
+        return false;
+    }
+    if (pthread_key_create(&trace_key, NULL) != 0) {
+        log_error("error: cannot set up tracing\n");
+        return false;
+    }
+    strcpy(trace_path, path);
+    trace_main = pthread_self();
+    trace_epoch = trace_now();
+    g_trace_enabled = true;
+    return true;
+}
+
+/* Buffer of the calling thread, created on its first event */
+static TraceBuffer *thread_buffer(void)
+{
+    TraceBuffer *buf = pthread_getspecific(trace_key);
+    if (buf) {
+        return buf;
+    }
+
+    buf = calloc(1, sizeof(TraceBuffer));
+    if (!buf || !(buf->events = malloc(TRACE_RING * sizeof(TraceEvent)))) {
+        free(buf);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    buf->tid = ++trace_threads;
+    buf->main = pthread_equal(pthread_self(), trace_main) != 0;
+    buf->next = trace_buffers;
+    trace_buffers = buf;
+    pthread_mutex_unlock(&trace_lock);
+
+    pthread_setspecific(trace_key, buf);
+    return buf;
+}
+
+/* Record a finished span in the calling thread's ring buffer */
+void trace_record(const char *name, uint64_t start, const char *arg)
+{
+    uint64_t end = trace_now();
+    TraceBuffer *buf = thread_buffer();
+    if (!buf) {
+        return;
+    }
+
+    TraceEvent *ev = &buf->events[buf->recorded % TRACE_RING];
+    buf->recorded++;
+    ev->name = name;
+    ev->start = start;
+    ev->end = end;
+    if (arg) {
+        size_t len = strlen(arg);
+        if (len >= TRACE_ARG) len = TRACE_ARG - 1;
+        memcpy(ev->arg, arg, len);
+        ev->arg[len] = '\0';
+    } else {
+        ev->arg[0] = '\0';
+    }
+}
+
+/* Write recorded events as Chrome trace JSON and stop recording */
+bool trace_close(void)
+{
+    if (!g_trace_enabled) {
+        return true;
+    }
+    g_trace_enabled = false;
+
+    FILE *f = fopen(trace_path, "w");
+    if (!f) {
+        log_error("error: cannot create trace '%s': %s\n", trace_path, strerror(errno));
+    }
+
+    long pid = (long)getpid();
+    uint64_t dropped = 0;
+    bool first = true;
+
+    if (f) fputs("{\"traceEvents\":[\n", f);
+    for (TraceBuffer *buf = trace_buffers; buf; ) {
+        if (f) {
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s %d\"}}",
+                    first ? "" : ",\n", pid, buf->tid,
+                    buf->main ? "main" : "worker", buf->tid);
+            first = false;
+
+            uint64_t from = buf->recorded > TRACE_RING ? buf->recorded - TRACE_RING : 0;
+            dropped += from;
+            for (uint64_t i = from; i < buf->recorded; i++) {
+                const TraceEvent *ev = &buf->events[i % TRACE_RING];
+                uint64_t ts = ev->start - trace_epoch;
+                uint64_t dur = ev->end - ev->start;
+                fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"ryft\",\"ph\":\"X\","
+                        "\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":%ld,\"tid\":%d",
+                        ev->name,
+                        (unsigned long long)(ts / 1000), (unsigned long long)(ts % 1000),
+                        (unsigned long long)(dur / 1000), (unsigned long long)(dur % 1000),
+                        pid, buf->tid);
+                if (ev->arg[0]) {
+                    fputs(",\"args\":{\"arg\":\"", f);
+                    put_json(f, ev->arg);
+                    fputs("\"}", f);
+                }
+                fputc('}', f);
+            }
+        }
+
+        TraceBuffer *next = buf->next;
+        free(buf->events);
+        free(buf);
+        buf = next;
+    }
+    trace_buffers = NULL;
+
+    if (!f) {
+        return false;
+    }
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", f);
+
+    if (dropped > 0) {
+        log_warn("warning: trace buffer full, %llu oldest event(s) dropped\n",
+                 (unsigned long long)dropped);
+    }
+    if (fclose(f) != 0) {
+        log_error("error: failed writing trace '%s': %s\n", trace_path, strerror(errno));
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+/*
+ * trace.h - Pipeline tracing (Chrome trace events, USDT probes)
+ */
+
+#ifndef RYFT_TRACE_H
+#define RYFT_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_RING 16384       /* events kept per thread */
+#define TRACE_ARG 80           /* bytes of the argument (usually a path) kept */
+
+/* Static probe points for perf/bpftrace: make WITH_USDT=1
+ * Each traced site fires ryft:<name>_begin and ryft:<name>_end with its
+ * argument, whether or not --trace is recording.
+ */
+#ifdef RYFT_USDT
+#include <sys/sdt.h>
+#define TRACE_PROBE(name, arg) DTRACE_PROBE1(ryft, name, arg)
+#else
+#define TRACE_PROBE(name, arg) ((void)0)
+#endif
+
+extern bool g_trace_enabled;
+
+/* Start a span; t stays 0 unless --trace is recording */
+#define TRACE_BEGIN(t, name, arg) do { \
+        TRACE_PROBE(name##_begin, arg); \
+        (t) = g_trace_enabled ? trace_now() : 0; \
+    } while (0)
+
+/* Finish a span started with TRACE_BEGIN */
+#define TRACE_END(t, name, arg) do { \
+        TRACE_PROBE(name##_end, arg); \
+        if (t) trace_record(#name, (t), (arg)); \
+    } while (0)
+
+/* Start recording; events are written to path by trace_close()
+ * Returns false if tracing could not be set up
+ */
+bool trace_open(const char *path);
+
+/* Monotonic time in nanoseconds */
+uint64_t trace_now(void);
+
+/* Record a finished span in the calling thread's ring buffer */
+void trace_record(const char *name, uint64_t start, const char *arg);
+
+/* Write recorded events as Chrome trace JSON and stop recording
+ * Returns false if the file could not be written
+ */
+bool trace_close(void);
+
+#endif /* RYFT_TRACE_H */
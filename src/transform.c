@@ -0,0 +1,373 @@
+/*
+ * transform.c - Streaming output transforms (dedent, EOL, trim, tabs)
+ *
+ * Sits between a block body (after variable expansion) and its output.
+ * Lines are found with memchr() and only the bytes a transform changes
+ * are rewritten: untouched stretches of input are passed on as one run,
+ * so a body with nothing to change goes out in a single write and the
+ * transforms add no pass of their own over the data. Only dedent holds a
+ * block back, as the common indentation is known once the block ends.
+ */
+
+#include "transform.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char spaces[MAX_TAB_WIDTH] = "                ";
+
+/* Check if key names a transform (dedent, eol, trim, tabs) */
+bool transform_key(const char *key)
+{
+    return strcmp(key, "dedent") == 0 || strcmp(key, "eol") == 0 ||
+           strcmp(key, "trim") == 0 || strcmp(key, "tabs") == 0;
+}
+
+/* Set one transform from a config key or fence attribute */
+bool transform_parse(TransformSpec *spec, const char *key, const char *value)
+{
+    if (strcmp(key, "dedent") == 0) {
+        return (spec->dedent_set = parse_bool(value, &spec->dedent));
+    }
+    if (strcmp(key, "trim") == 0) {
+        return (spec->trim_set = parse_bool(value, &spec->trim));
+    }
+    if (strcmp(key, "eol") == 0) {
+        if (strcmp(value, "lf") == 0) {
+            spec->eol = EOL_LF;
+        } else if (strcmp(value, "crlf") == 0) {
+            spec->eol = EOL_CRLF;
+        } else if (strcmp(value, "keep") == 0) {
+            spec->eol = EOL_KEEP;
+        } else {
+            return false;
+        }
+        spec->eol_set = true;
+        return true;
+    }
+    if (strcmp(key, "tabs") == 0) {
+        char *end;
+        long width = strtol(value, &end, 10);
+        if (end == value || *end || width < 0 || width > MAX_TAB_WIDTH) {
+            return false;
+        }
+        spec->tabs = (int)width;
+        spec->tabs_set = true;
+        return true;
+    }
+    return false;
+}
+
+/* Overlay fence attributes ("dedent=on eol=lf") on a document's spec */
+bool transform_overlay(TransformSpec *spec, const char *attrs, char *bad, size_t bad_size)
+{
+    bool ok = true;
+
+    while (*attrs) {
+        size_t len = strcspn(attrs, " ");
+        char attr[MAX_TRANSFORM];
+        size_t copy = len < sizeof(attr) ? len : sizeof(attr) - 1;
+        memcpy(attr, attrs, copy);
+        attr[copy] = '\0';
+
+        char *eq = strchr(attr, '=');
+        if (eq) {
+            *eq = '\0';
+        }
+        if ((!eq || !transform_parse(spec, attr, eq + 1)) && ok) {
+            if (eq) {
+                *eq = '=';
+            }
+            snprintf(bad, bad_size, "%s", attr);
+            ok = false;
+        }
+
+        attrs += len;
+        while (*attrs == ' ') attrs++;
+    }
+    return ok;
+}
+
+/* Check if a spec changes anything */
+bool transform_enabled(const TransformSpec *spec)
+{
+    return spec->dedent || spec->trim || spec->eol != EOL_KEEP || spec->tabs > 0;
+}
+
+/* Start transforming a block body into sink */
+void transform_begin(Transform *tf, const TransformSpec *spec,
+                     void (*sink)(void *ctx, const char *p, size_t len), void *ctx)
+{
+    tf->spec = *spec;
+    tf->run = NULL;
+    tf->run_len = 0;
+    tf->col = 0;
+    tf->cr = false;
+    tf->ws_len = 0;
+    tf->held_len = 0;
+    tf->failed = false;
+    tf->sink = sink;
+    tf->sink_ctx = ctx;
+}
+
+/* Pass on the pending run of unchanged input */
+static void flush_run(Transform *tf)
+{
+    if (tf->run_len > 0) {
+        tf->sink(tf->sink_ctx, tf->run, tf->run_len);
+        tf->run_len = 0;
+    }
+}
+
+/* Pass on input bytes, merged with the pending run when adjacent */
+static void out_input(Transform *tf, const char *p, size_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    if (tf->run_len > 0 && tf->run + tf->run_len == p) {
+        tf->run_len += len;
+        return;
+    }
+    flush_run(tf);
+    tf->run = p;
+    tf->run_len = len;
+}
+
+/* Pass on bytes that are not part of the input */
+static void out_other(Transform *tf, const char *p, size_t len)
+{
+    flush_run(tf);
+    if (len > 0) {
+        tf->sink(tf->sink_ctx, p, len);
+    }
+}
+
+/* Append bytes to a growable buffer
+ * Returns false on allocation failure
+ */
+static bool append(char **buf, size_t *len, size_t *cap, const char *p, size_t n)
+{
+    if (n > *cap - *len) {
+        size_t grown_cap = *cap ? *cap : 256;
+        while (grown_cap - *len < n) grown_cap *= 2;
+        char *grown = realloc(*buf, grown_cap);
+        if (!grown) {
+            return false;
+        }
+        *buf = grown;
+        *cap = grown_cap;
+    }
+    memcpy(*buf + *len, p, n);
+    *len += n;
+    return true;
+}
+
+/* Display columns of UTF-8 text (continuation bytes take none) */
+static size_t columns(const char *p, size_t len)
+{
+    size_t cols = 0;
+    for (size_t i = 0; i < len; i++) {
+        cols += ((unsigned char)p[i] & 0xC0) != 0x80;
+    }
+    return cols;
+}
+
+/* Write line text, expanding tabs if asked; input says whether p points
+ * into the caller's piece (and may join the pending run)
+ */
+static void put(Transform *tf, const char *p, size_t len, bool input)
+{
+    void (*out)(Transform *, const char *, size_t) = input ? out_input : out_other;
+
+    if (tf->spec.tabs <= 0) {
+        out(tf, p, len);
+        return;
+    }
+
+    size_t width = (size_t)tf->spec.tabs;
+    while (len > 0) {
+        const char *tab = memchr(p, '\t', len);
+        size_t n = tab ? (size_t)(tab - p) : len;
+        out(tf, p, n);
+        tf->col += columns(p, n);
+        if (!tab) {
+            break;
+        }
+        size_t pad = width - tf->col % width;
+        out_other(tf, spaces, pad);
+        tf->col += pad;
+        p = tab + 1;
+        len -= n + 1;
+    }
+}
+
+/* Write line text (no '\n'), holding back trailing whitespace when
+ * trimming until it is known whether more text follows on the line
+ */
+static void text(Transform *tf, const char *p, size_t len, bool input)
+{
+    if (!tf->spec.trim) {
+        put(tf, p, len, input);
+        return;
+    }
+
+    size_t keep = len;
+    while (keep > 0 && (p[keep - 1] == ' ' || p[keep - 1] == '\t')) keep--;
+
+    if (keep > 0) {
+        if (tf->ws_len > 0) {
+            put(tf, tf->ws, tf->ws_len, false);
+            tf->ws_len = 0;
+        }
+        put(tf, p, keep, input);
+    }
+    if (keep < len && !append(&tf->ws, &tf->ws_len, &tf->ws_cap, p + keep, len - keep)) {
+        tf->failed = true;
+    }
+}
+
+/* End a line; nl points at the input's "\n", and had_cr is set when a
+ * '\r' came before it (in_piece when that '\r' is at nl[-1])
+ */
+static void line_end(Transform *tf, const char *nl, bool had_cr, bool in_piece)
+{
+    tf->ws_len = 0;
+    tf->col = 0;
+
+    if (tf->spec.eol == EOL_LF || (tf->spec.eol == EOL_KEEP && !had_cr)) {
+        out_input(tf, nl, 1);
+    } else if (had_cr && in_piece) {
+        out_input(tf, nl - 1, 2);
+    } else {
+        out_other(tf, "\r\n", 2);
+    }
+}
+
+/* Transform a piece of body text; the caller flushes the run */
+static void stream(Transform *tf, const char *p, size_t len)
+{
+    /* A '\r' ending the last piece is either half of "\r\n" or text */
+    if (tf->cr && len > 0) {
+        tf->cr = false;
+        if (p[0] == '\n') {
+            line_end(tf, p, true, false);
+            p++;
+            len--;
+        } else {
+            text(tf, "\r", 1, false);
+        }
+    }
+
+    while (len > 0) {
+        const char *nl = memchr(p, '\n', len);
+        if (!nl) {
+            if (p[len - 1] == '\r') {
+                tf->cr = true;
+                len--;
+            }
+            text(tf, p, len, true);
+            return;
+        }
+
+        size_t n = (size_t)(nl - p);
+        bool had_cr = n > 0 && p[n - 1] == '\r';
+        text(tf, p, n - had_cr, true);
+        line_end(tf, nl, had_cr, true);
+        p = nl + 1;
+        len -= n + 1;
+    }
+}
+
+/* Transform a piece of a block body */
+void transform_write(Transform *tf, const char *p, size_t len)
+{
+    if (tf->spec.dedent) {
+        if (!append(&tf->held, &tf->held_len, &tf->held_cap, p, len)) {
+            tf->failed = true;
+        }
+        return;
+    }
+    stream(tf, p, len);
+    flush_run(tf);
+}
+
+/* Length of the leading whitespace shared by every non-blank line */
+static size_t common_indent(const char *p, size_t len, const char **prefix)
+{
+    const char *end = p + len;
+    size_t indent = 0;
+    *prefix = NULL;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *eol = nl ? nl : end;
+        const char *q = p;
+        while (q < eol && (*q == ' ' || *q == '\t')) q++;
+
+        /* Blank lines (whitespace only) do not count */
+        if (q < eol && !(q + 1 == eol && *q == '\r')) {
+            size_t ws = (size_t)(q - p);
+            if (!*prefix) {
+                *prefix = p;
+                indent = ws;
+            } else {
+                size_t i = 0;
+                while (i < indent && i < ws && p[i] == (*prefix)[i]) i++;
+                indent = i;
+            }
+        }
+        p = nl ? nl + 1 : end;
+    }
+    return indent;
+}
+
+/* Write the held body with its common indentation removed */
+static void dedent(Transform *tf)
+{
+    const char *p = tf->held;
+    const char *end = p + tf->held_len;
+    const char *prefix;
+    size_t indent = common_indent(p, tf->held_len, &prefix);
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *next = nl ? nl + 1 : end;
+        size_t strip = 0;
+        while (strip < indent && p + strip < next && p[strip] == prefix[strip]) strip++;
+        stream(tf, p + strip, (size_t)(next - p - strip));
+        p = next;
+    }
+    flush_run(tf);
+}
+
+/* Finish a block body */
+bool transform_end(Transform *tf)
+{
+    if (tf->spec.dedent && tf->held_len > 0) {
+        dedent(tf);
+    }
+    tf->held_len = 0;
+
+    /* A lone '\r' at the very end is text; trailing whitespace is dropped */
+    if (tf->cr) {
+        tf->cr = false;
+        text(tf, "\r", 1, false);
+    }
+    tf->ws_len = 0;
+    flush_run(tf);
+    return !tf->failed;
+}
+
+/* Release buffers kept between blocks */
+void transform_free(Transform *tf)
+{
+    free(tf->ws);
+    free(tf->held);
+    tf->ws = NULL;
+    tf->ws_cap = 0;
+    tf->held = NULL;
+    tf->held_cap = 0;
+}
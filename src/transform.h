@@ -0,0 +1,82 @@
+/*
+ * transform.h - Streaming output transforms (dedent, EOL, trim, tabs)
+ */
+
+#ifndef RYFT_TRANSFORM_H
+#define RYFT_TRANSFORM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_TRANSFORM 64       /* fence attribute text: "dedent=on eol=lf ..." */
+#define MAX_TAB_WIDTH 16
+
+typedef enum {
+    EOL_KEEP,                  /* line endings as written */
+    EOL_LF,
+    EOL_CRLF
+} EolMode;
+
+/* Transforms set by a ryft.config block or a fence */
+typedef struct {
+    bool dedent;               /* strip the indentation common to a block's lines */
+    bool dedent_set;
+    bool trim;                 /* strip trailing spaces and tabs */
+    bool trim_set;
+    EolMode eol;
+    bool eol_set;
+    int tabs;                  /* expand tabs to this tab stop, 0 to keep them */
+    bool tabs_set;
+} TransformSpec;
+
+/* Transform state for one block body; bytes may arrive in any pieces */
+typedef struct {
+    TransformSpec spec;
+    const char *run;           /* unchanged input bytes not yet passed on */
+    size_t run_len;
+    size_t col;                /* display column in the current line (tabs) */
+    bool cr;                   /* a '\r' ended the last piece */
+    char *ws;                  /* trailing whitespace held back (trim) */
+    size_t ws_len;
+    size_t ws_cap;
+    char *held;                /* whole body, held until the end (dedent) */
+    size_t held_len;
+    size_t held_cap;
+    bool failed;               /* out of memory, output is incomplete */
+    void (*sink)(void *ctx, const char *p, size_t len);
+    void *sink_ctx;
+} Transform;
+
+/* Check if key names a transform (dedent, eol, trim, tabs) */
+bool transform_key(const char *key);
+
+/* Set one transform from a config key or fence attribute
+ * Returns false if the value is invalid
+ */
+bool transform_parse(TransformSpec *spec, const char *key, const char *value);
+
+/* Overlay fence attributes ("dedent=on eol=lf") on a document's spec;
+ * invalid attributes are skipped
+ * Returns false with the first invalid attribute in bad
+ */
+bool transform_overlay(TransformSpec *spec, const char *attrs, char *bad, size_t bad_size);
+
+/* Check if a spec changes anything */
+bool transform_enabled(const TransformSpec *spec);
+
+/* Start transforming a block body into sink */
+void transform_begin(Transform *tf, const TransformSpec *spec,
+                     void (*sink)(void *ctx, const char *p, size_t len), void *ctx);
+
+/* Transform a piece of a block body */
+void transform_write(Transform *tf, const char *p, size_t len);
+
+/* Finish a block body (dedented bodies are written here)
+ * Returns false if memory ran out and output was lost
+ */
+bool transform_end(Transform *tf);
+
+/* Release buffers kept between blocks */
+void transform_free(Transform *tf);
+
+#endif /* RYFT_TRANSFORM_H */
@@ -5,56 +5,124 @@
 #ifndef RYFT_TYPES_H
 #define RYFT_TYPES_H
 
+#include "include/ryft.h"
+#include "fingerprint.h"
+#include "place.h"
+#include "tags.h"
+#include "spill.h"
+#include "transform.h"
+#include "vars.h"
+
 #include <stdbool.h>
 #include <stdio.h>
 
 #define MAX_LINE 4096
-#define MAX_LANG 64
+#define MAX_LANG RYFT_MAX_LANG
 #define MAX_FILENAME 256
-#define MAX_PATH 1024
-#define MAX_OUTPUT_FILES 64
+#define MAX_PATH RYFT_MAX_PATH
 
 typedef struct {
     char lang[MAX_LANG];
     char filename[MAX_FILENAME];
+    char cond[MAX_COND];       /* if= expression, empty if unconditional */
+    char exec[MAX_LANG];       /* exec= interpreter, empty unless the block is run */
+    char inputs[MAX_PATH];     /* inputs= files (comma-separated) an exec= result depends on */
+    char transform[MAX_TRANSFORM];  /* dedent=, eol=, trim=, tabs= as "name=value ..." */
+    char place[MAX_PLACE];     /* id=, order=, before=, after= as "name=value ..." */
+    char vars[8];              /* vars= value (on/off), empty if unset */
     bool is_config;      /* ryft.config block */
     bool is_display;     /* 4+ backticks, skip extraction */
     int backtick_count;
 } FenceInfo;
 
+/* One block of an output whose blocks are placed (order=, before=, after=);
+ * the blocks before the first one with a placement attribute share a piece */
+typedef struct OutputPiece {
+    int block;                 /* block number, for messages */
+    size_t offset;             /* where its bytes start in OutputFile.placed */
+    Placement place;
+} OutputPiece;
+
+/* A write held back behind an exec= result that is not ready yet */
+typedef struct PendingWrite {
+    struct ExecJob *job;       /* result to insert, NULL for buffered bytes */
+    int piece;                 /* block piece starting after the result, -1 if none */
+    SpillBuffer buf;           /* bytes written after it */
+    struct PendingWrite *next;
+} PendingWrite;
+
 typedef struct {
     char path[MAX_PATH];
     char backup_path[MAX_PATH];  /* path to backup file if created */
     char lang[MAX_LANG];         /* primary language for this file */
-    FILE *fp;
+    RyftIO *io;                  /* backend the file is written through */
+    RyftFile *file;              /* open output, NULL until opened */
     int block_count;             /* blocks written to this file */
     int unnamed_block_count;     /* blocks without explicit filename */
     bool existed;                /* file existed before we wrote to it */
     bool backed_up;              /* backup was created */
     bool opened;                 /* file has been opened (or simulated in dry-run) */
+    bool skipped;                /* not selected by --only, never written */
+    bool checking;               /* compared with the existing file (--check) */
+    bool stale;                  /* differs from the existing file */
+    const char *check_data;      /* existing contents, mapped (--check, --in-place) */
+    size_t check_len;
+    size_t check_pos;            /* bytes matched so far */
+    bool diffing;                /* new contents are kept for a diff (--diff) */
+    SpillBuffer *diff;           /* those contents, NULL until the first byte */
+    bool updating;               /* only changed chunks are written (--in-place) */
+    bool streaming;              /* contents shifted, the rest is written unseen */
+    bool failed;                 /* a write failed (already reported) */
+    char *chunk;                 /* pending bytes of the current aligned chunk */
+    size_t chunk_len;
+    bool chunk_dirty;            /* chunk differs from the existing bytes */
+    int dirty_run;               /* changed chunks in a row */
+    size_t size;                 /* bytes of new contents */
+    size_t written;              /* bytes actually written */
+    PendingWrite *pending;       /* held-back writes, oldest first */
+    PendingWrite *pending_tail;
+    bool is_pipe;                /* |cmd target: streamed into a command */
+    struct PipeSink *sink;       /* running command, NULL until opened */
+    bool exited;                 /* command has exited, exit_status is set */
+    int exit_status;             /* wait status of the command */
+    int lock_fd;                 /* advisory lock held while writing, -1 if none
+                                  * (or if the file's own descriptor holds it) */
+    bool locked;                 /* counted in the locks this process holds */
+    bool fingerprinting;         /* header line added at close (--fingerprint) */
+    Fingerprint fp;              /* hash of the contents so far */
+    SpillBuffer *held;           /* contents kept until the header is known */
+    int *block_ids;              /* blocks written to this file, for the header */
+    int block_id_count;
+    int block_id_cap;
+    char *old_header;            /* existing file's header line, NULL if none */
+    char *header;                /* new header line (--check), NULL until closed */
+    bool current;                /* header matched, the file was left alone */
+    bool placing;                /* blocks are held and placed at close (order=, ...) */
+    bool arranging;              /* a block had id=, order=, before= or after=: from
+                                  * then on each block is its own piece */
+    SpillBuffer *placed;         /* their contents in arrival order, NULL until written */
+    struct OutputPiece *pieces;  /* in document order */
+    int piece_count;
+    int piece_cap;
 } OutputFile;
 
 typedef struct {
-    OutputFile files[MAX_OUTPUT_FILES];
+    OutputFile **files;        /* grows as outputs appear; entries never move */
     int count;
+    int cap;
+    int *slots;                /* path hash table: index + 1, 0 for empty */
+    int slot_count;            /* power of two */
     int current;               /* index of current output target, -1 if none */
+    char root[MAX_PATH];       /* directory relative outputs go under, "" for none */
+    const char *source;        /* document the outputs come from */
+    char made_dir[MAX_PATH];   /* directory the last output was created in */
     char default_lang[MAX_LANG];
     bool has_named_blocks;
     bool has_unnamed_blocks;
     bool multiple_files;
+    bool placing;              /* blocks may be placed: hold every file output */
 } OutputState;
 
-/* Global options */
-typedef struct {
-    bool backup;               /* create backup before overwriting */
-    bool backup_timestamp;     /* use timestamp in backup name (vs sequential) */
-    int  backup_limit;         /* max backups to keep (0=unlimited) */
-    bool dry_run;              /* don't write files, just show what would happen */
-    bool verbose;              /* extra output during processing */
-    bool summary;              /* print summary at end */
-    bool strict_mode;          /* fail on warnings instead of continuing */
-} RyftOptions;
-
 /* Statistics for summary */
 typedef struct {
     int total_blocks;          /* all code blocks found */
@@ -64,14 +132,19 @@ typedef struct {
     int files_created;         /* new files created */
     int files_overwritten;     /* existing files overwritten */
     int backups_created;       /* backup files created */
+    int files_current;         /* fingerprinted files left alone, already current */
+    int pipes_started;         /* |cmd sinks started */
 } RyftStats;
 
 /* Document-level config from ryft.config blocks */
 typedef struct {
     char output[MAX_PATH];     /* default output path (or filename) */
+    bool output_dir;           /* output names a directory */
+    bool output_resolved;      /* output_dir has been worked out */
     char filename[MAX_PATH];   /* explicit output filename */
     char lang[MAX_LANG];       /* default language */
     char version[32];          /* config version */
+    char fingerprint[MAX_PATH];  /* languages that get header lines, "" if unset */
     bool backup;               /* create backups */
     bool backup_set;           /* backup was explicitly set */
     bool backup_timestamp;     /* use timestamp in backup name */
@@ -84,6 +157,9 @@ typedef struct {
     bool summary_set;          /* summary was explicitly set */
     bool strict_mode;          /* fail on warnings */
     bool strict_mode_set;
+    VarTable *vars;            /* where var.NAME keys go, NULL to ignore them */
+    bool expand_vars;          /* vars = on: expand ${NAME} in the blocks after it */
+    TransformSpec transform;   /* dedent, eol, trim, tabs for every block */
 } RyftConfig;
 
 #endif /* RYFT_TYPES_H */
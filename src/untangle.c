@@ -0,0 +1,648 @@
+/*
+ * untangle.c - Propagate edits in generated files back into markdown
+ *
+ * Each output is compared against the contents the document would
+ * produce. Changed hunks are mapped back to their originating block
+ * through the source map's block-to-output line ranges, and only those
+ * block bodies are rewritten in the markdown.
+ *
+ * Outputs hold bodies with ${NAME} variables expanded. Expansion never
+ * adds or removes lines, so the diff runs against expanded bodies while
+ * unchanged lines are rebuilt from the raw ones and keep their references.
+ */
+
+#define _XOPEN_SOURCE 700       /* realpath */
+#define _POSIX_C_SOURCE 200809L
+
+#include "untangle.h"
+#include "config.h"
+#include "diff.h"
+#include "fingerprint.h"
+#include "input.h"
+#include "log.h"
+#include "markdown.h"
+#include "output.h"
+#include "process.h"
+#include "sink.h"
+#include "util.h"
+#include "vars.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+/* Growable byte buffer */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} Buffer;
+
+/* Replacement body for a block */
+typedef struct {
+    Buffer body;
+    bool changed;
+} BlockEdit;
+
+/* Blank line added after a block closed with 4+ backticks */
+static const char blank_line[] = "\n";
+
+static bool buf_append(Buffer *buf, const char *data, size_t len)
+{
+    if (len == 0) return true;  /* data may be NULL */
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len) cap *= 2;
+        char *p = realloc(buf->data, cap);
+        if (!p) return false;
+        buf->data = p;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return true;
+}
+
+static bool append_lines(Buffer *buf, const DiffLines *dl, size_t start, size_t end)
+{
+    for (size_t i = start; i < end; i++) {
+        if (!buf_append(buf, dl->lines[i].ptr, dl->lines[i].len)) return false;
+    }
+    return true;
+}
+
+/* Block body as written to its output */
+typedef struct {
+    char *data;                /* expanded body, NULL if same as the document */
+    size_t len;
+    bool vars;                 /* variables were defined when the block was read */
+} Expanded;
+
+/* Body of block i as written to its output */
+static void block_body(const char *doc, RyftSourceMap *map, const Expanded *expanded,
+                       size_t i, const char **p, size_t *n)
+{
+    if (expanded && expanded[i].data) {
+        *p = expanded[i].data;
+        *n = expanded[i].len;
+    } else {
+        *p = doc + map->blocks[i].body_offset;
+        *n = map->blocks[i].body_len;
+    }
+}
+
+/* Expand variables in every block body, in document order
+ * Returns one entry per block, or NULL if no variables are in play;
+ * *ok is false on allocation failure
+ */
+static Expanded *expand_bodies(const char *doc, RyftSourceMap *map, bool *ok)
+{
+    VarTable vars = g_vars;
+
+    RyftConfig doc_config = {0};
+    doc_config.vars = &vars;
+
+    Expanded *expanded = NULL;
+    *ok = true;
+
+    for (size_t i = 0; *ok && i < map->block_count; i++) {
+        RyftBlock *b = &map->blocks[i];
+        const char *body = doc + b->body_offset;
+
+        if (b->kind == RYFT_BLOCK_CONFIG) {
+            char line[MAX_LINE];
+            const char *p = body;
+            const char *end = body + b->body_len;
+            while (p < end) {
+                size_t n = input_piece(p, end, sizeof(line));
+                memcpy(line, p, n);
+                line[n] = '\0';
+                parse_config_line(line, &doc_config, NULL);
+                p += n;
+            }
+            continue;
+        }
+
+        if (b->kind != RYFT_BLOCK_CODE || b->output < 0 || !b->expands) {
+            continue;
+        }
+
+        if (!expanded && !(expanded = calloc(map->block_count, sizeof(Expanded)))) {
+            *ok = false;
+            break;
+        }
+        expanded[i].vars = true;
+
+        if (!memchr(body, '$', b->body_len)) {
+            continue;
+        }
+
+        char *data = NULL;
+        size_t len = 0;
+        FILE *mem = open_memstream(&data, &len);
+        if (!mem) {
+            *ok = false;
+            break;
+        }
+        Expander ex;
+        expand_begin(&ex, &vars);
+        expand_write(&ex, body, b->body_len, mem);
+        expand_end(&ex, mem);
+        if (fclose(mem) != 0) {
+            free(data);
+            *ok = false;
+            break;
+        }
+
+        if (len == b->body_len && memcmp(data, body, len) == 0) {
+            free(data);  /* Only '$' that is not a reference */
+            continue;
+        }
+        expanded[i].data = data;
+        expanded[i].len = len;
+    }
+
+    if (!*ok && expanded) {
+        for (size_t i = 0; i < map->block_count; i++) free(expanded[i].data);
+        free(expanded);
+        expanded = NULL;
+    }
+    return expanded;
+}
+
+/* Append lines copied from an output to a body that gets expanded,
+ * escaping literal ${ so it survives the next tangle
+ */
+static bool append_escaped(Buffer *buf, const DiffLines *dl, size_t start, size_t end)
+{
+    for (size_t i = start; i < end; i++) {
+        const char *p = dl->lines[i].ptr;
+        const char *stop = p + dl->lines[i].len;
+        const char *ref;
+        while ((ref = memchr(p, '$', (size_t)(stop - p))) && ref + 1 < stop) {
+            if (ref[1] == '{') {
+                if (!buf_append(buf, p, (size_t)(ref - p)) || !buf_append(buf, "$", 1)) {
+                    return false;
+                }
+                p = ref;
+            }
+            if (!buf_append(buf, p, (size_t)(ref + 1 - p))) return false;
+            p = ref + 1;
+        }
+        if (!buf_append(buf, p, (size_t)(stop - p))) return false;
+    }
+    return true;
+}
+
+/* A block of an output and where it lands */
+typedef struct {
+    size_t offset;
+    size_t index;
+} OutputBlock;
+
+static int compare_output_blocks(const void *a, const void *b)
+{
+    const OutputBlock *x = a;
+    const OutputBlock *y = b;
+    if (x->offset != y->offset) {
+        return x->offset < y->offset ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* Blocks of output o in output order, which order=, before= and after=
+ * can make differ from document order; NULL if out of memory
+ */
+static size_t *output_blocks(const RyftSourceMap *map, int o, size_t *count)
+{
+    OutputBlock *sorted = malloc(map->block_count * sizeof(OutputBlock) + 1);
+    size_t *blocks = malloc(map->block_count * sizeof(size_t) + 1);
+    if (!sorted || !blocks) {
+        free(sorted);
+        free(blocks);
+        return NULL;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < map->block_count; i++) {
+        if (map->blocks[i].output == o) {
+            sorted[n].offset = map->blocks[i].out_offset;
+            sorted[n].index = i;
+            n++;
+        }
+    }
+    qsort(sorted, n, sizeof(OutputBlock), compare_output_blocks);
+    for (size_t i = 0; i < n; i++) blocks[i] = sorted[i].index;
+
+    free(sorted);
+    *count = n;
+    return blocks;
+}
+
+/* Check whether contents match what the document would produce */
+static bool matches_expected(const char *doc, RyftSourceMap *map, const Expanded *expanded,
+                             const size_t *blocks, size_t count, int o,
+                             const char *data, size_t len)
+{
+    RyftOutput *out = &map->outputs[o];
+    if (!expanded && len != out->size) {
+        return false;
+    }
+
+    size_t pos = 0;
+    size_t line = 0;  /* lines of expected output consumed so far */
+
+    for (size_t k = 0; k < count; k++) {
+        size_t i = blocks[k];
+        RyftBlock *b = &map->blocks[i];
+
+        /* Separator lines before this block */
+        for (; line < b->out_line - 1; line++, pos++) {
+            if (pos >= len || data[pos] != '\n') return false;
+        }
+
+        const char *body;
+        size_t body_len;
+        block_body(doc, map, expanded, i, &body, &body_len);
+        if (body_len > len - pos || memcmp(data + pos, body, body_len) != 0) {
+            return false;
+        }
+        pos += body_len;
+        line += b->out_lines;
+    }
+
+    for (; pos < len; pos++) {
+        if (data[pos] != '\n') return false;
+    }
+    return true;
+}
+
+/* Check that no new line would close the block's fence early */
+static bool safe_body(const Buffer *body)
+{
+    char line[MAX_LINE];
+    const char *p = body->data;
+    const char *end = body->data + body->len;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t n = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+        if (fence_line(p, n)) {
+            size_t copy = n < sizeof(line) ? n : sizeof(line) - 1;
+            memcpy(line, p, copy);
+            line[copy] = '\0';
+            if (get_closing_fence_backticks(line, 3) > 0) return false;
+        }
+        p += n;
+    }
+    return true;
+}
+
+/* Diff one output and record new bodies for the blocks it came from
+ * Returns 0 on success, non-zero on error
+ */
+static int untangle_output(const char *doc, RyftSourceMap *map, const Expanded *expanded,
+                           int o, BlockEdit *edits, RyftOptions *options)
+{
+    RyftOutput *out = &map->outputs[o];
+
+    /* A |cmd target was never written to a file */
+    if (sink_target(out->path)) {
+        if (options->verbose) {
+            log_info("  skipping: %s (pipe target)\n", out->path);
+        }
+        return 0;
+    }
+
+    /* Text generated by exec= blocks or rewritten by transforms has no
+     * source to copy edits back to, and which if= blocks an output holds
+     * depends on the --tags it was tangled with */
+    for (size_t i = 0; i < map->block_count; i++) {
+        const RyftBlock *b = &map->blocks[i];
+        if (b->output == o && (b->kind == RYFT_BLOCK_EXEC || b->transformed ||
+                               b->conditional)) {
+            if (options->verbose) {
+                log_info("  skipping: %s (%s)\n", out->path,
+                         b->transformed ? "transformed" :
+                         b->conditional ? "has if= blocks" : "generated by exec= blocks");
+            }
+            return 0;
+        }
+    }
+
+    char *data;
+    size_t len;
+    if (!read_file(out->path, &data, &len)) {
+        if (options->verbose) {
+            log_info("  missing: %s (skipped)\n", out->path);
+        }
+        return 0;
+    }
+
+    /* A fingerprint header is not part of any block */
+    fingerprint_strip(data, &len);
+
+    size_t count;
+    size_t *blocks = output_blocks(map, o, &count);
+    if (!blocks) {
+        log_error("error: out of memory\n");
+        free(data);
+        return 1;
+    }
+
+    /* Clean outputs cost one read and compare */
+    if (matches_expected(doc, map, expanded, blocks, count, o, data, len)) {
+        if (options->verbose) {
+            log_info("  unchanged: %s\n", out->path);
+        }
+        free(blocks);
+        free(data);
+        return 0;
+    }
+
+    /* Expected lines, and the block each one came from (-1 for blank separators);
+     * raw holds the same lines before variable expansion */
+    DiffLines expected = {0};
+    DiffLines raw = {0};
+    DiffLines actual = {0};
+    DiffResult diff = {0};
+    int *owner = NULL;
+    int *hunk_block = NULL;
+    int rc = 1;
+
+    for (size_t k = 0; k < count; k++) {
+        size_t i = blocks[k];
+        RyftBlock *b = &map->blocks[i];
+        while (expected.count < b->out_line - 1) {
+            if (!diff_add_lines(&expected, blank_line, 1) ||
+                !diff_add_lines(&raw, blank_line, 1)) goto oom;
+        }
+        const char *body;
+        size_t body_len;
+        block_body(doc, map, expanded, i, &body, &body_len);
+        if (!diff_add_lines(&expected, body, body_len) ||
+            !diff_add_lines(&raw, doc + b->body_offset, b->body_len)) goto oom;
+    }
+    while (expected.count < out->lines) {
+        if (!diff_add_lines(&expected, blank_line, 1) ||
+            !diff_add_lines(&raw, blank_line, 1)) goto oom;
+    }
+
+    owner = malloc((expected.count + 1) * sizeof(int));
+    if (!owner) goto oom;
+    for (size_t i = 0; i < expected.count; i++) owner[i] = -1;
+    for (size_t i = 0; i < map->block_count; i++) {
+        RyftBlock *b = &map->blocks[i];
+        if (b->output != o) continue;
+        for (size_t l = 0; l < b->out_lines; l++) owner[b->out_line - 1 + l] = (int)i;
+    }
+
+    if (!diff_add_lines(&actual, data, len) || !diff_lines(&expected, &actual, &diff)) {
+        goto oom;
+    }
+
+    /* Attribute each hunk to a block; insertions prefer the block they follow */
+    hunk_block = malloc((diff.count + 1) * sizeof(int));
+    if (!hunk_block) goto oom;
+
+    for (size_t h = 0; h < diff.count; h++) {
+        DiffHunk *d = &diff.hunks[h];
+        if (d->a_count > 0) {
+            int first = owner[d->a_start];
+            int last = owner[d->a_start + d->a_count - 1];
+            hunk_block[h] = first == last ? first : -1;
+        } else {
+            int prev = d->a_start > 0 ? owner[d->a_start - 1] : -1;
+            int next = d->a_start < expected.count ? owner[d->a_start] : -1;
+            hunk_block[h] = prev >= 0 ? prev : next;
+        }
+
+        if (hunk_block[h] < 0) {
+            if (options->strict_mode) {
+                log_error("error: %s:%zu: change does not map to a single block (strict mode)\n",
+                          out->path, d->b_start + 1);
+                goto done;
+            }
+            log_warn("warning: %s:%zu: change does not map to a single block, skipped\n",
+                     out->path, d->b_start + 1);
+        }
+    }
+
+    /* Rebuild each touched block body from its unchanged lines and the new lines */
+    for (size_t h = 0; h < diff.count; ) {
+        int b = hunk_block[h];
+        if (b < 0) {
+            h++;
+            continue;
+        }
+
+        RyftBlock *blk = &map->blocks[b];
+        BlockEdit *edit = &edits[b];
+        size_t cursor = blk->out_line - 1;
+        size_t end = cursor + blk->out_lines;
+        size_t first_hunk = h;
+
+        for (; h < diff.count && hunk_block[h] == b; h++) {
+            DiffHunk *d = &diff.hunks[h];
+            bool escape = expanded && expanded[b].vars;
+            if (!append_lines(&edit->body, &raw, cursor, d->a_start) ||
+                !(escape ? append_escaped(&edit->body, &actual, d->b_start, d->b_start + d->b_count)
+                         : append_lines(&edit->body, &actual, d->b_start, d->b_start + d->b_count))) {
+                goto oom;
+            }
+            for (size_t l = d->a_start; l < d->a_start + d->a_count; l++) {
+                if (raw.lines[l].len != expected.lines[l].len ||
+                    memcmp(raw.lines[l].ptr, expected.lines[l].ptr, raw.lines[l].len) != 0) {
+                    log_warn("warning: %s:%zu: edited line used variables, "
+                             "expanded text copied back\n", out->path, d->b_start + 1);
+                    break;
+                }
+            }
+            cursor = d->a_start + d->a_count;
+        }
+        if (!append_lines(&edit->body, &raw, cursor, end)) goto oom;
+
+        /* Body must end at a line boundary so the closing fence stays on its own line */
+        if (edit->body.len > 0 && edit->body.data[edit->body.len - 1] != '\n' &&
+            !buf_append(&edit->body, "\n", 1)) {
+            goto oom;
+        }
+
+        if (!safe_body(&edit->body)) {
+            log_warn("warning: %s: edit to block at line %zu would close its fence, skipped\n",
+                     out->path, blk->fence_line);
+            edit->body.len = 0;
+            continue;
+        }
+
+        edit->changed = true;
+        if (options->verbose) {
+            log_debug("  [block %d] %s:%zu -> %zu hunk(s)\n", b + 1, out->path,
+                      blk->out_line, h - first_hunk);
+        }
+    }
+
+    rc = 0;
+    goto done;
+
+oom:
+    log_error("error: out of memory\n");
+done:
+    free(hunk_block);
+    free(owner);
+    free(blocks);
+    diff_free(&diff);
+    diff_free_lines(&actual);
+    diff_free_lines(&raw);
+    diff_free_lines(&expected);
+    free(data);
+    return rc;
+}
+
+/* Write the document with edited block bodies spliced in */
+static int rewrite_document(const char *filepath, const char *doc, size_t doc_len,
+                            RyftSourceMap *map, BlockEdit *edits, RyftOptions *options)
+{
+    Buffer out = {0};
+    size_t cursor = 0;
+
+    for (size_t i = 0; i < map->block_count; i++) {
+        RyftBlock *b = &map->blocks[i];
+        if (!edits[i].changed) continue;
+        if (!buf_append(&out, doc + cursor, b->body_offset - cursor) ||
+            !buf_append(&out, edits[i].body.data, edits[i].body.len)) {
+            free(out.data);
+            log_error("error: out of memory\n");
+            return 1;
+        }
+        cursor = b->body_offset + b->body_len;
+    }
+    if (!buf_append(&out, doc + cursor, doc_len - cursor)) {
+        free(out.data);
+        log_error("error: out of memory\n");
+        return 1;
+    }
+
+    if (options->backup) {
+        RyftStats stats = {0};
+        if (!create_backup(filepath, NULL, 0, options, &stats)) {
+            free(out.data);
+            return 1;
+        }
+    }
+
+    /* Write to a temp file and rename so the document is never half-written;
+     * a symlinked document is replaced where it really lives, and keeps
+     * its permissions */
+    struct stat st;
+    char *target = realpath(filepath, NULL);
+    if (!target || stat(target, &st) != 0) {
+        log_error("error: cannot resolve '%s': %s\n", filepath, strerror(errno));
+        free(target);
+        free(out.data);
+        return 1;
+    }
+    char tmp[MAX_PATH + 8];
+    int n = snprintf(tmp, sizeof(tmp), "%s.tmp", target);
+
+    FILE *f = n >= 0 && (size_t)n < sizeof(tmp) ? fopen(tmp, "wb") : NULL;
+    if (!f) {
+        log_error("error: cannot create '%s': %s\n", tmp, strerror(errno));
+        free(target);
+        free(out.data);
+        return 1;
+    }
+
+    bool ok = fwrite(out.data, 1, out.len, f) == out.len &&
+              fchmod(fileno(f), st.st_mode & 07777) == 0;
+    if (fclose(f) != 0) ok = false;
+    if (ok && rename(tmp, target) != 0) ok = false;
+    if (!ok) {
+        log_error("error: cannot write '%s': %s\n", target, strerror(errno));
+        remove(tmp);
+    }
+
+    free(target);
+    free(out.data);
+    return ok ? 0 : 1;
+}
+
+/* Diff each output against what the document would produce and rewrite
+ * the bodies of the blocks the changes came from
+ */
+int untangle_file(const char *filepath, RyftOptions *options)
+{
+    char *doc;
+    size_t doc_len;
+    if (!read_file(filepath, &doc, &doc_len)) {
+        log_error("error: cannot open '%s'\n", filepath);
+        return 1;
+    }
+
+    /* Block bodies are rewritten in place, which a compressed stream
+     * does not allow */
+    if (input_detect((const unsigned char *)doc, doc_len) != INPUT_PLAIN) {
+        log_error("error: cannot untangle compressed document '%s'\n", filepath);
+        free(doc);
+        return 1;
+    }
+
+    RyftSourceMap map;
+    if (ryft_map_buffer_opts(doc, doc_len, filepath, RYFT_MAP_UNCONDITIONAL, options,
+                             &map) != 0) {
+        log_error("error: out of memory\n");
+        free(doc);
+        return 1;
+    }
+
+    if (options->verbose) {
+        log_info("untangling: %s\n", filepath);
+    }
+
+    int rc = 0;
+    bool expand_ok;
+    Expanded *expanded = expand_bodies(doc, &map, &expand_ok);
+    BlockEdit *edits = calloc(map.block_count + 1, sizeof(BlockEdit));
+    if (!edits || !expand_ok) {
+        log_error("error: out of memory\n");
+        rc = 1;
+    }
+
+    for (size_t o = 0; rc == 0 && o < map.output_count; o++) {
+        rc = untangle_output(doc, &map, expanded, (int)o, edits, options);
+    }
+
+    int changed = 0;
+    for (size_t i = 0; edits && i < map.block_count; i++) {
+        if (edits[i].changed) changed++;
+    }
+
+    if (rc == 0 && changed > 0 && !options->dry_run) {
+        rc = rewrite_document(filepath, doc, doc_len, &map, edits, options);
+    }
+
+    if (rc == 0) {
+        if (changed == 0) {
+            printf("untangle: no changes in %zu output(s)\n", map.output_count);
+        } else if (options->dry_run) {
+            printf("[dry-run] would update %d block(s) in %s\n", changed, filepath);
+        } else {
+            printf("updated %d block(s) in %s\n", changed, filepath);
+        }
+    }
+
+    for (size_t i = 0; edits && i < map.block_count; i++) {
+        free(edits[i].body.data);
+    }
+    free(edits);
+    for (size_t i = 0; expanded && i < map.block_count; i++) {
+        free(expanded[i].data);
+    }
+    free(expanded);
+    ryft_map_free(&map);
+    free(doc);
+    log_flush();
+    return rc;
+}
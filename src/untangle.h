@@ -0,0 +1,16 @@
+/*
+ * untangle.h - Propagate edits in generated files back into markdown
+ */
+
+#ifndef RYFT_UNTANGLE_H
+#define RYFT_UNTANGLE_H
+
+#include "types.h"
+
+/* Diff each output against what the document would produce and rewrite
+ * the bodies of the blocks the changes came from
+ * Returns 0 on success, non-zero on error
+ */
+int untangle_file(const char *filepath, RyftOptions *options);
+
+#endif /* RYFT_UNTANGLE_H */
@@ -0,0 +1,675 @@
+/*
+ * uring.c - io_uring output backend (Linux)
+ *
+ * Tangling reference docs can create thousands of small outputs, and on
+ * the POSIX backend each costs its own open, write and close round trip.
+ * This backend keeps an output in memory until it is closed, then queues
+ * openat -> write -> close as one linked chain into a fixed file slot.
+ * Up to URING_DEPTH chains are in flight; when all slots are busy, the
+ * queue is submitted and completions are reaped until one frees. flush()
+ * waits for the rest and reports each output that failed.
+ *
+ * Reads, in-place updates and outputs past URING_MAX_BUFFER go through
+ * stdio as on the POSIX backend, as does everything but writing. The
+ * ring is driven with raw syscalls, so there is no library to link; a
+ * kernel that cannot open into fixed slots (before 5.15), or where
+ * io_uring is disabled, gets NULL from ryft_io_uring() and callers use
+ * the POSIX backend instead.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE            /* MAP_POPULATE */
+#else
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "uring.h"
+
+#include <stdlib.h>
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define URING_ENTRIES (URING_DEPTH * 4)   /* three SQEs per output, rounded up */
+
+enum { OP_OPEN, OP_WRITE, OP_CLOSE };
+
+/* RyftFile of this backend */
+typedef struct {
+    FILE *stream;              /* reads, updates and outputs past the buffer */
+    char *path;                /* output: written on close */
+    char *data;
+    size_t len;
+    size_t cap;
+} UringFile;
+
+/* Fixed file slot and the output whose chain uses it */
+typedef struct {
+    UringFile *file;           /* NULL when free */
+    int pending;               /* completions still to come */
+    int err;                   /* first error of the chain (errno) */
+} UringSlot;
+
+/* Output that could not be written, until flush() reports it */
+typedef struct UringFailure {
+    char *path;
+    int err;
+    struct UringFailure *next;
+} UringFailure;
+
+typedef struct {
+    int fd;
+    void *ring;
+    size_t ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned tail;             /* next SQE, published on submit */
+    unsigned unsubmitted;      /* SQEs the kernel has not taken yet */
+    int inflight;              /* slots in use */
+    bool broken;               /* the ring failed: write synchronously */
+    UringSlot slots[URING_DEPTH];
+    UringFailure *failures;
+} Uring;
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned wait)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait,
+                        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned op, void *arg, unsigned count)
+{
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, count);
+}
+
+/* Next free SQE, cleared; slots bound the chains so there always is one */
+static struct io_uring_sqe *get_sqe(Uring *r)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->tail - head >= r->sq_entries) {
+        return NULL;
+    }
+    unsigned idx = r->tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->tail++;
+    r->unsubmitted++;
+    return sqe;
+}
+
+/* Hand queued SQEs to the kernel, waiting for wait completions; on
+ * EAGAIN or EBUSY the caller reaps and calls again
+ * Returns false if the ring failed
+ */
+static bool submit(Uring *r, unsigned wait)
+{
+    __atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+    for (;;) {
+        int n = uring_enter(r->fd, r->unsubmitted, wait);
+        if (n >= 0) {
+            r->unsubmitted -= (unsigned)n;
+            return true;
+        }
+        if (errno == EAGAIN || errno == EBUSY) {
+            return true;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+/* Remember an output that could not be written */
+static void record_failure(Uring *r, char *path, int err)
+{
+    UringFailure *f = malloc(sizeof(UringFailure));
+    if (!f) {
+        free(path);
+        return;
+    }
+    f->path = path;
+    f->err = err;
+    f->next = r->failures;
+    r->failures = f;
+}
+
+static void free_file(UringFile *f)
+{
+    free(f->path);
+    free(f->data);
+    free(f);
+}
+
+/* Account for one completion; a chain's last one frees its slot */
+static void complete(Uring *r, uint64_t user_data, int res)
+{
+    UringSlot *slot = &r->slots[user_data >> 2];
+    int op = (int)(user_data & 3);
+
+    /* Chains run in order, so the first error is the one that matters */
+    if (!slot->err) {
+        if (res < 0) {
+            slot->err = -res;
+        } else if (op == OP_WRITE && (size_t)res != slot->file->len) {
+            slot->err = EIO;
+        }
+    }
+
+    if (--slot->pending == 0) {
+        if (slot->err) {
+            record_failure(r, slot->file->path, slot->err);
+            slot->file->path = NULL;
+        }
+        free_file(slot->file);
+        slot->file = NULL;
+        slot->err = 0;
+        r->inflight--;
+    }
+}
+
+static void reap(Uring *r)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        complete(r, cqe->user_data, cqe->res);
+        head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Submit and reap until at most max slots are in use
+ * Returns false if the ring failed
+ */
+static bool wait_slots(Uring *r, int max)
+{
+    reap(r);
+    while (r->inflight > max) {
+        if (!submit(r, 1)) {
+            return false;
+        }
+        reap(r);
+    }
+    return true;
+}
+
+/* Queue openat -> write -> close for an output into a free slot; hard
+ * links keep the chain going after a failure, so the slot is always
+ * closed again
+ * Returns false if the ring failed
+ */
+static bool queue_output(Uring *r, UringFile *f)
+{
+    if (!wait_slots(r, URING_DEPTH - 1)) {
+        return false;
+    }
+    unsigned s = 0;
+    while (r->slots[s].file) s++;
+
+    struct io_uring_sqe *open = get_sqe(r);
+    struct io_uring_sqe *write = f->len > 0 ? get_sqe(r) : NULL;
+    struct io_uring_sqe *close = get_sqe(r);
+
+    open->opcode = IORING_OP_OPENAT;
+    open->fd = AT_FDCWD;
+    open->addr = (uintptr_t)f->path;
+    open->len = 0666;
+    open->open_flags = O_WRONLY | O_CREAT | O_TRUNC;   /* slots take no O_CLOEXEC */
+    open->file_index = s + 1;
+    open->flags = IOSQE_IO_HARDLINK;
+    open->user_data = (uint64_t)s << 2 | OP_OPEN;
+
+    if (write) {
+        write->opcode = IORING_OP_WRITE;
+        write->fd = (int)s;
+        write->addr = (uintptr_t)f->data;
+        write->len = (unsigned)f->len;
+        write->off = 0;
+        write->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        write->user_data = (uint64_t)s << 2 | OP_WRITE;
+    }
+
+    close->opcode = IORING_OP_CLOSE;
+    close->file_index = s + 1;
+    close->user_data = (uint64_t)s << 2 | OP_CLOSE;
+
+    r->slots[s].file = f;
+    r->slots[s].pending = write ? 3 : 2;
+    r->inflight++;
+
+    /* A full batch goes out at once; smaller ones wait for the next */
+    if (r->unsubmitted >= URING_ENTRIES / 2) {
+        return submit(r, 0);
+    }
+    return true;
+}
+
+/* Open the stream an output continues on once it outgrows the buffer */
+static bool spill_to_stream(UringFile *f)
+{
+    f->stream = fopen(f->path, "w");
+    if (!f->stream) {
+        return false;
+    }
+    if (f->len > 0 && fwrite(f->data, 1, f->len, f->stream) != f->len) {
+        return false;
+    }
+    free(f->data);
+    f->data = NULL;
+    f->len = f->cap = 0;
+    return true;
+}
+
+static RyftFile *uring_open(RyftIO *io, const char *path, bool write)
+{
+    (void)io;
+    UringFile *f = calloc(1, sizeof(UringFile));
+    if (!f) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!write) {
+        f->stream = fopen(path, "r");
+    } else if ((f->path = malloc(strlen(path) + 1))) {
+        strcpy(f->path, path);
+    }
+    if (!f->stream && !f->path) {
+        int saved = errno;
+        free(f);
+        errno = saved;
+        return NULL;
+    }
+    return (RyftFile *)f;
+}
+
+static size_t uring_read(RyftIO *io, RyftFile *file, void *buf, size_t len)
+{
+    (void)io;
+    return fread(buf, 1, len, ((UringFile *)file)->stream);
+}
+
+static size_t uring_write(RyftIO *io, RyftFile *file, const void *buf, size_t len)
+{
+    (void)io;
+    UringFile *f = (UringFile *)file;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    if (!f->stream && len > URING_MAX_BUFFER - f->len && !spill_to_stream(f)) {
+        return 0;
+    }
+    if (f->stream) {
+        return fwrite(buf, 1, len, f->stream);
+    }
+
+    if (len > f->cap - f->len) {
+        size_t cap = f->cap ? f->cap : 4096;
+        while (cap - f->len < len) cap *= 2;
+        char *grown = realloc(f->data, cap);
+        if (!grown) {
+            errno = ENOMEM;
+            return 0;
+        }
+        f->data = grown;
+        f->cap = cap;
+    }
+    memcpy(f->data + f->len, buf, len);
+    f->len += len;
+    return len;
+}
+
+/* Write an output synchronously (the ring failed) */
+static int write_now(UringFile *f)
+{
+    int rc = spill_to_stream(f) ? 0 : -1;
+    int saved = errno;
+    if (f->stream && fclose(f->stream) != 0) {
+        saved = errno;
+        rc = -1;
+    }
+    free_file(f);
+    errno = saved;
+    return rc;
+}
+
+static int uring_close(RyftIO *io, RyftFile *file)
+{
+    Uring *r = io->ctx;
+    UringFile *f = (UringFile *)file;
+
+    if (f->stream) {
+        int rc = fclose(f->stream) == 0 ? 0 : -1;
+        int saved = errno;
+        free_file(f);
+        errno = saved;
+        return rc;
+    }
+    if (r->broken) {
+        return write_now(f);
+    }
+    if (!queue_output(r, f)) {
+        /* Chains already queued still complete; new ones are written here */
+        r->broken = true;
+        return write_now(f);
+    }
+    return 0;
+}
+
+/* Everything else is the POSIX backend's, on the file's stream */
+
+static int uring_stat(RyftIO *io, const char *path, size_t *size)
+{
+    (void)io;
+    RyftIO *posix = ryft_io_posix();
+    return posix->stat(posix, path, size);
+}
+
+static int uring_mkdir(RyftIO *io, const char *path)
+{
+    (void)io;
+    RyftIO *posix = ryft_io_posix();
+    return posix->mkdir(posix, path);
+}
+
+static int uring_rename(RyftIO *io, const char *from, const char *to)
+{
+    (void)io;
+    RyftIO *posix = ryft_io_posix();
+    return posix->rename(posix, from, to);
+}
+
+static int uring_clone(RyftIO *io, const char *from, const char *to)
+{
+    (void)io;
+    RyftIO *posix = ryft_io_posix();
+    return posix->clone(posix, from, to);
+}
+
+static int uring_map(RyftIO *io, const char *path, const char **data, size_t *len)
+{
+    (void)io;
+    RyftIO *posix = ryft_io_posix();
+    return posix->map(posix, path, data, len);
+}
+
+static void uring_unmap(RyftIO *io, const char *data, size_t len)
+{
+    (void)io;
+    RyftIO *posix = ryft_io_posix();
+    posix->unmap(posix, data, len);
+}
+
+static RyftFile *uring_update(RyftIO *io, const char *path)
+{
+    (void)io;
+    UringFile *f = calloc(1, sizeof(UringFile));
+    if (!f) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    f->stream = fopen(path, "r+");
+    if (!f->stream) {
+        int saved = errno;
+        free(f);
+        errno = saved;
+        return NULL;
+    }
+    return (RyftFile *)f;
+}
+
+static size_t uring_pwrite(RyftIO *io, RyftFile *file, const void *buf, size_t len, size_t off)
+{
+    (void)io;
+    RyftIO *posix = ryft_io_posix();
+    return posix->pwrite(posix, (RyftFile *)((UringFile *)file)->stream, buf, len, off);
+}
+
+static int uring_truncate(RyftIO *io, RyftFile *file, size_t size)
+{
+    (void)io;
+    RyftIO *posix = ryft_io_posix();
+    return posix->truncate(posix, (RyftFile *)((UringFile *)file)->stream, size);
+}
+
+/* Wait for every queued output; each failed one is reported by a call
+ * of its own, with errno set and *path naming it (valid until the next
+ * call)
+ */
+static int uring_flush(RyftIO *io, const char **path)
+{
+    Uring *r = io->ctx;
+    static char failed[RYFT_MAX_PATH];
+
+    if (!wait_slots(r, 0)) {
+        /* Chains the ring lost cannot be told apart: report them all */
+        for (int s = 0; s < URING_DEPTH; s++) {
+            UringSlot *slot = &r->slots[s];
+            if (slot->file) {
+                record_failure(r, slot->file->path, errno);
+                slot->file->path = NULL;
+                free_file(slot->file);
+                slot->file = NULL;
+            }
+        }
+        r->inflight = 0;
+        r->broken = true;
+    }
+
+    UringFailure *f = r->failures;
+    if (!f) {
+        return 0;
+    }
+    r->failures = f->next;
+    snprintf(failed, sizeof(failed), "%s", f->path);
+    errno = f->err;
+    free(f->path);
+    free(f);
+    *path = failed;
+    return -1;
+}
+
+static void uring_release(RyftIO *io)
+{
+    Uring *r = io->ctx;
+    const char *path;
+    while (uring_flush(io, &path) != 0) {}
+
+    munmap(r->sqes, r->sqes_size);
+    munmap(r->ring, r->ring_size);
+    close(r->fd);
+    free(r);
+    free(io);
+}
+
+/* Run the one queued SQE
+ * Returns its result, or -1 if the ring failed
+ */
+static int run_one(Uring *r)
+{
+    if (!submit(r, 1) || r->unsubmitted) {
+        return -1;
+    }
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    int res = r->cqes[head & *r->cq_mask].res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return res;
+}
+
+/* Open "/" into slot 0 and close it again. Kernels before 5.15 ignore
+ * the slot and return a plain descriptor instead of 0, and would take
+ * a close of the slot for a close of descriptor 0, so the open is
+ * checked on its own first
+ */
+static bool probe(Uring *r)
+{
+    struct io_uring_sqe *open = get_sqe(r);
+    open->opcode = IORING_OP_OPENAT;
+    open->fd = AT_FDCWD;
+    open->addr = (uintptr_t)"/";
+    open->open_flags = O_RDONLY | O_DIRECTORY;
+    open->file_index = 1;
+    int res = run_one(r);
+    if (res > 0) {
+        close(res);
+    }
+    if (res != 0) {
+        return false;
+    }
+
+    struct io_uring_sqe *close = get_sqe(r);
+    close->opcode = IORING_OP_CLOSE;
+    close->file_index = 1;
+    return run_one(r) == 0;
+}
+
+/* Map the rings of a new io_uring instance */
+static bool map_rings(Uring *r, const struct io_uring_params *p)
+{
+    size_t sq_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    size_t cq_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    r->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    r->ring = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQ_RING);
+    if (r->ring == MAP_FAILED) {
+        return false;
+    }
+    r->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->ring, r->ring_size);
+        return false;
+    }
+
+    char *base = r->ring;
+    r->sq_head = (unsigned *)(base + p->sq_off.head);
+    r->sq_tail = (unsigned *)(base + p->sq_off.tail);
+    r->sq_mask = (unsigned *)(base + p->sq_off.ring_mask);
+    r->sq_array = (unsigned *)(base + p->sq_off.array);
+    r->sq_entries = p->sq_entries;
+    r->cq_head = (unsigned *)(base + p->cq_off.head);
+    r->cq_tail = (unsigned *)(base + p->cq_off.tail);
+    r->cq_mask = (unsigned *)(base + p->cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(base + p->cq_off.cqes);
+    r->tail = *r->sq_tail;
+    return true;
+}
+
+/* Set up a ring with URING_DEPTH empty fixed file slots
+ * Returns NULL if io_uring cannot be used here
+ */
+static Uring *uring_create(void)
+{
+    Uring *r = calloc(1, sizeof(Uring));
+    if (!r) {
+        return NULL;
+    }
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = uring_setup(URING_ENTRIES, &p);
+    if (r->fd < 0) {
+        free(r);
+        return NULL;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !map_rings(r, &p)) {
+        close(r->fd);
+        free(r);
+        return NULL;
+    }
+
+    int fds[URING_DEPTH];
+    for (int i = 0; i < URING_DEPTH; i++) {
+        fds[i] = -1;
+    }
+    if (uring_register(r->fd, IORING_REGISTER_FILES, fds, URING_DEPTH) != 0 || !probe(r)) {
+        munmap(r->sqes, r->sqes_size);
+        munmap(r->ring, r->ring_size);
+        close(r->fd);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+/* Local filesystem with output writes batched through io_uring */
+RyftIO *ryft_io_uring(void)
+{
+    RyftIO *io = calloc(1, sizeof(RyftIO));
+    Uring *r = io ? uring_create() : NULL;
+    if (!r) {
+        free(io);
+        return NULL;
+    }
+
+    io->open = uring_open;
+    io->read = uring_read;
+    io->write = uring_write;
+    io->close = uring_close;
+    io->stat = uring_stat;
+    io->mkdir = uring_mkdir;
+    io->rename = uring_rename;
+    io->clone = uring_clone;
+    io->map = uring_map;
+    io->unmap = uring_unmap;
+    io->update = uring_update;
+    io->pwrite = uring_pwrite;
+    io->truncate = uring_truncate;
+    io->flush = uring_flush;
+    io->release = uring_release;
+    io->ctx = r;
+    return io;
+}
+
+/* True for a backend made by ryft_io_uring() */
+bool uring_backend(const RyftIO *io)
+{
+    return io->flush == uring_flush;
+}
+
+#else /* !__linux__ */
+
+/* Local filesystem with output writes batched through io_uring */
+RyftIO *ryft_io_uring(void)
+{
+    return NULL;
+}
+
+/* True for a backend made by ryft_io_uring() */
+bool uring_backend(const RyftIO *io)
+{
+    (void)io;
+    return false;
+}
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * uring.h - io_uring output backend (Linux)
+ */
+
+#ifndef RYFT_URING_H
+#define RYFT_URING_H
+
+#include "include/ryft.h"
+
+#include <stdbool.h>
+
+#define URING_DEPTH 64         /* outputs being written at once */
+#define URING_MAX_BUFFER 65536 /* larger outputs are written as they arrive */
+
+/* True for a backend made by ryft_io_uring() */
+bool uring_backend(const RyftIO *io);
+
+#endif /* RYFT_URING_H */
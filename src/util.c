@@ -2,14 +2,23 @@
  * util.c - String and path utilities
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "util.h"
+#include "log.h"
 #include "types.h"
 
+#include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 /* Language to extension mapping */
 const char *lang_to_ext(const char *lang)
@@ -66,6 +75,40 @@ const char *lang_to_ext(const char *lang)
     return ext;
 }
 
+/* Comment syntax for a language, by the extension it maps to
+ * Sets *open and *close ("" for line comments). Returns false for
+ * languages without comments, and for PHP, whose comments only work
+ * inside <?php
+ */
+bool lang_comment(const char *lang, const char **open, const char **close)
+{
+    static const struct {
+        const char *exts;      /* space-separated, each followed by a space */
+        const char *open;
+        const char *close;
+    } styles[] = {
+        { ".c .h .cpp .hpp .css ", "/*", " */" },
+        { ".js .ts .rs .go .java .swift .kt .scala .zig ", "//", "" },
+        { ".py .rb .sh .zsh .fish .pl .yaml .toml .r .jl .nim .conf .mk .dockerfile ", "#", "" },
+        { ".lua .sql .hs ", "--", "" },
+        { ".html .xml .md ", "<!--", " -->" },
+        { ".el .lisp .scm .ini ", ";;", "" },
+        { ".ml ", "(*", " *)" },
+        { ".vim ", "\"", "" },
+    };
+
+    char ext[MAX_LANG + 2];
+    snprintf(ext, sizeof(ext), "%s ", lang_to_ext(lang));
+    for (size_t i = 0; i < sizeof(styles) / sizeof(styles[0]); i++) {
+        if (ext[0] == '.' && strstr(styles[i].exts, ext)) {
+            *open = styles[i].open;
+            *close = styles[i].close;
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Strip leading/trailing whitespace in place */
 char *str_trim(char *str)
 {
@@ -118,6 +161,27 @@ bool parse_bool(const char *value, bool *result)
     return false;
 }
 
+/* Parse a byte count with an optional K, M or G suffix (powers of 1024) */
+bool parse_size(const char *value, size_t *result)
+{
+    if (!value || !isdigit((unsigned char)*value)) return false;
+
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(value, &end, 10);
+    int shift = 0;
+    switch (toupper((unsigned char)*end)) {
+    case 'K': shift = 10; end++; break;
+    case 'M': shift = 20; end++; break;
+    case 'G': shift = 30; end++; break;
+    }
+    if (*end == 'B' || *end == 'b') end++;
+    if (*end || errno == ERANGE || n > (SIZE_MAX >> shift)) return false;
+
+    *result = (size_t)n << shift;
+    return true;
+}
+
 /* Expand ~ to home directory */
 bool expand_path(const char *path, char *out, size_t out_size)
 {
@@ -129,7 +193,7 @@ bool expand_path(const char *path, char *out, size_t out_size)
     if (path[0] == '~') {
         const char *home = getenv("HOME");
         if (!home) {
-            fprintf(stderr, "warning: HOME environment variable not set\n");
+            log_warn("warning: HOME environment variable not set\n");
             strncpy(out, path, out_size - 1);
             out[out_size - 1] = '\0';
             return true;
@@ -144,7 +208,7 @@ bool expand_path(const char *path, char *out, size_t out_size)
             snprintf(out, out_size, "%s%s", home, path + 1);
         } else {
             /* ~username - not supported, copy as-is */
-            fprintf(stderr, "warning: ~username expansion not supported: %s\n", path);
+            log_warn("warning: ~username expansion not supported: %s\n", path);
             strncpy(out, path, out_size - 1);
             out[out_size - 1] = '\0';
         }
@@ -157,26 +221,28 @@ bool expand_path(const char *path, char *out, size_t out_size)
     return true;
 }
 
-/* Check if path looks like a directory (ends with / or is an existing directory) */
-bool is_directory_path(const char *path)
+/* Check if path looks like a directory (ends with / or, when io is given,
+ * is an existing directory on that backend)
+ */
+bool is_directory_path(RyftIO *io, const char *path)
 {
     if (!path || !*path) return false;
 
     size_t len = strlen(path);
     if (path[len - 1] == '/') return true;
+    if (!io) return false;
 
-    /* Check if it's an existing directory */
-    struct stat st;
+    /* Backends only report whether a path exists; "dir/." exists only
+     * for a directory */
     char expanded[MAX_PATH];
+    char dot[MAX_PATH + 2];
+    size_t size;
     expand_path(path, expanded, sizeof(expanded));
-    if (stat(expanded, &st) == 0 && S_ISDIR(st.st_mode)) {
-        return true;
-    }
-
-    return false;
+    snprintf(dot, sizeof(dot), "%s/.", expanded);
+    return io->stat(io, dot, &size) == 0;
 }
 
-/* Extract basename without extension from path */
+/* Extract basename without .md (and .gz/.zst) extension from path */
 void get_basename_no_ext(const char *path, char *out, size_t out_size)
 {
     const char *base = strrchr(path, '/');
@@ -185,8 +251,13 @@ void get_basename_no_ext(const char *path, char *out, size_t out_size)
     strncpy(out, base, out_size - 1);
     out[out_size - 1] = '\0';
 
-    /* Remove .md extension if present */
+    /* Remove compression suffix, then .md extension if present */
     size_t len = strlen(out);
+    if (len > 3 && strcmp(out + len - 3, ".gz") == 0) {
+        out[len -= 3] = '\0';
+    } else if (len > 4 && strcmp(out + len - 4, ".zst") == 0) {
+        out[len -= 4] = '\0';
+    }
     if (len > 3 && strcmp(out + len - 3, ".md") == 0) {
         out[len - 3] = '\0';
     }
@@ -194,10 +265,10 @@ void get_basename_no_ext(const char *path, char *out, size_t out_size)
 
 /* Build output path from config output setting and filename
  * - If config_output is empty, use filename as-is (current directory)
- * - If config_output is a directory (ends with / or exists as dir), append filename
+ * - If config_output is a directory (is_dir, see is_directory_path), append filename
  * - Otherwise, use config_output as the full path (for single-file output)
  */
-void build_output_path(const char *config_output, const char *filename,
+void build_output_path(const char *config_output, bool is_dir, const char *filename,
                        char *out, size_t out_size)
 {
     if (!config_output || !config_output[0]) {
@@ -207,7 +278,7 @@ void build_output_path(const char *config_output, const char *filename,
         return;
     }
 
-    if (is_directory_path(config_output)) {
+    if (is_dir) {
         /* Config output is a directory - append filename */
         size_t len = strlen(config_output);
         if (config_output[len - 1] == '/') {
@@ -244,49 +315,146 @@ bool get_directory(const char *path, char *out, size_t out_size)
     return true;
 }
 
-/* Check if file exists */
-bool file_exists(const char *path)
+/* Match path against a glob; patterns without '/' also match the basename */
+bool path_matches(const char *path, const char *pattern)
 {
-    struct stat st;
-    return stat(path, &st) == 0;
+    if (fnmatch(pattern, path, 0) == 0) {
+        return true;
+    }
+
+    if (!strchr(pattern, '/')) {
+        const char *base = strrchr(path, '/');
+        if (base && fnmatch(pattern, base + 1, 0) == 0) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
-/* Create directory and all parent directories (like mkdir -p) */
-bool ensure_directory(const char *path)
+/* Fast 64-bit hash of a byte range (not cryptographic)
+ * Mixes 8 bytes at a time, finishing with a 64-bit avalanche
+ */
+uint64_t hash_bytes(const void *data, size_t len)
 {
-    char tmp[MAX_PATH];
-    char *p = NULL;
-    size_t len;
+    const unsigned char *p = data;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len * 0xff51afd7ed558ccdULL);
+
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ (w * 0xc4ceb9fe1a85ec53ULL)) * 0x100000001b3ULL;
+        h ^= h >> 29;
+        p += 8;
+        len -= 8;
+    }
 
-    snprintf(tmp, sizeof(tmp), "%s", path);
-    len = strlen(tmp);
+    uint64_t tail = 0;
+    memcpy(&tail, p, len);
+    h = (h ^ (tail * 0xc4ceb9fe1a85ec53ULL)) * 0x100000001b3ULL;
 
-    /* Remove trailing slash */
-    if (len > 0 && tmp[len - 1] == '/') {
-        tmp[len - 1] = '\0';
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Read a whole file into a malloc'd buffer (caller frees) */
+bool read_file(const char *path, char **buf, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
     }
 
-    /* Walk through path creating directories */
-    for (p = tmp + 1; *p; p++) {
-        if (*p == '/') {
-            *p = '\0';
+    size_t cap = 65536;
+    size_t n = 0;
+    char *data = malloc(cap);
 
-            if (mkdir(tmp, 0755) != 0 && errno != EEXIST) {
-                fprintf(stderr, "error: cannot create directory '%s': %s\n",
-                        tmp, strerror(errno));
-                return false;
-            }
+    while (data) {
+        n += fread(data + n, 1, cap - n, f);
+        if (n < cap) break;
 
-            *p = '/';
+        char *p = realloc(data, cap * 2);
+        if (!p) {
+            free(data);
+            data = NULL;
+            break;
         }
+        data = p;
+        cap *= 2;
+    }
+
+    bool ok = data && !ferror(f);
+    fclose(f);
+    if (!ok) {
+        free(data);
+        return false;
+    }
+
+    *buf = data;
+    *len = n;
+    return true;
+}
+
+/* Map a whole file read-only (empty files map to NULL, 0) */
+bool map_file(const char *path, const char **data, size_t *len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
     }
 
-    /* Create final directory */
-    if (mkdir(tmp, 0755) != 0 && errno != EEXIST) {
-        fprintf(stderr, "error: cannot create directory '%s': %s\n",
-                tmp, strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
         return false;
     }
 
+    *data = NULL;
+    *len = (size_t)st.st_size;
+    if (*len > 0) {
+        void *p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        *data = p;
+    }
+
+    close(fd);
     return true;
 }
+
+/* Unmap a file mapped with map_file() */
+void unmap_file(const char *data, size_t len)
+{
+    if (data && len > 0) {
+        munmap((void *)data, len);
+    }
+}
+
+/* Check if file exists */
+bool file_exists(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+/* Write s as a JSON string body */
+void put_json(FILE *f, const char *s)
+{
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+}
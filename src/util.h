@@ -5,12 +5,21 @@
 #ifndef RYFT_UTIL_H
 #define RYFT_UTIL_H
 
+#include "include/ryft.h"
+
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 /* Language to extension mapping */
 const char *lang_to_ext(const char *lang);
 
+/* Comment syntax for a language, by the extension it maps to
+ * Returns false for languages without comments (JSON, unknown)
+ */
+bool lang_comment(const char *lang, const char **open, const char **close);
+
 /* Strip leading/trailing whitespace in place */
 char *str_trim(char *str);
 
@@ -20,26 +29,48 @@ char *str_unquote(char *str);
 /* Parse boolean value: on/off, true/false, yes/no, 1/0 */
 bool parse_bool(const char *value, bool *result);
 
+/* Parse a byte count with an optional K, M or G suffix (powers of 1024) */
+bool parse_size(const char *value, size_t *result);
+
 /* Expand ~ to home directory */
 bool expand_path(const char *path, char *out, size_t out_size);
 
-/* Check if path looks like a directory */
-bool is_directory_path(const char *path);
+/* Check if path looks like a directory, asking io unless it is NULL */
+bool is_directory_path(RyftIO *io, const char *path);
 
-/* Extract basename without extension from path */
+/* Extract basename without .md (and .gz/.zst) extension from path */
 void get_basename_no_ext(const char *path, char *out, size_t out_size);
 
 /* Build output path from config output setting and filename */
-void build_output_path(const char *config_output, const char *filename,
+void build_output_path(const char *config_output, bool is_dir, const char *filename,
                        char *out, size_t out_size);
 
 /* Get directory portion of a path */
 bool get_directory(const char *path, char *out, size_t out_size);
 
+/* Match path against a glob; patterns without '/' also match the basename */
+bool path_matches(const char *path, const char *pattern);
+
+/* Fast 64-bit hash of a byte range (not cryptographic) */
+uint64_t hash_bytes(const void *data, size_t len);
+
+/* Read a whole file into a malloc'd buffer (caller frees)
+ * Returns false if the file cannot be read
+ */
+bool read_file(const char *path, char **buf, size_t *len);
+
+/* Map a whole file read-only (empty files map to NULL, 0)
+ * Returns false if the file cannot be mapped
+ */
+bool map_file(const char *path, const char **data, size_t *len);
+
+/* Unmap a file mapped with map_file() */
+void unmap_file(const char *data, size_t len);
+
 /* Check if file exists */
 bool file_exists(const char *path);
 
-/* Create directory and all parent directories (like mkdir -p) */
-bool ensure_directory(const char *path);
+/* Write s as a JSON string body (without the quotes) */
+void put_json(FILE *f, const char *s);
 
 #endif /* RYFT_UTIL_H */
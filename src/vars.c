@@ -0,0 +1,213 @@
+/*
+ * vars.c - User variables and ${NAME} expansion in block bodies
+ *
+ * Expansion runs while a body streams to its output: text between '$'
+ * characters is written in bulk, and only the few bytes of a reference
+ * still being read are carried between writes.
+ */
+
+#include "vars.h"
+
+#include <string.h>
+
+/* Expander states */
+enum {
+    EX_TEXT,                   /* copying plain text */
+    EX_DOLLAR,                 /* read "$" */
+    EX_ESCAPE,                 /* read "$$" */
+    EX_NAME                    /* read "${" and name so far */
+};
+
+static bool is_name_char(char c, bool first)
+{
+    if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_') {
+        return true;
+    }
+    return !first && c >= '0' && c <= '9';
+}
+
+/* Write to the sink or out; out is NULL in dry-run, where references are
+ * still checked */
+static void put(Expander *ex, FILE *out, const char *p, size_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    if (ex->sink) {
+        ex->sink(ex->sink_ctx, p, len);
+    } else if (out) {
+        fwrite(p, 1, len, out);
+    }
+}
+
+/* Check that name is a valid variable name: [A-Za-z_][A-Za-z0-9_]* */
+bool var_valid_name(const char *name, size_t len)
+{
+    if (len == 0 || len >= MAX_VAR_NAME) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!is_name_char(name[i], i == 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Set a variable; values from config never replace values from the CLI */
+bool var_set(VarTable *table, const char *name, const char *value, bool cli)
+{
+    size_t len = strlen(name);
+    if (!var_valid_name(name, len) || strlen(value) >= MAX_VAR_VALUE ||
+        strchr(value, '\n')) {
+        return false;
+    }
+
+    Var *v = NULL;
+    for (int i = 0; i < table->count; i++) {
+        if (strcmp(table->vars[i].name, name) == 0) {
+            v = &table->vars[i];
+            break;
+        }
+    }
+
+    if (!v) {
+        if (table->count >= MAX_VARS) {
+            return false;
+        }
+        v = &table->vars[table->count++];
+        memcpy(v->name, name, len + 1);
+        v->cli = false;
+    } else if (v->cli && !cli) {
+        return true;  /* --define wins over config */
+    }
+
+    strcpy(v->value, value);
+    v->cli = v->cli || cli;
+    return true;
+}
+
+/* Set a variable from a NAME=value string (--define) */
+bool var_define(VarTable *table, const char *def)
+{
+    const char *eq = strchr(def, '=');
+    if (!eq) {
+        return false;
+    }
+
+    char name[MAX_VAR_NAME];
+    size_t len = (size_t)(eq - def);
+    if (!var_valid_name(def, len)) {
+        return false;
+    }
+    memcpy(name, def, len);
+    name[len] = '\0';
+
+    return var_set(table, name, eq + 1, true);
+}
+
+/* Look up a variable by name, NULL if undefined */
+const char *var_get(const VarTable *table, const char *name, size_t len)
+{
+    for (int i = 0; i < table->count; i++) {
+        const Var *v = &table->vars[i];
+        if (strncmp(v->name, name, len) == 0 && v->name[len] == '\0') {
+            return v->value;
+        }
+    }
+    return NULL;
+}
+
+/* Start expanding a block body */
+void expand_begin(Expander *ex, const VarTable *vars)
+{
+    memset(ex, 0, sizeof(*ex));
+    ex->vars = vars;
+    ex->state = EX_TEXT;
+}
+
+/* Expand a piece of a block body into out */
+void expand_write(Expander *ex, const char *p, size_t len, FILE *out)
+{
+    const char *end = p + len;
+
+    while (p < end) {
+        if (ex->state == EX_TEXT) {
+            /* Copy everything up to the next '$' in one go */
+            const char *dollar = memchr(p, '$', (size_t)(end - p));
+            size_t run = dollar ? (size_t)(dollar - p) : (size_t)(end - p);
+            put(ex, out, p, run);
+            if (!dollar) {
+                return;
+            }
+            p = dollar + 1;
+            ex->state = EX_DOLLAR;
+            continue;
+        }
+
+        char c = *p;
+
+        if (ex->state == EX_DOLLAR) {
+            if (c == '{') {
+                ex->state = EX_NAME;
+                ex->name_len = 0;
+                p++;
+            } else if (c == '$') {
+                ex->state = EX_ESCAPE;
+                p++;
+            } else {
+                put(ex, out, "$", 1);
+                ex->state = EX_TEXT;
+            }
+        } else if (ex->state == EX_ESCAPE) {
+            if (c == '{') {
+                put(ex, out, "${", 2);  /* $${NAME} -> literal ${NAME} */
+                ex->state = EX_TEXT;
+                p++;
+            } else if (c == '$') {
+                put(ex, out, "$", 1);
+                p++;
+            } else {
+                put(ex, out, "$$", 2);
+                ex->state = EX_TEXT;
+            }
+        } else if (c == '}' && ex->name_len > 0) {
+            const char *value = var_get(ex->vars, ex->name, ex->name_len);
+            if (value) {
+                put(ex, out, value, strlen(value));
+            } else {
+                if (ex->undefined++ == 0) {
+                    memcpy(ex->first_undefined, ex->name, ex->name_len);
+                    ex->first_undefined[ex->name_len] = '\0';
+                }
+                put(ex, out, "${", 2);
+                put(ex, out, ex->name, ex->name_len);
+                put(ex, out, "}", 1);
+            }
+            ex->state = EX_TEXT;
+            p++;
+        } else if (is_name_char(c, ex->name_len == 0) && ex->name_len < MAX_VAR_NAME - 1) {
+            ex->name[ex->name_len++] = c;
+            p++;
+        } else {
+            /* Not a reference after all */
+            put(ex, out, "${", 2);
+            put(ex, out, ex->name, ex->name_len);
+            ex->state = EX_TEXT;
+        }
+    }
+}
+
+/* Finish a block body, writing any incomplete reference literally */
+void expand_end(Expander *ex, FILE *out)
+{
+    if (ex->state == EX_DOLLAR) {
+        put(ex, out, "$", 1);
+    } else if (ex->state == EX_ESCAPE) {
+        put(ex, out, "$$", 2);
+    } else if (ex->state == EX_NAME) {
+        put(ex, out, "${", 2);
+        put(ex, out, ex->name, ex->name_len);
+    }
+    ex->state = EX_TEXT;
+}
@@ -0,0 +1,66 @@
+/*
+ * vars.h - User variables and ${NAME} expansion in block bodies
+ */
+
+#ifndef RYFT_VARS_H
+#define RYFT_VARS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define MAX_VARS 64
+#define MAX_VAR_NAME 64
+#define MAX_VAR_VALUE 1024
+
+typedef struct {
+    char name[MAX_VAR_NAME];
+    char value[MAX_VAR_VALUE];
+    bool cli;                  /* set by --define, config cannot override */
+} Var;
+
+typedef struct {
+    Var vars[MAX_VARS];
+    int count;
+} VarTable;
+
+/* Streaming expander state; a reference may be split across writes */
+typedef struct {
+    const VarTable *vars;
+    int state;                 /* position inside a "$${NAME}" sequence */
+    char name[MAX_VAR_NAME];
+    size_t name_len;
+    int undefined;             /* undefined references seen */
+    char first_undefined[MAX_VAR_NAME];
+    void (*sink)(void *ctx, const char *p, size_t len);  /* replaces out if set */
+    void *sink_ctx;
+} Expander;
+
+/* Check that name is a valid variable name: [A-Za-z_][A-Za-z0-9_]* */
+bool var_valid_name(const char *name, size_t len);
+
+/* Set a variable; values from config never replace values from the CLI
+ * Returns false if the name is invalid, the value too long or the table full
+ */
+bool var_set(VarTable *table, const char *name, const char *value, bool cli);
+
+/* Set a variable from a NAME=value string (--define) */
+bool var_define(VarTable *table, const char *def);
+
+/* Look up a variable by name, NULL if undefined */
+const char *var_get(const VarTable *table, const char *name, size_t len);
+
+/* Start expanding a block body */
+void expand_begin(Expander *ex, const VarTable *vars);
+
+/* Expand a piece of a block body into out (NULL to only check references)
+ * or into ex->sink when one is set after expand_begin()
+ * $${NAME} is written as a literal ${NAME}; undefined references are
+ * left as-is and counted in ex->undefined
+ */
+void expand_write(Expander *ex, const char *p, size_t len, FILE *out);
+
+/* Finish a block body, writing any incomplete reference literally */
+void expand_end(Expander *ex, FILE *out);
+
+#endif /* RYFT_VARS_H */